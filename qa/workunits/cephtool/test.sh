@@ -31,6 +31,24 @@ ceph osd pool set data size 2
 
 ceph osd pool get rbd crush_ruleset | grep 'crush_ruleset: 2'
 
+# cache tiering
+ceph osd pool create cache 2
+ceph osd pool create cache2 2
+! ceph osd tier add data data
+! ceph osd tier cache-mode cache writeback
+ceph osd tier add data cache
+ceph osd tier add data cache  # idempotent
+! ceph osd tier add cache cache2  # no stacking
+ceph osd tier cache-mode cache writeback
+ceph osd tier set-overlay data cache
+! ceph osd tier remove data cache  # still the overlay
+ceph osd tier cache-mode cache readonly  # nothing dirty yet
+ceph osd tier cache-mode cache none
+ceph osd tier remove-overlay data
+ceph osd tier remove data cache
+ceph osd pool delete cache cache --yes-i-really-really-mean-it
+ceph osd pool delete cache2 cache2 --yes-i-really-really-mean-it
+
 for id in `ceph osd ls` ; do
 	ceph tell osd.$id version
 done
@@ -326,6 +326,9 @@ int main(int argc, const char **argv)
   Messenger *messenger_hbserver = Messenger::create(g_ceph_context,
 						    entity_name_t::OSD(whoami), "hbserver",
 						    getpid());
+  Messenger *messenger_objecter = Messenger::create(g_ceph_context,
+						    entity_name_t::OSD(whoami), "ms_objecter",
+						    getpid());
   cluster_messenger->set_cluster_protocol(CEPH_OSD_PROTOCOL);
   messenger_hbclient->set_cluster_protocol(CEPH_OSD_PROTOCOL);
   messenger_hbserver->set_cluster_protocol(CEPH_OSD_PROTOCOL);
@@ -372,6 +375,8 @@ int main(int argc, const char **argv)
   messenger_hbserver->set_policy(entity_name_t::TYPE_OSD,
 			     Messenger::Policy::stateless_server(0, 0));
 
+  messenger_objecter->set_default_policy(Messenger::Policy::lossy_client(0, CEPH_FEATURE_OSDREPLYMUX));
+
   r = client_messenger->bind(g_conf->public_addr);
   if (r < 0)
     exit(1);
@@ -411,6 +416,7 @@ int main(int argc, const char **argv)
 
   osd = new OSD(whoami, cluster_messenger, client_messenger,
 		messenger_hbclient, messenger_hbserver,
+		messenger_objecter,
 		&mc,
 		g_conf->osd_data, g_conf->osd_journal);
 
@@ -428,6 +434,7 @@ int main(int argc, const char **argv)
   messenger_hbclient->start();
   messenger_hbserver->start();
   cluster_messenger->start();
+  messenger_objecter->start();
 
   // install signal handlers
   init_async_signal_handler();
@@ -447,6 +454,7 @@ int main(int argc, const char **argv)
   messenger_hbclient->wait();
   messenger_hbserver->wait();
   cluster_messenger->wait();
+  messenger_objecter->wait();
 
   unregister_async_signal_handler(SIGHUP, sighup_handler);
   unregister_async_signal_handler(SIGINT, handle_osd_signal);
@@ -458,6 +466,7 @@ int main(int argc, const char **argv)
   delete messenger_hbclient;
   delete messenger_hbserver;
   delete cluster_messenger;
+  delete messenger_objecter;
   g_ceph_context->put();
 
   // cd on exit, so that gmon.out (if any) goes into a separate directory for each node.
@@ -93,6 +93,10 @@ cls_method_handle_t h_old_snapshots_list;
 cls_method_handle_t h_old_snapshot_add;
 cls_method_handle_t h_old_snapshot_remove;
 cls_method_handle_t h_assign_bid;
+cls_method_handle_t h_object_map_load;
+cls_method_handle_t h_object_map_save;
+cls_method_handle_t h_object_map_resize;
+cls_method_handle_t h_object_map_update;
 
 #define RBD_MAX_KEYS_READ 64
 #define RBD_SNAP_KEY_PREFIX "snapshot_"
@@ -1383,6 +1387,233 @@ int copyup(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
 }
 
 
+/******************** rbd_object_map object methods **********************/
+
+/*
+ * An object map starts with the number of data objects it covers
+ * (an encoded uint64_t), followed by one bit per data object: bit
+ * (i % 8) of byte (i / 8) is set if object i may exist.  Bits past
+ * the end of the map are ignored.
+ */
+
+#define OBJECT_MAP_HEADER_LEN 8
+
+static int object_map_read_size(cls_method_context_t hctx,
+				uint64_t *num_objects)
+{
+  bufferlist bl;
+  int r = cls_cxx_read(hctx, 0, OBJECT_MAP_HEADER_LEN, &bl);
+  if (r < 0)
+    return r;
+  if (r < OBJECT_MAP_HEADER_LEN) {
+    CLS_ERR("object map header too short: %d bytes", r);
+    return -EIO;
+  }
+  try {
+    bufferlist::iterator iter = bl.begin();
+    ::decode(*num_objects, iter);
+  } catch (const buffer::error &err) {
+    return -EIO;
+  }
+  return 0;
+}
+
+static int object_map_read_bits(cls_method_context_t hctx, uint64_t start_byte,
+				uint64_t len, bufferlist *bl)
+{
+  int r = cls_cxx_read(hctx, OBJECT_MAP_HEADER_LEN + start_byte, len, bl);
+  if (r < 0)
+    return r;
+  if ((uint64_t)r < len) {
+    // never written; treat as all clear
+    bl->append_zero(len - r);
+  }
+  return 0;
+}
+
+/**
+ * Input:
+ * none
+ *
+ * Output:
+ * @param num_objects number of objects covered by the map (uint64_t)
+ * @param bits the bitmap (bufferlist)
+ * @returns 0 on success, negative error code on failure
+ */
+int object_map_load(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
+{
+  uint64_t num_objects;
+  int r = object_map_read_size(hctx, &num_objects);
+  if (r < 0)
+    return r;
+
+  bufferlist bits;
+  r = object_map_read_bits(hctx, 0, (num_objects + 7) / 8, &bits);
+  if (r < 0)
+    return r;
+
+  ::encode(num_objects, *out);
+  ::encode(bits, *out);
+  return 0;
+}
+
+/**
+ * Replace the whole map.
+ *
+ * Input:
+ * @param num_objects number of objects covered by the map (uint64_t)
+ * @param bits the bitmap, at least (num_objects + 7) / 8 bytes (bufferlist)
+ *
+ * Output:
+ * @returns 0 on success, negative error code on failure
+ */
+int object_map_save(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
+{
+  uint64_t num_objects;
+  bufferlist bits;
+  try {
+    bufferlist::iterator iter = in->begin();
+    ::decode(num_objects, iter);
+    ::decode(bits, iter);
+  } catch (const buffer::error &err) {
+    return -EINVAL;
+  }
+  if (bits.length() < (num_objects + 7) / 8)
+    return -EINVAL;
+
+  bufferlist bl;
+  ::encode(num_objects, bl);
+  bl.claim_append(bits);
+  return cls_cxx_write_full(hctx, &bl);
+}
+
+/**
+ * Change the number of objects covered by the map, creating it if
+ * necessary.  Objects added to the map get the given state.
+ *
+ * Input:
+ * @param num_objects new number of objects (uint64_t)
+ * @param exists state of any new objects (uint8_t)
+ *
+ * Output:
+ * @returns 0 on success, negative error code on failure
+ */
+int object_map_resize(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
+{
+  uint64_t num_objects;
+  uint8_t exists;
+  try {
+    bufferlist::iterator iter = in->begin();
+    ::decode(num_objects, iter);
+    ::decode(exists, iter);
+  } catch (const buffer::error &err) {
+    return -EINVAL;
+  }
+
+  uint64_t old_num_objects = 0;
+  int r = object_map_read_size(hctx, &old_num_objects);
+  if (r < 0 && r != -ENOENT)
+    return r;
+
+  CLS_LOG(20, "object_map_resize %llu -> %llu objects",
+	  (unsigned long long)old_num_objects, (unsigned long long)num_objects);
+
+  bufferlist header;
+  ::encode(num_objects, header);
+
+  if (num_objects < old_num_objects) {
+    // keep the bytes still in use and drop the rest
+    bufferlist bits;
+    r = object_map_read_bits(hctx, 0, (num_objects + 7) / 8, &bits);
+    if (r < 0)
+      return r;
+    header.claim_append(bits);
+    return cls_cxx_write_full(hctx, &header);
+  }
+
+  if (num_objects > old_num_objects) {
+    // the partially used last byte (if any) may hold stale bits
+    uint64_t start_byte = old_num_objects / 8;
+    uint64_t end_byte = (num_objects + 7) / 8;
+    bufferlist bits;
+    if (old_num_objects % 8) {
+      r = object_map_read_bits(hctx, start_byte, 1, &bits);
+      if (r < 0)
+	return r;
+    } else {
+      bits.append_zero(1);
+    }
+    bits.append_zero(end_byte - start_byte - 1);
+    bits.rebuild();
+    unsigned char *p = (unsigned char *)bits.c_str();
+    for (uint64_t i = old_num_objects; i < num_objects; i++) {
+      unsigned char mask = 1 << (i % 8);
+      if (exists)
+	p[i / 8 - start_byte] |= mask;
+      else
+	p[i / 8 - start_byte] &= ~mask;
+    }
+    r = cls_cxx_write(hctx, OBJECT_MAP_HEADER_LEN + start_byte,
+		      bits.length(), &bits);
+    if (r < 0)
+      return r;
+  }
+
+  return cls_cxx_write(hctx, 0, header.length(), &header);
+}
+
+/**
+ * Set the state of a range of objects.  Objects past the end of the
+ * map are ignored.
+ *
+ * Input:
+ * @param start first object (uint64_t)
+ * @param end one past the last object (uint64_t)
+ * @param exists new state (uint8_t)
+ *
+ * Output:
+ * @returns 0 on success, negative error code on failure
+ */
+int object_map_update(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
+{
+  uint64_t start, end;
+  uint8_t exists;
+  try {
+    bufferlist::iterator iter = in->begin();
+    ::decode(start, iter);
+    ::decode(end, iter);
+    ::decode(exists, iter);
+  } catch (const buffer::error &err) {
+    return -EINVAL;
+  }
+
+  uint64_t num_objects;
+  int r = object_map_read_size(hctx, &num_objects);
+  if (r < 0)
+    return r;
+  end = MIN(end, num_objects);
+  if (start >= end)
+    return 0;
+
+  uint64_t start_byte = start / 8;
+  uint64_t end_byte = (end + 7) / 8;
+  bufferlist bits;
+  r = object_map_read_bits(hctx, start_byte, end_byte - start_byte, &bits);
+  if (r < 0)
+    return r;
+  bits.rebuild();
+  unsigned char *p = (unsigned char *)bits.c_str();
+  for (uint64_t i = start; i < end; i++) {
+    unsigned char mask = 1 << (i % 8);
+    if (exists)
+      p[i / 8 - start_byte] |= mask;
+    else
+      p[i / 8 - start_byte] &= ~mask;
+  }
+  return cls_cxx_write(hctx, OBJECT_MAP_HEADER_LEN + start_byte,
+		       bits.length(), &bits);
+}
+
 /************************ rbd_id object methods **************************/
 
 /**
@@ -2094,6 +2325,20 @@ void __cls_init()
 			  CLS_METHOD_RD,
 			  get_children, &h_get_children);
 
+  /* methods for the rbd_object_map.$image_id objects */
+  cls_register_cxx_method(h_class, "object_map_load",
+			  CLS_METHOD_RD,
+			  object_map_load, &h_object_map_load);
+  cls_register_cxx_method(h_class, "object_map_save",
+			  CLS_METHOD_RD | CLS_METHOD_WR,
+			  object_map_save, &h_object_map_save);
+  cls_register_cxx_method(h_class, "object_map_resize",
+			  CLS_METHOD_RD | CLS_METHOD_WR,
+			  object_map_resize, &h_object_map_resize);
+  cls_register_cxx_method(h_class, "object_map_update",
+			  CLS_METHOD_RD | CLS_METHOD_WR,
+			  object_map_update, &h_object_map_update);
+
   /* methods for the rbd_id.$image_name objects */
   cls_register_cxx_method(h_class, "get_id",
 			  CLS_METHOD_RD,
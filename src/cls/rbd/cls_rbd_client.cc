@@ -631,5 +631,78 @@ namespace librbd {
       ::encode(id, in);
       return ioctx->exec(oid, "rbd", "dir_rename_image", in, out);
     }
+
+    int object_map_load(librados::IoCtx *ioctx, const std::string &oid,
+			std::vector<bool> *object_map)
+    {
+      bufferlist in, out;
+      int r = ioctx->exec(oid, "rbd", "object_map_load", in, out);
+      if (r < 0)
+	return r;
+
+      uint64_t num_objects;
+      bufferlist bits;
+      try {
+	bufferlist::iterator iter = out.begin();
+	::decode(num_objects, iter);
+	::decode(bits, iter);
+      } catch (const buffer::error &err) {
+	return -EBADMSG;
+      }
+      if (bits.length() < (num_objects + 7) / 8)
+	return -EBADMSG;
+
+      const unsigned char *p = (const unsigned char *)bits.c_str();
+      object_map->resize(num_objects);
+      for (uint64_t i = 0; i < num_objects; i++)
+	(*object_map)[i] = p[i / 8] & (1 << (i % 8));
+      return 0;
+    }
+
+    int object_map_save(librados::IoCtx *ioctx, const std::string &oid,
+			const std::vector<bool> &object_map)
+    {
+      uint64_t num_objects = object_map.size();
+      bufferptr bp((num_objects + 7) / 8);
+      bp.zero();
+      unsigned char *p = (unsigned char *)bp.c_str();
+      for (uint64_t i = 0; i < num_objects; i++)
+	if (object_map[i])
+	  p[i / 8] |= 1 << (i % 8);
+      bufferlist bits;
+      bits.push_back(bp);
+
+      bufferlist in, out;
+      ::encode(num_objects, in);
+      ::encode(bits, in);
+      return ioctx->exec(oid, "rbd", "object_map_save", in, out);
+    }
+
+    int object_map_resize(librados::IoCtx *ioctx, const std::string &oid,
+			  uint64_t num_objects, bool exists)
+    {
+      bufferlist in, out;
+      ::encode(num_objects, in);
+      ::encode((uint8_t)exists, in);
+      return ioctx->exec(oid, "rbd", "object_map_resize", in, out);
+    }
+
+    void object_map_update(librados::ObjectWriteOperation *rados_op,
+			   uint64_t start, uint64_t end, bool exists)
+    {
+      bufferlist in;
+      ::encode(start, in);
+      ::encode(end, in);
+      ::encode((uint8_t)exists, in);
+      rados_op->exec("rbd", "object_map_update", in);
+    }
+
+    int object_map_update(librados::IoCtx *ioctx, const std::string &oid,
+			  uint64_t start, uint64_t end, bool exists)
+    {
+      librados::ObjectWriteOperation op;
+      object_map_update(&op, start, end, exists);
+      return ioctx->operate(oid, &op);
+    }
   } // namespace cls_client
 } // namespace librbd
@@ -100,6 +100,18 @@ namespace librbd {
 			 const std::string &src, const std::string &dest,
 			 const std::string &id);
 
+    // operations on rbd_object_map objects
+    int object_map_load(librados::IoCtx *ioctx, const std::string &oid,
+			std::vector<bool> *object_map);
+    int object_map_save(librados::IoCtx *ioctx, const std::string &oid,
+			const std::vector<bool> &object_map);
+    int object_map_resize(librados::IoCtx *ioctx, const std::string &oid,
+			  uint64_t num_objects, bool exists);
+    void object_map_update(librados::ObjectWriteOperation *rados_op,
+			   uint64_t start, uint64_t end, bool exists);
+    int object_map_update(librados::IoCtx *ioctx, const std::string &oid,
+			  uint64_t start, uint64_t end, bool exists);
+
     // class operations on the old format, kept for
     // backwards compatability
     int old_snapshot_add(librados::IoCtx *ioctx, const std::string &oid,
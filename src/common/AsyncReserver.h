@@ -18,12 +18,19 @@
 #include <map>
 #include <utility>
 #include <list>
+#include <set>
 
 #include "common/Mutex.h"
 #include "common/Finisher.h"
+#include "common/Formatter.h"
 
 /**
  * Manages a configurable number of asyncronous reservations.
+ *
+ * Reservations are granted in priority order, highest first, and in
+ * request order within a priority.  A reservation that was requested
+ * with an on_preempt callback may be taken away again when a request
+ * with a higher priority is waiting and no slot is free.
  */
 template <typename T>
 class AsyncReserver {
@@ -31,18 +38,55 @@ class AsyncReserver {
   unsigned max_allowed;
   Mutex lock;
 
-  list<pair<T, Context*> > queue;
-  map<T, typename list<pair<T, Context*> >::iterator > queue_pointers;
-  set<T> in_progress;
+  struct Reservation {
+    T item;
+    unsigned prio;
+    Context *grant;
+    Context *preempt;
+    Reservation() : prio(0), grant(0), preempt(0) {}
+    Reservation(T i, unsigned pr, Context *g, Context *p)
+      : item(i), prio(pr), grant(g), preempt(p) {}
+  };
+
+  typedef typename list<Reservation>::iterator queue_iterator;
+
+  map<unsigned, list<Reservation> > queues;
+  map<T, pair<unsigned, queue_iterator> > queue_pointers;
+  map<T, Reservation> in_progress;
+  set<pair<unsigned, T> > preempt_by_prio;  ///< preemptible in_progress items
+
+  void preempt_one() {
+    assert(!preempt_by_prio.empty());
+    typename map<T, Reservation>::iterator p =
+      in_progress.find(preempt_by_prio.begin()->second);
+    assert(p != in_progress.end());
+    f->queue(p->second.preempt);
+    preempt_by_prio.erase(preempt_by_prio.begin());
+    in_progress.erase(p);
+  }
 
   void do_queues() {
-    while (in_progress.size() < max_allowed &&
-           !queue.empty()) {
-      pair<T, Context*> p = queue.front();
-      queue_pointers.erase(p.first);
-      queue.pop_front();
-      f->queue(p.second);
-      in_progress.insert(p.first);
+    while (!queues.empty()) {
+      typename map<unsigned, list<Reservation> >::iterator it = --queues.end();
+      if (in_progress.size() >= max_allowed) {
+	// make room for the highest priority waiter, if someone with a
+	// lower priority can give up their slot
+	if (preempt_by_prio.empty() ||
+	    preempt_by_prio.begin()->first >= it->first)
+	  break;
+	preempt_one();
+	continue;
+      }
+      Reservation p = it->second.front();
+      queue_pointers.erase(p.item);
+      it->second.pop_front();
+      if (it->second.empty())
+	queues.erase(it);
+      f->queue(p.grant);
+      p.grant = 0;
+      in_progress[p.item] = p;
+      if (p.preempt)
+	preempt_by_prio.insert(make_pair(p.prio, p.item));
     }
   }
 public:
@@ -65,16 +109,24 @@ public:
    * the callback must be safe in that case.  Callback will be called
    * with no locks held.  cancel_reservation must be called to release the
    * reservation slot.
+   *
+   * If on_preempt is given, a granted reservation may be revoked in
+   * favor of a waiting request with a higher priority.  on_preempt is
+   * then called (with no locks held) and the slot is already released;
+   * cancel_reservation is harmless but not needed.
    */
   void request_reservation(
     T item,                   ///< [in] reservation key
-    Context *on_reserved      ///< [in] callback to be called on reservation
+    Context *on_reserved,     ///< [in] callback to be called on reservation
+    unsigned prio = 0,        ///< [in] priority, higher is granted first
+    Context *on_preempt = 0   ///< [in] callback to be called on preemption
     ) {
     Mutex::Locker l(lock);
     assert(!queue_pointers.count(item) &&
 	   !in_progress.count(item));
-    queue.push_back(make_pair(item, on_reserved));
-    queue_pointers.insert(make_pair(item, --queue.end()));
+    list<Reservation> &q = queues[prio];
+    q.push_back(Reservation(item, prio, on_reserved, on_preempt));
+    queue_pointers.insert(make_pair(item, make_pair(prio, --q.end())));
     do_queues();
   }
 
@@ -89,14 +141,68 @@ public:
     T item                   ///< [in] key for reservation to cancel
     ) {
     Mutex::Locker l(lock);
-    if (queue_pointers.count(item)) {
-      queue.erase(queue_pointers[item]);
-      queue_pointers.erase(item);
+    typename map<T, pair<unsigned, queue_iterator> >::iterator i =
+      queue_pointers.find(item);
+    if (i != queue_pointers.end()) {
+      unsigned prio = i->second.first;
+      delete i->second.second->grant;
+      delete i->second.second->preempt;
+      queues[prio].erase(i->second.second);
+      if (queues[prio].empty())
+	queues.erase(prio);
+      queue_pointers.erase(i);
     } else {
-      in_progress.erase(item);
+      typename map<T, Reservation>::iterator p = in_progress.find(item);
+      if (p != in_progress.end()) {
+	if (p->second.preempt) {
+	  preempt_by_prio.erase(make_pair(p->second.prio, item));
+	  delete p->second.preempt;
+	}
+	in_progress.erase(p);
+      }
     }
     do_queues();
   }
+
+  /// number of waiting requests, by priority
+  void get_queue_depths(map<unsigned, unsigned> *depths) {
+    Mutex::Locker l(lock);
+    depths->clear();
+    for (typename map<unsigned, list<Reservation> >::iterator p = queues.begin();
+	 p != queues.end();
+	 ++p)
+      (*depths)[p->first] = p->second.size();
+  }
+
+  void dump(Formatter *f) {
+    Mutex::Locker l(lock);
+    f->dump_unsigned("max_allowed", max_allowed);
+    f->open_array_section("queues");
+    for (typename map<unsigned, list<Reservation> >::reverse_iterator p =
+	   queues.rbegin();
+	 p != queues.rend();
+	 ++p) {
+      f->open_object_section("queue");
+      f->dump_unsigned("priority", p->first);
+      f->open_array_section("items");
+      for (queue_iterator q = p->second.begin(); q != p->second.end(); ++q)
+	f->dump_stream("item") << q->item;
+      f->close_section();
+      f->close_section();
+    }
+    f->close_section();
+    f->open_array_section("in_progress");
+    for (typename map<T, Reservation>::iterator p = in_progress.begin();
+	 p != in_progress.end();
+	 ++p) {
+      f->open_object_section("reservation");
+      f->dump_stream("item") << p->first;
+      f->dump_unsigned("priority", p->second.prio);
+      f->dump_int("can_preempt", p->second.preempt != 0);
+      f->close_section();
+    }
+    f->close_section();
+  }
 };
 
 #endif
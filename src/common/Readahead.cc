@@ -0,0 +1,174 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "common/Readahead.h"
+
+#include "include/assert.h"
+#include "include/intarith.h"
+
+using std::vector;
+
+Readahead::Readahead()
+  : m_lock("Readahead::m_lock"),
+    m_trigger_requests(10),
+    m_min_readahead_size(0),
+    m_max_readahead_size(512 * 1024),
+    m_alignment(0),
+    m_nr_consec_read(0),
+    m_consec_read_bytes(0),
+    m_last_pos(0),
+    m_readahead_size(0),
+    m_readahead_start(0),
+    m_readahead_pos(0),
+    m_readahead_trigger_pos(0),
+    m_pending_lock("Readahead::m_pending_lock"),
+    m_pending(0)
+{
+}
+
+Readahead::extent_t Readahead::update(const vector<extent_t>& extents,
+				      uint64_t limit, uint64_t *hit_bytes)
+{
+  Mutex::Locker l(m_lock);
+  uint64_t hit = 0;
+  for (vector<extent_t>::const_iterator p = extents.begin();
+       p != extents.end();
+       ++p)
+    hit += observe_read(p->first, p->second);
+  if (hit_bytes)
+    *hit_bytes = hit;
+  return compute_readahead(limit);
+}
+
+Readahead::extent_t Readahead::update(uint64_t offset, uint64_t length,
+				      uint64_t limit, uint64_t *hit_bytes)
+{
+  Mutex::Locker l(m_lock);
+  uint64_t hit = observe_read(offset, length);
+  if (hit_bytes)
+    *hit_bytes = hit;
+  return compute_readahead(limit);
+}
+
+/// @return how much of the read falls in what we already read ahead
+uint64_t Readahead::observe_read(uint64_t offset, uint64_t length)
+{
+  uint64_t hit = 0;
+  if (m_readahead_size) {
+    uint64_t start = MAX(offset, m_readahead_start);
+    uint64_t end = MIN(offset + length, m_readahead_pos);
+    if (start < end)
+      hit = end - start;
+  }
+
+  if (offset == m_last_pos) {
+    m_nr_consec_read++;
+    m_consec_read_bytes += length;
+  } else {
+    m_nr_consec_read = 0;
+    m_consec_read_bytes = 0;
+    m_readahead_size = 0;
+    m_readahead_start = 0;
+    m_readahead_pos = 0;
+    m_readahead_trigger_pos = 0;
+  }
+  m_last_pos = offset + length;
+  return hit;
+}
+
+Readahead::extent_t Readahead::compute_readahead(uint64_t limit)
+{
+  if (m_nr_consec_read < m_trigger_requests ||
+      m_last_pos < m_readahead_trigger_pos ||
+      m_max_readahead_size == 0)
+    return extent_t(0, 0);
+
+  if (m_readahead_size == 0) {
+    m_readahead_size = m_consec_read_bytes;
+    m_readahead_start = m_last_pos;
+    m_readahead_pos = m_last_pos;
+  } else {
+    m_readahead_size *= 2;
+    // the reader overtook us; don't read what it already has
+    if (m_last_pos > m_readahead_pos)
+      m_readahead_pos = m_last_pos;
+  }
+  m_readahead_size = MAX(m_readahead_size, m_min_readahead_size);
+  m_readahead_size = MIN(m_readahead_size, m_max_readahead_size);
+
+  uint64_t offset = m_readahead_pos;
+  uint64_t length = m_readahead_size;
+
+  // end on an alignment boundary if that changes the size by less than
+  // half; the window itself keeps growing from its unaligned size
+  if (m_alignment) {
+    uint64_t end = offset + length;
+    uint64_t align_prev = end / m_alignment * m_alignment;
+    uint64_t align_next = align_prev + m_alignment;
+    uint64_t dist_prev = end - align_prev;
+    uint64_t dist_next = align_next - end;
+    if (dist_prev < length / 2 && dist_prev <= dist_next) {
+      assert(align_prev > offset);
+      length = align_prev - offset;
+    } else if (dist_next < length / 2) {
+      length = align_next - offset;
+    }
+  }
+
+  if (offset >= limit)
+    return extent_t(0, 0);
+  if (offset + length > limit)
+    length = limit - offset;
+
+  m_readahead_trigger_pos = offset + length / 2;
+  m_readahead_pos = offset + length;
+  return extent_t(offset, length);
+}
+
+void Readahead::inc_pending(int count)
+{
+  assert(count > 0);
+  Mutex::Locker l(m_pending_lock);
+  m_pending += count;
+}
+
+void Readahead::dec_pending(int count)
+{
+  assert(count > 0);
+  Mutex::Locker l(m_pending_lock);
+  assert(m_pending >= count);
+  m_pending -= count;
+  if (m_pending == 0)
+    m_pending_cond.Signal();
+}
+
+void Readahead::wait_for_pending()
+{
+  Mutex::Locker l(m_pending_lock);
+  while (m_pending > 0)
+    m_pending_cond.Wait(m_pending_lock);
+}
+
+void Readahead::set_trigger_requests(int trigger_requests)
+{
+  Mutex::Locker l(m_lock);
+  m_trigger_requests = trigger_requests;
+}
+
+void Readahead::set_min_readahead_size(uint64_t min_readahead_size)
+{
+  Mutex::Locker l(m_lock);
+  m_min_readahead_size = min_readahead_size;
+}
+
+void Readahead::set_max_readahead_size(uint64_t max_readahead_size)
+{
+  Mutex::Locker l(m_lock);
+  m_max_readahead_size = max_readahead_size;
+}
+
+void Readahead::set_alignment(uint64_t alignment)
+{
+  Mutex::Locker l(m_lock);
+  m_alignment = alignment;
+}
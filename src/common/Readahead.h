@@ -0,0 +1,89 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2013 Inktank
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_READAHEAD_H
+#define CEPH_READAHEAD_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "common/Cond.h"
+#include "common/Mutex.h"
+
+/**
+ * detect sequential reads and decide what to read ahead
+ *
+ * Readahead starts once @trigger_requests reads in a row each began
+ * where the previous one ended.  The first window is as large as the
+ * sequential reads so far, and it doubles every time the reader gets
+ * halfway through the previous window, up to the maximum size.  Any
+ * other read starts over.
+ *
+ * The caller issues the reads itself, and keeps track of them with
+ * inc_pending()/dec_pending() so they can be drained.
+ */
+class Readahead {
+public:
+  typedef std::pair<uint64_t, uint64_t> extent_t;
+
+  Readahead();
+
+  /**
+   * observe a read and compute the readahead it triggers
+   *
+   * @param extents image extents of the read, in order
+   * @param limit end of the readable range, e.g. the image size
+   * @param hit_bytes [out] bytes of the read that were read ahead
+   * @return extent to read ahead, of length 0 if none
+   */
+  extent_t update(const std::vector<extent_t>& extents, uint64_t limit,
+		  uint64_t *hit_bytes = NULL);
+  extent_t update(uint64_t offset, uint64_t length, uint64_t limit,
+		  uint64_t *hit_bytes = NULL);
+
+  void inc_pending(int count = 1);
+  void dec_pending(int count = 1);
+  /// block until every readahead started so far has finished
+  void wait_for_pending();
+
+  void set_trigger_requests(int trigger_requests);
+  void set_min_readahead_size(uint64_t min_readahead_size);
+  void set_max_readahead_size(uint64_t max_readahead_size);
+  /// end readahead windows on a multiple of @alignment when it is close
+  void set_alignment(uint64_t alignment);
+
+private:
+  uint64_t observe_read(uint64_t offset, uint64_t length);
+  extent_t compute_readahead(uint64_t limit);
+
+  Mutex m_lock;
+  int m_trigger_requests;
+  uint64_t m_min_readahead_size;
+  uint64_t m_max_readahead_size;
+  uint64_t m_alignment;
+
+  int m_nr_consec_read;         ///< sequential reads in a row
+  uint64_t m_consec_read_bytes; ///< bytes read by them
+  uint64_t m_last_pos;          ///< where the next sequential read starts
+  uint64_t m_readahead_size;    ///< size of the last window, 0 if none
+  uint64_t m_readahead_start;   ///< start of the data read ahead so far
+  uint64_t m_readahead_pos;     ///< end of the data read ahead so far
+  uint64_t m_readahead_trigger_pos;  ///< read past this to extend
+
+  Mutex m_pending_lock;
+  Cond m_pending_cond;
+  int m_pending;
+};
+
+#endif
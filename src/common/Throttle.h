@@ -8,6 +8,7 @@
 #include "Cond.h"
 #include <list>
 #include "include/atomic.h"
+#include "include/Context.h"
 
 class CephContext;
 class PerfCounters;
@@ -58,5 +59,44 @@ public:
   int64_t put(int64_t c = 1);
 };
 
+/**
+ * keep at most @max asynchronous operations in flight
+ *
+ * start_op() blocks while @max operations are outstanding; each
+ * operation calls end_op() with its result when it completes.
+ * wait_for_ret() waits for everything started so far and returns the
+ * first error, if any.  -ENOENT is not an error if @ignore_enoent is
+ * set.
+ */
+class SimpleThrottle {
+public:
+  SimpleThrottle(uint64_t max, bool ignore_enoent);
+  ~SimpleThrottle();
+  void start_op();
+  void end_op(int r);
+  /// true once an operation has failed; callers may stop starting more
+  bool pending_error() const;
+  int wait_for_ret();
+private:
+  mutable Mutex m_lock;
+  Cond m_cond;
+  uint64_t m_max;
+  uint64_t m_current;
+  int m_ret;
+  bool m_ignore_enoent;
+};
+
+/// completion that reports its result to a SimpleThrottle
+class C_SimpleThrottle : public Context {
+public:
+  C_SimpleThrottle(SimpleThrottle *throttle) : m_throttle(throttle) {
+    m_throttle->start_op();
+  }
+  virtual void finish(int r) {
+    m_throttle->end_op(r);
+  }
+private:
+  SimpleThrottle *m_throttle;
+};
 
 #endif
@@ -153,6 +153,7 @@ OPTION(mon_globalid_prealloc, OPT_INT, 100)   // how many globalids to prealloc
 OPTION(mon_osd_report_timeout, OPT_INT, 900)    // grace period before declaring unresponsive OSDs dead
 OPTION(mon_force_standby_active, OPT_BOOL, true) // should mons force standby-replay mds to be active
 OPTION(mon_min_osdmap_epochs, OPT_INT, 500)
+OPTION(mon_osdmap_full_interval, OPT_INT, 10)  // keep a full osdmap every this many epochs; others are rebuilt from incrementals
 OPTION(mon_max_pgmap_epochs, OPT_INT, 500)
 OPTION(mon_max_log_epochs, OPT_INT, 500)
 OPTION(mon_max_osd, OPT_INT, 10000)
@@ -224,6 +225,7 @@ OPTION(fuse_default_permissions, OPT_BOOL, true)
 OPTION(fuse_big_writes, OPT_BOOL, true)
 OPTION(fuse_atomic_o_trunc, OPT_BOOL, true)
 OPTION(fuse_debug, OPT_BOOL, false)
+OPTION(crush_location, OPT_STR, "")  // e.g. "host=foo rack=bar"; used to pick nearby replicas for localized reads
 OPTION(objecter_tick_interval, OPT_DOUBLE, 5.0)
 OPTION(objecter_timeout, OPT_DOUBLE, 10.0)    // before we ask for a map
 OPTION(objecter_inflight_op_bytes, OPT_U64, 1024*1024*100) // max in-flight data (both directions)
@@ -348,11 +350,23 @@ OPTION(osd_pool_default_pg_num, OPT_INT, 8) // number of PGs for new pools. Conf
 OPTION(osd_pool_default_pgp_num, OPT_INT, 8) // number of PGs for placement purposes. Should be equal to pg_num
 OPTION(osd_pool_default_flags, OPT_INT, 0)   // default flags for new pools
 OPTION(osd_map_dedup, OPT_BOOL, true)
+OPTION(osd_map_cache_pg_mapping, OPT_BOOL, true)  // osds and clients cache the crush result of each pg in their current map
 OPTION(osd_map_cache_size, OPT_INT, 500)
+OPTION(osd_map_full_interval, OPT_INT, 10)  // store a full osdmap every this many epochs; others are rebuilt from incrementals
+OPTION(osd_map_max_advance, OPT_INT, 200) // epochs a pg may get ahead of the slowest pg; keep it < osd_map_cache_size
 OPTION(osd_map_message_max, OPT_INT, 100)  // max maps per MOSDMap message
 OPTION(osd_op_threads, OPT_INT, 2)    // 0 == no threading
+OPTION(osd_peering_wq_threads, OPT_INT, 2)  // threads advancing pgs through new maps and handling peering events
+OPTION(osd_peering_wq_batch_size, OPT_U64, 20)  // pgs each peering thread takes at a time
 OPTION(osd_op_pq_max_tokens_per_priority, OPT_U64, 4194304)
 OPTION(osd_op_pq_min_cost, OPT_U64, 65536)
+OPTION(osd_op_queue, OPT_STR, "prioritized") // op queue scheduler: prioritized or mclock
+OPTION(osd_op_queue_mclock_client_op_res, OPT_DOUBLE, 0.0) // client ops/sec reserved, unless set on the pool
+OPTION(osd_op_queue_mclock_client_op_wgt, OPT_DOUBLE, 63.0) // client weight, unless set on the pool
+OPTION(osd_op_queue_mclock_client_op_lim, OPT_DOUBLE, 0.0) // client ops/sec limit, unless set on the pool
+OPTION(osd_op_queue_mclock_recov_res, OPT_DOUBLE, 0.0) // recovery ops/sec reserved per peer osd
+OPTION(osd_op_queue_mclock_recov_wgt, OPT_DOUBLE, 10.0) // recovery weight per peer osd
+OPTION(osd_op_queue_mclock_recov_lim, OPT_DOUBLE, 0.0) // recovery ops/sec limit per peer osd
 OPTION(osd_disk_threads, OPT_INT, 1)
 OPTION(osd_recovery_threads, OPT_INT, 1)
 OPTION(osd_recover_clone_overlap, OPT_BOOL, true)   // preserve clone_overlap during recovery/migration
@@ -361,6 +375,7 @@ OPTION(osd_backfill_scan_max, OPT_INT, 512)
 OPTION(osd_op_thread_timeout, OPT_INT, 15)
 OPTION(osd_recovery_thread_timeout, OPT_INT, 30)
 OPTION(osd_snap_trim_thread_timeout, OPT_INT, 60*60*1)
+OPTION(osd_tier_agent_thread_timeout, OPT_INT, 60*60*1)
 OPTION(osd_scrub_thread_timeout, OPT_INT, 60)
 OPTION(osd_scrub_finalize_thread_timeout, OPT_INT, 60*10)
 OPTION(osd_remove_thread_timeout, OPT_INT, 60*60)
@@ -368,8 +383,10 @@ OPTION(osd_command_thread_timeout, OPT_INT, 10*60)
 OPTION(osd_age, OPT_FLOAT, .8)
 OPTION(osd_age_time, OPT_INT, 0)
 OPTION(osd_heartbeat_addr, OPT_ADDR, entity_addr_t())
-OPTION(osd_heartbeat_interval, OPT_INT, 6)       // (seconds) how often we ping peers
+OPTION(osd_heartbeat_interval, OPT_DOUBLE, 6)    // (seconds) how often we ping peers
 OPTION(osd_heartbeat_grace, OPT_INT, 20)         // (seconds) how long before we decide a peer has failed
+OPTION(osd_heartbeat_min_grace, OPT_DOUBLE, 20)  // (seconds) lower bound for a peer's grace adapted to its ping round trip times
+OPTION(osd_heartbeat_rtt_grace_mult, OPT_DOUBLE, 8) // adaptive grace: 2 intervals + srtt + this * rtt deviation
 OPTION(osd_mon_heartbeat_interval, OPT_INT, 30)  // (seconds) how often to ping monitor if no peers
 OPTION(osd_mon_report_interval_max, OPT_INT, 120)
 OPTION(osd_mon_report_interval_min, OPT_INT, 5)  // pg stats, failures, up_thru, boot.
@@ -383,12 +400,18 @@ OPTION(osd_recovery_delay_start, OPT_FLOAT, 0)
 OPTION(osd_recovery_max_active, OPT_INT, 5)
 OPTION(osd_recovery_max_chunk, OPT_U64, 8<<20)  // max size of push chunk
 OPTION(osd_recovery_forget_lost_objects, OPT_BOOL, false)   // off for now
+OPTION(osd_tier_agent_max_ops, OPT_INT, 4)  // objects each cache pool pg flushes or evicts per tick
 OPTION(osd_max_scrubs, OPT_INT, 1)
 OPTION(osd_scrub_load_threshold, OPT_FLOAT, 0.5)
 OPTION(osd_scrub_min_interval, OPT_FLOAT, 60*60*24)    // if load is low
 OPTION(osd_scrub_max_interval, OPT_FLOAT, 7*60*60*24)  // regardless of load
 OPTION(osd_deep_scrub_interval, OPT_FLOAT, 60*60*24*7) // once a week
 OPTION(osd_deep_scrub_stride, OPT_INT, 524288)
+OPTION(osd_deep_scrub_threads, OPT_INT, 2)  // threads hashing objects for deep scrub; 0 hashes inline
+OPTION(osd_deep_scrub_readahead_objects, OPT_INT, 4)  // objects to prefetch ahead of the deep scrub hashing
+OPTION(osd_deep_scrub_max_bytes_per_sec, OPT_U64, 0)  // deep scrub read bandwidth per osd; 0 for unlimited
+OPTION(osd_deep_scrub_client_op_rate, OPT_FLOAT, 0)  // client ops/sec at which deep scrub bandwidth drops to the minimum; 0 to ignore client load
+OPTION(osd_deep_scrub_min_bandwidth_ratio, OPT_FLOAT, .1)  // fraction of osd_deep_scrub_max_bytes_per_sec left to deep scrub under client load
 OPTION(osd_auto_weight, OPT_BOOL, false)
 OPTION(osd_class_dir, OPT_STR, CEPH_LIBDIR "/rados-classes") // where rados plugins are stored
 OPTION(osd_check_for_log_corruption, OPT_BOOL, false)
@@ -481,6 +504,20 @@ OPTION(rbd_cache_size, OPT_LONGLONG, 32<<20)         // cache size in bytes
 OPTION(rbd_cache_max_dirty, OPT_LONGLONG, 24<<20)    // dirty limit in bytes - set to 0 for write-through caching
 OPTION(rbd_cache_target_dirty, OPT_LONGLONG, 16<<20) // target dirty limit in bytes
 OPTION(rbd_cache_max_dirty_age, OPT_FLOAT, 1.0)      // seconds in cache before writeback starts
+OPTION(rbd_cache_shards, OPT_INT, 1)     // independently locked parts of the cache, sharing its size and dirty limits
+OPTION(rbd_cache_write_around_bytes, OPT_LONGLONG, 1<<20) // write back sequential writes to an object right away after this many bytes, and evict them first; 0 disables
+OPTION(rbd_persistent_cache, OPT_BOOL, false) // log writes to a local file (e.g. on an SSD) and write them back in the background; replaces rbd_cache for writable images
+OPTION(rbd_persistent_cache_path, OPT_STR, "/var/lib/ceph/rbd-cache") // directory holding the log files
+OPTION(rbd_persistent_cache_size, OPT_LONGLONG, 1<<30) // log file size in bytes
+OPTION(rbd_persistent_cache_max_dirty_age, OPT_FLOAT, 5.0) // seconds in the log before writeback starts
+OPTION(rbd_persistent_cache_target_dirty, OPT_FLOAT, .5) // write back everything once this fraction of the log is used
+OPTION(rbd_persistent_cache_inject_crash, OPT_BOOL, false) // for testing: close leaves the log behind unwritten, as after a crash
+OPTION(rbd_clone_copy_on_read, OPT_BOOL, false) // copy objects a clone reads from its parent into the clone
+OPTION(rbd_copy_on_read_max_ops, OPT_INT, 16)  // max copy-on-read copyups in flight per image
+OPTION(rbd_readahead_trigger_requests, OPT_INT, 10) // sequential requests needed to trigger readahead
+OPTION(rbd_readahead_max_bytes, OPT_LONGLONG, 512 * 1024) // max size of a readahead request, 0 disables readahead
+OPTION(rbd_readahead_disable_after_bytes, OPT_LONGLONG, 50 * 1024 * 1024) // stop reading ahead once this many bytes have been read (e.g. after booting), 0 never stops
+OPTION(rbd_concurrent_management_ops, OPT_INT, 10)   // stripe periods/requests in flight for export, copy, flatten, remove and shrink
 
 OPTION(nss_db_path, OPT_STR, "") // path to nss db
 
@@ -0,0 +1,94 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2013 Inktank
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_HISTOGRAM_H
+#define CEPH_HISTOGRAM_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "common/Formatter.h"
+
+/**
+ * power of 2 histogram
+ *
+ * Bucket 0 counts values <= 0, and bucket i > 0 counts values v with
+ * 2^(i-1) <= v < 2^i.  Buckets are added as larger values show up.
+ */
+struct pow2_hist_t {
+  std::vector<uint64_t> h;
+
+  static unsigned bucket_of(int64_t v) {
+    unsigned b = 0;
+    while (v > 0) {
+      ++b;
+      v >>= 1;
+    }
+    return b;
+  }
+  /// smallest value that no longer falls in bucket @b
+  static int64_t upper_bound_of(unsigned b) {
+    return (int64_t)1 << b;
+  }
+
+  void add(int64_t v) {
+    unsigned b = bucket_of(v);
+    if (h.size() <= b)
+      h.resize(b + 1);
+    h[b]++;
+  }
+  void clear() {
+    h.clear();
+  }
+  uint64_t count() const {
+    uint64_t n = 0;
+    for (std::vector<uint64_t>::const_iterator p = h.begin(); p != h.end(); ++p)
+      n += *p;
+    return n;
+  }
+  bool empty() const {
+    return count() == 0;
+  }
+
+  /**
+   * estimate a percentile
+   *
+   * @param p fraction of the values, in (0, 1]
+   * @return upper bound of the bucket holding that value, 0 if empty
+   */
+  int64_t percentile(double p) const {
+    uint64_t n = count();
+    if (!n)
+      return 0;
+    uint64_t want = (uint64_t)(p * n);
+    if (want == 0)
+      want = 1;
+    uint64_t seen = 0;
+    for (unsigned b = 0; b < h.size(); ++b) {
+      seen += h[b];
+      if (seen >= want)
+	return upper_bound_of(b);
+    }
+    return upper_bound_of(h.size() - 1);
+  }
+
+  void dump(ceph::Formatter *f) const {
+    f->open_array_section("histogram");
+    for (std::vector<uint64_t>::const_iterator p = h.begin(); p != h.end(); ++p)
+      f->dump_unsigned("count", *p);
+    f->close_section();
+  }
+};
+
+#endif
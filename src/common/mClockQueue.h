@@ -0,0 +1,320 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2013 Inktank
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef MCLOCK_QUEUE_H
+#define MCLOCK_QUEUE_H
+
+#include "common/Clock.h"
+#include "common/Formatter.h"
+#include "common/PrioritizedQueue.h"
+
+#include <map>
+#include <utility>
+#include <list>
+#include <limits>
+#include <algorithm>
+
+/**
+ * Queue scheduling items with the mClock algorithm
+ *
+ * Every class K (e.g. a client) has a reservation (minimum ops/sec),
+ * a weight (share of the spare capacity) and a limit (maximum
+ * ops/sec), any of which may be 0 to mean "none".  Each queued item
+ * gets three tags when it is enqueued:
+ *
+ *   R = max(R_prev + 1/reservation, now)
+ *   P = max(P_prev + 1/weight, now)
+ *   L = max(L_prev + 1/limit, now)
+ *
+ * On dequeue, the class whose head item has the smallest R tag not in
+ * the future is served first, so that every reservation is met.  If
+ * no reservation is due, the class with the smallest P tag among
+ * those under their limit (L tag not in the future) is served, and
+ * its remaining R tags are pulled back by 1/reservation so that the
+ * extra service does not count against its reservation.
+ *
+ * Tags are charged per item; the cost passed to enqueue is accepted for
+ * interface compatibility with PrioritizedQueue but does not scale the
+ * tags, so reservations and limits are in ops/sec.
+ *
+ * Limits are soft: when every class with queued items is over its
+ * limit the queue still hands out the item with the smallest P tag
+ * rather than leaving the op threads idle.
+ *
+ * Items queued with enqueue_strict bypass mClock and are served
+ * first, in strict priority order, exactly as with PrioritizedQueue.
+ *
+ * A class is kept while it has items queued, or tags in the future
+ * that it would be charged for if it came back.  dequeue() forgets the
+ * idle classes it comes across once their tags are due, so classes
+ * for clients that went away (each client instance is a new class)
+ * don't pile up.
+ */
+template <typename T, typename K>
+class mClockQueue {
+public:
+  struct ClientInfo {
+    double reservation;  ///< ops/sec, 0 for none
+    double weight;       ///< relative share, 0 is treated as 1
+    double limit;        ///< ops/sec, 0 for none
+    ClientInfo(double r = 0, double w = 1, double l = 0)
+      : reservation(r), weight(w), limit(l) {}
+  };
+
+private:
+  struct Tag {
+    double reservation, proportion, limit;
+    Tag() : reservation(0), proportion(0), limit(0) {}
+  };
+
+  struct Item {
+    Tag tag;
+    T item;
+    Item(const Tag &t, T i) : tag(t), item(i) {}
+  };
+
+  struct Client {
+    ClientInfo info;
+    Tag prev;          ///< tags of the most recently enqueued item
+    list<Item> q;
+  };
+
+  static double max_tag() {
+    return std::numeric_limits<double>::max();
+  }
+
+  typedef typename map<K, Client>::iterator client_iterator;
+
+  map<K, Client> clients;
+  PrioritizedQueue<T, K> high_queue;
+  unsigned size;
+
+  void tag_item(Client &c, double now, Tag *t) {
+    const ClientInfo &info = c.info;
+    t->reservation = info.reservation > 0 ?
+      std::max(c.prev.reservation + 1.0 / info.reservation, now) : max_tag();
+    t->proportion = std::max(c.prev.proportion +
+			1.0 / (info.weight > 0 ? info.weight : 1.0), now);
+    t->limit = info.limit > 0 ?
+      std::max(c.prev.limit + 1.0 / info.limit, now) : 0;
+    c.prev = *t;
+  }
+
+  /// forget an idle class that has no tag left in the future
+  bool trim(client_iterator p, double now) {
+    Client &c = p->second;
+    if (c.q.empty() &&
+	(c.prev.reservation == max_tag() || c.prev.reservation <= now) &&
+	c.prev.proportion <= now &&
+	c.prev.limit <= now) {
+      clients.erase(p);
+      return true;
+    }
+    return false;
+  }
+
+  T pop(client_iterator p, bool proportional, double now) {
+    Client &c = p->second;
+    T ret = c.q.front().item;
+    c.q.pop_front();
+    size--;
+    if (proportional && c.info.reservation > 0) {
+      double d = 1.0 / c.info.reservation;
+      for (typename list<Item>::iterator i = c.q.begin(); i != c.q.end(); ++i)
+	i->tag.reservation -= d;
+      c.prev.reservation -= d;
+    }
+    trim(p, now);
+    return ret;
+  }
+
+  template <class F>
+  static unsigned filter_list(list<Item> *l, F f, list<T> *out) {
+    unsigned ret = 0;
+    for (typename list<Item>::iterator i = l->begin(); i != l->end(); ) {
+      if (f(i->item)) {
+	if (out)
+	  out->push_back(i->item);
+	l->erase(i++);
+	++ret;
+      } else {
+	++i;
+      }
+    }
+    return ret;
+  }
+
+public:
+  mClockQueue(unsigned max_per, unsigned min_c)
+    : high_queue(max_per, min_c),
+      size(0)
+  {}
+
+  unsigned length() {
+    return size + high_queue.length();
+  }
+
+  bool empty() {
+    return size == 0 && high_queue.empty();
+  }
+
+  /// number of classes we keep state for, including idle ones
+  unsigned get_num_classes() const {
+    return clients.size();
+  }
+
+  template <class F>
+  void remove_by_filter(F f, list<T> *removed, double now) {
+    high_queue.remove_by_filter(f, removed);
+    for (client_iterator p = clients.begin(); p != clients.end(); ) {
+      size -= filter_list(&p->second.q, f, removed);
+      trim(p++, now);
+    }
+  }
+  template <class F>
+  void remove_by_filter(F f, list<T> *removed = 0) {
+    remove_by_filter(f, removed, (double)ceph_clock_now(NULL));
+  }
+
+  void remove_by_class(K k, list<T> *out = 0) {
+    high_queue.remove_by_class(k, out);
+    client_iterator p = clients.find(k);
+    if (p == clients.end())
+      return;
+    if (out) {
+      for (typename list<Item>::iterator i = p->second.q.begin();
+	   i != p->second.q.end();
+	   ++i)
+	out->push_back(i->item);
+    }
+    size -= p->second.q.size();
+    clients.erase(p);
+  }
+
+  void enqueue_strict(K cl, unsigned priority, T item) {
+    high_queue.enqueue_strict(cl, priority, item);
+  }
+
+  void enqueue_strict_front(K cl, unsigned priority, T item) {
+    high_queue.enqueue_strict_front(cl, priority, item);
+  }
+
+  void enqueue(K cl, const ClientInfo &info, unsigned cost, T item,
+	       double now) {
+    Client &c = clients[cl];
+    c.info = info;
+    Tag t;
+    tag_item(c, now, &t);
+    c.q.push_back(Item(t, item));
+    size++;
+  }
+  void enqueue(K cl, const ClientInfo &info, unsigned cost, T item) {
+    enqueue(cl, info, cost, item, (double)ceph_clock_now(NULL));
+  }
+
+  /**
+   * requeue an item at the front of its class, e.g. after it was
+   * dequeued but could not be processed.  it reuses the tags of the
+   * current head so that it is not charged twice.
+   */
+  void enqueue_front(K cl, const ClientInfo &info, unsigned cost, T item,
+		     double now) {
+    Client &c = clients[cl];
+    c.info = info;
+    Tag t;
+    if (c.q.empty()) {
+      t.reservation = info.reservation > 0 ? now : max_tag();
+      t.proportion = now;
+      t.limit = 0;
+    } else {
+      t = c.q.front().tag;
+    }
+    c.q.push_front(Item(t, item));
+    size++;
+  }
+  void enqueue_front(K cl, const ClientInfo &info, unsigned cost, T item) {
+    enqueue_front(cl, info, cost, item, (double)ceph_clock_now(NULL));
+  }
+
+  T dequeue(double now) {
+    assert(!empty());
+
+    if (!high_queue.empty())
+      return high_queue.dequeue();
+
+    // reservations first; sweep out expired idle classes on the way
+    client_iterator best = clients.end();
+    for (client_iterator p = clients.begin(); p != clients.end(); ) {
+      if (p->second.q.empty()) {
+	trim(p++, now);
+	continue;
+      }
+      double r = p->second.q.front().tag.reservation;
+      if (r <= now &&
+	  (best == clients.end() ||
+	   r < best->second.q.front().tag.reservation))
+	best = p;
+      ++p;
+    }
+    if (best != clients.end())
+      return pop(best, false, now);
+
+    // then weights, among the classes under their limit
+    client_iterator over = clients.end();
+    for (client_iterator p = clients.begin(); p != clients.end(); ++p) {
+      if (p->second.q.empty())
+	continue;
+      const Tag &t = p->second.q.front().tag;
+      if (t.limit <= now) {
+	if (best == clients.end() ||
+	    t.proportion < best->second.q.front().tag.proportion)
+	  best = p;
+      } else {
+	if (over == clients.end() ||
+	    t.proportion < over->second.q.front().tag.proportion)
+	  over = p;
+      }
+    }
+    if (best == clients.end())
+      best = over;
+    assert(best != clients.end());
+    return pop(best, true, now);
+  }
+  T dequeue() {
+    return dequeue((double)ceph_clock_now(NULL));
+  }
+
+  void dump(Formatter *f) const {
+    f->dump_int("num_clients", clients.size());
+    f->dump_int("size", size);
+    f->open_object_section("high_queue");
+    high_queue.dump(f);
+    f->close_section();
+    f->open_array_section("clients");
+    for (typename map<K, Client>::const_iterator p = clients.begin();
+	 p != clients.end();
+	 ++p) {
+      f->open_object_section("client");
+      f->dump_stream("class") << p->first;
+      f->dump_float("reservation", p->second.info.reservation);
+      f->dump_float("weight", p->second.info.weight);
+      f->dump_float("limit", p->second.info.limit);
+      f->dump_int("queued", p->second.q.size());
+      f->close_section();
+    }
+    f->close_section();
+  }
+};
+
+#endif
@@ -94,6 +94,18 @@ public:
     return weak_refs.begin()->first;
   }
 
+  /// get a reference to every value that is still alive
+  void get_values(list<VPtr> *out) {
+    Mutex::Locker l(lock);
+    for (typename map<K, WeakVPtr>::iterator i = weak_refs.begin();
+	 i != weak_refs.end();
+	 ++i) {
+      VPtr val = i->second.lock();
+      if (val)
+	out->push_back(val);
+    }
+  }
+
   VPtr lower_bound(K key) {
     VPtr val;
     list<VPtr> to_release;
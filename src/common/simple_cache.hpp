@@ -88,6 +88,19 @@ public:
     Mutex::Locker l(lock);
     _add(key, value);
   }
+
+  /// copy out the cached and pinned values
+  void get_values(map<K, V> *out) {
+    Mutex::Locker l(lock);
+    for (typename list<pair<K, V> >::iterator i = lru.begin();
+	 i != lru.end();
+	 ++i)
+      (*out)[i->first] = i->second;
+    for (typename map<K, V>::iterator i = pinned.begin();
+	 i != pinned.end();
+	 ++i)
+      (*out)[i->first] = i->second;
+  }
 };
 
 #endif
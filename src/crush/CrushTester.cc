@@ -1,7 +1,11 @@
 
 #include "CrushTester.h"
+#include "common/Clock.h"
+#include "common/Thread.h"
 
 #include <stdlib.h>
+#include <math.h>
+#include <algorithm>
 
 
 void CrushTester::set_device_weight(int dev, float f)
@@ -589,3 +593,347 @@ int CrushTester::test()
 
   return 0;
 }
+
+/// replace every straw bucket in @c with a straw2 bucket with the same items
+static void convert_to_straw2(CrushWrapper& c)
+{
+  for (int i = 0; i < c.crush->max_buckets; i++) {
+    crush_bucket *b = c.crush->buckets[i];
+    if (!b || b->alg != CRUSH_BUCKET_STRAW)
+      continue;
+    vector<int> items(b->size), weights(b->size);
+    for (unsigned j = 0; j < b->size; j++) {
+      items[j] = b->items[j];
+      weights[j] = crush_get_bucket_item_weight(b, j);
+    }
+    crush_bucket *n = crush_make_bucket(CRUSH_BUCKET_STRAW2, b->hash, b->type,
+					b->size,
+					items.empty() ? NULL : &items[0],
+					weights.empty() ? NULL : &weights[0]);
+    assert(n);
+    n->id = b->id;
+    crush_destroy_bucket(b);
+    c.crush->buckets[i] = n;
+  }
+}
+
+/// count the replicas in @before that are not in @after, and those that
+/// neither left nor were replaced by @item
+static void count_moved(const vector<int>& before, const vector<int>& after,
+			int item, int *moved, int *unrelated)
+{
+  int left = 0, left_other = 0, to_item = 0;
+  for (unsigned i = 0; i < before.size(); i++)
+    if (find(after.begin(), after.end(), before[i]) == after.end()) {
+      left++;
+      if (before[i] != item)
+	left_other++;
+    }
+  for (unsigned i = 0; i < after.size(); i++)
+    if (after[i] == item &&
+	find(before.begin(), before.end(), item) == before.end())
+      to_item++;
+  *moved += left;
+  if (left_other > to_item)
+    *unrelated += left_other - to_item;
+}
+
+int CrushTester::compare_straw2(CephContext *cct, int item)
+{
+  if (min_rule < 0 || max_rule < 0) {
+    min_rule = 0;
+    max_rule = crush.get_max_rules() - 1;
+  }
+  if (min_x < 0 || max_x < 0) {
+    min_x = 0;
+    max_x = 1023;
+  }
+
+  vector<__u32> weight;
+  for (int o = 0; o < crush.get_max_devices(); o++) {
+    if (device_weight.count(o))
+      weight.push_back(device_weight[o]);
+    else if (crush.check_item_present(o))
+      weight.push_back(0x10000);
+    else
+      weight.push_back(0);
+  }
+
+  if (item < 0) {
+    for (int o = 0; o < crush.get_max_devices(); o++)
+      if (crush.check_item_present(o)) {
+	item = o;
+	break;
+      }
+  }
+  if (item < 0 || !crush.check_item_present(item)) {
+    err << "compare_straw2: no device to reweight" << std::endl;
+    return -ENOENT;
+  }
+
+  // [0] is the map as is, [1] uses straw2
+  bufferlist bl;
+  crush.encode(bl);
+  CrushWrapper maps[2];
+  for (int m = 0; m < 2; m++) {
+    bufferlist::iterator p = bl.begin();
+    maps[m].decode(p);
+  }
+  convert_to_straw2(maps[1]);
+  const char *names[2] = { "straw", "straw2" };
+
+  vector<vector<vector<int> > > before[2];
+  double elapsed[2] = { 0, 0 };
+  int num_x = max_x - min_x + 1;
+  int num_mappings = 0;
+
+  for (int m = 0; m < 2; m++) {
+    utime_t start = ceph_clock_now(cct);
+    for (int r = min_rule; r < crush.get_max_rules() && r <= max_rule; r++) {
+      if (!crush.rule_exists(r))
+	continue;
+      before[m].push_back(vector<vector<int> >());
+      int nr = max_rep < 0 ? crush.get_rule_mask_max_size(r) : max_rep;
+      for (int x = min_x; x <= max_x; x++) {
+	vector<int> out;
+	maps[m].do_rule(r, x, out, nr, weight);
+	before[m].back().push_back(out);
+      }
+    }
+    elapsed[m] = (double)(ceph_clock_now(cct) - start);
+    num_mappings = before[m].size() * num_x;
+  }
+  if (!num_mappings) {
+    err << "compare_straw2: no rules to test" << std::endl;
+    return -ENOENT;
+  }
+
+  int iw = crush.get_item_weight(item);
+  err << "reweighting device " << item << " from " << (float)iw / (float)0x10000
+      << " to " << (float)(iw / 2) / (float)0x10000
+      << ", x = " << min_x << ".." << max_x << std::endl;
+  for (int m = 0; m < 2; m++) {
+    maps[m].adjust_item_weight(cct, item, iw / 2);
+
+    int moved = 0, unrelated = 0, replicas = 0;
+    unsigned ri = 0;
+    for (int r = min_rule; r < crush.get_max_rules() && r <= max_rule; r++) {
+      if (!crush.rule_exists(r))
+	continue;
+      int nr = max_rep < 0 ? crush.get_rule_mask_max_size(r) : max_rep;
+      for (int x = min_x; x <= max_x; x++) {
+	vector<int> out;
+	maps[m].do_rule(r, x, out, nr, weight);
+	const vector<int>& prev = before[m][ri][x - min_x];
+	replicas += prev.size();
+	count_moved(prev, out, item, &moved, &unrelated);
+      }
+      ri++;
+    }
+
+    err << "  " << names[m] << ":\t"
+	<< (elapsed[m] * 1000000.0 / num_mappings) << " us/mapping, moved "
+	<< moved << "/" << replicas
+	<< " (" << (replicas ? 100.0 * moved / replicas : 0) << "%), "
+	<< unrelated << " not to or from device " << item
+	<< std::endl;
+  }
+  return 0;
+}
+
+/// maps a slice of the x range with private copies of both maps
+class CrushCompareThread : public Thread {
+  CrushWrapper crush[2];
+  int rule, nr;
+  int first, last;
+  const vector<__u32>& weight;
+public:
+  vector<uint64_t> per[2];
+  uint64_t replicas, moved, inputs_changed;
+  double elapsed[2];
+
+  CrushCompareThread(bufferlist& a, bufferlist& b, int r, int n,
+		     int f, int l, const vector<__u32>& w)
+    : rule(r), nr(n), first(f), last(l), weight(w),
+      replicas(0), moved(0), inputs_changed(0) {
+    bufferlist::iterator p = a.begin();
+    crush[0].decode(p);
+    p = b.begin();
+    crush[1].decode(p);
+    per[0].resize(w.size());
+    per[1].resize(w.size());
+    elapsed[0] = elapsed[1] = 0;
+  }
+
+  void *entry() {
+    // map in chunks so that the clock is read once per chunk per map
+    const int chunk = 1024;
+    vector<vector<int> > out[2];
+    out[0].resize(chunk);
+    out[1].resize(chunk);
+    for (int x = first; x <= last; x += chunk) {
+      int n = min(chunk, last - x + 1);
+      for (int m = 0; m < 2; m++) {
+	utime_t start = ceph_clock_now(NULL);
+	for (int i = 0; i < n; i++)
+	  crush[m].do_rule(rule, x + i, out[m][i], nr, weight);
+	elapsed[m] += (double)(ceph_clock_now(NULL) - start);
+      }
+      for (int i = 0; i < n; i++) {
+	const vector<int>& a = out[0][i];
+	const vector<int>& b = out[1][i];
+	replicas += a.size();
+	unsigned left = 0;
+	for (unsigned j = 0; j < a.size(); j++) {
+	  if (a[j] >= 0 && a[j] < (int)per[0].size())
+	    per[0][a[j]]++;
+	  if (find(b.begin(), b.end(), a[j]) == b.end())
+	    left++;
+	}
+	for (unsigned j = 0; j < b.size(); j++)
+	  if (b[j] >= 0 && b[j] < (int)per[1].size())
+	    per[1][b[j]]++;
+	moved += left;
+	if (left || a.size() != b.size())
+	  inputs_changed++;
+      }
+    }
+    return 0;
+  }
+};
+
+/// print utilization statistics of @crush's devices given placement counts
+static void dump_utilization(ostream& out, CrushWrapper& crush,
+			     const vector<uint64_t>& per)
+{
+  uint64_t total = 0;
+  int64_t total_weight = 0;
+  for (unsigned o = 0; o < per.size(); o++) {
+    total += per[o];
+    if ((int)o < crush.get_max_devices() && crush.check_item_present(o))
+      total_weight += crush.get_item_weight(o);
+  }
+  if (!total || !total_weight) {
+    out << "no placements";
+    return;
+  }
+
+  int n = 0;
+  double sum = 0, sum2 = 0, lo = 0, hi = 0;
+  for (unsigned o = 0; o < per.size(); o++) {
+    if ((int)o >= crush.get_max_devices() || !crush.check_item_present(o))
+      continue;
+    int w = crush.get_item_weight(o);
+    if (w <= 0)
+      continue;
+    double expected = (double)total * w / total_weight;
+    double u = per[o] / expected;
+    if (n == 0 || u < lo)
+      lo = u;
+    if (n == 0 || u > hi)
+      hi = u;
+    sum += u;
+    sum2 += u * u;
+    n++;
+  }
+  double avg = sum / n;
+  double var = sum2 / n - avg * avg;
+  if (var < 0)
+    var = 0;
+  out << n << " devices, utilization stddev " << sqrt(var)
+      << " min " << lo << " max " << hi;
+}
+
+int CrushTester::compare(CrushWrapper& other, int threads)
+{
+  if (min_rule < 0 || max_rule < 0) {
+    min_rule = 0;
+    max_rule = crush.get_max_rules() - 1;
+  }
+  if (min_x < 0 || max_x < 0) {
+    min_x = 0;
+    max_x = 1023;
+  }
+  if (threads < 1)
+    threads = 1;
+
+  // a device counts as up if either map has it
+  vector<__u32> weight;
+  int max_devices = max(crush.get_max_devices(), other.get_max_devices());
+  for (int o = 0; o < max_devices; o++) {
+    if (device_weight.count(o))
+      weight.push_back(device_weight[o]);
+    else if ((o < crush.get_max_devices() && crush.check_item_present(o)) ||
+	     (o < other.get_max_devices() && other.check_item_present(o)))
+      weight.push_back(0x10000);
+    else
+      weight.push_back(0);
+  }
+
+  bufferlist bl[2];
+  crush.encode(bl[0]);
+  other.encode(bl[1]);
+
+  int num_x = max_x - min_x + 1;
+  int ret = 0;
+  for (int r = min_rule; r < crush.get_max_rules() && r <= max_rule; r++) {
+    if (!crush.rule_exists(r))
+      continue;
+    if (!other.rule_exists(r)) {
+      err << "rule " << r << " (" << crush.get_rule_name(r)
+	  << ") does not exist in the other map" << std::endl;
+      ret = -ENOENT;
+      continue;
+    }
+    int nr = max_rep < 0 ? crush.get_rule_mask_max_size(r) : max_rep;
+
+    int n = min(threads, num_x);
+    vector<CrushCompareThread*> workers;
+    int first = min_x;
+    for (int i = 0; i < n; i++) {
+      int last = (i == n - 1) ? max_x : first + num_x / n - 1;
+      workers.push_back(new CrushCompareThread(bl[0], bl[1], r, nr,
+					       first, last, weight));
+      first = last + 1;
+    }
+    utime_t start = ceph_clock_now(NULL);
+    for (int i = 0; i < n; i++)
+      workers[i]->create();
+
+    vector<uint64_t> per[2];
+    per[0].resize(weight.size());
+    per[1].resize(weight.size());
+    uint64_t replicas = 0, moved = 0, inputs_changed = 0;
+    double elapsed[2] = { 0, 0 };
+    for (int i = 0; i < n; i++) {
+      CrushCompareThread *t = workers[i];
+      t->join();
+      for (int m = 0; m < 2; m++) {
+	for (unsigned o = 0; o < weight.size(); o++)
+	  per[m][o] += t->per[m][o];
+	elapsed[m] += t->elapsed[m];
+      }
+      replicas += t->replicas;
+      moved += t->moved;
+      inputs_changed += t->inputs_changed;
+      delete t;
+    }
+    double wall = (double)(ceph_clock_now(NULL) - start);
+
+    err << "rule " << r << " (" << crush.get_rule_name(r) << ") num_rep " << nr
+	<< ", x = " << min_x << ".." << max_x
+	<< ", " << n << " threads, " << wall << " s" << std::endl;
+    const char *names[2] = { "before", "after" };
+    CrushWrapper *maps[2] = { &crush, &other };
+    for (int m = 0; m < 2; m++) {
+      err << "  " << names[m] << ":\t"
+	  << (elapsed[m] * 1000000.0 / num_x) << " us/mapping, ";
+      dump_utilization(err, *maps[m], per[m]);
+      err << std::endl;
+    }
+    err << "  moved " << moved << "/" << replicas << " replicas ("
+	<< (replicas ? 100.0 * moved / replicas : 0) << "%), "
+	<< inputs_changed << "/" << num_x << " inputs changed" << std::endl;
+  }
+  return ret;
+}
@@ -255,6 +255,27 @@ public:
   }
 
   int test();
+
+  /**
+   * compare straw and straw2 buckets
+   *
+   * Map the inputs with the current map and with a copy in which
+   * every straw bucket is a straw2 bucket, then halve the weight of
+   * @item (the first device if < 0) in both and report the mapping
+   * time and the fraction of the mappings that moved.
+   */
+  int compare_straw2(CephContext *cct, int item=-1);
+
+  /**
+   * compare the mappings of this map with those of @other
+   *
+   * Map every input in the x range with both maps, split across
+   * @threads threads, and report for each rule the time per mapping,
+   * the per-device utilization (placements over the share its crush
+   * weight calls for) of each map and how much data moves between
+   * them.  Nothing is kept per input, so the range can be large.
+   */
+  int compare(CrushWrapper& other, int threads=1);
 };
 
 #endif
@@ -596,6 +596,11 @@ void CrushWrapper::encode(bufferlist& bl, bool lean) const
       }
       break;
 
+    case CRUSH_BUCKET_STRAW2:
+      for (unsigned j=0; j<crush->buckets[i]->size; j++)
+	::encode(((crush_bucket_straw2*)crush->buckets[i])->item_weights[j], bl);
+      break;
+
     default:
       assert(0);
       break;
@@ -734,6 +739,9 @@ void CrushWrapper::decode_crush_bucket(crush_bucket** bptr, bufferlist::iterator
   case CRUSH_BUCKET_STRAW:
     size = sizeof(crush_bucket_straw);
     break;
+  case CRUSH_BUCKET_STRAW2:
+    size = sizeof(crush_bucket_straw2);
+    break;
   default:
     {
       char str[128];
@@ -797,6 +805,14 @@ void CrushWrapper::decode_crush_bucket(crush_bucket** bptr, bufferlist::iterator
     break;
   }
 
+  case CRUSH_BUCKET_STRAW2: {
+    crush_bucket_straw2* cbs2 = (crush_bucket_straw2*)bucket;
+    cbs2->item_weights = (__u32*)calloc(1, bucket->size * sizeof(__u32));
+    for (unsigned j = 0; j < bucket->size; ++j)
+      ::decode(cbs2->item_weights[j], blp);
+    break;
+  }
+
   default:
     // We should have handled this case in the first switch statement
     assert(0);
@@ -157,6 +157,12 @@ public:
     return
       crush->chooseleaf_descend_once != 0;
   }
+  bool has_v2_buckets() const {
+    for (int i = 0; i < crush->max_buckets; i++)
+      if (crush->buckets[i] && crush->buckets[i]->alg == CRUSH_BUCKET_STRAW2)
+	return true;
+    return false;
+  }
 
   // bucket types
   int get_num_type_names() const {
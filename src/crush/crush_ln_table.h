@@ -0,0 +1,82 @@
+#ifndef CEPH_CRUSH_LN_H
+#define CEPH_CRUSH_LN_H
+
+/*
+ * __CRUSH_LN_TABLE[i] = 2^44 * log2(1 + i/256), for i = 0..256
+ *
+ * Used by crush_ln() in mapper.c to compute a fixed point log2 without
+ * any floating point, so that every client computes the exact same
+ * straw2 draws.
+ *
+ * LGPL2
+ */
+
+static const __s64 __CRUSH_LN_TABLE[257] = {
+	0x000000000000ll, 0x001709c46d7bll, 0x002dfca16ddell, 0x0044d8c45ea6ll,
+	0x005b9e5a170bll, 0x00724d8eea14ll, 0x0088e68ea89all, 0x009f6984a343ll,
+	0x00b5d69bac78ll, 0x00cc2dfe1a4bll, 0x00e26fd5c855ll, 0x00f89c4c1993ll,
+	0x010eb389fa2all, 0x0124b5b7e136ll, 0x013aa2fdd27fll, 0x01507b836034ll,
+	0x01663f6fac91ll, 0x017beee96b8all, 0x01918a16e463ll, 0x01a7111df348ll,
+	0x01bc84240adbll, 0x01d1e34e35b8ll, 0x01e72ec117fall, 0x01fc66a0f0b0ll,
+	0x02118b119b4fll, 0x02269c369121ll, 0x023b9a32eaa5ll, 0x0250852960f5ll,
+	0x02655d3c4f16ll, 0x027a228db351ll, 0x028ed53f307fll, 0x02a375720f4cll,
+	0x02b803473f7bll, 0x02cc7edf5922ll, 0x02e0e85a9de0ll, 0x02f53fd8fa0cll,
+	0x0309857a05e0ll, 0x031db95d06a5ll, 0x0331dba0efcell, 0x0345ec646417ll,
+	0x0359ebc5b69ell, 0x036dd9e2ebf3ll, 0x0381b6d9bb2all, 0x039582c78ee2ll,
+	0x03a93dc9864bll, 0x03bce7fc7629ll, 0x03d0817ce9cdll, 0x03e40a672412ll,
+	0x03f782d7204dll, 0x040aeae89342ll, 0x041e42b6ec0cll, 0x04318a5d550bll,
+	0x0444c1f6b4c3ll, 0x0457e99daec2ll, 0x046b016ca47cll, 0x047e097db624ll,
+	0x049101eac382ll, 0x04a3eacd6ccall, 0x04b6c43f1367ll, 0x04c98e58dacall,
+	0x04dc4933a933ll, 0x04eef4e82877ll, 0x0501918ec6c1ll, 0x05141f3fb754ll,
+	0x05269e12f347ll, 0x05390e203a3fll, 0x054b6f7f1326ll, 0x055dc246ccdell,
+	0x0570068e7ef6ll, 0x05823c6d0a52ll, 0x059463f919dfll, 0x05a67d492335ll,
+	0x05b888736743ll, 0x05ca858df2f0ll, 0x05dc74ae9fbfll, 0x05ee55eb146bll,
+	0x06002958c587ll, 0x0611ef0cf618ll, 0x0623a71cb82dll, 0x0635519ced71ll,
+	0x0646eea247c6ll, 0x06587e4149d0ll, 0x066a008e4789ll, 0x067b759d66c9ll,
+	0x068cdd829fd8ll, 0x069e3851bdf0ll, 0x06af861e5fc8ll, 0x06c0c6fbf819ll,
+	0x06d1fafdce21ll, 0x06e32236fe22ll, 0x06f43cba79e4ll, 0x07054a9b0933ll,
+	0x07164beb4a57ll, 0x072740bdb292ll, 0x073829248e96ll, 0x0749053202fdll,
+	0x0759d4f80cbbll, 0x076a98888194ll, 0x077b4ff5108ell, 0x078bfb4f425dll,
+	0x079c9aa879d5ll, 0x07ad2e11f457ll, 0x07bdb59cca39ll, 0x07ce3159ef31ll,
+	0x07dea15a32c2ll, 0x07ef05ae409all, 0x07ff5e66a100ll, 0x080fab93b932ll,
+	0x081fed45cbcdll, 0x0830238cf927ll, 0x08404e793fb8ll, 0x08506e1a7c71ll,
+	0x086082806b1dll, 0x08708bbaa6bell, 0x088089d8a9e4ll, 0x08907ce9cf0cll,
+	0x08a064fd50f3ll, 0x08b042224af0ll, 0x08c01467b94cll, 0x08cfdbdc7992ll,
+	0x08df988f4ae8ll, 0x08ef4a8ece5ell, 0x08fef1e98741ll, 0x090e8eaddb6bll,
+	0x091e20ea1394ll, 0x092da8ac5b9fll, 0x093d2602c2e6ll, 0x094c98fb3c8bll,
+	0x095c01a39fbdll, 0x096b6009a80all, 0x097ab43af5a0ll, 0x0989fe450d9bll,
+	0x09993e355a4ell, 0x09a874192b84ll, 0x09b79ffdb6c9ll, 0x09c6c1f017afll,
+	0x09d5d9fd5011ll, 0x09e4e8324857ll, 0x09f3ec9bcfb8ll, 0x0a02e7469c7all,
+	0x0a11d83f4c35ll, 0x0a20bf926411ll, 0x0a2f9d4c5104ll, 0x0a3e71796813ll,
+	0x0a4d3c25e68ell, 0x0a5bfd5df24cll, 0x0a6ab52d99e7ll, 0x0a7963a0d4fall,
+	0x0a8808c38454ll, 0x0a96a4a1723dll, 0x0aa5374652a2ll, 0x0ab3c0bdc358ll,
+	0x0ac241134c4fll, 0x0ad0b8525fc7ll, 0x0adf26865a8all, 0x0aed8bba8421ll,
+	0x0afbe7fa0f05ll, 0x0b0a3b5018d9ll, 0x0b1885c7aa98ll, 0x0b26c76bb8cell,
+	0x0b35004723c4ll, 0x0b433064b7b8ll, 0x0b5157cf2d08ll, 0x0b5f76912867ll,
+	0x0b6d8cb53b0dll, 0x0b7b9a45e2e3ll, 0x0b899f4d8ab6ll, 0x0b979bd68a63ll,
+	0x0ba58feb2704ll, 0x0bb37b95931fll, 0x0bc15edfeed3ll, 0x0bcf39d44803ll,
+	0x0bdd0c7c9a81ll, 0x0bead6e2d03cll, 0x0bf89910c168ll, 0x0c06531034a7ll,
+	0x0c1404eadf38ll, 0x0c21aeaa651cll, 0x0c2f5058593ell, 0x0c3ce9fe3d9ell,
+	0x0c4a7ba58378ll, 0x0c5805578b6all, 0x0c65871da59ell, 0x0c73010111ebll,
+	0x0c80730b0001ll, 0x0c8ddd448f8cll, 0x0c9b3fb6d056ll, 0x0ca89a6ac271ll,
+	0x0cb5ed69565bll, 0x0cc338bb6d1cll, 0x0cd07c69d870ll, 0x0cddb87d5ae7ll,
+	0x0ceaecfea808ll, 0x0cf819f66475ll, 0x0d053f6d2609ll, 0x0d125d6b73fell,
+	0x0d1f73f9c70cll, 0x0d2c8320898bll, 0x0d398ae81790ll, 0x0d468b58bf14ll,
+	0x0d53847ac00all, 0x0d6076564c8all, 0x0d6d60f388e4ll, 0x0d7a445a8bc9ll,
+	0x0d8720935e64ll, 0x0d93f5a5fc78ll, 0x0da0c39a5480ll, 0x0dad8a7847cbll,
+	0x0dba4a47aa99ll, 0x0dc70310443all, 0x0dd3b4d9cf25ll, 0x0de05fabf91bll,
+	0x0ded038e633fll, 0x0df9a088a232ll, 0x0e0636a23e2fll, 0x0e12c5e2b324ll,
+	0x0e1f4e5170d0ll, 0x0e2bcff5dadbll, 0x0e384ad748f1ll, 0x0e44befd06dbll,
+	0x0e512c6e549all, 0x0e5d9332667ell, 0x0e69f3506545ll, 0x0e764ccf6e29ll,
+	0x0e829fb69304ll, 0x0e8eec0cda62ll, 0x0e9b31d93f99ll, 0x0ea77122b2e3ll,
+	0x0eb3a9f01975ll, 0x0ebfdc484d95ll, 0x0ecc08321eb3ll, 0x0ed82db4517ell,
+	0x0ee44cd59ffbll, 0x0ef0659cb99cll, 0x0efc78104358ll, 0x0f088436d7ball,
+	0x0f148a170701ll, 0x0f2089b7572bll, 0x0f2c831e4411ll, 0x0f3876523f7cll,
+	0x0f446359b135ll, 0x0f504a3af71ell, 0x0f5c2afc6544ll, 0x0f6805a445f6ll,
+	0x0f73da38d9d5ll, 0x0f7fa8c057eall, 0x0f8b7140edbbll, 0x0f9733c0bf5cll,
+	0x0fa2f045e783ll, 0x0faea6d6779bll, 0x0fba577877d8ll, 0x0fc60231e746ll,
+	0x0fd1a708bbe1ll, 0x0fdd4602e2a2ll, 0x0fe8df263f95ll, 0x0ff47278ade9ll,
+	0x100000000000ll,
+};
+
+#endif
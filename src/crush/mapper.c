@@ -20,6 +20,11 @@
 
 #include "crush.h"
 #include "hash.h"
+#include "crush_ln_table.h"
+
+#ifndef S64_MIN
+# define S64_MIN ((__s64)(-0x7fffffffffffffffll - 1))
+#endif
 
 /*
  * Implement the core CRUSH mapping algorithm.
@@ -236,6 +241,65 @@ static int bucket_straw_choose(struct crush_bucket_straw *bucket,
 	return bucket->h.items[high];
 }
 
+/* straw2 */
+
+/*
+ * crush_ln - 2^44 * log2(x + 1), for x in [0, 0xffff]
+ *
+ * Normalize x + 1 to a 16 bit fraction, look up log2 of its top 8
+ * bits and interpolate linearly over the low 8 bits.  Integer only, so
+ * the result is the same everywhere.
+ */
+static __s64 crush_ln(unsigned int xin)
+{
+	unsigned int x = xin + 1;
+	int bits = 0;
+	unsigned int frac, idx, lo;
+	__s64 a, b;
+
+	while ((x >> bits) > 1)
+		bits++;
+	frac = (x << (16 - bits)) - 0x10000;  /* 16 bit fraction */
+	idx = frac >> 8;
+	lo = frac & 0xff;
+	a = __CRUSH_LN_TABLE[idx];
+	b = __CRUSH_LN_TABLE[idx + 1];
+	return ((__s64)bits << 44) + a + (((b - a) * lo) >> 8);
+}
+
+/*
+ * Each item draws ln(u) / weight for a uniform u in (0, 1] and the
+ * largest draw wins.  Draws are independent of the other items, so
+ * changing one item's weight only moves inputs to or from that item.
+ */
+static int bucket_straw2_choose(struct crush_bucket_straw2 *bucket,
+				int x, int r)
+{
+	__u32 i;
+	int high = 0;
+	__s64 high_draw = 0;
+	__s64 draw, ln;
+	__u32 u;
+
+	for (i = 0; i < bucket->h.size; i++) {
+		if (bucket->item_weights[i]) {
+			u = crush_hash32_3(bucket->h.hash, x,
+					   bucket->h.items[i], r);
+			u &= 0xffff;
+			/* ln(u) is in [-2^48, 0] */
+			ln = crush_ln(u) - 0x1000000000000ll;
+			draw = ln / bucket->item_weights[i];
+		} else {
+			draw = S64_MIN;
+		}
+		if (i == 0 || draw > high_draw) {
+			high = i;
+			high_draw = draw;
+		}
+	}
+	return bucket->h.items[high];
+}
+
 static int crush_bucket_choose(struct crush_bucket *in, int x, int r)
 {
 	dprintk(" crush_bucket_choose %d x=%d r=%d\n", in->id, x, r);
@@ -253,6 +317,9 @@ static int crush_bucket_choose(struct crush_bucket *in, int x, int r)
 	case CRUSH_BUCKET_STRAW:
 		return bucket_straw_choose((struct crush_bucket_straw *)in,
 					   x, r);
+	case CRUSH_BUCKET_STRAW2:
+		return bucket_straw2_choose((struct crush_bucket_straw2 *)in,
+					    x, r);
 	default:
 		dprintk("unknown bucket %d alg %d\n", in->id, in->alg);
 		return in->items[0];
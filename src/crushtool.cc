@@ -87,7 +87,7 @@ void usage()
   cout << "                         specify output for for (de)compilation\n";
   cout << "   --build --num_osds N layer1 ...\n";
   cout << "                         build a new map, where each 'layer' is\n";
-  cout << "                           'name (uniform|straw|list|tree) size'\n";
+  cout << "                           'name (uniform|straw|straw2|list|tree) size'\n";
   cout << "   -i mapfn --test       test a range of inputs on the map\n";
   cout << "      [--min-x x] [--max-x x] [--x x]\n";
   cout << "      [--min-rule r] [--max-rule r] [--rule r]\n";
@@ -110,6 +110,14 @@ void usage()
   cout << "                         reweight a given item (and adjust ancestor\n"
        << "                         weights as needed)\n";
   cout << "   -i mapfn --reweight   recalculate all bucket weights\n";
+  cout << "   -i mapfn --compare othermapfn [--threads n]\n";
+  cout << "                         map the test range with both maps and report\n";
+  cout << "                         time per mapping, device utilization and the\n";
+  cout << "                         fraction of data that moves between them\n";
+  cout << "   -i mapfn --compare-straw2 [--compare-item devno]\n";
+  cout << "                         compare mapping time and data movement on\n";
+  cout << "                         reweight of the map's straw buckets with\n";
+  cout << "                         straw2 buckets\n";
   cout << "   --show-utilization    show OSD usage\n";
   cout << "   --show utilization-all\n";
   cout << "                         include zero weight items\n";
@@ -141,6 +149,7 @@ struct bucket_types_t {
   { "uniform", CRUSH_BUCKET_UNIFORM },
   { "list", CRUSH_BUCKET_LIST },
   { "straw", CRUSH_BUCKET_STRAW },
+  { "straw2", CRUSH_BUCKET_STRAW2 },
   { "tree", CRUSH_BUCKET_TREE },
   { 0, 0 },
 };
@@ -161,6 +170,10 @@ int main(int argc, const char **argv)
   bool compile = false;
   bool decompile = false;
   bool test = false;
+  bool compare_straw2 = false;
+  int compare_item = -1;
+  std::string comparefn;
+  int threads = 1;
   bool display = false;
   bool write_to_file = false;
   int verbose = 0;
@@ -234,6 +247,22 @@ int main(int argc, const char **argv)
       compile = true;
     } else if (ceph_argparse_flag(args, i, "-t", "--test", (char*)NULL)) {
       test = true;
+    } else if (ceph_argparse_witharg(args, i, &val, "--compare", (char*)NULL)) {
+      comparefn = val;
+    } else if (ceph_argparse_withint(args, i, &threads, &err,
+				     "--threads", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << err.str() << std::endl;
+	exit(EXIT_FAILURE);
+      }
+    } else if (ceph_argparse_flag(args, i, "--compare-straw2", (char*)NULL)) {
+      compare_straw2 = true;
+    } else if (ceph_argparse_withint(args, i, &compare_item, &err,
+				     "--compare-item", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << err.str() << std::endl;
+	exit(EXIT_FAILURE);
+      }
     } else if (ceph_argparse_flag(args, i, "-s", "--simulate", (char*)NULL)) {
       tester.set_random_placement();
     } else if (ceph_argparse_flag(args, i, "--enable-unsafe-tunables", (char*)NULL)) {
@@ -418,6 +447,7 @@ int main(int argc, const char **argv)
     exit(EXIT_FAILURE);
   }
   if (!compile && !decompile && !build && !test && !reweight && !adjust &&
+      !compare_straw2 && comparefn.empty() &&
       add_item < 0 &&
       remove_name.empty() && reweight_name.empty()) {
     cout << "no action specified; -h for help" << std::endl;
@@ -720,5 +750,28 @@ int main(int argc, const char **argv)
       exit(1);
   }
 
+  if (!comparefn.empty()) {
+    CrushWrapper other;
+    bufferlist bl;
+    std::string error;
+    int r = bl.read_file(comparefn.c_str(), &error);
+    if (r < 0) {
+      cerr << me << ": error reading '" << comparefn << "': "
+	   << error << std::endl;
+      exit(1);
+    }
+    bufferlist::iterator p = bl.begin();
+    other.decode(p);
+    r = tester.compare(other, threads);
+    if (r < 0)
+      exit(1);
+  }
+
+  if (compare_straw2) {
+    int r = tester.compare_straw2(g_ceph_context, compare_item);
+    if (r < 0)
+      exit(1);
+  }
+
   return 0;
 }
@@ -36,6 +36,9 @@
 #define CEPH_FEATURE_MDSENC         (1<<29)
 #define CEPH_FEATURE_OSDHASHPSPOOL  (1<<30)
 #define CEPH_FEATURE_MON_SINGLE_PAXOS (1<<31)
+#define CEPH_FEATURE_CRUSH_V2       (1ULL<<32)  /* straw2 buckets */
+#define CEPH_FEATURE_RESERVATION_PRIO (1ULL<<33)  /* preemptible reservations */
+#define CEPH_FEATURE_OSD_CACHEPOOL  (1ULL<<34)  /* cache tiers, overlays */
 
 /*
  * Features supported.  Should be everything above.
@@ -72,7 +75,10 @@
 	 CEPH_FEATURE_OSD_HBMSGS |		\
 	 CEPH_FEATURE_MDSENC |			\
 	 CEPH_FEATURE_OSDHASHPSPOOL |       \
-	 CEPH_FEATURE_MON_SINGLE_PAXOS)
+	 CEPH_FEATURE_MON_SINGLE_PAXOS |    \
+	 CEPH_FEATURE_CRUSH_V2 |	    \
+	 CEPH_FEATURE_RESERVATION_PRIO |    \
+	 CEPH_FEATURE_OSD_CACHEPOOL)
 
 #define CEPH_FEATURES_SUPPORTED_DEFAULT  CEPH_FEATURES_ALL
 
@@ -81,6 +87,7 @@
  */
 #define CEPH_FEATURES_CRUSH			\
 	(CEPH_FEATURE_CRUSH_TUNABLES |		\
-	 CEPH_FEATURE_CRUSH_TUNABLES2)
+	 CEPH_FEATURE_CRUSH_TUNABLES2 |		\
+	 CEPH_FEATURE_CRUSH_V2)
 
 #endif
@@ -26,6 +26,7 @@ const char *ceph_osd_op_name(int op)
 	case CEPH_OSD_OP_NOTIFY_ACK: return "notify-ack";
 	case CEPH_OSD_OP_ASSERT_VER: return "assert-version";
 	case CEPH_OSD_OP_LIST_WATCHERS: return "list-watchers";
+	case CEPH_OSD_OP_LIST_SNAPS: return "list-snaps";
 
 	case CEPH_OSD_OP_MASKTRUNC: return "masktrunc";
 
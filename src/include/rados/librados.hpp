@@ -12,6 +12,7 @@
 #include "buffer.h"
 
 #include "librados.h"
+#include "rados_types.hpp"
 
 namespace librados
 {
@@ -115,6 +116,18 @@ namespace librados
     OP_FAILOK = 2,
   };
 
+  /*
+   * flags for a whole read: by default reads go to the primary; with
+   * these they may be served by another replica in the acting set.  a
+   * replica that can't safely serve the read sends the client back to
+   * the primary.
+   */
+  enum ObjectOperationGlobalFlags {
+    OPERATION_NOFLAG         = 0,
+    OPERATION_BALANCE_READS  = 1,  // any replica, picked at random
+    OPERATION_LOCALIZE_READS = 2,  // the closest replica (conf crush_location)
+  };
+
   /*
    * ObjectOperation : compount object operation
    * Batch multiple object operations into a single request, to be applied
@@ -334,6 +347,16 @@ namespace librados
      */
     void list_watchers(std::list<obj_watch_t> *out_watchers, int *prval);
 
+    /**
+     * list_snaps: Get the clones of an object and the extents they share
+     *
+     * The IoCtx must be reading from SNAP_DIR.
+     *
+     * @param out_snaps [out] place returned clones in out_snaps on completion
+     * @param prval [out] place error code in prval upon completion
+     */
+    void list_snaps(snap_set_t *out_snaps, int *prval);
+
   };
 
   /* IoCtx : This is a context in which we can perform I/O.
@@ -499,6 +522,8 @@ namespace librados
     int aio_operate(const std::string& oid, AioCompletion *c, ObjectWriteOperation *op);
     int aio_operate(const std::string& oid, AioCompletion *c, ObjectReadOperation *op,
 		    bufferlist *pbl);
+    int aio_operate(const std::string& oid, AioCompletion *c, ObjectReadOperation *op,
+		    int flags, bufferlist *pbl);
 
     // watch/notify
     int watch(const std::string& o, uint64_t ver, uint64_t *handle,
@@ -506,8 +531,13 @@ namespace librados
     int unwatch(const std::string& o, uint64_t handle);
     int notify(const std::string& o, uint64_t ver, bufferlist& bl);
     int list_watchers(const std::string& o, std::list<obj_watch_t> *out_watchers);
+    /// list the clones of an object; the IoCtx must read from SNAP_DIR
+    int list_snaps(const std::string& o, snap_set_t *out_snaps);
     void set_notify_timeout(uint32_t timeout);
 
+    // ObjectOperationGlobalFlags applied to every read on this IoCtx
+    void set_read_flags(int flags);
+
     // assert version for next sync operations
     void set_assert_version(uint64_t ver);
     void set_assert_src_version(const std::string& o, uint64_t ver);
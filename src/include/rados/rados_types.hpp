@@ -0,0 +1,45 @@
+#ifndef CEPH_RADOS_TYPES_HPP
+#define CEPH_RADOS_TYPES_HPP
+
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+namespace librados {
+
+typedef uint64_t snap_t;
+
+/// clone id of the head in a snap_set_t
+const snap_t SNAP_HEAD = (uint64_t)(-2);
+/// snapshot to read from to list the snapshots of an object
+const snap_t SNAP_DIR = (uint64_t)(-1);
+
+/**
+ * @struct clone_info_t
+ * One clone (or the head) of an object, from list_snaps
+ */
+struct clone_info_t {
+  snap_t cloneid;                                      ///< SNAP_HEAD for the head
+  std::vector<snap_t> snaps;                           ///< ascending
+  std::vector<std::pair<uint64_t, uint64_t> > overlap; ///< offset, length
+  uint64_t size;
+
+  clone_info_t() : cloneid(0), size(0) {}
+};
+
+/**
+ * @struct snap_set_t
+ * The clones of an object, from list_snaps
+ *
+ * The overlap of a clone is the set of extents that did not change
+ * between it and the next newer clone (or the head).
+ */
+struct snap_set_t {
+  std::vector<clone_info_t> clones;                    ///< ascending, head last
+  snap_t seq;                                          ///< newest snapid seen
+
+  snap_set_t() : seq(0) {}
+};
+
+}
+#endif
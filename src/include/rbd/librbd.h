@@ -184,6 +184,37 @@ int rbd_snap_set(rbd_image_t image, const char *snapname);
 
 int rbd_flatten(rbd_image_t image);
 
+/**
+ * Recreate the object map of an image from the objects that exist.
+ *
+ * The map is rebuilt for the snapshot the image is set to, or for
+ * the image itself if no snapshot is set.  The image should not be
+ * written to by anyone else meanwhile.
+ *
+ * @param image which image to rebuild the object map of
+ * @param cb called with progress as objects are checked
+ * @param cbdata passed to cb
+ * @returns 0 on success, -EINVAL if the image has no object map,
+ * other negative error code on failure
+ */
+int rbd_rebuild_object_map(rbd_image_t image,
+			   librbd_progress_fn_t cb, void *cbdata);
+
+/**
+ * Compare the object map of an image with the objects that exist.
+ *
+ * @param image which image (and implicitly snapshot) to check
+ * @param cb called with progress as objects are checked
+ * @param cbdata passed to cb
+ * @param missing set to the number of existing objects the map lacks
+ * @param stale set to the number of objects in the map that don't exist
+ * @returns 0 on success, -EINVAL if the image has no object map,
+ * other negative error code on failure
+ */
+int rbd_check_object_map(rbd_image_t image,
+			 librbd_progress_fn_t cb, void *cbdata,
+			 uint64_t *missing, uint64_t *stale);
+
 /**
  * List all images that are cloned from the image at the
  * snapshot that is set via rbd_snap_set().
@@ -310,8 +341,38 @@ int rbd_break_lock(rbd_image_t image, const char *client, const char *cookie);
 typedef void *rbd_completion_t;
 typedef void (*rbd_callback_t)(rbd_completion_t cb, void *arg);
 ssize_t rbd_read(rbd_image_t image, uint64_t ofs, size_t len, char *buf);
+/**
+ * iterate over the contents of part of an image
+ *
+ * The callback gets the offset (relative to ofs), length and data of
+ * each successive piece, in order.  Holes are passed with a NULL data
+ * pointer and read as zeros.  A negative return value from the
+ * callback stops the iteration and is returned.
+ *
+ * @returns number of bytes read, or negative error code
+ */
 int64_t rbd_read_iterate(rbd_image_t image, uint64_t ofs, size_t len,
 			 int (*cb)(uint64_t, size_t, const char *, void *), void *arg);
+/**
+ * iterate over the extents of an image that changed since a snapshot
+ *
+ * The callback gets the image offset and length of each changed
+ * extent, and whether it holds data (1) or was discarded or truncated
+ * away (0).  Extents are passed in order, but may be split or only
+ * approximately as small as the writes that changed them.  Without a
+ * fromsnapname every allocated extent is reported, including the
+ * ones still inherited from a parent.  A negative return value from
+ * the callback stops the iteration and is returned.
+ *
+ * The end of the range is the snapshot the image is opened at, or its
+ * current contents.
+ *
+ * @param fromsnapname start snapshot (inclusive), or NULL
+ * @returns 0 on success, or negative error code
+ */
+int rbd_diff_iterate(rbd_image_t image, const char *fromsnapname,
+		     uint64_t ofs, uint64_t len,
+		     int (*cb)(uint64_t, size_t, int, void *), void *arg);
 ssize_t rbd_write(rbd_image_t image, uint64_t ofs, size_t len, const char *buf);
 int rbd_discard(rbd_image_t image, uint64_t ofs, uint64_t len);
 int rbd_aio_write(rbd_image_t image, uint64_t off, size_t len, const char *buf, rbd_completion_t c);
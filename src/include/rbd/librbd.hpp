@@ -125,6 +125,11 @@ public:
 
   int flatten();
   int flatten_with_progress(ProgressContext &prog_ctx);
+
+  /* object map */
+  int rebuild_object_map(ProgressContext &prog_ctx);
+  int check_object_map(ProgressContext &prog_ctx,
+		       uint64_t *missing, uint64_t *stale);
   /**
    * Returns a pair of poolname, imagename for each clone
    * of this image at the currently set snapshot.
@@ -154,6 +159,9 @@ public:
   ssize_t read(uint64_t ofs, size_t len, ceph::bufferlist& bl);
   int64_t read_iterate(uint64_t ofs, size_t len,
 		       int (*cb)(uint64_t, size_t, const char *, void *), void *arg);
+  /* see rbd_diff_iterate */
+  int diff_iterate(const char *fromsnapname, uint64_t ofs, uint64_t len,
+		   int (*cb)(uint64_t, size_t, int, void *), void *arg);
   ssize_t write(uint64_t ofs, size_t len, ceph::bufferlist& bl);
   int discard(uint64_t ofs, uint64_t len);
 
@@ -27,11 +27,16 @@
  *   rbd_data.<id>.00000000
  *   rbd_data.<id>.00000001
  *   ...                     - data
+ *   rbd_object_map.<id>     - which data objects exist, if the image
+ *                             has the object map feature
+ *   rbd_object_map.<id>.<snapid>
+ *                           - the same, as of a snapshot
  */
 
 #define RBD_HEADER_PREFIX      "rbd_header."
 #define RBD_DATA_PREFIX        "rbd_data."
 #define RBD_ID_PREFIX          "rbd_id."
+#define RBD_OBJECT_MAP_PREFIX  "rbd_object_map."
 
 /*
  * old-style rbd image 'foo' consists of objects
@@ -61,6 +66,7 @@
  */
 #define RBD_CHILDREN		"rbd_children"
 #define RBD_LOCK_NAME		"rbd_lock"
+#define RBD_PERSISTENT_CACHE_LOCK_NAME	"rbd_persistent_cache"
 
 #define RBD_DEFAULT_OBJ_ORDER	22   /* 4MB */
 
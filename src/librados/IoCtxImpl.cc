@@ -27,6 +27,7 @@
 
 librados::IoCtxImpl::IoCtxImpl() :
   ref_cnt(0), client(NULL), poolid(0), assert_ver(0), notify_timeout(30),
+  extra_read_flags(0),
   aio_write_list_lock("librados::IoCtxImpl::aio_write_list_lock"),
   aio_write_seq(0), lock(NULL), objecter(NULL)
 {
@@ -37,7 +38,7 @@ librados::IoCtxImpl::IoCtxImpl(RadosClient *c, Objecter *objecter,
 			       const char *pool_name, snapid_t s)
   : ref_cnt(0), client(c), poolid(poolid), pool_name(pool_name), snap_seq(s),
     assert_ver(0), notify_timeout(c->cct->_conf->client_notify_timeout),
-    oloc(poolid),
+    extra_read_flags(0), oloc(poolid),
     aio_write_list_lock("librados::IoCtxImpl::aio_write_list_lock"),
     aio_write_seq(0), lock(client_lock), objecter(objecter)
 {
@@ -643,7 +644,7 @@ int librados::IoCtxImpl::operate_read(const object_t& oid,
 
   lock->Lock();
   objecter->read(oid, oloc,
-	           *o, snap_seq, pbl, 0,
+	           *o, snap_seq, pbl, extra_read_flags,
 	           onack, &ver);
   lock->Unlock();
 
@@ -659,7 +660,8 @@ int librados::IoCtxImpl::operate_read(const object_t& oid,
 
 int librados::IoCtxImpl::aio_operate_read(const object_t &oid,
 					  ::ObjectOperation *o,
-					  AioCompletionImpl *c, bufferlist *pbl)
+					  AioCompletionImpl *c, int flags,
+					  bufferlist *pbl)
 {
   Context *onack = new C_aio_Ack(c);
 
@@ -667,9 +669,8 @@ int librados::IoCtxImpl::aio_operate_read(const object_t &oid,
   c->io = this;
   c->pbl = pbl;
 
-  Mutex::Locker l(*lock);
   objecter->read(oid, oloc,
-		 *o, snap_seq, pbl, 0,
+		 *o, snap_seq, pbl, flags | extra_read_flags,
 		 onack, &c->objver);
   return 0;
 }
@@ -688,7 +689,6 @@ int librados::IoCtxImpl::aio_operate(const object_t& oid,
   c->io = this;
   queue_aio_write(c);
 
-  Mutex::Locker l(*lock);
   objecter->mutate(oid, oloc, *o, snapc, ut, 0, onack, oncommit, &c->objver);
 
   return 0;
@@ -707,9 +707,8 @@ int librados::IoCtxImpl::aio_read(const object_t oid, AioCompletionImpl *c,
   c->io = this;
   c->pbl = pbl;
 
-  Mutex::Locker l(*lock);
   objecter->read(oid, oloc,
-		 off, len, snap_seq, &c->bl, 0,
+		 off, len, snap_seq, &c->bl, extra_read_flags,
 		 onack, &c->objver);
   return 0;
 }
@@ -727,9 +726,8 @@ int librados::IoCtxImpl::aio_read(const object_t oid, AioCompletionImpl *c,
   c->buf = buf;
   c->maxlen = len;
 
-  Mutex::Locker l(*lock);
   objecter->read(oid, oloc,
-		 off, len, snap_seq, &c->bl, 0,
+		 off, len, snap_seq, &c->bl, extra_read_flags,
 		 onack, &c->objver);
 
   return 0;
@@ -750,9 +748,8 @@ int librados::IoCtxImpl::aio_sparse_read(const object_t oid,
   c->io = this;
   c->pbl = NULL;
 
-  Mutex::Locker l(*lock);
   objecter->sparse_read(oid, oloc,
-		 off, len, snap_seq, &c->bl, 0,
+		 off, len, snap_seq, &c->bl, extra_read_flags,
 		 onack);
   return 0;
 }
@@ -774,7 +771,6 @@ int librados::IoCtxImpl::aio_write(const object_t &oid, AioCompletionImpl *c,
   Context *onack = new C_aio_Ack(c);
   Context *onsafe = new C_aio_Safe(c);
 
-  Mutex::Locker l(*lock);
   objecter->write(oid, oloc,
 		  off, len, snapc, bl, ut, 0,
 		  onack, onsafe, &c->objver);
@@ -797,7 +793,6 @@ int librados::IoCtxImpl::aio_append(const object_t &oid, AioCompletionImpl *c,
   Context *onack = new C_aio_Ack(c);
   Context *onsafe = new C_aio_Safe(c);
 
-  Mutex::Locker l(*lock);
   objecter->append(oid, oloc,
 		   len, snapc, bl, ut, 0,
 		   onack, onsafe, &c->objver);
@@ -821,7 +816,6 @@ int librados::IoCtxImpl::aio_write_full(const object_t &oid,
   Context *onack = new C_aio_Ack(c);
   Context *onsafe = new C_aio_Safe(c);
 
-  Mutex::Locker l(*lock);
   objecter->write_full(oid, oloc,
 		       snapc, bl, ut, 0,
 		       onack, onsafe, &c->objver);
@@ -843,7 +837,6 @@ int librados::IoCtxImpl::aio_remove(const object_t &oid, AioCompletionImpl *c)
   Context *onack = new C_aio_Ack(c);
   Context *onsafe = new C_aio_Safe(c);
 
-  Mutex::Locker l(*lock);
   objecter->remove(oid, oloc,
 		   snapc, ut, 0,
 		   onack, onsafe, &c->objver);
@@ -858,9 +851,8 @@ int librados::IoCtxImpl::aio_stat(const object_t& oid, AioCompletionImpl *c,
   c->io = this;
   C_aio_stat_Ack *onack = new C_aio_stat_Ack(c, pmtime);
 
-  Mutex::Locker l(*lock);
   objecter->stat(oid, oloc,
-		 snap_seq, psize, &onack->mtime, 0,
+		 snap_seq, psize, &onack->mtime, extra_read_flags,
 		 onack, &c->objver);
 
   return 0;
@@ -1023,7 +1015,7 @@ int librados::IoCtxImpl::tmap_get(const object_t& oid, bufferlist& bl)
   ::ObjectOperation rd;
   prepare_assert_ops(&rd);
   rd.tmap_get(&bl, NULL);
-  objecter->read(oid, oloc, rd, snap_seq, 0, 0, onack, &ver);
+  objecter->read(oid, oloc, rd, snap_seq, 0, extra_read_flags, onack, &ver);
   lock->Unlock();
 
   mylock.Lock();
@@ -1075,7 +1067,6 @@ int librados::IoCtxImpl::aio_exec(const object_t& oid, AioCompletionImpl *c,
   c->is_read = true;
   c->io = this;
 
-  Mutex::Locker l(*lock);
   ::ObjectOperation rd;
   prepare_assert_ops(&rd);
   rd.call(cls, method, inbl);
@@ -1103,7 +1094,7 @@ int librados::IoCtxImpl::read(const object_t& oid,
 
   lock->Lock();
   objecter->read(oid, oloc,
-		 off, len, snap_seq, &bl, 0,
+		 off, len, snap_seq, &bl, extra_read_flags,
 		 onack, &ver, pop);
   lock->Unlock();
 
@@ -1140,7 +1131,7 @@ int librados::IoCtxImpl::mapext(const object_t& oid,
 
   lock->Lock();
   objecter->mapext(oid, oloc,
-		   off, len, snap_seq, &bl, 0,
+		   off, len, snap_seq, &bl, extra_read_flags,
 		   onack);
   lock->Unlock();
 
@@ -1177,7 +1168,7 @@ int librados::IoCtxImpl::sparse_read(const object_t& oid,
 
   lock->Lock();
   objecter->sparse_read(oid, oloc,
-			off, len, snap_seq, &bl, 0,
+			off, len, snap_seq, &bl, extra_read_flags,
 			onack);
   lock->Unlock();
 
@@ -1216,7 +1207,7 @@ int librados::IoCtxImpl::stat(const object_t& oid, uint64_t *psize, time_t *pmti
 
   lock->Lock();
   objecter->stat(oid, oloc,
-		 snap_seq, psize, &mtime, 0,
+		 snap_seq, psize, &mtime, extra_read_flags,
 		 onack, &ver, pop);
   lock->Unlock();
 
@@ -1250,7 +1241,7 @@ int librados::IoCtxImpl::getxattr(const object_t& oid,
 
   lock->Lock();
   objecter->getxattr(oid, oloc,
-		     name, snap_seq, &bl, 0,
+		     name, snap_seq, &bl, extra_read_flags,
 		     onack, &ver, pop);
   lock->Unlock();
 
@@ -1546,6 +1537,11 @@ void librados::IoCtxImpl::set_notify_timeout(uint32_t timeout)
   notify_timeout = timeout;
 }
 
+void librados::IoCtxImpl::set_read_flags(int flags)
+{
+  extra_read_flags = flags;
+}
+
 ///////////////////////////// C_aio_Ack ////////////////////////////////
 
 librados::IoCtxImpl::C_aio_Ack::C_aio_Ack(AioCompletionImpl *_c) : c(_c)
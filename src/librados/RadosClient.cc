@@ -277,6 +277,13 @@ int librados::RadosClient::create_ioctx(const char *name, IoCtxImpl **io)
 
 bool librados::RadosClient::ms_dispatch(Message *m)
 {
+  // the objecter does its own locking for op replies; keep them off
+  // our lock so completions from many OSDs don't serialize on it
+  if (m->get_type() == CEPH_MSG_OSD_OPREPLY) {
+    objecter->handle_osd_op_reply(static_cast<MOSDOpReply*>(m));
+    return true;
+  }
+
   Mutex::Locker l(lock);
   bool ret;
 
@@ -314,9 +321,6 @@ bool librados::RadosClient::_dispatch(Message *m)
 {
   switch (m->get_type()) {
   // OSD
-  case CEPH_MSG_OSD_OPREPLY:
-    objecter->handle_osd_op_reply(static_cast<MOSDOpReply*>(m));
-    break;
   case CEPH_MSG_OSD_MAP:
     objecter->handle_osd_map(static_cast<MOSDMap*>(m));
     cond.Signal();
@@ -0,0 +1,25 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef __CEPH_OSDC_SNAP_SET_DIFF_H
+#define __CEPH_OSDC_SNAP_SET_DIFF_H
+
+class CephContext;
+#include "include/rados/rados_types.hpp"
+#include "include/interval_set.h"
+
+/**
+ * compute the extents of an object that changed between two snapshots
+ *
+ * @param snap_set clones of the object, from list_snaps
+ * @param start older snapshot (0 for the beginning of time)
+ * @param end newer snapshot (SNAP_HEAD for the head)
+ * @param diff [out] object extents that differ between start and end
+ * @param end_exists [out] whether the object exists as of end
+ */
+void calc_snap_set_diff(CephContext *cct,
+			const librados::snap_set_t& snap_set,
+			librados::snap_t start, librados::snap_t end,
+			interval_set<uint64_t> *diff, bool *end_exists);
+
+#endif
@@ -34,7 +34,9 @@ namespace librbd {
   {
     ldout(cct, 20) << "AioCompletion::finalize() " << (void*)this << " rval " << rval << " read_buf " << (void*)read_buf
 		   << " read_bl " << (void*)read_bl << dendl;
-    if (rval >= 0 && aio_type == AIO_TYPE_READ) {
+    if (rval >= 0 && aio_type == AIO_TYPE_READ && read_extents) {
+      destriper.assemble_result(cct, read_extents);
+    } else if (rval >= 0 && aio_type == AIO_TYPE_READ) {
       // FIXME: make the destriper write directly into a buffer so
       // that we avoid shuffling pointers and copying zeros around.
       bufferlist bl;
@@ -59,6 +59,7 @@ namespace librbd {
     bufferlist *read_bl;
     char *read_buf;
     size_t read_buf_len;
+    map<uint64_t, bufferlist> *read_extents;  ///< sparse result; holes omitted
 
     AioCompletion() : lock("AioCompletion::lock", true),
 		      done(false), rval(0), complete_cb(NULL),
@@ -66,7 +67,8 @@ namespace librbd {
 		      pending_count(0), building(true),
 		      ref(1), released(false), ictx(NULL),
 		      aio_type(AIO_TYPE_NONE),
-		      read_bl(NULL), read_buf(NULL), read_buf_len(0) {
+		      read_bl(NULL), read_buf(NULL), read_buf_len(0),
+		      read_extents(NULL) {
     }
     ~AioCompletion() {
     }
@@ -5,8 +5,12 @@
 #include "common/dout.h"
 #include "common/Mutex.h"
 #include "common/RWLock.h"
+#include "common/errno.h"
+#include "common/perf_counters.h"
+#include "cls/rbd/cls_rbd_client.h"
 
 #include "librbd/AioCompletion.h"
+#include "librbd/CopyupRequest.h"
 #include "librbd/ImageCtx.h"
 #include "librbd/internal.h"
 
@@ -85,17 +89,89 @@ namespace librbd {
       uint64_t object_overlap = m_ictx->prune_parent_extents(image_extents, image_overlap);
       if (object_overlap) {
 	m_tried_parent = true;
+	if (should_copy_on_read()) {
+	  // read the whole object, so it can be copied into the child
+	  image_extents.clear();
+	  Striper::extent_to_file(m_ictx->cct, &m_ictx->layout, m_object_no,
+				  0, m_ictx->layout.fl_object_size,
+				  image_extents);
+	  m_ictx->prune_parent_extents(image_extents, image_overlap);
+	  m_copy_on_read = true;
+	}
 	read_from_parent(image_extents);
 	return false;
       }
     }
 
+    if (m_copy_on_read) {
+      m_copy_on_read = false;
+      if (r >= 0) {
+	copy_on_read();
+      } else {
+	m_ictx->finish_copyup(m_object_no);
+      }
+    }
+
     return true;
   }
 
+  bool AioRead::should_copy_on_read()
+  {
+    if (!m_ictx->cct->_conf->rbd_clone_copy_on_read ||
+	m_snap_id != CEPH_NOSNAP || m_ictx->read_only)
+      return false;
+    return m_ictx->start_copyup(m_object_no);
+  }
+
+  /// releases a copy-on-read slot once its copyup is done
+  struct C_FinishCopyup : public Context {
+    ImageCtx *ictx;
+    uint64_t object_no;
+    C_FinishCopyup(ImageCtx *i, uint64_t o) : ictx(i), object_no(o) {}
+    virtual void finish(int r) {
+      ictx->finish_copyup(object_no);
+    }
+  };
+
+  void AioRead::copy_on_read()
+  {
+    // m_read_data holds the object from its start; hand the part that
+    // was asked for to the reader and the rest to the copyup
+    bufferlist object_data;
+    object_data.claim(m_read_data);
+    if (m_object_off < object_data.length()) {
+      uint64_t len = MIN(m_object_len, object_data.length() - m_object_off);
+      m_read_data.substr_of(object_data, m_object_off, len);
+    }
+
+    // like flatten, don't allocate an object that is all zeros
+    if (object_data.is_zero()) {
+      ldout(m_ictx->cct, 20) << "copy_on_read " << this << " " << m_oid
+			     << " is zero, not copying" << dendl;
+      m_ictx->finish_copyup(m_object_no);
+      return;
+    }
+
+    m_ictx->perfcounter->inc(l_librbd_copyup_on_read);
+    m_ictx->perfcounter->inc(l_librbd_copyup_on_read_bytes,
+			     object_data.length());
+    CopyupRequest *req = new CopyupRequest(m_ictx, m_oid, m_object_no,
+					   object_data,
+					   new C_FinishCopyup(m_ictx,
+							      m_object_no));
+    req->send();
+  }
+
   int AioRead::send() {
     ldout(m_ictx->cct, 20) << "send " << this << " " << m_oid << " " << m_object_off << "~" << m_object_len << dendl;
 
+    if (!m_ictx->object_may_exist(m_object_no)) {
+      ldout(m_ictx->cct, 20) << "send " << this << " object does not exist"
+			     << dendl;
+      complete(-ENOENT);
+      return 0;
+    }
+
     librados::AioCompletion *rados_completion =
       librados::Rados::aio_create_completion(this, rados_req_cb, NULL);
     int r;
@@ -114,6 +190,7 @@ namespace librbd {
 
   AbstractWrite::AbstractWrite()
     : m_state(LIBRBD_AIO_WRITE_FLAT),
+      m_object_map_pending(false),
       m_parent_overlap(0) {}
   AbstractWrite::AbstractWrite(ImageCtx *ictx, const std::string &oid,
 			       uint64_t object_no, uint64_t object_off, uint64_t len,
@@ -123,7 +200,8 @@ namespace librbd {
 			       Context *completion,
 			       bool hide_enoent)
     : AioRequest(ictx, oid, object_no, object_off, len, snap_id, completion, hide_enoent),
-      m_state(LIBRBD_AIO_WRITE_FLAT)
+      m_state(LIBRBD_AIO_WRITE_FLAT),
+      m_object_map_pending(false)
   {
     m_object_image_extents = objectx;
     m_parent_overlap = object_overlap;
@@ -151,6 +229,20 @@ namespace librbd {
     ldout(m_ictx->cct, 20) << "write " << this << " " << m_oid << " " << m_object_off << "~" << m_object_len
 			   << " should_complete: r = " << r << dendl;
 
+    if (m_object_map_pending) {
+      m_object_map_pending = false;
+      if (r < 0) {
+	lderr(m_ictx->cct) << "error updating object map for " << m_oid
+			   << ": " << cpp_strerror(r) << dendl;
+	return true;
+      }
+      m_ictx->set_object_map(m_object_no, m_object_no + 1, true);
+      r = send_write();
+      if (r < 0)
+	return should_complete(r);
+      return false;
+    }
+
     bool finished = true;
     switch (m_state) {
     case LIBRBD_AIO_WRITE_GUARD:
@@ -231,6 +323,24 @@ namespace librbd {
 
   int AbstractWrite::send() {
     ldout(m_ictx->cct, 20) << "send " << this << " " << m_oid << " " << m_object_off << "~" << m_object_len << dendl;
+    if (m_ictx->object_map_enabled() && !removes_object() &&
+	!m_ictx->object_map_marked(m_object_no)) {
+      ldout(m_ictx->cct, 20) << "send " << this << " marking object "
+			     << m_object_no << " as existing" << dendl;
+      librados::ObjectWriteOperation op;
+      cls_client::object_map_update(&op, m_object_no, m_object_no + 1, true);
+      m_object_map_pending = true;
+      librados::AioCompletion *rados_completion =
+	librados::Rados::aio_create_completion(this, NULL, rados_req_cb);
+      int r = m_ictx->md_ctx.aio_operate(
+	m_ictx->object_map_name(CEPH_NOSNAP), rados_completion, &op);
+      rados_completion->release();
+      return r;
+    }
+    return send_write();
+  }
+
+  int AbstractWrite::send_write() {
     librados::AioCompletion *rados_completion =
       librados::Rados::aio_create_completion(this, NULL, rados_req_cb);
     int r;
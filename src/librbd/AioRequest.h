@@ -68,7 +68,7 @@ namespace librbd {
 	    Context *completion)
       : AioRequest(ictx, oid, objectno, offset, len, snap_id, completion, false),
 	m_buffer_extents(be),
-	m_tried_parent(false), m_sparse(sparse) {
+	m_tried_parent(false), m_sparse(sparse), m_copy_on_read(false) {
       m_ioctx.snap_set_read(m_snap_id);
     }
     virtual ~AioRead() {}
@@ -83,9 +83,13 @@ namespace librbd {
     friend class C_AioRead;
 
   private:
+    bool should_copy_on_read();
+    void copy_on_read();
+
     vector<pair<uint64_t,uint64_t> > m_buffer_extents;
     bool m_tried_parent;
     bool m_sparse;
+    bool m_copy_on_read;  ///< reading the whole object from the parent
   };
 
   class AbstractWrite : public AioRequest {
@@ -107,6 +111,12 @@ namespace librbd {
       return !m_object_image_extents.empty();
     }
 
+    /// true if this request leaves no object behind, so need not mark
+    /// it in the object map
+    virtual bool removes_object() const {
+      return false;
+    }
+
   private:
     /**
      * Writes go through the following state machine to deal with
@@ -123,6 +133,11 @@ namespace librbd {
      *
      * Writes start in LIBRBD_AIO_WRITE_GUARD or _FLAT, depending on whether
      * there is a parent or not.
+     *
+     * If the image has an object map and the object is not marked as
+     * existing in it, the map is updated first, and the write is only
+     * sent once that update is on disk.  Unless we hold the exclusive
+     * lock, our copy of the map may be stale, so every write updates it.
      */
     enum write_state_d {
       LIBRBD_AIO_WRITE_GUARD,
@@ -134,12 +149,14 @@ namespace librbd {
     virtual void add_copyup_ops() = 0;
 
     write_state_d m_state;
+    bool m_object_map_pending;
     vector<pair<uint64_t,uint64_t> > m_object_image_extents;
     uint64_t m_parent_overlap;
     librados::ObjectWriteOperation m_write;
     librados::ObjectWriteOperation m_copyup;
 
   private:
+    int send_write();
     void send_copyup();
   };
 
@@ -190,6 +207,10 @@ namespace librbd {
     }
     virtual ~AioRemove() {}
 
+    virtual bool removes_object() const {
+      return !has_parent();
+    }
+
   protected:
     virtual void add_copyup_ops() {
       // removing an object never needs to copyup
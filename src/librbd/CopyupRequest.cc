@@ -0,0 +1,100 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "common/ceph_context.h"
+#include "common/dout.h"
+#include "common/errno.h"
+#include "include/Context.h"
+#include "cls/rbd/cls_rbd_client.h"
+
+#include "librbd/ImageCtx.h"
+#include "librbd/internal.h"
+
+#include "librbd/CopyupRequest.h"
+
+#define dout_subsys ceph_subsys_rbd
+#undef dout_prefix
+#define dout_prefix *_dout << "librbd::CopyupRequest: "
+
+namespace librbd {
+
+  CopyupRequest::CopyupRequest(ImageCtx *ictx, const std::string &oid,
+			       uint64_t objectno, ceph::bufferlist &data,
+			       Context *on_finish)
+    : m_ictx(ictx), m_oid(oid), m_object_no(objectno),
+      m_object_map_pending(false), m_on_finish(on_finish)
+  {
+    m_data.claim(data);
+  }
+
+  void CopyupRequest::rados_cb(librados::completion_t c, void *arg)
+  {
+    CopyupRequest *req = reinterpret_cast<CopyupRequest *>(arg);
+    req->complete(rados_aio_get_return_value(c));
+  }
+
+  void CopyupRequest::send()
+  {
+    ldout(m_ictx->cct, 20) << "send " << this << " " << m_oid << " "
+			   << m_data.length() << " bytes" << dendl;
+
+    int r;
+    if (m_ictx->object_map_enabled() &&
+	!m_ictx->object_map_marked(m_object_no)) {
+      // the object must never exist without being in the map
+      librados::ObjectWriteOperation op;
+      cls_client::object_map_update(&op, m_object_no, m_object_no + 1, true);
+      m_object_map_pending = true;
+      librados::AioCompletion *rados_completion =
+	librados::Rados::aio_create_completion(this, NULL, rados_cb);
+      r = m_ictx->md_ctx.aio_operate(m_ictx->object_map_name(CEPH_NOSNAP),
+				     rados_completion, &op);
+      rados_completion->release();
+    } else {
+      r = send_copyup();
+    }
+    if (r < 0)
+      complete(r);
+  }
+
+  int CopyupRequest::send_copyup()
+  {
+    librados::IoCtx ioctx;
+    ioctx.dup(m_ictx->data_ctx);
+    {
+      RWLock::RLocker l(m_ictx->snap_lock);
+      std::vector<librados::snap_t> snaps;
+      for (std::vector<snapid_t>::const_iterator it =
+	     m_ictx->snapc.snaps.begin();
+	   it != m_ictx->snapc.snaps.end(); ++it)
+	snaps.push_back(it->val);
+      ioctx.selfmanaged_snap_set_write_ctx(m_ictx->snapc.seq.val, snaps);
+    }
+
+    librados::ObjectWriteOperation op;
+    op.exec("rbd", "copyup", m_data);
+    librados::AioCompletion *rados_completion =
+      librados::Rados::aio_create_completion(this, NULL, rados_cb);
+    int r = ioctx.aio_operate(m_oid, rados_completion, &op);
+    rados_completion->release();
+    return r;
+  }
+
+  void CopyupRequest::complete(int r)
+  {
+    ldout(m_ictx->cct, 20) << "complete " << this << " " << m_oid
+			   << " r = " << r << dendl;
+    if (m_object_map_pending && r >= 0) {
+      m_object_map_pending = false;
+      m_ictx->set_object_map(m_object_no, m_object_no + 1, true);
+      r = send_copyup();
+      if (r >= 0)
+	return;
+    }
+    if (r < 0)
+      lderr(m_ictx->cct) << "error copying up " << m_oid << ": "
+			 << cpp_strerror(r) << dendl;
+    m_on_finish->complete(r);
+    delete this;
+  }
+}
@@ -0,0 +1,46 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#ifndef CEPH_LIBRBD_COPYUPREQUEST_H
+#define CEPH_LIBRBD_COPYUPREQUEST_H
+
+#include "include/buffer.h"
+#include "include/rados/librados.hpp"
+
+class Context;
+
+namespace librbd {
+
+  class ImageCtx;
+
+  /**
+   * Copy the data a clone inherits for one object from its parent
+   * into the clone, in the background.  Used by copy-on-read and
+   * flatten, which have already read the data from the parent.
+   *
+   * If the object already exists by the time the copyup reaches it,
+   * e.g. because it was written meanwhile, the copyup does nothing.
+   * The request deletes itself when done, after completing
+   * @on_finish with the result.
+   */
+  class CopyupRequest {
+  public:
+    CopyupRequest(ImageCtx *ictx, const std::string &oid, uint64_t objectno,
+		  ceph::bufferlist &data, Context *on_finish);
+    void send();
+
+  private:
+    static void rados_cb(librados::completion_t c, void *arg);
+    void complete(int r);
+    int send_copyup();
+
+    ImageCtx *m_ictx;
+    std::string m_oid;
+    uint64_t m_object_no;
+    ceph::bufferlist m_data;
+    bool m_object_map_pending;
+    Context *m_on_finish;
+  };
+
+}
+
+#endif
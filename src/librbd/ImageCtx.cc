@@ -6,6 +6,7 @@
 #include "common/dout.h"
 #include "common/errno.h"
 #include "common/perf_counters.h"
+#include "include/stringify.h"
 
 #include "librbd/internal.h"
 #include "librbd/WatchCtx.h"
@@ -44,12 +45,17 @@ namespace librbd {
       snap_lock("librbd::ImageCtx::snap_lock"),
       parent_lock("librbd::ImageCtx::parent_lock"),
       refresh_lock("librbd::ImageCtx::refresh_lock"),
+      object_map_lock("librbd::ImageCtx::object_map_lock"),
+      copyup_lock("librbd::ImageCtx::copyup_lock"),
       old_format(true),
       order(0), size(0), features(0),
       format_string(NULL),
       id(image_id), parent(NULL),
       stripe_unit(0), stripe_count(0),
-      object_cacher(NULL), writeback_handler(NULL), object_set(NULL)
+      object_map_trusted(false),
+      cache_budget(NULL),
+      write_log(NULL),
+      total_bytes_read(0)
   {
     md_ctx.dup(p);
     data_ctx.dup(p);
@@ -66,37 +72,58 @@ namespace librbd {
     }
     perf_start(pname);
 
-    if (cct->_conf->rbd_cache) {
-      Mutex::Locker l(cache_lock);
-      ldout(cct, 20) << "enabling writeback caching..." << dendl;
-      writeback_handler = new LibrbdWriteback(this, cache_lock);
-      object_cacher = new ObjectCacher(cct, pname, *writeback_handler, cache_lock,
-				       NULL, NULL,
-				       cct->_conf->rbd_cache_size,
-				       10,  /* reset this in init */
-				       cct->_conf->rbd_cache_max_dirty,
-				       cct->_conf->rbd_cache_target_dirty,
-				       cct->_conf->rbd_cache_max_dirty_age);
-      object_set = new ObjectCacher::ObjectSet(NULL, data_ctx.get_id(), 0);
-      object_set->return_enoent = true;
-      object_cacher->start();
+    // writable opens of the image head use the persistent cache instead
+    bool persistent_cache = cct->_conf->rbd_persistent_cache && !ro &&
+      snap_name.empty();
+    if (cct->_conf->rbd_cache && !persistent_cache) {
+      int shards = MAX(1, cct->_conf->rbd_cache_shards);
+      ldout(cct, 20) << "enabling writeback caching with " << shards
+		     << " shards..." << dendl;
+      if (shards > 1)
+	cache_budget = new ObjectCacher::Budget(cct);
+      for (int i = 0; i < shards; ++i) {
+	CacheShard *shard = new CacheShard;
+	string shard_name = pname;
+	if (shards > 1)
+	  shard_name += "-shard" + stringify(i);
+	shard->writeback_handler = new LibrbdWriteback(this, shard->lock);
+	shard->object_cacher =
+	  new ObjectCacher(cct, shard_name, *shard->writeback_handler,
+			   shard->lock, NULL, NULL,
+			   cct->_conf->rbd_cache_size,
+			   10,  /* reset this in init */
+			   cct->_conf->rbd_cache_max_dirty,
+			   cct->_conf->rbd_cache_target_dirty,
+			   cct->_conf->rbd_cache_max_dirty_age,
+			   cache_budget);
+	shard->object_cacher->set_write_around_bytes(
+	  cct->_conf->rbd_cache_write_around_bytes);
+	shard->object_set = new ObjectCacher::ObjectSet(NULL,
+							data_ctx.get_id(), 0);
+	shard->object_set->return_enoent = true;
+	shard->object_cacher->start();
+	cache_shards.push_back(shard);
+      }
+
+      readahead.set_trigger_requests(
+	cct->_conf->rbd_readahead_trigger_requests);
+      readahead.set_max_readahead_size(cct->_conf->rbd_readahead_max_bytes);
     }
   }
 
   ImageCtx::~ImageCtx() {
     perf_stop();
-    if (object_cacher) {
-      delete object_cacher;
-      object_cacher = NULL;
-    }
-    if (writeback_handler) {
-      delete writeback_handler;
-      writeback_handler = NULL;
-    }
-    if (object_set) {
-      delete object_set;
-      object_set = NULL;
+    for (vector<CacheShard*>::iterator p = cache_shards.begin();
+	 p != cache_shards.end();
+	 ++p) {
+      delete (*p)->object_cacher;
+      delete (*p)->writeback_handler;
+      delete (*p)->object_set;
+      delete *p;
     }
+    cache_shards.clear();
+    delete cache_budget;
+    cache_budget = NULL;
     delete[] format_string;
   }
 
@@ -169,11 +196,16 @@ namespace librbd {
     }
 
     // size object cache appropriately
-    if (object_cacher) {
+    if (!cache_shards.empty()) {
       uint64_t obj = cct->_conf->rbd_cache_size / (1ull << order);
       ldout(cct, 10) << " cache bytes " << cct->_conf->rbd_cache_size << " order " << (int)order
 		     << " -> about " << obj << " objects" << dendl;
-      object_cacher->set_max_objects(obj * 4 + 10);
+      for (vector<CacheShard*>::iterator p = cache_shards.begin();
+	   p != cache_shards.end();
+	   ++p)
+	(*p)->object_cacher->set_max_objects(obj * 4 / cache_shards.size() +
+					     10);
+      readahead.set_alignment(get_stripe_period());
     }
 
     ldout(cct, 10) << "init_layout stripe_unit " << stripe_unit
@@ -211,6 +243,21 @@ namespace librbd {
     plb.add_u64_counter(l_librbd_snap_rollback, "snap_rollback");
     plb.add_u64_counter(l_librbd_notify, "notify");
     plb.add_u64_counter(l_librbd_resize, "resize");
+    plb.add_u64_counter(l_librbd_readahead, "readahead");
+    plb.add_u64_counter(l_librbd_readahead_bytes, "readahead_bytes");
+    plb.add_u64_counter(l_librbd_readahead_hit_bytes, "readahead_hit_bytes");
+    plb.add_u64_counter(l_librbd_copyup_on_read, "copyup_on_read");
+    plb.add_u64_counter(l_librbd_copyup_on_read_bytes, "copyup_on_read_bytes");
+    plb.add_u64_counter(l_librbd_copyup_on_read_throttled,
+			"copyup_on_read_throttled");
+    plb.add_u64_counter(l_librbd_pcache_wr, "pcache_wr");
+    plb.add_u64_counter(l_librbd_pcache_wr_bytes, "pcache_wr_bytes");
+    plb.add_time_avg(l_librbd_pcache_wr_latency, "pcache_wr_latency");
+    plb.add_u64_counter(l_librbd_pcache_rd_hit_bytes, "pcache_rd_hit_bytes");
+    plb.add_u64_counter(l_librbd_pcache_writeback, "pcache_writeback");
+    plb.add_u64_counter(l_librbd_pcache_writeback_bytes,
+			"pcache_writeback_bytes");
+    plb.add_u64_counter(l_librbd_pcache_full, "pcache_full");
 
     perfcounter = plb.create_perf_counters();
     cct->get_perfcounters_collection()->add(perfcounter);
@@ -309,9 +356,14 @@ namespace librbd {
   }
 
   uint64_t ImageCtx::get_num_objects() const
+  {
+    return get_num_objects(size);
+  }
+
+  uint64_t ImageCtx::get_num_objects(uint64_t in_size) const
   {
     uint64_t period = get_stripe_period();
-    uint64_t num_periods = (size + period - 1) / period;
+    uint64_t num_periods = (in_size + period - 1) / period;
     return num_periods * stripe_count;
   }
 
@@ -442,46 +494,51 @@ namespace librbd {
     return 0;
   }
 
-  void ImageCtx::aio_read_from_cache(object_t o, bufferlist *bl, size_t len,
+  void ImageCtx::aio_read_from_cache(object_t o, uint64_t object_no,
+				     bufferlist *bl, size_t len,
 				     uint64_t off, Context *onfinish) {
+    CacheShard *shard = get_cache_shard(object_no);
     snap_lock.get_read();
-    ObjectCacher::OSDRead *rd = object_cacher->prepare_read(snap_id, bl, 0);
+    ObjectCacher::OSDRead *rd = shard->object_cacher->prepare_read(snap_id, bl,
+								   0);
     snap_lock.put_read();
-    ObjectExtent extent(o, 0 /* a lie */, off, len);
+    ObjectExtent extent(o, object_no, off, len);
     extent.oloc.pool = data_ctx.get_id();
     extent.buffer_extents.push_back(make_pair(0, len));
     rd->extents.push_back(extent);
-    cache_lock.Lock();
-    int r = object_cacher->readx(rd, object_set, onfinish);
-    cache_lock.Unlock();
+    shard->lock.Lock();
+    int r = shard->object_cacher->readx(rd, shard->object_set, onfinish);
+    shard->lock.Unlock();
     if (r != 0)
       onfinish->complete(r);
   }
 
-  void ImageCtx::write_to_cache(object_t o, bufferlist& bl, size_t len,
-				uint64_t off) {
+  void ImageCtx::write_to_cache(object_t o, uint64_t object_no,
+				bufferlist& bl, size_t len, uint64_t off) {
+    CacheShard *shard = get_cache_shard(object_no);
     snap_lock.get_read();
-    ObjectCacher::OSDWrite *wr = object_cacher->prepare_write(snapc, bl,
-							      utime_t(), 0);
+    ObjectCacher::OSDWrite *wr = shard->object_cacher->prepare_write(snapc, bl,
+								     utime_t(),
+								     0);
     snap_lock.put_read();
-    ObjectExtent extent(o, 0, off, len);
+    ObjectExtent extent(o, object_no, off, len);
     extent.oloc.pool = data_ctx.get_id();
     extent.buffer_extents.push_back(make_pair(0, len));
     wr->extents.push_back(extent);
     {
-      Mutex::Locker l(cache_lock);
-      object_cacher->writex(wr, object_set, cache_lock);
+      Mutex::Locker l(shard->lock);
+      shard->object_cacher->writex(wr, shard->object_set, shard->lock);
     }
   }
 
-  int ImageCtx::read_from_cache(object_t o, bufferlist *bl, size_t len,
-				uint64_t off) {
+  int ImageCtx::read_from_cache(object_t o, uint64_t object_no,
+				bufferlist *bl, size_t len, uint64_t off) {
     int r;
     Mutex mylock("librbd::ImageCtx::read_from_cache");
     Cond cond;
     bool done;
     Context *onfinish = new C_SafeCond(&mylock, &cond, &done, &r);
-    aio_read_from_cache(o, bl, len, off, onfinish);
+    aio_read_from_cache(o, object_no, bl, len, off, onfinish);
     mylock.Lock();
     while (!done)
       cond.Wait(mylock);
@@ -489,15 +546,41 @@ namespace librbd {
     return r;
   }
 
+  void ImageCtx::discard_from_cache(const vector<ObjectExtent>& extents) {
+    vector<vector<ObjectExtent> > shard_extents(cache_shards.size());
+    for (vector<ObjectExtent>::const_iterator p = extents.begin();
+	 p != extents.end();
+	 ++p)
+      shard_extents[p->objectno % cache_shards.size()].push_back(*p);
+    for (size_t i = 0; i < cache_shards.size(); ++i) {
+      if (shard_extents[i].empty())
+	continue;
+      Mutex::Locker l(cache_shards[i]->lock);
+      cache_shards[i]->object_cacher->discard_set(cache_shards[i]->object_set,
+						  shard_extents[i]);
+    }
+  }
+
   int ImageCtx::flush_cache() {
     int r = 0;
     Mutex mylock("librbd::ImageCtx::flush_cache");
     Cond cond;
     bool done;
     Context *onfinish = new C_SafeCond(&mylock, &cond, &done, &r);
-    cache_lock.Lock();
-    bool already_flushed = object_cacher->flush_set(object_set, onfinish);
-    cache_lock.Unlock();
+    C_GatherBuilder gather(cct, onfinish);
+    bool already_flushed = true;
+    for (vector<CacheShard*>::iterator p = cache_shards.begin();
+	 p != cache_shards.end();
+	 ++p) {
+      Mutex::Locker l((*p)->lock);
+      // flush_set() deletes its context if the set is empty
+      if ((*p)->object_set->objects.empty())
+	continue;
+      Context *ctx = gather.new_sub();
+      if (!(*p)->object_cacher->flush_set((*p)->object_set, ctx))
+	already_flushed = false;
+    }
+    gather.activate();
     if (!already_flushed) {
       mylock.Lock();
       while (!done) {
@@ -514,21 +597,32 @@ namespace librbd {
     md_lock.get_write();
     invalidate_cache();
     md_lock.put_write();
-    object_cacher->stop();
+    for (vector<CacheShard*>::iterator p = cache_shards.begin();
+	 p != cache_shards.end();
+	 ++p)
+      (*p)->object_cacher->stop();
   }
 
   void ImageCtx::invalidate_cache() {
-    if (!object_cacher)
+    if (cache_shards.empty())
       return;
-    cache_lock.Lock();
-    object_cacher->release_set(object_set);
-    cache_lock.Unlock();
+    for (vector<CacheShard*>::iterator p = cache_shards.begin();
+	 p != cache_shards.end();
+	 ++p) {
+      Mutex::Locker l((*p)->lock);
+      (*p)->object_cacher->release_set((*p)->object_set);
+    }
     int r = flush_cache();
     if (r)
       lderr(cct) << "flush_cache returned " << r << dendl;
-    cache_lock.Lock();
-    bool unclean = object_cacher->release_set(object_set);
-    cache_lock.Unlock();
+    bool unclean = false;
+    for (vector<CacheShard*>::iterator p = cache_shards.begin();
+	 p != cache_shards.end();
+	 ++p) {
+      Mutex::Locker l((*p)->lock);
+      if ((*p)->object_cacher->release_set((*p)->object_set))
+	unclean = true;
+    }
     if (unclean)
       lderr(cct) << "could not release all objects from cache" << dendl;
   }
@@ -584,4 +678,147 @@ namespace librbd {
 		   << " from image extents " << objectx << dendl;
     return len;
  }
+
+  bool ImageCtx::object_map_enabled() const
+  {
+    return !old_format && (features & RBD_FEATURE_OBJECT_MAP);
+  }
+
+  string ImageCtx::object_map_name(snap_t in_snap_id) const
+  {
+    string oid(RBD_OBJECT_MAP_PREFIX + id);
+    if (in_snap_id != CEPH_NOSNAP) {
+      char buf[32];
+      snprintf(buf, sizeof(buf), ".%016llx", (unsigned long long)in_snap_id);
+      oid += buf;
+    }
+    return oid;
+  }
+
+  int ImageCtx::refresh_object_map()
+  {
+    snap_t map_snap_id;
+    uint64_t num_objects;
+    bool enabled;
+    bool locked = false;
+    {
+      RWLock::RLocker l(snap_lock);
+      map_snap_id = snap_id;
+      num_objects = get_num_objects(get_image_size(snap_id));
+      enabled = object_map_enabled();
+      if (exclusive_locked) {
+	entity_name_t me =
+	  entity_name_t::CLIENT(librados::Rados(md_ctx).get_instance_id());
+	map<rados::cls::lock::locker_id_t,
+	    rados::cls::lock::locker_info_t>::const_iterator p;
+	for (p = lockers.begin(); p != lockers.end(); ++p)
+	  if (p->first.locker == me)
+	    locked = true;
+      }
+    }
+
+    vector<bool> new_map;
+    if (enabled) {
+      string oid = object_map_name(map_snap_id);
+      int r = cls_client::object_map_load(&md_ctx, oid, &new_map);
+      if (r == -ENOENT && map_snap_id == CEPH_NOSNAP && !read_only) {
+	// nothing can be trusted; start over assuming every object exists
+	lderr(cct) << "object map " << oid << " is missing, recreating it; "
+		   << "run 'rbd object-map rebuild' to regain its benefits"
+		   << dendl;
+	r = cls_client::object_map_resize(&md_ctx, oid, num_objects, true);
+	if (r < 0) {
+	  lderr(cct) << "error creating object map " << oid << ": "
+		     << cpp_strerror(r) << dendl;
+	  return r;
+	}
+	new_map.assign(num_objects, true);
+      } else if (r == -ENOENT) {
+	// e.g. a snapshot taken before the feature was enabled
+	ldout(cct, 5) << "no object map " << oid << dendl;
+	new_map.clear();
+      } else if (r < 0) {
+	lderr(cct) << "error loading object map " << oid << ": "
+		   << cpp_strerror(r) << dendl;
+	return r;
+      }
+    }
+
+    ldout(cct, 20) << "refresh_object_map snap " << map_snap_id
+		   << " locked " << locked << dendl;
+    Mutex::Locker l(object_map_lock);
+    object_map.swap(new_map);
+    object_map_trusted = (map_snap_id != CEPH_NOSNAP || locked);
+    return 0;
+  }
+
+  void ImageCtx::untrust_object_map()
+  {
+    Mutex::Locker l(object_map_lock);
+    object_map_trusted = false;
+  }
+
+  bool ImageCtx::object_may_exist(uint64_t object_no)
+  {
+    Mutex::Locker l(object_map_lock);
+    if (!object_map_trusted || object_no >= object_map.size())
+      return true;
+    return object_map[object_no];
+  }
+
+  bool ImageCtx::object_map_marked(uint64_t object_no)
+  {
+    // without the lock another client may have cleared the bit since
+    // we loaded it, so only an update of the on-disk map is safe
+    Mutex::Locker l(object_map_lock);
+    if (!object_map_trusted)
+      return false;
+    if (object_no >= object_map.size())
+      return true;
+    return object_map[object_no];
+  }
+
+  void ImageCtx::set_object_map(uint64_t start, uint64_t end, bool exists)
+  {
+    Mutex::Locker l(object_map_lock);
+    if (end > object_map.size())
+      end = object_map.size();
+    for (uint64_t i = start; i < end; ++i)
+      object_map[i] = exists;
+  }
+
+  void ImageCtx::resize_object_map(uint64_t num_objects)
+  {
+    Mutex::Locker l(object_map_lock);
+    if (!object_map.empty())
+      object_map.resize(num_objects, false);
+  }
+
+  bool ImageCtx::start_copyup(uint64_t object_no)
+  {
+    Mutex::Locker l(copyup_lock);
+    if (copyup_in_flight.count(object_no))
+      return false;
+    if ((int)copyup_in_flight.size() >= cct->_conf->rbd_copy_on_read_max_ops) {
+      perfcounter->inc(l_librbd_copyup_on_read_throttled);
+      return false;
+    }
+    copyup_in_flight.insert(object_no);
+    return true;
+  }
+
+  void ImageCtx::finish_copyup(uint64_t object_no)
+  {
+    Mutex::Locker l(copyup_lock);
+    copyup_in_flight.erase(object_no);
+    if (copyup_in_flight.empty())
+      copyup_cond.Signal();
+  }
+
+  void ImageCtx::wait_for_copyups()
+  {
+    Mutex::Locker l(copyup_lock);
+    while (!copyup_in_flight.empty())
+      copyup_cond.Wait(copyup_lock);
+  }
 }
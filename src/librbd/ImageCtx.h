@@ -10,7 +10,9 @@
 #include <string>
 #include <vector>
 
+#include "common/Cond.h"
 #include "common/Mutex.h"
+#include "common/Readahead.h"
 #include "common/RWLock.h"
 #include "common/snap_types.h"
 #include "include/buffer.h"
@@ -30,6 +32,7 @@ class PerfCounters;
 namespace librbd {
 
   class WatchCtx;
+  class WriteLog;
 
   struct ImageCtx {
     CephContext *cct;
@@ -58,15 +61,19 @@ namespace librbd {
 
     /**
      * Lock ordering:
-     * md_lock, cache_lock, snap_lock, parent_lock, refresh_lock
+     * md_lock, cache_lock (or a CacheShard::lock), snap_lock,
+     * parent_lock, refresh_lock, object_map_lock, copyup_lock
      */
     RWLock md_lock; // protects access to the mutable image metadata that
                    // isn't guarded by other locks below
                    // (size, features, image locks, etc)
-    Mutex cache_lock; // used as client_lock for the ObjectCacher
+    Mutex cache_lock; // protects total_bytes_read
     RWLock snap_lock; // protects snapshot-related member variables:
     RWLock parent_lock; // protects parent_md and parent
     Mutex refresh_lock; // protects refresh_seq and last_refresh
+    Mutex object_map_lock; // protects object_map, object_map_trusted
+    Mutex copyup_lock; // protects copyup_in_flight
+    Cond copyup_cond;
 
     bool old_format;
     uint8_t order;
@@ -82,9 +89,49 @@ namespace librbd {
 
     ceph_file_layout layout;
 
-    ObjectCacher *object_cacher;
-    LibrbdWriteback *writeback_handler;
-    ObjectCacher::ObjectSet *object_set;
+    /**
+     * which data objects may exist, as of snap_id, if the image has
+     * the object map feature.  The on-disk map is updated before an
+     * object is created, so it never misses an object that exists.
+     * Bits are only cleared by resize, rollback and rebuild, never by
+     * I/O.  Empty if unknown.
+     */
+    std::vector<bool> object_map;
+    /**
+     * whether object_map can be used to skip I/O: it is a snapshot's,
+     * or we held the exclusive image lock when it was loaded.  Anyone
+     * else's copy may miss objects other clients created since.
+     */
+    bool object_map_trusted;
+
+    /**
+     * part of the object cache
+     *
+     * Objects are spread over the shards by object number.  Each shard
+     * has its own lock, ObjectCacher and flusher, so I/O to objects in
+     * different shards doesn't serialize; the cache size and dirty
+     * limits apply to all of them together, through cache_budget.
+     */
+    struct CacheShard {
+      Mutex lock; // used as client_lock for the ObjectCacher
+      LibrbdWriteback *writeback_handler;
+      ObjectCacher *object_cacher;
+      ObjectCacher::ObjectSet *object_set;
+      CacheShard()
+	: lock("librbd::ImageCtx::CacheShard::lock"),
+	  writeback_handler(NULL), object_cacher(NULL), object_set(NULL) {}
+    };
+    std::vector<CacheShard*> cache_shards;  ///< empty if not caching
+    ObjectCacher::Budget *cache_budget;     ///< if more than one shard
+
+    /// persistent cache, in place of cache_shards; set up by open_image()
+    WriteLog *write_log;
+
+    /// objects being copied up from the parent in the background
+    std::set<uint64_t> copyup_in_flight;
+
+    Readahead readahead;  ///< into the object cacher, if any
+    uint64_t total_bytes_read;  ///< readahead stops after enough of these
 
     /**
      * Either image_name or image_id must be set.
@@ -110,6 +157,7 @@ namespace librbd {
     uint64_t get_object_size() const;
     string get_object_name(uint64_t num) const;
     uint64_t get_num_objects() const;
+    uint64_t get_num_objects(uint64_t in_size) const;
     uint64_t get_stripe_unit() const;
     uint64_t get_stripe_count() const;
     uint64_t get_stripe_period() const;
@@ -125,10 +173,16 @@ namespace librbd {
     uint64_t get_parent_snap_id(librados::snap_t in_snap_id) const;
     int get_parent_overlap(librados::snap_t in_snap_id,
 			   uint64_t *overlap) const;
-    void aio_read_from_cache(object_t o, bufferlist *bl, size_t len,
-			     uint64_t off, Context *onfinish);
-    void write_to_cache(object_t o, bufferlist& bl, size_t len, uint64_t off);
-    int read_from_cache(object_t o, bufferlist *bl, size_t len, uint64_t off);
+    CacheShard *get_cache_shard(uint64_t object_no) {
+      return cache_shards[object_no % cache_shards.size()];
+    }
+    void aio_read_from_cache(object_t o, uint64_t object_no, bufferlist *bl,
+			     size_t len, uint64_t off, Context *onfinish);
+    void write_to_cache(object_t o, uint64_t object_no, bufferlist& bl,
+			size_t len, uint64_t off);
+    int read_from_cache(object_t o, uint64_t object_no, bufferlist *bl,
+			size_t len, uint64_t off);
+    void discard_from_cache(const vector<ObjectExtent>& extents);
     int flush_cache();
     void shutdown_cache();
     void invalidate_cache();
@@ -139,6 +193,25 @@ namespace librbd {
     uint64_t prune_parent_extents(vector<pair<uint64_t,uint64_t> >& objectx,
 				  uint64_t overlap);
 
+    bool object_map_enabled() const;
+    std::string object_map_name(librados::snap_t in_snap_id) const;
+    int refresh_object_map();
+    void untrust_object_map();
+    bool object_may_exist(uint64_t object_no);
+    bool object_map_marked(uint64_t object_no);
+    void set_object_map(uint64_t start, uint64_t end, bool exists);
+    void resize_object_map(uint64_t num_objects);
+
+    /**
+     * reserve a background copyup of @object_no
+     *
+     * @return false if it is already being copied up, or too many
+     * copyups are in flight
+     */
+    bool start_copyup(uint64_t object_no);
+    void finish_copyup(uint64_t object_no);
+    void wait_for_copyups();
+
   };
 }
 
@@ -0,0 +1,868 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include "common/ceph_context.h"
+#include "common/dout.h"
+#include "common/errno.h"
+#include "common/perf_counters.h"
+#include "common/safe_io.h"
+#include "cls/lock/cls_lock_client.h"
+#include "include/Context.h"
+#include "include/encoding.h"
+#include "include/interval_set.h"
+#include "include/rbd_types.h"
+#include "include/stringify.h"
+#include "include/uuid.h"
+
+#include "librbd/ImageCtx.h"
+#include "librbd/internal.h"
+
+#include "librbd/WriteLog.h"
+
+#define dout_subsys ceph_subsys_rbd
+#undef dout_prefix
+#define dout_prefix *_dout << "librbd::WriteLog: "
+
+using std::make_pair;
+using std::map;
+using std::pair;
+using std::string;
+using std::vector;
+// list binds to librbd::list() here, so std::list is explicitly used below
+
+using ceph::bufferlist;
+
+namespace librbd {
+
+  /*
+   * The file starts with a header block holding the magic, the image,
+   * the current generation, where the oldest entry (the head) is and
+   * the owner's lock cookie.
+   * Entries follow it back to back, wrapping to the front of the file
+   * when one does not fit before the end: a fixed size header (magic,
+   * type, generation, sequence number, image extent, crc of the data,
+   * crc of the header) and, for writes, the data.
+   */
+  static const uint64_t HEADER_SIZE = 4096;
+  static const __u32 HEADER_MAGIC = 0x5242444c;  // "RBDL"
+  static const __u32 ENTRY_MAGIC = 0x52424445;   // "RBDE"
+  static const uint64_t ENTRY_HEADER_SIZE = 45;
+
+  struct WriteLog::C_Writeback : public Context {
+    WriteLog *log;
+    Entry *entry;
+    bufferlist data;
+    C_Writeback(WriteLog *l, Entry *e) : log(l), entry(e) {}
+    virtual void finish(int r) {
+      log->finish_writeback(entry, r);
+    }
+  };
+
+  WriteLog::WriteLog(ImageCtx *ictx)
+    : m_flusher_thread(this),
+      m_ictx(ictx),
+      m_cct(ictx->cct),
+      m_fd(-1),
+      m_lock("librbd::WriteLog::m_lock"),
+      m_generation(0),
+      m_next_seq(1),
+      m_append_pos(HEADER_SIZE),
+      m_head_pos(HEADER_SIZE),
+      m_header_head_pos(HEADER_SIZE),
+      m_in_flight(0),
+      m_writeback_seq(0),
+      m_space_wanted(false),
+      m_stopping(false),
+      m_error(0)
+  {
+    // old format images have no id
+    m_image_key = stringify(ictx->md_ctx.get_id()) + "." +
+      (ictx->id.empty() ? ictx->name : ictx->id);
+    m_path = m_cct->_conf->rbd_persistent_cache_path + "/" + m_image_key;
+    m_size = MAX((uint64_t)m_cct->_conf->rbd_persistent_cache_size,
+		 1ull << 20);
+    // big writes are split up so a single one never fills the log
+    m_max_entry_data = (m_size - HEADER_SIZE) / 4;
+  }
+
+  WriteLog::~WriteLog()
+  {
+    for (std::list<Entry*>::iterator p = m_entries.begin();
+	 p != m_entries.end();
+	 ++p)
+      delete *p;
+    if (m_fd >= 0)
+      ::close(m_fd);
+  }
+
+  int WriteLog::init()
+  {
+    ldout(m_cct, 5) << "init " << m_path << " size " << m_size << dendl;
+    int r = open_file();
+    if (r < 0)
+      return r;
+
+    Mutex::Locker l(m_lock);
+    r = load_entries();
+    if (r == 0) {
+      r = take_ownership();
+      // don't leave an empty log behind for a cache we can't use
+      if (r < 0 && m_entries.empty())
+	::unlink(m_path.c_str());
+    }
+    if (r < 0) {
+      ::close(m_fd);
+      m_fd = -1;
+      return r;
+    }
+    m_flusher_thread.create();
+    return 0;
+  }
+
+  int WriteLog::open_file()
+  {
+    m_fd = ::open(m_path.c_str(), O_RDWR | O_CREAT, 0600);
+    if (m_fd < 0) {
+      int r = -errno;
+      lderr(m_cct) << "unable to open " << m_path << ": " << cpp_strerror(r)
+		   << dendl;
+      return r;
+    }
+    // another user of the same image on this host has its own log
+    if (::flock(m_fd, LOCK_EX | LOCK_NB) < 0) {
+      int r = -errno;
+      lderr(m_cct) << "unable to lock " << m_path << ": " << cpp_strerror(r)
+		   << dendl;
+      ::close(m_fd);
+      m_fd = -1;
+      return r;
+    }
+    return 0;
+  }
+
+  /**
+   * lock the image for this log
+   *
+   * Entries left in the log are only ours to replay if the lock we
+   * held when we wrote them is still there; otherwise someone has
+   * broken it, and may have written to the image since.
+   */
+  int WriteLog::take_ownership()
+  {
+    assert(m_lock.is_locked());
+    map<rados::cls::lock::locker_id_t,
+	rados::cls::lock::locker_info_t> lockers;
+    ClsLockType lock_type;
+    string tag;
+    int r = rados::cls::lock::get_lock_info(&m_ictx->md_ctx,
+					    m_ictx->header_oid,
+					    RBD_PERSISTENT_CACHE_LOCK_NAME,
+					    &lockers, &lock_type, &tag);
+    if (r < 0 && r != -ENOENT) {
+      lderr(m_cct) << "error getting lock info: " << cpp_strerror(r)
+		   << dendl;
+      return r;
+    }
+
+    bool ours = false;
+    map<rados::cls::lock::locker_id_t,
+	rados::cls::lock::locker_info_t>::iterator p;
+    for (p = lockers.begin(); p != lockers.end(); ++p) {
+      if (m_owner.empty() || p->first.cookie != m_owner)
+	continue;
+      // held by the client that wrote the log, which is gone now
+      ldout(m_cct, 10) << "taking over lock " << m_owner << " from "
+		       << p->first.locker << dendl;
+      r = rados::cls::lock::break_lock(&m_ictx->md_ctx, m_ictx->header_oid,
+				       RBD_PERSISTENT_CACHE_LOCK_NAME,
+				       m_owner, p->first.locker);
+      if (r < 0 && r != -ENOENT) {
+	lderr(m_cct) << "error breaking lock " << m_owner << ": "
+		     << cpp_strerror(r) << dendl;
+	return r;
+      }
+      ours = true;
+    }
+
+    if (!ours) {
+      if (!m_entries.empty()) {
+	lderr(m_cct) << m_path << " is not owned by this image's "
+		     << "persistent cache lock (cookie '" << m_owner
+		     << "'), not replaying it" << dendl;
+	r = set_aside();
+	if (r < 0)
+	  return r;
+      }
+      uuid_d uuid;
+      uuid.generate_random();
+      m_owner = stringify(uuid);
+    }
+
+    r = rados::cls::lock::lock(&m_ictx->md_ctx, m_ictx->header_oid,
+			       RBD_PERSISTENT_CACHE_LOCK_NAME, LOCK_EXCLUSIVE,
+			       m_owner, "", "librbd persistent cache",
+			       utime_t(), 0);
+    if (r < 0) {
+      lderr(m_cct) << "unable to lock image for the persistent cache: "
+		   << cpp_strerror(r) << dendl;
+      return r;
+    }
+    return 0;
+  }
+
+  /// keep the log at <path>.stale for inspection, and start a new one
+  int WriteLog::set_aside()
+  {
+    assert(m_lock.is_locked());
+    string stale = m_path + ".stale";
+    if (::rename(m_path.c_str(), stale.c_str()) < 0) {
+      int r = -errno;
+      lderr(m_cct) << "unable to rename " << m_path << " to " << stale
+		   << ": " << cpp_strerror(r) << dendl;
+      return r;
+    }
+    lderr(m_cct) << "moved " << m_path << " to " << stale << dendl;
+    ::close(m_fd);
+    m_fd = -1;
+
+    for (std::list<Entry*>::iterator p = m_entries.begin();
+	 p != m_entries.end();
+	 ++p)
+      delete *p;
+    m_entries.clear();
+    m_index.clear();
+    m_owner.clear();
+    m_next_seq = 1;
+    m_append_pos = m_head_pos = m_header_head_pos = HEADER_SIZE;
+
+    int r = open_file();
+    if (r < 0)
+      return r;
+    return load_entries();
+  }
+
+  int WriteLog::replay()
+  {
+    int r = writeback();
+    if (r < 0)
+      return r;
+
+    // entries of the old generation may still be anywhere in the file
+    Mutex::Locker l(m_lock);
+    assert(m_entries.empty());
+    ++m_generation;
+    m_next_seq = 1;
+    m_append_pos = m_head_pos = HEADER_SIZE;
+    ldout(m_cct, 10) << "replay done, starting generation " << m_generation
+		     << dendl;
+    return write_header();
+  }
+
+  int WriteLog::shutdown()
+  {
+    ldout(m_cct, 5) << "shutdown " << m_path << dendl;
+    bool crash = m_cct->_conf->rbd_persistent_cache_inject_crash;
+    int r = crash ? 0 : writeback();
+
+    m_lock.Lock();
+    m_stopping = true;
+    m_cond.Signal();
+    m_lock.Unlock();
+    m_flusher_thread.join();
+
+    if (crash) {
+      ldout(m_cct, 0) << "leaving " << m_path << " behind, as after a crash"
+		      << dendl;
+      flush();
+    } else if (r < 0) {
+      lderr(m_cct) << "unable to write back " << m_path
+		   << ", keeping it to replay on the next open: "
+		   << cpp_strerror(r) << dendl;
+      flush();
+    } else if (::unlink(m_path.c_str()) < 0) {
+      r = -errno;
+      lderr(m_cct) << "unable to remove " << m_path << ": "
+		   << cpp_strerror(r) << dendl;
+    } else {
+      // nothing is left to replay
+      int ur = rados::cls::lock::unlock(&m_ictx->md_ctx, m_ictx->header_oid,
+					RBD_PERSISTENT_CACHE_LOCK_NAME,
+					m_owner);
+      if (ur < 0 && ur != -ENOENT)
+	lderr(m_cct) << "unable to unlock image: " << cpp_strerror(ur)
+		     << dendl;
+    }
+    ::close(m_fd);
+    m_fd = -1;
+    return r;
+  }
+
+  int WriteLog::append_write(uint64_t off, bufferlist &bl)
+  {
+    uint64_t pos = 0;
+    while (pos < bl.length()) {
+      uint64_t len = MIN(bl.length() - pos, m_max_entry_data);
+      bufferlist data;
+      data.substr_of(bl, pos, len);
+      int r = append(false, off + pos, len, data);
+      if (r < 0)
+	return r;
+      pos += len;
+    }
+    return 0;
+  }
+
+  int WriteLog::append_discard(uint64_t off, uint64_t len)
+  {
+    bufferlist data;
+    return append(true, off, len, data);
+  }
+
+  int WriteLog::append(bool discard, uint64_t off, uint64_t len,
+		       bufferlist &data)
+  {
+    utime_t start = ceph_clock_now(m_cct);
+    uint64_t need = ENTRY_HEADER_SIZE + data.length();
+    __u32 data_crc = discard ? 0 : data.crc32c(0);
+
+    Mutex::Locker l(m_lock);
+    bool waited = false;
+    uint64_t pos;
+    while (!find_space(m_header_head_pos, need, &pos)) {
+      if (find_space(m_head_pos, need, &pos)) {
+	// the space has been written back, but a replay would still
+	// start there; move the head on disk first
+	int r = write_header();
+	if (r < 0)
+	  return r;
+	continue;
+      }
+      if (!waited) {
+	ldout(m_cct, 10) << "append waiting for free space" << dendl;
+	m_ictx->perfcounter->inc(l_librbd_pcache_full);
+	waited = true;
+      }
+      m_space_wanted = true;
+      m_cond.Signal();
+      m_cond.Wait(m_lock);
+    }
+    m_space_wanted = false;
+
+    Entry *e = new Entry;
+    e->seq = m_next_seq;
+    e->discard = discard;
+    e->image_off = off;
+    e->len = len;
+    e->log_off = pos;
+    e->data_off = pos + ENTRY_HEADER_SIZE;
+    e->state = STATE_NEW;
+
+    bufferlist bl;
+    ::encode(ENTRY_MAGIC, bl);
+    ::encode((__u8)discard, bl);
+    ::encode(m_generation, bl);
+    ::encode(e->seq, bl);
+    ::encode(off, bl);
+    ::encode(len, bl);
+    ::encode(data_crc, bl);
+    __u32 header_crc = bl.crc32c(0);
+    ::encode(header_crc, bl);
+    assert(bl.length() == ENTRY_HEADER_SIZE);
+    bl.claim_append(data);
+
+    ldout(m_cct, 20) << "append seq " << e->seq << (discard ? " discard " : " write ")
+		     << off << "~" << len << " at " << pos << dendl;
+    int r = safe_pwrite(m_fd, bl.c_str(), bl.length(), pos);
+    if (r < 0) {
+      lderr(m_cct) << "error appending to " << m_path << ": "
+		   << cpp_strerror(r) << dendl;
+      delete e;
+      return r;
+    }
+    ++m_next_seq;
+    m_append_pos = pos + need;
+    if (m_entries.empty())
+      m_head_pos = pos;
+    e->stamp = ceph_clock_now(m_cct);
+    m_entries.push_back(e);
+    index_insert(e);
+
+    m_ictx->perfcounter->inc(l_librbd_pcache_wr);
+    m_ictx->perfcounter->inc(l_librbd_pcache_wr_bytes, len);
+    m_ictx->perfcounter->tinc(l_librbd_pcache_wr_latency, e->stamp - start);
+    return 0;
+  }
+
+  /**
+   * find room for @need bytes after the tail of the log
+   *
+   * @param head where the log starts; nothing from there to the tail
+   *             may be overwritten
+   * @param pos [out] where to write
+   */
+  bool WriteLog::find_space(uint64_t head, uint64_t need, uint64_t *pos) const
+  {
+    uint64_t tail = m_append_pos;
+    if (tail >= head) {
+      if (tail + need <= m_size) {
+	*pos = tail;
+	return true;
+      }
+      // wrap, leaving a gap so that a full log never looks empty
+      if (HEADER_SIZE + need < head) {
+	*pos = HEADER_SIZE;
+	return true;
+      }
+      return false;
+    }
+    if (tail + need < head) {
+      *pos = tail;
+      return true;
+    }
+    return false;
+  }
+
+  /// bytes between the head and the tail, i.e. not yet written back
+  uint64_t WriteLog::log_used() const
+  {
+    if (m_entries.empty())
+      return 0;
+    if (m_append_pos > m_head_pos)
+      return m_append_pos - m_head_pos;
+    return (m_size - m_head_pos) + (m_append_pos - HEADER_SIZE);
+  }
+
+  int WriteLog::flush()
+  {
+    ldout(m_cct, 20) << "flush" << dendl;
+    if (::fdatasync(m_fd) < 0) {
+      int r = -errno;
+      lderr(m_cct) << "error syncing " << m_path << ": " << cpp_strerror(r)
+		   << dendl;
+      return r;
+    }
+    return 0;
+  }
+
+  int WriteLog::writeback()
+  {
+    Mutex::Locker l(m_lock);
+    if (m_entries.empty())
+      return 0;
+
+    uint64_t seq = m_entries.back()->seq;
+    ldout(m_cct, 10) << "writeback through seq " << seq << dendl;
+    m_writeback_seq = MAX(m_writeback_seq, seq);
+    m_error = 0;
+    m_retry_after = utime_t();
+    m_cond.Signal();
+    while (!m_entries.empty() && m_entries.front()->seq <= seq) {
+      if (m_error < 0)
+	return m_error;
+      m_cond.Wait(m_lock);
+    }
+    return 0;
+  }
+
+  int WriteLog::read(uint64_t off, uint64_t len,
+		     vector<pair<uint64_t,uint64_t> > *misses,
+		     map<uint64_t, bufferlist> *hits)
+  {
+    Mutex::Locker l(m_lock);
+    uint64_t end = off + len;
+    uint64_t pos = off;
+    uint64_t hit_bytes = 0;
+
+    map<uint64_t, Extent>::iterator p = m_index.lower_bound(off);
+    if (p != m_index.begin()) {
+      --p;
+      if (p->first + p->second.len <= off)
+	++p;
+    }
+    for (; p != m_index.end() && p->first < end; ++p) {
+      uint64_t hit_start = MAX(p->first, off);
+      uint64_t hit_end = MIN(p->first + p->second.len, end);
+      if (hit_start > pos)
+	misses->push_back(make_pair(pos, hit_start - pos));
+
+      Entry *e = p->second.entry;
+      bufferlist &bl = (*hits)[hit_start];
+      if (e->discard) {
+	bl.append_zero(hit_end - hit_start);
+      } else {
+	bufferptr bp(hit_end - hit_start);
+	int r = safe_pread_exact(m_fd, bp.c_str(), bp.length(),
+				 e->data_off + (hit_start - e->image_off));
+	if (r < 0) {
+	  lderr(m_cct) << "error reading from " << m_path << ": "
+		       << cpp_strerror(r) << dendl;
+	  return r;
+	}
+	bl.append(bp);
+      }
+      hit_bytes += hit_end - hit_start;
+      pos = hit_end;
+    }
+    if (pos < end)
+      misses->push_back(make_pair(pos, end - pos));
+
+    if (hit_bytes)
+      m_ictx->perfcounter->inc(l_librbd_pcache_rd_hit_bytes, hit_bytes);
+    return 0;
+  }
+
+  void WriteLog::flusher_entry()
+  {
+    ldout(m_cct, 10) << "flusher start" << dendl;
+    m_lock.Lock();
+    while (true) {
+      int max_ops = MAX(1, m_cct->_conf->rbd_concurrent_management_ops);
+      utime_t max_age;
+      max_age.set_from_double(
+	m_cct->_conf->rbd_persistent_cache_max_dirty_age);
+      uint64_t target = (uint64_t)((m_size - HEADER_SIZE) *
+		m_cct->_conf->rbd_persistent_cache_target_dirty);
+      utime_t now = ceph_clock_now(m_cct);
+      bool full = m_space_wanted || log_used() > target;
+
+      // entries are written back in order, so stop at the first one
+      // that can wait.  One that overlaps an older entry still in the
+      // log waits for it, or a retried failure could overwrite it.
+      std::list<Entry*>::iterator p = m_entries.begin();
+      interval_set<uint64_t> unwritten;
+      while (!m_stopping && m_in_flight < max_ops && now >= m_retry_after &&
+	     p != m_entries.end()) {
+	Entry *e = *p;
+	if (e->state == STATE_DONE) {
+	  ++p;
+	  continue;
+	}
+	bool blocked = e->len && unwritten.intersects(e->image_off, e->len);
+	if (e->state == STATE_SENT || blocked) {
+	  if (e->len) {
+	    interval_set<uint64_t> ex;
+	    ex.insert(e->image_off, e->len);
+	    unwritten.union_of(ex);
+	  }
+	  ++p;
+	  continue;
+	}
+	if (!full && e->seq > m_writeback_seq && now - e->stamp < max_age)
+	  break;
+	e->state = STATE_SENT;
+	++m_in_flight;
+	m_lock.Unlock();
+	send_writeback(e);
+	m_lock.Lock();
+	// older entries may have finished meanwhile
+	p = m_entries.begin();
+	unwritten.clear();
+      }
+
+      if (m_stopping && m_in_flight == 0)
+	break;
+      m_cond.WaitInterval(m_cct, m_lock, utime_t(1, 0));
+    }
+    m_lock.Unlock();
+    ldout(m_cct, 10) << "flusher finish" << dendl;
+  }
+
+  void WriteLog::send_writeback(Entry *e)
+  {
+    ldout(m_cct, 20) << "send_writeback seq " << e->seq << " "
+		     << e->image_off << "~" << e->len << dendl;
+    C_Writeback *ctx = new C_Writeback(this, e);
+    if (!e->discard) {
+      // the data stays put until everything has been written back
+      bufferptr bp(e->len);
+      int r = safe_pread_exact(m_fd, bp.c_str(), e->len, e->data_off);
+      if (r < 0) {
+	lderr(m_cct) << "error reading from " << m_path << ": "
+		     << cpp_strerror(r) << dendl;
+	ctx->complete(r);
+	return;
+      }
+      ctx->data.append(bp);
+    }
+    aio_writeback(m_ictx, e->image_off, e->len,
+		  e->discard ? NULL : ctx->data.c_str(), ctx);
+  }
+
+  void WriteLog::finish_writeback(Entry *e, int r)
+  {
+    ldout(m_cct, 20) << "finish_writeback seq " << e->seq << " r = " << r
+		     << dendl;
+    Mutex::Locker l(m_lock);
+    --m_in_flight;
+    if (r < 0) {
+      lderr(m_cct) << "error writing back " << e->image_off << "~" << e->len
+		   << ", will retry: " << cpp_strerror(r) << dendl;
+      e->state = STATE_NEW;
+      m_error = r;
+      m_retry_after = ceph_clock_now(m_cct);
+      m_retry_after += utime_t(1, 0);
+      m_cond.Signal();
+      return;
+    }
+
+    e->state = STATE_DONE;
+    m_ictx->perfcounter->inc(l_librbd_pcache_writeback);
+    m_ictx->perfcounter->inc(l_librbd_pcache_writeback_bytes, e->len);
+    while (!m_entries.empty() && m_entries.front()->state == STATE_DONE) {
+      Entry *done = m_entries.front();
+      m_entries.pop_front();
+      index_remove(done);
+      delete done;
+    }
+    m_head_pos = m_entries.empty() ? m_append_pos :
+      m_entries.front()->log_off;
+    m_cond.Signal();
+  }
+
+  int WriteLog::load_entries()
+  {
+    assert(m_lock.is_locked());
+    bool valid = false;
+    uint64_t generation = 0;
+    string owner;
+    uint64_t head_pos = HEADER_SIZE;
+    uint64_t head_seq = 1;
+    bufferptr hp(HEADER_SIZE);
+    int r = safe_pread(m_fd, hp.c_str(), HEADER_SIZE, 0);
+    if (r < 0) {
+      lderr(m_cct) << "error reading " << m_path << ": " << cpp_strerror(r)
+		   << dendl;
+      return r;
+    }
+    if (r == (int)HEADER_SIZE) {
+      bufferlist bl;
+      bl.append(hp);
+      try {
+	bufferlist::iterator p = bl.begin();
+	__u32 magic, crc;
+	__u8 version;
+	string key;
+	uint64_t size;
+	::decode(magic, p);
+	::decode(version, p);
+	::decode(key, p);
+	::decode(generation, p);
+	::decode(size, p);
+	// version 1 logs always started at the front
+	if (version >= 2) {
+	  ::decode(head_pos, p);
+	  ::decode(head_seq, p);
+	}
+	// older versions had no owner, and will not be replayed
+	if (version >= 3)
+	  ::decode(owner, p);
+	bufferlist covered;
+	covered.substr_of(bl, 0, p.get_off());
+	::decode(crc, p);
+	valid = (magic == HEADER_MAGIC && version >= 1 && version <= 3 &&
+		 key == m_image_key && covered.crc32c(0) == crc &&
+		 head_pos >= HEADER_SIZE && head_pos <= m_size);
+      } catch (buffer::error& e) {
+      }
+    }
+    if (!valid) {
+      // start a new log, dropping whatever the file held
+      ldout(m_cct, 10) << "creating new log " << m_path << dendl;
+      if (::ftruncate(m_fd, 0) < 0) {
+	r = -errno;
+	lderr(m_cct) << "error truncating " << m_path << ": "
+		     << cpp_strerror(r) << dendl;
+	return r;
+      }
+      m_generation = 1;
+      return write_header();
+    }
+
+    // take the longest run of intact entries of this generation from
+    // the head, following it to the front of the file if it wrapped
+    m_generation = generation;
+    m_owner = owner;
+    m_next_seq = head_seq;
+    uint64_t pos = head_pos;
+    while (true) {
+      Entry *e = NULL;
+      r = load_entry(pos, &e);
+      if (r == 0 && pos != HEADER_SIZE)
+	r = load_entry(HEADER_SIZE, &e);
+      if (r < 0)
+	return r;
+      if (r == 0)
+	break;
+      m_entries.push_back(e);
+      index_insert(e);
+      ++m_next_seq;
+      pos = e->data_off + (e->discard ? 0 : e->len);
+    }
+    m_append_pos = pos;
+    m_head_pos = m_entries.empty() ? pos : m_entries.front()->log_off;
+    m_header_head_pos = head_pos;
+
+    if (!m_entries.empty())
+      ldout(m_cct, 1) << "found " << m_entries.size() << " entries ("
+		      << log_used() << " bytes) to replay in "
+		      << m_path << dendl;
+    return 0;
+  }
+
+  /**
+   * read the entry at @pos, if it is the next one in the log
+   *
+   * @return 1 and the entry in @pe if it is, 0 if not, <0 on error
+   */
+  int WriteLog::load_entry(uint64_t pos, Entry **pe)
+  {
+    if (pos + ENTRY_HEADER_SIZE > m_size)
+      return 0;
+    bufferptr ep(ENTRY_HEADER_SIZE);
+    int r = safe_pread(m_fd, ep.c_str(), ENTRY_HEADER_SIZE, pos);
+    if (r < 0) {
+      lderr(m_cct) << "error reading " << m_path << ": "
+		   << cpp_strerror(r) << dendl;
+      return r;
+    }
+    if (r < (int)ENTRY_HEADER_SIZE)
+      return 0;
+
+    bufferlist bl;
+    bl.append(ep);
+    bufferlist::iterator p = bl.begin();
+    __u32 magic, data_crc, header_crc;
+    __u8 discard;
+    uint64_t entry_generation, seq, off, len;
+    ::decode(magic, p);
+    ::decode(discard, p);
+    ::decode(entry_generation, p);
+    ::decode(seq, p);
+    ::decode(off, p);
+    ::decode(len, p);
+    ::decode(data_crc, p);
+    bufferlist covered;
+    covered.substr_of(bl, 0, p.get_off());
+    ::decode(header_crc, p);
+    if (magic != ENTRY_MAGIC || covered.crc32c(0) != header_crc ||
+	entry_generation != m_generation || seq != m_next_seq)
+      return 0;
+
+    uint64_t data_off = pos + ENTRY_HEADER_SIZE;
+    if (!discard) {
+      if (data_off + len > m_size)
+	return 0;
+      bufferptr dp(len);
+      r = safe_pread(m_fd, dp.c_str(), len, data_off);
+      if (r < 0) {
+	lderr(m_cct) << "error reading " << m_path << ": "
+		     << cpp_strerror(r) << dendl;
+	return r;
+      }
+      if ((uint64_t)r < len)
+	return 0;
+      bufferlist data;
+      data.append(dp);
+      if (data.crc32c(0) != data_crc)
+	return 0;
+    }
+
+    Entry *e = new Entry;
+    e->seq = seq;
+    e->discard = discard;
+    e->image_off = off;
+    e->len = len;
+    e->log_off = pos;
+    e->data_off = data_off;
+    e->stamp = ceph_clock_now(m_cct);
+    e->state = STATE_NEW;
+    *pe = e;
+    return 1;
+  }
+
+  int WriteLog::write_header()
+  {
+    uint64_t head_seq = m_entries.empty() ? m_next_seq :
+      m_entries.front()->seq;
+    bufferlist bl;
+    ::encode(HEADER_MAGIC, bl);
+    ::encode((__u8)3, bl);
+    ::encode(m_image_key, bl);
+    ::encode(m_generation, bl);
+    ::encode(m_size, bl);
+    ::encode(m_head_pos, bl);
+    ::encode(head_seq, bl);
+    ::encode(m_owner, bl);
+    __u32 crc = bl.crc32c(0);
+    ::encode(crc, bl);
+    assert(bl.length() <= HEADER_SIZE);
+    bl.append_zero(HEADER_SIZE - bl.length());
+
+    int r = safe_pwrite(m_fd, bl.c_str(), bl.length(), 0);
+    if (r < 0) {
+      lderr(m_cct) << "error writing header of " << m_path << ": "
+		   << cpp_strerror(r) << dendl;
+      return r;
+    }
+    // the header must be durable before any entry it points past is
+    // overwritten
+    if (::fdatasync(m_fd) < 0) {
+      r = -errno;
+      lderr(m_cct) << "error syncing " << m_path << ": " << cpp_strerror(r)
+		   << dendl;
+      return r;
+    }
+    ldout(m_cct, 10) << "write_header head " << m_head_pos << " seq "
+		     << head_seq << dendl;
+    m_header_head_pos = m_head_pos;
+    return 0;
+  }
+
+  void WriteLog::index_insert(Entry *e)
+  {
+    uint64_t off = e->image_off;
+    uint64_t end = off + e->len;
+
+    // trim an extent that starts before us, keeping its tail if it
+    // extends past us
+    map<uint64_t, Extent>::iterator p = m_index.lower_bound(off);
+    if (p != m_index.begin()) {
+      map<uint64_t, Extent>::iterator q = p;
+      --q;
+      uint64_t q_end = q->first + q->second.len;
+      if (q_end > off) {
+	q->second.len = off - q->first;
+	if (q_end > end)
+	  m_index[end] = Extent(q_end - end, q->second.entry);
+      }
+    }
+
+    // drop the extents we cover, keeping the tail of the last one
+    while (p != m_index.end() && p->first < end) {
+      uint64_t p_end = p->first + p->second.len;
+      Entry *p_entry = p->second.entry;
+      m_index.erase(p++);
+      if (p_end > end) {
+	m_index[end] = Extent(p_end - end, p_entry);
+	break;
+      }
+    }
+    m_index[off] = Extent(e->len, e);
+  }
+
+  void WriteLog::index_remove(Entry *e)
+  {
+    // whatever is left of e in the index is now in the cluster
+    map<uint64_t, Extent>::iterator p = m_index.lower_bound(e->image_off);
+    while (p != m_index.end() && p->first < e->image_off + e->len) {
+      if (p->second.entry == e)
+	m_index.erase(p++);
+      else
+	++p;
+    }
+  }
+}
@@ -0,0 +1,177 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#ifndef CEPH_LIBRBD_WRITELOG_H
+#define CEPH_LIBRBD_WRITELOG_H
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "common/Cond.h"
+#include "common/Mutex.h"
+#include "common/Thread.h"
+#include "include/buffer.h"
+#include "include/utime.h"
+
+class CephContext;
+
+namespace librbd {
+
+  struct ImageCtx;
+
+  /**
+   * persistent write-back cache for an image, on local storage
+   *
+   * Writes and discards are appended, in order, to a log file (e.g. on
+   * an SSD) and acknowledged as soon as they are in the log.  A flusher
+   * thread writes them back to the cluster in the same order once they
+   * are old enough, when the log fills up, or when asked to.  Reads of
+   * data that is still in the log are served from it.
+   *
+   * The log is made durable by flush().  Each entry carries the log
+   * generation, its sequence number and checksums, so after a crash
+   * the longest valid run of entries from the head of the log is
+   * replayed to the cluster when the image is opened again; that
+   * includes everything written before the last flush().  Once that is
+   * done the log starts over with a new generation, so nothing left in
+   * the file from before can be mistaken for a later entry.
+   *
+   * While a log exists, its owner holds an exclusive lock on the image
+   * header, and the lock's cookie is recorded in the log header.  A log
+   * whose lock has been broken, so that the image may have been written
+   * elsewhere since, is never replayed: it is moved aside to
+   * <path>.stale and a new log is started.  So is a log from before
+   * the cookie was recorded.
+   *
+   * The file is used as a ring: space is reclaimed from the head as the
+   * oldest entries are written back, and an entry that does not fit
+   * before the end of the file goes to the front.  The header records
+   * where the head is, and is rewritten before the space it points to
+   * is reused.  A clean shutdown writes everything back and removes
+   * the file.
+   *
+   * An entry is not written back while an older entry it overlaps is
+   * still unwritten, so a failed write that is retried can never land
+   * on top of newer data.
+   */
+  class WriteLog {
+  public:
+    WriteLog(ImageCtx *ictx);
+    ~WriteLog();
+
+    /// open and lock the log file, load what it holds, take ownership
+    int init();
+    /// write back what a previous owner left in the log; must be called
+    /// after init() and before anything is appended
+    int replay();
+    /// write everything back and stop; the file is kept if that fails
+    int shutdown();
+
+    /// log a write; returns once it is in the log
+    int append_write(uint64_t off, ceph::bufferlist &bl);
+    /// log a discard; returns once it is in the log
+    int append_discard(uint64_t off, uint64_t len);
+    /// make everything logged so far durable
+    int flush();
+    /// write everything logged so far back to the cluster and wait
+    int writeback();
+
+    /**
+     * split a read between the log and the cluster
+     *
+     * @param misses [out] parts of off~len to read from the cluster
+     * @param hits [out] image offset -> data, for the parts in the log
+     */
+    int read(uint64_t off, uint64_t len,
+	     std::vector<std::pair<uint64_t,uint64_t> > *misses,
+	     std::map<uint64_t, ceph::bufferlist> *hits);
+
+    const std::string &get_path() const {
+      return m_path;
+    }
+
+  private:
+    enum {
+      STATE_NEW,      ///< only in the log
+      STATE_SENT,     ///< being written back
+      STATE_DONE,     ///< written back, waiting for older entries
+    };
+
+    struct Entry {
+      uint64_t seq;
+      bool discard;
+      uint64_t image_off;
+      uint64_t len;
+      uint64_t log_off;   ///< where the entry is in the file
+      uint64_t data_off;  ///< where the data is in the file
+      utime_t stamp;
+      int state;
+    };
+
+    /// part of the image whose latest data is in the log
+    struct Extent {
+      uint64_t len;
+      Entry *entry;
+      Extent() : len(0), entry(NULL) {}
+      Extent(uint64_t l, Entry *e) : len(l), entry(e) {}
+    };
+
+    class FlusherThread : public Thread {
+      WriteLog *log;
+    public:
+      FlusherThread(WriteLog *l) : log(l) {}
+      void *entry() {
+	log->flusher_entry();
+	return 0;
+      }
+    } m_flusher_thread;
+
+    struct C_Writeback;
+
+    void flusher_entry();
+    void send_writeback(Entry *e);
+    void finish_writeback(Entry *e, int r);
+
+    int append(bool discard, uint64_t off, uint64_t len,
+	       ceph::bufferlist &data);
+    bool find_space(uint64_t head, uint64_t need, uint64_t *pos) const;
+    uint64_t log_used() const;
+    int open_file();
+    int take_ownership();
+    int set_aside();
+    int load_entries();
+    int load_entry(uint64_t pos, Entry **pe);
+    int write_header();
+    void index_insert(Entry *e);
+    void index_remove(Entry *e);
+
+    ImageCtx *m_ictx;
+    CephContext *m_cct;
+    std::string m_path;
+    std::string m_image_key;
+    int m_fd;
+    uint64_t m_size;
+    uint64_t m_max_entry_data;
+
+    Mutex m_lock;     ///< protects everything below, and appends to the file
+    Cond m_cond;
+    std::string m_owner;       ///< cookie of our lock on the image header
+    uint64_t m_generation;
+    uint64_t m_next_seq;
+    uint64_t m_append_pos;
+    uint64_t m_head_pos;       ///< where the oldest entry is, or m_append_pos
+    uint64_t m_header_head_pos;  ///< the head as recorded in the header
+    std::list<Entry*> m_entries;       ///< not yet written back, in order
+    std::map<uint64_t, Extent> m_index;
+    int m_in_flight;
+    uint64_t m_writeback_seq;  ///< write back entries up to this one now
+    bool m_space_wanted;       ///< an append is waiting for free space
+    bool m_stopping;
+    int m_error;               ///< last writeback error
+    utime_t m_retry_after;     ///< don't retry failed writebacks before
+  };
+
+}
+
+#endif
@@ -6,6 +6,7 @@
 #include "common/ceph_context.h"
 #include "common/dout.h"
 #include "common/errno.h"
+#include "common/Throttle.h"
 #include "cls/lock/cls_lock_client.h"
 #include "include/inttypes.h"
 #include "include/stringify.h"
@@ -14,10 +15,13 @@
 
 #include "librbd/AioCompletion.h"
 #include "librbd/AioRequest.h"
+#include "librbd/CopyupRequest.h"
+#include "librbd/WriteLog.h"
 #include "librbd/ImageCtx.h"
 
 #include "librbd/internal.h"
 #include "librbd/parent_types.h"
+#include "librados/snap_set_diff.h"
 #include "include/util.h"
 
 #define dout_subsys ceph_subsys_rbd
@@ -141,7 +145,18 @@ namespace librbd {
     return 0;
   }
 
-  void trim_image(ImageCtx *ictx, uint64_t newsize, ProgressContext& prog_ctx)
+  /// log how fast a bulk operation went through @objects objects
+  void log_object_rate(CephContext *cct, const char *what, uint64_t objects,
+		       utime_t start_time)
+  {
+    utime_t elapsed = ceph_clock_now(cct) - start_time;
+    double secs = (double)elapsed;
+    ldout(cct, 2) << what << " " << objects << " objects in " << elapsed
+		  << " (" << (secs > 0 ? (uint64_t)(objects / secs) : 0)
+		  << " objects/sec)" << dendl;
+  }
+
+  int trim_image(ImageCtx *ictx, uint64_t newsize, ProgressContext& prog_ctx)
   {
     CephContext *cct = (CephContext *)ictx->data_ctx.cct();
 
@@ -159,15 +174,44 @@ namespace librbd {
 		   << " delete objects " << delete_start << " to " << (num_objects-1)
 		   << dendl;
 
+    // reload the map (and whether we hold the lock) rather than trust
+    // the copy from the last refresh
+    if (ictx->object_map_enabled()) {
+      int r = ictx->refresh_object_map();
+      if (r < 0)
+	return r;
+    }
+
     if (delete_start < num_objects) {
       ldout(cct, 2) << "trim_image objects " << delete_start << " to "
 		    << (num_objects - 1) << dendl;
+      utime_t start_time = ceph_clock_now(cct);
+      uint64_t removed = 0;
+      SimpleThrottle throttle(MAX(1, cct->_conf->rbd_concurrent_management_ops),
+			      true);
       for (uint64_t i = delete_start; i < num_objects; ++i) {
-	string oid = ictx->get_object_name(i);
-	ictx->data_ctx.remove(oid);
+	if (throttle.pending_error())
+	  break;
+	if (ictx->object_may_exist(i)) {
+	  string oid = ictx->get_object_name(i);
+	  Context *ctx = new C_SimpleThrottle(&throttle);
+	  librados::AioCompletion *rados_completion =
+	    Rados::aio_create_completion(ctx, NULL, rados_ctx_cb);
+	  int r = ictx->data_ctx.aio_remove(oid, rados_completion);
+	  rados_completion->release();
+	  if (r < 0)
+	    ctx->complete(r);
+	  ++removed;
+	}
 	prog_ctx.update_progress((i - delete_start) * object_size,
 				 (num_objects - delete_start) * object_size);
       }
+      int r = throttle.wait_for_ret();
+      if (r < 0) {
+	lderr(cct) << "error removing objects: " << cpp_strerror(r) << dendl;
+	return r;
+      }
+      log_object_rate(cct, "trim_image removed", removed, start_time);
     }
 
     // discard the weird boundary, if any
@@ -177,8 +221,18 @@ namespace librbd {
 
       for (vector<ObjectExtent>::iterator p = extents.begin(); p != extents.end(); ++p) {
 	ldout(ictx->cct, 20) << " ex " << *p << dendl;
-	if (p->offset == 0) {
-	  ictx->data_ctx.remove(p->oid.name);
+	if (!ictx->object_may_exist(p->objectno)) {
+	  continue;
+	} else if (p->offset == 0) {
+	  // nobody may write past the new size, so this is the one place
+	  // besides a rebuild where clearing an object's bit is safe
+	  int r = ictx->data_ctx.remove(p->oid.name);
+	  if ((r == 0 || r == -ENOENT) && ictx->object_map_enabled()) {
+	    ictx->set_object_map(p->objectno, p->objectno + 1, false);
+	    cls_client::object_map_update(&ictx->md_ctx,
+					  ictx->object_map_name(CEPH_NOSNAP),
+					  p->objectno, p->objectno + 1, false);
+	  }
 	} else {
 	  librados::ObjectWriteOperation op;
 	  op.truncate(p->offset);
@@ -186,6 +240,7 @@ namespace librbd {
 	}
       }
     }
+    return 0;
   }
 
   int read_rbd_info(IoCtx& io_ctx, const string& info_oid,
@@ -311,8 +366,36 @@ namespace librbd {
     uint64_t numseg = ictx->get_num_objects();
     uint64_t bsize = ictx->get_object_size();
 
+    // objects in neither the head nor the snapshot map don't need
+    // rolling back; the head map must cover both until we're done
+    vector<bool> snap_map, rollback_map;
+    bool object_map = ictx->object_map_enabled();
+    if (object_map) {
+      int r = cls_client::object_map_load(&ictx->md_ctx,
+					  ictx->object_map_name(snap_id),
+					  &snap_map);
+      if (r < 0 && r != -ENOENT)
+	return r;
+      if (r == -ENOENT)
+	snap_map.assign(numseg, true);
+      snap_map.resize(numseg, true);
+
+      rollback_map = snap_map;
+      for (uint64_t i = 0; i < numseg; i++)
+	if (ictx->object_may_exist(i))
+	  rollback_map[i] = true;
+      string map_oid = ictx->object_map_name(CEPH_NOSNAP);
+      r = cls_client::object_map_save(&ictx->md_ctx, map_oid, rollback_map);
+      if (r < 0)
+	return r;
+      Mutex::Locker l(ictx->object_map_lock);
+      ictx->object_map = rollback_map;
+    }
+
     for (uint64_t i = 0; i < numseg; i++) {
       int r;
+      if (object_map && !rollback_map[i])
+	continue;
       string oid = ictx->get_object_name(i);
       r = ictx->data_ctx.selfmanaged_snap_rollback(oid, snap_id);
       ldout(ictx->cct, 10) << "selfmanaged_snap_rollback on " << oid << " to "
@@ -321,6 +404,16 @@ namespace librbd {
       if (r < 0 && r != -ENOENT)
 	return r;
     }
+
+    if (object_map) {
+      int r = cls_client::object_map_save(&ictx->md_ctx,
+					  ictx->object_map_name(CEPH_NOSNAP),
+					  snap_map);
+      if (r < 0)
+	return r;
+      Mutex::Locker l(ictx->object_map_lock);
+      ictx->object_map = snap_map;
+    }
     return 0;
   }
 
@@ -429,6 +522,12 @@ namespace librbd {
       return r;
 
     RWLock::RLocker l(ictx->md_lock);
+    // the snapshot must include everything written so far
+    if (ictx->write_log) {
+      r = ictx->write_log->writeback();
+      if (r < 0)
+	return r;
+    }
     do {
       r = add_snap(ictx, snap_name);
     } while (r == -ESTALE);
@@ -761,6 +860,21 @@ reprotect_and_return_err:
       }
     }
 
+    if (features & RBD_FEATURE_OBJECT_MAP) {
+      uint64_t object_size = 1ull << order;
+      uint64_t count = stripe_count ? stripe_count : 1;
+      uint64_t period = object_size * count;
+      uint64_t num_objects = ((size + period - 1) / period) * count;
+      r = cls_client::object_map_resize(&io_ctx,
+					RBD_OBJECT_MAP_PREFIX + id,
+					num_objects, false);
+      if (r < 0) {
+	lderr(cct) << "error creating object map: " << cpp_strerror(r)
+		   << dendl;
+	goto err_remove_header;
+      }
+    }
+
     ldout(cct, 2) << "done." << dendl;
     return 0;
 
@@ -1305,8 +1419,13 @@ reprotect_and_return_err:
       unknown_format = false;
       id = ictx->id;
       ictx->md_lock.get_read();
-      trim_image(ictx, 0, prog_ctx);
+      r = trim_image(ictx, 0, prog_ctx);
       ictx->md_lock.put_read();
+      if (r < 0) {
+	lderr(cct) << "error removing data objects" << dendl;
+	close_image(ictx);
+	return r;
+      }
 
       ictx->parent_lock.get_read();
       // struct assignment
@@ -1319,8 +1438,19 @@ reprotect_and_return_err:
 	lderr(cct) << "error removing child from children list" << dendl;
 	return r;
       }
+      bool object_map = ictx->object_map_enabled();
       close_image(ictx);
 
+      if (object_map) {
+	ldout(cct, 2) << "removing object map..." << dendl;
+	r = io_ctx.remove(RBD_OBJECT_MAP_PREFIX + id);
+	if (r < 0 && r != -ENOENT) {
+	  lderr(cct) << "error removing object map: " << cpp_strerror(r)
+		     << dendl;
+	  return r;
+	}
+      }
+
       ldout(cct, 2) << "removing header..." << dendl;
       r = io_ctx.remove(header_oid);
       if (r < 0 && r != -ENOENT) {
@@ -1383,11 +1513,27 @@ reprotect_and_return_err:
     } else {
       ldout(cct, 2) << "shrinking image " << ictx->size << " -> " << size
 		    << dendl;
-      trim_image(ictx, size, prog_ctx);
+      int r = trim_image(ictx, size, prog_ctx);
+      if (r < 0)
+	return r;
     }
-    ictx->size = size;
 
     int r;
+    if (ictx->object_map_enabled()) {
+      // new objects start out absent; removed ones are already gone
+      uint64_t num_objects = ictx->get_num_objects(size);
+      r = cls_client::object_map_resize(&ictx->md_ctx,
+					ictx->object_map_name(CEPH_NOSNAP),
+					num_objects, false);
+      if (r < 0) {
+	lderr(cct) << "error resizing object map: " << cpp_strerror(r)
+		   << dendl;
+	return r;
+      }
+      ictx->resize_object_map(num_objects);
+    }
+    ictx->size = size;
+
     if (ictx->old_format) {
       // rewrite header
       bufferlist bl;
@@ -1426,12 +1572,20 @@ reprotect_and_return_err:
       return r;
 
     RWLock::WLocker l(ictx->md_lock);
-    if (size < ictx->size && ictx->object_cacher) {
+    if (size < ictx->size && ictx->write_log) {
+      // don't write anything back past the new end later
+      r = ictx->write_log->writeback();
+      if (r < 0)
+	return r;
+    }
+    if (size < ictx->size && !ictx->cache_shards.empty()) {
       // need to invalidate since we're deleting objects, and
       // ObjectCacher doesn't track non-existent objects
       ictx->invalidate_cache();
     }
-    resize_helper(ictx, size, prog_ctx);
+    r = resize_helper(ictx, size, prog_ctx);
+    if (r < 0)
+      return r;
 
     ldout(cct, 2) << "done." << dendl;
 
@@ -1472,6 +1626,17 @@ reprotect_and_return_err:
       return r;
     }
 
+    // objects removed while the snapshot is taken are only cleared
+    // from the head map afterwards, and objects created meanwhile are
+    // set before they are written, so the union of the head map
+    // before and after the snapshot covers everything it contains
+    string map_oid = ictx->object_map_name(CEPH_NOSNAP);
+    vector<bool> before;
+    bool object_map = ictx->object_map_enabled();
+    if (object_map &&
+	cls_client::object_map_load(&ictx->md_ctx, map_oid, &before) < 0)
+      object_map = false;
+
     if (ictx->old_format) {
       r = cls_client::old_snapshot_add(&ictx->md_ctx, ictx->header_oid,
 				       snap_id, snap_name);
@@ -1486,6 +1651,21 @@ reprotect_and_return_err:
       return r;
     }
 
+    vector<bool> after;
+    if (object_map &&
+	cls_client::object_map_load(&ictx->md_ctx, map_oid, &after) == 0) {
+      if (before.size() > after.size())
+	after.resize(before.size(), false);
+      for (size_t i = 0; i < before.size(); ++i)
+	if (before[i])
+	  after[i] = true;
+      r = cls_client::object_map_save(&ictx->md_ctx,
+				      ictx->object_map_name(snap_id), after);
+      if (r < 0)
+	lderr(ictx->cct) << "error saving snapshot object map: "
+			 << cpp_strerror(r) << dendl;
+    }
+
     return 0;
   }
 
@@ -1497,9 +1677,15 @@ reprotect_and_return_err:
 					  ictx->header_oid, snap_name);
     } else {
       RWLock::RLocker l(ictx->snap_lock);
+      snap_t snap_id = ictx->get_snap_id(snap_name);
       r = cls_client::snapshot_remove(&ictx->md_ctx,
-				      ictx->header_oid,
-				      ictx->get_snap_id(snap_name));
+				      ictx->header_oid, snap_id);
+      if (r == 0 && ictx->object_map_enabled()) {
+	int r2 = ictx->md_ctx.remove(ictx->object_map_name(snap_id));
+	if (r2 < 0 && r2 != -ENOENT)
+	  lderr(ictx->cct) << "error removing snapshot object map: "
+			   << cpp_strerror(r2) << dendl;
+      }
     }
 
     if (r < 0) {
@@ -1713,6 +1899,10 @@ reprotect_and_return_err:
       ictx->data_ctx.selfmanaged_snap_set_write_ctx(ictx->snapc.seq, ictx->snaps);
     } // release snap_lock
 
+    int r = ictx->refresh_object_map();
+    if (r < 0)
+      return r;
+
     if (new_snap) {
       _flush(ictx);
     }
@@ -1758,6 +1948,11 @@ reprotect_and_return_err:
     // need to flush any pending writes before resizing and rolling back -
     // writes might create new snapshots. Rolling back will replace
     // the current version, so we have to invalidate that too.
+    if (ictx->write_log) {
+      r = ictx->write_log->writeback();
+      if (r < 0)
+	return r;
+    }
     ictx->invalidate_cache();
 
     ldout(cct, 2) << "resizing to snapshot size..." << dendl;
@@ -1781,25 +1976,83 @@ reprotect_and_return_err:
     return r;
   }
 
+  /**
+   * true if an aio_* call that returned an error had already started
+   * @c, in which case it will still complete.  The caller must hold a
+   * reference to @c.
+   */
+  static bool aio_started(AioCompletion *c)
+  {
+    Mutex::Locker l(c->lock);
+    return !c->building;
+  }
+
   struct CopyProgressCtx {
     CopyProgressCtx(ProgressContext &p)
-      : destictx(NULL), src_size(0), prog_ctx(p)
+      : destictx(NULL), src_size(0), prog_ctx(p),
+	lock("librbd::CopyProgressCtx::lock"), in_flight(0), ret(0)
     { }
 
     ImageCtx *destictx;
     uint64_t src_size;
     ProgressContext &prog_ctx;
+
+    Mutex lock;      ///< protects in_flight, ret
+    Cond cond;
+    int in_flight;   ///< writes to destictx in flight
+    int ret;         ///< first write error
+
+    void finish_write(int r) {
+      Mutex::Locker l(lock);
+      if (r < 0 && ret == 0)
+	ret = r;
+      in_flight--;
+      cond.Signal();
+    }
+    int wait_for_writes(int max) {
+      Mutex::Locker l(lock);
+      while (in_flight > max)
+	cond.Wait(lock);
+      return ret;
+    }
   };
 
+  void copy_write_cb(completion_t cb, void *arg)
+  {
+    CopyProgressCtx *cp = reinterpret_cast<CopyProgressCtx*>(arg);
+    AioCompletion *comp = reinterpret_cast<AioCompletion*>(cb);
+    int r = comp->get_return_value();
+    comp->release();
+    cp->finish_write(r);
+  }
+
   int do_copy_extent(uint64_t offset, size_t len, const char *buf, void *data)
   {
     CopyProgressCtx *cp = reinterpret_cast<CopyProgressCtx*>(data);
     cp->prog_ctx.update_progress(offset, cp->src_size);
-    int ret = 0;
-    if (buf) {
-      ret = write(cp->destictx, offset, len, buf);
+    if (!buf)
+      return 0;
+
+    // writes copy buf, so keep up to rbd_concurrent_management_ops of
+    // them in flight while the next periods are read
+    int max = MAX(1, cp->destictx->cct->_conf->rbd_concurrent_management_ops);
+    int ret = cp->wait_for_writes(max - 1);
+    if (ret < 0)
+      return ret;
+
+    cp->lock.Lock();
+    cp->in_flight++;
+    cp->lock.Unlock();
+
+    AioCompletion *comp = aio_create_completion_internal(cp, copy_write_cb);
+    comp->get();
+    ret = aio_write(cp->destictx, offset, len, buf, comp);
+    if (ret < 0 && !aio_started(comp)) {
+      comp->release();
+      cp->finish_write(ret);
     }
-    return ret;
+    comp->put();
+    return ret < 0 ? ret : 0;
   }
 
   int copy(ImageCtx *src, IoCtx& dest_md_ctx, const char *destname,
@@ -1862,6 +2115,9 @@ reprotect_and_return_err:
     cp.src_size = src_size;
 
     int64_t r = read_iterate(src, 0, src_size, do_copy_extent, &cp);
+    int ret = cp.wait_for_writes(0);
+    if (r >= 0)
+      r = ret;
 
     if (r >= 0) {
       // don't return total bytes read, which may not fit in an int
@@ -1875,20 +2131,22 @@ reprotect_and_return_err:
 
   int _snap_set(ImageCtx *ictx, const char *snap_name)
   {
-    RWLock::WLocker l1(ictx->snap_lock);
-    RWLock::WLocker l2(ictx->parent_lock);
-    int r;
-    if ((snap_name != NULL) && (strlen(snap_name) != 0)) {
-      r = ictx->snap_set(snap_name);
-    } else {
-      ictx->snap_unset();
-      r = 0;
-    }
-    if (r < 0) {
-      return r;
+    {
+      RWLock::WLocker l1(ictx->snap_lock);
+      RWLock::WLocker l2(ictx->parent_lock);
+      int r;
+      if ((snap_name != NULL) && (strlen(snap_name) != 0)) {
+	r = ictx->snap_set(snap_name);
+      } else {
+	ictx->snap_unset();
+	r = 0;
+      }
+      if (r < 0) {
+	return r;
+      }
+      refresh_parent(ictx);
     }
-    refresh_parent(ictx);
-    return 0;
+    return ictx->refresh_object_map();
   }
 
   int snap_set(ImageCtx *ictx, const char *snap_name)
@@ -1898,6 +2156,12 @@ reprotect_and_return_err:
     // ignore return value, since we may be set to a non-existent
     // snapshot and the user is trying to fix that
     ictx_check(ictx);
+    // the log can't be written back once we're reading a snapshot
+    if (ictx->write_log) {
+      int r = ictx->write_log->writeback();
+      if (r < 0)
+	return r;
+    }
     return _snap_set(ictx, snap_name);
   }
 
@@ -1930,6 +2194,27 @@ reprotect_and_return_err:
     if ((r = _snap_set(ictx, ictx->snap_name.c_str())) < 0)
       goto err_close;
 
+    if (ictx->cct->_conf->rbd_persistent_cache && !ictx->read_only &&
+	ictx->snap_id == CEPH_NOSNAP) {
+      WriteLog *log = new WriteLog(ictx);
+      r = log->init();
+      if (r < 0) {
+	lderr(ictx->cct) << "not using persistent cache " << log->get_path()
+			 << ": " << cpp_strerror(r) << dendl;
+	delete log;
+      } else {
+	ictx->write_log = log;
+	// replay whatever was left in the log last time
+	r = log->replay();
+	if (r < 0) {
+	  lderr(ictx->cct) << "error writing back persistent cache "
+			   << log->get_path() << ": " << cpp_strerror(r)
+			   << dendl;
+	  goto err_close;
+	}
+      }
+    }
+
     return 0;
 
   err_close:
@@ -1940,7 +2225,15 @@ reprotect_and_return_err:
   void close_image(ImageCtx *ictx)
   {
     ldout(ictx->cct, 20) << "close_image " << ictx << dendl;
-    if (ictx->object_cacher)
+    ictx->readahead.wait_for_pending();
+    ictx->wait_for_copyups();
+    if (ictx->write_log) {
+      // writes everything back; on failure the log is kept for replay
+      ictx->write_log->shutdown();
+      delete ictx->write_log;
+      ictx->write_log = NULL;
+    }
+    if (!ictx->cache_shards.empty())
       ictx->shutdown_cache(); // implicitly flushes
     else
       flush(ictx);
@@ -1957,6 +2250,63 @@ reprotect_and_return_err:
   }
 
   // 'flatten' child image by copying all parent's blocks
+  /// copies one object of a clone up from its parent, for flatten
+  struct C_FlattenObject : public Context {
+    ImageCtx *ictx;
+    uint64_t object_no;
+    bufferlist data;
+    Context *on_finish;
+
+    C_FlattenObject(ImageCtx *i, uint64_t o, Context *f)
+      : ictx(i), object_no(o), on_finish(f) {}
+
+    /// read @objectx from the parent; the caller holds parent_lock
+    void send(const vector<pair<uint64_t,uint64_t> >& objectx);
+
+    virtual void finish(int r) {
+      if (r < 0) {
+	lderr(ictx->cct) << "reading from parent failed" << dendl;
+	on_finish->complete(r);
+	return;
+      }
+      // if data is all zero, don't bother with the object
+      if (data.is_zero()) {
+	on_finish->complete(0);
+	return;
+      }
+      CopyupRequest *req = new CopyupRequest(ictx,
+					     ictx->get_object_name(object_no),
+					     object_no, data, on_finish);
+      req->send();
+    }
+  };
+
+  void flatten_read_cb(completion_t cb, void *arg)
+  {
+    C_FlattenObject *req = reinterpret_cast<C_FlattenObject*>(arg);
+    AioCompletion *comp = reinterpret_cast<AioCompletion*>(cb);
+    int r = comp->get_return_value();
+    comp->release();
+    req->complete(r);
+  }
+
+  void C_FlattenObject::send(const vector<pair<uint64_t,uint64_t> >& objectx)
+  {
+    if (objectx.empty()) {
+      complete(0);
+      return;
+    }
+    AioCompletion *comp = aio_create_completion_internal(this,
+							 flatten_read_cb);
+    comp->get();
+    int r = aio_read(ictx->parent, objectx, NULL, &data, comp);
+    if (r < 0 && !aio_started(comp)) {
+      comp->release();
+      complete(r);
+    }
+    comp->put();
+  }
+
   int flatten(ImageCtx *ictx, ProgressContext &prog_ctx)
   {
     ldout(ictx->cct, 20) << "flatten" << dendl;
@@ -2002,42 +2352,48 @@ reprotect_and_return_err:
       overlap_objects = overlap_periods * ictx->get_stripe_count();
     }
 
-    char *buf = new char[object_size];
-
-    for (uint64_t ono = 0; ono < overlap_objects; ono++) {
-      prog_ctx.update_progress(ono, overlap_objects);
-
-      // map child object onto the parent
-      vector<pair<uint64_t,uint64_t> > objectx;
-      Striper::extent_to_file(ictx->cct, &ictx->layout,
-			    ono, 0, object_size,
-			    objectx);
-      uint64_t object_overlap = ictx->prune_parent_extents(objectx, overlap);
-      assert(object_overlap <= object_size);
+    {
+      utime_t start_time = ceph_clock_now(ictx->cct);
+      SimpleThrottle throttle(
+	MAX(1, ictx->cct->_conf->rbd_concurrent_management_ops), false);
+      uint64_t ono;
+      for (ono = 0; ono < overlap_objects; ono++) {
+	prog_ctx.update_progress(ono, overlap_objects);
+	if (throttle.pending_error())
+	  break;
 
-      RWLock::RLocker l(ictx->parent_lock);
-      // stop early if the parent went away - it just means
-      // another flatten finished first, so this one is useless.
-      if (!ictx->parent) {
-	r = 0;
-	goto err;
+	// map child object onto the parent
+	vector<pair<uint64_t,uint64_t> > objectx;
+	Striper::extent_to_file(ictx->cct, &ictx->layout,
+				ono, 0, object_size,
+				objectx);
+	uint64_t object_overlap = ictx->prune_parent_extents(objectx, overlap);
+	assert(object_overlap <= object_size);
+
+	// waits for a free slot, so do it before taking parent_lock
+	Context *ctx = new C_SimpleThrottle(&throttle);
+	RWLock::RLocker l(ictx->parent_lock);
+	// stop early if the parent went away - it just means
+	// another flatten finished first, so this one is useless.
+	if (!ictx->parent) {
+	  ctx->complete(0);
+	  break;
+	}
+	C_FlattenObject *req = new C_FlattenObject(ictx, ono, ctx);
+	req->send(objectx);
       }
-      if ((r = read(ictx->parent, objectx, buf, NULL)) < 0) {
-	lderr(ictx->cct) << "reading from parent failed" << dendl;
-	goto err;
+      r = throttle.wait_for_ret();
+      if (r < 0) {
+	lderr(ictx->cct) << "failed to flatten: " << cpp_strerror(r) << dendl;
+	return r;
       }
+      log_object_rate(ictx->cct, "flatten copied", ono, start_time);
+    }
 
-      // for actual amount read, if data is all zero, don't bother with block
-      if (!buf_is_zero(buf, r)) {
-	bufferlist bl;
-	string oid = ictx->get_object_name(ono);
-	bl.append(buf, r);
-	r = cls_client::copyup(&ictx->data_ctx, oid, bl);
-	if (r < 0) {
-	  lderr(ictx->cct) << "failed to copy block to child" << dendl;
-	  goto err;
-	}
-      }
+    {
+      RWLock::RLocker l(ictx->parent_lock);
+      if (!ictx->parent)
+	return 0;
     }
 
     // remove parent from this (base) image
@@ -2065,10 +2421,144 @@ reprotect_and_return_err:
     notify_change(ictx->md_ctx, ictx->header_oid, NULL, ictx);
 
     ldout(ictx->cct, 20) << "finished flattening" << dendl;
+    return 0;
+  }
 
-  err:
-    delete[] buf;
-    return r;
+  /**
+   * stat every object of the image as of its current snapshot
+   *
+   * @param exists set to which objects exist
+   * @returns 0 on success, negative error code on failure
+   */
+  static int scan_objects(ImageCtx *ictx, ProgressContext &prog_ctx,
+			  vector<bool> *exists)
+  {
+    snap_t snap_id;
+    uint64_t num_objects;
+    {
+      RWLock::RLocker l(ictx->snap_lock);
+      snap_id = ictx->snap_id;
+      num_objects = ictx->get_num_objects(ictx->get_image_size(snap_id));
+    }
+
+    IoCtx io_ctx;
+    io_ctx.dup(ictx->data_ctx);
+    io_ctx.snap_set_read(snap_id);
+
+    uint64_t batch = MAX(1, ictx->cct->_conf->rbd_concurrent_management_ops);
+    vector<uint64_t> sizes(batch);
+    vector<time_t> mtimes(batch);
+    vector<librados::AioCompletion*> comps(batch);
+    exists->assign(num_objects, false);
+    int ret = 0;
+    for (uint64_t start = 0; start < num_objects; start += batch) {
+      uint64_t end = MIN(start + batch, num_objects);
+      for (uint64_t i = start; i < end; ++i) {
+	comps[i - start] = librados::Rados::aio_create_completion();
+	int r = io_ctx.aio_stat(ictx->get_object_name(i), comps[i - start],
+				&sizes[i - start], &mtimes[i - start]);
+	assert(r == 0);
+      }
+      for (uint64_t i = start; i < end; ++i) {
+	comps[i - start]->wait_for_complete();
+	int r = comps[i - start]->get_return_value();
+	comps[i - start]->release();
+	if (r == 0) {
+	  (*exists)[i] = true;
+	} else if (r != -ENOENT && ret == 0) {
+	  lderr(ictx->cct) << "error checking object " << i << ": "
+			   << cpp_strerror(r) << dendl;
+	  ret = r;
+	}
+      }
+      prog_ctx.update_progress(end, num_objects);
+    }
+    return ret;
+  }
+
+  int rebuild_object_map(ImageCtx *ictx, ProgressContext &prog_ctx)
+  {
+    ldout(ictx->cct, 20) << "rebuild_object_map " << ictx << dendl;
+
+    int r = ictx_check(ictx);
+    if (r < 0)
+      return r;
+    if (!ictx->object_map_enabled())
+      return -EINVAL;
+
+    snap_t snap_id;
+    {
+      RWLock::RLocker l(ictx->snap_lock);
+      snap_id = ictx->snap_id;
+    }
+    if (snap_id == CEPH_NOSNAP && ictx->read_only)
+      return -EROFS;
+
+    r = _flush(ictx);
+    if (r < 0)
+      return r;
+
+    vector<bool> exists;
+    r = scan_objects(ictx, prog_ctx, &exists);
+    if (r < 0)
+      return r;
+
+    r = cls_client::object_map_save(&ictx->md_ctx,
+				    ictx->object_map_name(snap_id), exists);
+    if (r < 0) {
+      lderr(ictx->cct) << "error saving object map: " << cpp_strerror(r)
+		       << dendl;
+      return r;
+    }
+    return ictx->refresh_object_map();
+  }
+
+  int check_object_map(ImageCtx *ictx, ProgressContext &prog_ctx,
+		       uint64_t *missing, uint64_t *stale)
+  {
+    ldout(ictx->cct, 20) << "check_object_map " << ictx << dendl;
+
+    int r = ictx_check(ictx);
+    if (r < 0)
+      return r;
+    if (!ictx->object_map_enabled())
+      return -EINVAL;
+
+    snap_t snap_id;
+    {
+      RWLock::RLocker l(ictx->snap_lock);
+      snap_id = ictx->snap_id;
+    }
+
+    r = _flush(ictx);
+    if (r < 0)
+      return r;
+
+    vector<bool> exists;
+    r = scan_objects(ictx, prog_ctx, &exists);
+    if (r < 0)
+      return r;
+
+    vector<bool> object_map;
+    r = cls_client::object_map_load(&ictx->md_ctx,
+				    ictx->object_map_name(snap_id),
+				    &object_map);
+    if (r < 0)
+      return r;
+
+    *missing = 0;
+    *stale = 0;
+    for (size_t i = 0; i < exists.size(); ++i) {
+      bool mapped = i < object_map.size() && object_map[i];
+      if (exists[i] && !mapped) {
+	ldout(ictx->cct, 1) << "object " << i << " exists but is not in the "
+			    << "object map" << dendl;
+	++*missing;
+      } else if (!exists[i] && mapped) {
+	++*stale;
+      }
+    }
+    return 0;
   }
 
   int list_lockers(ImageCtx *ictx,
@@ -2140,6 +2630,9 @@ reprotect_and_return_err:
       return r;
 
     RWLock::RLocker locker(ictx->md_lock);
+    // stop skipping I/O before anyone else can take the lock; the
+    // refresh after the notify decides whether we still hold it
+    ictx->untrust_object_map();
     r = rados::cls::lock::unlock(&ictx->md_ctx, ictx->header_oid,
 				 RBD_LOCK_NAME, cookie);
     if (r < 0)
@@ -2165,6 +2658,7 @@ reprotect_and_return_err:
       return -EINVAL;
     }
     RWLock::RLocker locker(ictx->md_lock);
+    ictx->untrust_object_map();
     r = rados::cls::lock::break_lock(&ictx->md_ctx, ictx->header_oid,
 				     RBD_LOCK_NAME, cookie, lock_client);
     if (r < 0)
@@ -2180,6 +2674,45 @@ reprotect_and_return_err:
     ctx->complete(comp->get_return_value());
   }
 
+  /// a stripe period being read by read_iterate
+  struct ReadIteratePeriod {
+    uint64_t off;    ///< relative to the start of the iteration
+    uint64_t len;
+    AioCompletion *comp;
+    map<uint64_t, bufferlist> extents;  ///< data read, relative to off
+
+    ReadIteratePeriod(uint64_t o, uint64_t l)
+      : off(o), len(l), comp(aio_create_completion()) {
+      comp->read_extents = &extents;
+    }
+    ~ReadIteratePeriod() {
+      comp->release();
+    }
+
+    /// pass the data and holes of the period to @cb, in order
+    int deliver(int (*cb)(uint64_t, size_t, const char *, void *),
+		void *arg) {
+      uint64_t pos = 0;
+      for (map<uint64_t, bufferlist>::iterator p = extents.begin();
+	   p != extents.end();
+	   ++p) {
+	int r;
+	if (p->first > pos) {
+	  r = cb(off + pos, p->first - pos, NULL, arg);
+	  if (r < 0)
+	    return r;
+	}
+	r = cb(off + p->first, p->second.length(), p->second.c_str(), arg);
+	if (r < 0)
+	  return r;
+	pos = p->first + p->second.length();
+      }
+      if (pos < len)
+	return cb(off + pos, len - pos, NULL, arg);
+      return 0;
+    }
+  };
+
   int64_t read_iterate(ImageCtx *ictx, uint64_t off, size_t len,
 		       int (*cb)(uint64_t, size_t, const char *, void *),
 		       void *arg)
@@ -2198,54 +2731,307 @@ reprotect_and_return_err:
     if (r < 0)
       return r;
 
+    // keep up to this many stripe periods in flight, and hand them to
+    // the callback in order as the oldest one completes
+    int concurrency = MAX(1, ictx->cct->_conf->rbd_concurrent_management_ops);
     int64_t total_read = 0;
+    uint64_t issued = 0;
     uint64_t period = ictx->get_stripe_period();
     uint64_t left = mylen;
+    std::list<ReadIteratePeriod*> in_flight;
 
     start_time = ceph_clock_now(ictx->cct);
-    while (left > 0) {
-      uint64_t period_off = off - (off % period);
-      uint64_t read_len = min(period_off + period - off, left);
+    while (true) {
+      while (r >= 0 && left > 0 && (int)in_flight.size() < concurrency) {
+	uint64_t period_off = off - (off % period);
+	uint64_t read_len = min(period_off + period - off, left);
+
+	ReadIteratePeriod *p = new ReadIteratePeriod(issued, read_len);
+	int ret = aio_read(ictx, off, read_len, NULL, NULL, p->comp);
+	if (ret < 0) {
+	  r = ret;
+	  if (aio_started(p->comp))
+	    p->comp->wait_for_complete();
+	  delete p;
+	  break;
+	}
+	in_flight.push_back(p);
+	issued += read_len;
+	left -= read_len;
+	off += read_len;
+      }
+      if (in_flight.empty())
+	break;
+
+      // on error, reap whatever is still in flight without delivering it
+      ReadIteratePeriod *p = in_flight.front();
+      in_flight.pop_front();
+      p->comp->wait_for_complete();
+      int ret = p->comp->get_return_value();
+      if (r >= 0 && ret < 0)
+	r = ret;
+      if (r >= 0) {
+	r = p->deliver(cb, arg);
+	if (r >= 0)
+	  total_read += p->len;
+      }
+      delete p;
+    }
+    if (r < 0)
+      return r;
 
-      bufferlist bl;
+    elapsed = ceph_clock_now(ictx->cct) - start_time;
+    ictx->perfcounter->tinc(l_librbd_rd_latency, elapsed);
+    ictx->perfcounter->inc(l_librbd_rd);
+    ictx->perfcounter->inc(l_librbd_rd_bytes, mylen);
+    double secs = (double)elapsed;
+    ldout(ictx->cct, 10) << "read_iterate " << ictx << " read " << total_read
+			 << " bytes in " << elapsed << " with " << concurrency
+			 << " periods in flight ("
+			 << (secs > 0 ? (uint64_t)(total_read / secs) : 0)
+			 << " bytes/sec)" << dendl;
+    return total_read;
+  }
+
+  /// an object whose clones are being listed by diff_iterate
+  struct DiffIterateObject {
+    uint64_t objectno;
+    vector<ObjectExtent> extents;
+    librados::snap_set_t snap_set;
+    int r;
+    librados::AioCompletion *comp;  ///< NULL if known not to exist
 
-      Mutex mylock("IoCtxImpl::write::mylock");
-      Cond cond;
-      bool done;
-      int ret;
+    DiffIterateObject() : objectno(0), r(0), comp(NULL) {}
+    ~DiffIterateObject() {
+      if (comp)
+	comp->release();
+    }
+  };
 
-      Context *ctx = new C_SafeCond(&mylock, &cond, &done, &ret);
-      AioCompletion *c = aio_create_completion_internal(ctx, rbd_ctx_cb);
-      r = aio_read(ictx, off, read_len, NULL, &bl, c);
-      if (r < 0) {
-	c->release();
-	delete ctx;
-	return r;
+  /// a stripe period being examined by diff_iterate
+  struct DiffIteratePeriod {
+    uint64_t off;    ///< image offset of the start of the extents
+    map<object_t, DiffIterateObject> objects;
+
+    DiffIteratePeriod(uint64_t o) : off(o) {}
+  };
+
+  static int simple_diff_cb(uint64_t off, size_t len, int exists, void *arg)
+  {
+    interval_set<uint64_t> *diff = static_cast<interval_set<uint64_t> *>(arg);
+    diff->insert(off, len);
+    return 0;
+  }
+
+  /**
+   * pass the parts of object extent @q that fall in object range
+   * [@ooff, @ooff + @olen) to @cb, as image extents
+   */
+  static int diff_report_object_range(const ObjectExtent &q, uint64_t base,
+				      uint64_t ooff, uint64_t olen, bool exists,
+				      int (*cb)(uint64_t, size_t, int, void *),
+				      void *arg)
+  {
+    uint64_t pos = q.offset;
+    for (vector<pair<uint64_t,uint64_t> >::const_iterator b =
+	   q.buffer_extents.begin();
+	 b != q.buffer_extents.end();
+	 ++b) {
+      uint64_t start = MAX(pos, ooff);
+      uint64_t end = MIN(pos + b->second, ooff + olen);
+      if (start < end) {
+	int r = cb(base + b->first + (start - pos), end - start, exists, arg);
+	if (r < 0)
+	  return r;
       }
+      pos += b->second;
+    }
+    return 0;
+  }
 
-      mylock.Lock();
-      while (!done)
-	cond.Wait(mylock);
-      mylock.Unlock();
+  int diff_iterate(ImageCtx *ictx, const char *fromsnapname,
+		   uint64_t off, uint64_t len,
+		   int (*cb)(uint64_t, size_t, int, void *),
+		   void *arg)
+  {
+    ldout(ictx->cct, 20) << "diff_iterate " << ictx << " off = " << off
+			 << " len = " << len << dendl;
 
-      c->release();
-      if (ret < 0)
-	return ret;
+    int r = ictx_check(ictx);
+    if (r < 0)
+      return r;
 
-      r = cb(total_read, ret, bl.c_str(), arg);
-      if (r < 0)
-	return r;
+    // make sure everything we wrote is visible to the osds
+    r = _flush(ictx);
+    if (r < 0)
+      return r;
+
+    uint64_t mylen = len;
+    r = clip_io(ictx, off, &mylen);
+    if (r < 0)
+      return r;
 
-      total_read += ret;
-      left -= ret;
-      off += ret;
+    snap_t from_snap_id = 0;
+    snap_t end_snap_id;
+    uint64_t overlap = 0;
+    bool use_object_map;
+    {
+      RWLock::RLocker l(ictx->snap_lock);
+      if (fromsnapname) {
+	from_snap_id = ictx->get_snap_id(fromsnapname);
+	if (from_snap_id == CEPH_NOSNAP)
+	  return -ENOENT;
+      }
+      end_snap_id = ictx->snap_id;
+      RWLock::RLocker l2(ictx->parent_lock);
+      if (ictx->parent)
+	ictx->get_parent_overlap(end_snap_id, &overlap);
+      use_object_map = ictx->object_map_enabled();
     }
+    if (from_snap_id >= end_snap_id)
+      return -EINVAL;
 
-    elapsed = ceph_clock_now(ictx->cct) - start_time;
-    ictx->perfcounter->tinc(l_librbd_rd_latency, elapsed);
-    ictx->perfcounter->inc(l_librbd_rd);
-    ictx->perfcounter->inc(l_librbd_rd_bytes, mylen);
-    return total_read;
+    // objects missing from both the old and the new object map cannot
+    // have changed; without a map for the old snapshot we have to ask
+    vector<bool> from_object_map;
+    if (use_object_map && from_snap_id) {
+      r = cls_client::object_map_load(&ictx->md_ctx,
+				      ictx->object_map_name(from_snap_id),
+				      &from_object_map);
+      if (r < 0) {
+	ldout(ictx->cct, 5) << "diff_iterate no object map for snap "
+			    << from_snap_id << ": " << cpp_strerror(r)
+			    << dendl;
+	use_object_map = false;
+      }
+    }
+
+    // an image diffed against nothing includes whatever it still
+    // inherits from its parent
+    interval_set<uint64_t> parent_diff;
+    if (from_snap_id == 0 && overlap > 0 && off < overlap) {
+      RWLock::RLocker l(ictx->parent_lock);
+      if (ictx->parent) {
+	r = diff_iterate(ictx->parent, NULL, off, MIN(overlap - off, mylen),
+			 simple_diff_cb, &parent_diff);
+	if (r < 0)
+	  return r;
+      }
+    }
+
+    librados::IoCtx head_ctx;
+    head_ctx.dup(ictx->data_ctx);
+    head_ctx.snap_set_read(CEPH_SNAPDIR);
+
+    int concurrency = MAX(1, ictx->cct->_conf->rbd_concurrent_management_ops);
+    uint64_t period = ictx->get_stripe_period();
+    uint64_t left = mylen;
+    std::list<DiffIteratePeriod*> in_flight;
+
+    while (true) {
+      while (r >= 0 && left > 0 && (int)in_flight.size() < concurrency) {
+	uint64_t period_off = off - (off % period);
+	uint64_t read_len = min(period_off + period - off, left);
+
+	map<object_t, vector<ObjectExtent> > object_extents;
+	Striper::file_to_extents(ictx->cct, ictx->format_string,
+				 &ictx->layout, off, read_len, object_extents,
+				 0);
+
+	DiffIteratePeriod *p = new DiffIteratePeriod(off);
+	in_flight.push_back(p);
+	for (map<object_t, vector<ObjectExtent> >::iterator q =
+	       object_extents.begin();
+	     q != object_extents.end();
+	     ++q) {
+	  DiffIterateObject &o = p->objects[q->first];
+	  o.extents.swap(q->second);
+	  o.objectno = o.extents.front().objectno;
+	  if (use_object_map && !ictx->object_may_exist(o.objectno) &&
+	      (from_snap_id == 0 || (o.objectno < from_object_map.size() &&
+				     !from_object_map[o.objectno]))) {
+	    o.r = -ENOENT;
+	    continue;
+	  }
+	  librados::ObjectReadOperation op;
+	  op.list_snaps(&o.snap_set, &o.r);
+	  o.comp = librados::Rados::aio_create_completion();
+	  int ret = head_ctx.aio_operate(q->first.name, o.comp, &op, NULL);
+	  if (ret < 0) {
+	    r = ret;
+	    break;
+	  }
+	}
+	left -= read_len;
+	off += read_len;
+      }
+      if (in_flight.empty())
+	break;
+
+      // on error, reap whatever is still in flight without reporting it
+      DiffIteratePeriod *p = in_flight.front();
+      in_flight.pop_front();
+      for (map<object_t, DiffIterateObject>::iterator q = p->objects.begin();
+	   q != p->objects.end();
+	   ++q) {
+	DiffIterateObject &o = q->second;
+	if (o.comp) {
+	  o.comp->wait_for_complete();
+	  int ret = o.comp->get_return_value();
+	  if (ret < 0)
+	    o.r = ret;
+	}
+	if (r < 0)
+	  continue;
+
+	ldout(ictx->cct, 20) << "diff_iterate " << q->first << " r = " << o.r
+			     << dendl;
+	if (o.r == -ENOENT) {
+	  // the object never existed here; the parent may still show through
+	  if (parent_diff.empty())
+	    continue;
+	  for (vector<ObjectExtent>::iterator e = o.extents.begin();
+	       r >= 0 && e != o.extents.end();
+	       ++e) {
+	    for (vector<pair<uint64_t,uint64_t> >::iterator b =
+		   e->buffer_extents.begin();
+		 r >= 0 && b != e->buffer_extents.end();
+		 ++b) {
+	      interval_set<uint64_t> inherited;
+	      inherited.insert(p->off + b->first, b->second);
+	      inherited.intersection_of(parent_diff);
+	      for (interval_set<uint64_t>::iterator s = inherited.begin();
+		   r >= 0 && s != inherited.end();
+		   ++s)
+		r = cb(s.get_start(), s.get_len(), true, arg);
+	    }
+	  }
+	  continue;
+	}
+	if (o.r < 0) {
+	  lderr(ictx->cct) << "diff_iterate error listing snaps of "
+			   << q->first << ": " << cpp_strerror(o.r) << dendl;
+	  r = o.r;
+	  continue;
+	}
+
+	interval_set<uint64_t> diff;
+	bool end_exists;
+	calc_snap_set_diff(ictx->cct, o.snap_set, from_snap_id, end_snap_id,
+			   &diff, &end_exists);
+	for (vector<ObjectExtent>::iterator e = o.extents.begin();
+	     r >= 0 && e != o.extents.end();
+	     ++e) {
+	  for (interval_set<uint64_t>::iterator s = diff.begin();
+	       r >= 0 && s != diff.end();
+	       ++s)
+	    r = diff_report_object_range(*e, p->off, s.get_start(),
+					 s.get_len(), end_exists, cb, arg);
+	}
+      }
+      delete p;
+    }
+    return r < 0 ? r : 0;
   }
 
   int simple_read_cb(uint64_t ofs, size_t len, const char *buf, void *arg)
@@ -2435,6 +3221,12 @@ reprotect_and_return_err:
     req->complete(rados_aio_get_return_value(c));
   }
 
+  void rados_ctx_cb(rados_completion_t c, void *arg)
+  {
+    Context *ctx = reinterpret_cast<Context *>(arg);
+    ctx->complete(rados_aio_get_return_value(c));
+  }
+
   // validate extent against image size; clip to image size if necessary
   int clip_io(ImageCtx *ictx, uint64_t off, uint64_t *len)
   {
@@ -2472,6 +3264,10 @@ reprotect_and_return_err:
     if (r < 0)
       return r;
 
+    // once in the persistent cache, writes are as safe as in the cluster
+    if (ictx->write_log)
+      return ictx->write_log->flush();
+
     return _flush(ictx);
   }
 
@@ -2479,8 +3275,17 @@ reprotect_and_return_err:
   {
     CephContext *cct = ictx->cct;
     int r;
+    // make the persistent cache's writes visible to the osds, too
+    if (ictx->write_log) {
+      r = ictx->write_log->writeback();
+      if (r < 0) {
+	lderr(cct) << "_flush " << ictx << " writeback r = " << r << dendl;
+	return r;
+      }
+    }
+
     // flush any outstanding writes
-    if (ictx->object_cacher) {
+    if (!ictx->cache_shards.empty()) {
       r = ictx->flush_cache();
     } else {
       r = ictx->data_ctx.aio_flush();
@@ -2492,6 +3297,21 @@ reprotect_and_return_err:
     return r;
   }
 
+  static int _aio_write(ImageCtx *ictx, uint64_t off, size_t mylen,
+			const char *buf, AioCompletion *c);
+  static int _aio_discard(ImageCtx *ictx, uint64_t off, uint64_t len,
+			  AioCompletion *c);
+
+  /// complete @c right away, for requests the persistent cache took
+  static void complete_logged(ImageCtx *ictx, aio_type_t type,
+			      AioCompletion *c)
+  {
+    c->get();
+    c->init_time(ictx, type);
+    c->finish_adding_requests(ictx->cct);
+    c->put();
+  }
+
   int aio_write(ImageCtx *ictx, uint64_t off, size_t len, const char *buf,
 		AioCompletion *c)
   {
@@ -2511,6 +3331,33 @@ reprotect_and_return_err:
     if (r < 0)
       return r;
 
+    if (ictx->write_log) {
+      {
+	RWLock::RLocker l(ictx->snap_lock);
+	if (ictx->snap_id != CEPH_NOSNAP || ictx->read_only)
+	  return -EROFS;
+      }
+      bufferlist bl;
+      bl.append(buf, mylen);
+      r = ictx->write_log->append_write(off, bl);
+      if (r < 0)
+	return r;
+      complete_logged(ictx, AIO_TYPE_WRITE, c);
+    } else {
+      r = _aio_write(ictx, off, mylen, buf, c);
+    }
+
+    ictx->perfcounter->inc(l_librbd_aio_wr);
+    ictx->perfcounter->inc(l_librbd_aio_wr_bytes, mylen);
+    return r;
+  }
+
+  static int _aio_write(ImageCtx *ictx, uint64_t off, size_t mylen,
+			const char *buf, AioCompletion *c)
+  {
+    CephContext *cct = ictx->cct;
+    int r = 0;
+
     ictx->snap_lock.get_read();
     snapid_t snap_id = ictx->snap_id;
     ::SnapContext snapc = ictx->snapc;
@@ -2543,9 +3390,9 @@ reprotect_and_return_err:
 	bl.append(buf + q->first, q->second);
       }
 
-      if (ictx->object_cacher) {
+      if (!ictx->cache_shards.empty()) {
 	// may block
-	ictx->write_to_cache(p->oid, bl, p->length, p->offset);
+	ictx->write_to_cache(p->oid, p->objectno, bl, p->length, p->offset);
       } else {
 	// reverse map this object extent onto the parent
 	vector<pair<uint64_t,uint64_t> > objectx;
@@ -2568,9 +3415,6 @@ reprotect_and_return_err:
     c->finish_adding_requests(ictx->cct);
     c->put();
 
-    ictx->perfcounter->inc(l_librbd_aio_wr);
-    ictx->perfcounter->inc(l_librbd_aio_wr_bytes, mylen);
-
     /* FIXME: cleanup all the allocated stuff */
     return r;
   }
@@ -2592,6 +3436,31 @@ reprotect_and_return_err:
     if (r < 0)
       return r;
 
+    if (ictx->write_log) {
+      {
+	RWLock::RLocker l(ictx->snap_lock);
+	if (ictx->snap_id != CEPH_NOSNAP || ictx->read_only)
+	  return -EROFS;
+      }
+      r = ictx->write_log->append_discard(off, len);
+      if (r < 0)
+	return r;
+      complete_logged(ictx, AIO_TYPE_DISCARD, c);
+    } else {
+      r = _aio_discard(ictx, off, len, c);
+    }
+
+    ictx->perfcounter->inc(l_librbd_aio_discard);
+    ictx->perfcounter->inc(l_librbd_aio_discard_bytes, len);
+    return r;
+  }
+
+  static int _aio_discard(ImageCtx *ictx, uint64_t off, uint64_t len,
+			  AioCompletion *c)
+  {
+    CephContext *cct = ictx->cct;
+    int r;
+
     // TODO: check for snap
     ictx->snap_lock.get_read();
     snapid_t snap_id = ictx->snap_id;
@@ -2646,21 +3515,53 @@ reprotect_and_return_err:
     }
     r = 0;
   done:
-    if (ictx->object_cacher) {
-      Mutex::Locker l(ictx->cache_lock);
-      ictx->object_cacher->discard_set(ictx->object_set, extents);
-    }
+    if (!ictx->cache_shards.empty())
+      ictx->discard_from_cache(extents);
 
     c->finish_adding_requests(ictx->cct);
     c->put();
 
-    ictx->perfcounter->inc(l_librbd_aio_discard);
-    ictx->perfcounter->inc(l_librbd_aio_discard_bytes, len);
-
     /* FIXME: cleanup all the allocated stuff */
     return r;
   }
 
+  void writeback_cb(completion_t cb, void *arg)
+  {
+    Context *ctx = reinterpret_cast<Context *>(arg);
+    AioCompletion *comp = reinterpret_cast<AioCompletion *>(cb);
+    int r = comp->get_return_value();
+    comp->release();
+    ctx->complete(r);
+  }
+
+  void aio_writeback(ImageCtx *ictx, uint64_t off, uint64_t len,
+		     const char *buf, Context *ctx)
+  {
+    ldout(ictx->cct, 20) << "aio_writeback " << ictx << " off = " << off
+			 << " len = " << len << (buf ? "" : " discard")
+			 << dendl;
+    // the image may have shrunk since this was logged.  callers may
+    // hold md_lock while they wait for writeback, so don't use clip_io()
+    {
+      RWLock::RLocker l(ictx->snap_lock);
+      uint64_t image_size = ictx->get_image_size(CEPH_NOSNAP);
+      len = off < image_size ? MIN(len, image_size - off) : 0;
+    }
+
+    AioCompletion *comp = aio_create_completion_internal(ctx, writeback_cb);
+    comp->get();
+    int r;
+    if (buf)
+      r = _aio_write(ictx, off, len, buf, comp);
+    else
+      r = _aio_discard(ictx, off, len, comp);
+    if (r < 0 && !aio_started(comp)) {
+      comp->release();
+      ctx->complete(r);
+    }
+    comp->put();
+  }
+
   void rbd_req_cb(completion_t cb, void *arg)
   {
     AioRequest *req = reinterpret_cast<AioRequest *>(arg);
@@ -2677,6 +3578,81 @@ reprotect_and_return_err:
     return aio_read(ictx, image_extents, buf, bl, c);
   }
 
+  /// a readahead into the object cacher; the data is dropped
+  struct C_RBD_Readahead : public Context {
+    ImageCtx *ictx;
+    object_t oid;
+    uint64_t offset;
+    uint64_t length;
+    bufferlist bl;
+
+    C_RBD_Readahead(ImageCtx *ictx, object_t oid, uint64_t offset,
+		    uint64_t length)
+      : ictx(ictx), oid(oid), offset(offset), length(length) {}
+    void finish(int r) {
+      ldout(ictx->cct, 20) << "C_RBD_Readahead on " << oid << ": " << offset
+			   << "~" << length << " r = " << r << dendl;
+      ictx->readahead.dec_pending();
+    }
+  };
+
+  /// read ahead into the object cacher if @image_extents continue a
+  /// sequential stream
+  static void readahead(ImageCtx *ictx,
+			const vector<pair<uint64_t,uint64_t> >& image_extents)
+  {
+    uint64_t total_bytes = 0;
+    for (vector<pair<uint64_t,uint64_t> >::const_iterator p =
+	   image_extents.begin();
+	 p != image_extents.end();
+	 ++p)
+      total_bytes += p->second;
+
+    {
+      Mutex::Locker l(ictx->cache_lock);
+      uint64_t disable_after =
+	ictx->cct->_conf->rbd_readahead_disable_after_bytes;
+      if (disable_after && ictx->total_bytes_read > disable_after)
+	return;
+      ictx->total_bytes_read += total_bytes;
+    }
+
+    ictx->snap_lock.get_read();
+    uint64_t image_size = ictx->get_image_size(ictx->snap_id);
+    ictx->snap_lock.put_read();
+
+    uint64_t hit_bytes;
+    pair<uint64_t, uint64_t> extent =
+      ictx->readahead.update(image_extents, image_size, &hit_bytes);
+    if (hit_bytes)
+      ictx->perfcounter->inc(l_librbd_readahead_hit_bytes, hit_bytes);
+    if (extent.second == 0)
+      return;
+
+    ldout(ictx->cct, 20) << "readahead " << extent.first << "~"
+			 << extent.second << dendl;
+    map<object_t,vector<ObjectExtent> > object_extents;
+    Striper::file_to_extents(ictx->cct, ictx->format_string, &ictx->layout,
+			     extent.first, extent.second, object_extents, 0);
+    for (map<object_t,vector<ObjectExtent> >::iterator p =
+	   object_extents.begin();
+	 p != object_extents.end();
+	 ++p) {
+      for (vector<ObjectExtent>::iterator q = p->second.begin();
+	   q != p->second.end();
+	   ++q) {
+	C_RBD_Readahead *req_comp = new C_RBD_Readahead(ictx, q->oid,
+							 q->offset,
+							 q->length);
+	ictx->readahead.inc_pending();
+	ictx->aio_read_from_cache(q->oid, q->objectno, &req_comp->bl,
+				  q->length, q->offset, req_comp);
+      }
+    }
+    ictx->perfcounter->inc(l_librbd_readahead);
+    ictx->perfcounter->inc(l_librbd_readahead_bytes, extent.second);
+  }
+
   int aio_read(ImageCtx *ictx, const vector<pair<uint64_t,uint64_t> >& image_extents,
 	       char *buf, bufferlist *pbl, AioCompletion *c)
   {
@@ -2692,6 +3668,9 @@ reprotect_and_return_err:
 
     // map
     map<object_t,vector<ObjectExtent> > object_extents;
+    // data still in the persistent cache, by buffer offset
+    map<uint64_t, bufferlist> log_hits;
+    bool use_log = ictx->write_log && snap_id == CEPH_NOSNAP;
 
     uint64_t buffer_ofs = 0;
     for (vector<pair<uint64_t,uint64_t> >::const_iterator p = image_extents.begin();
@@ -2702,11 +3681,33 @@ reprotect_and_return_err:
       if (r < 0)
 	return r;
 
-      Striper::file_to_extents(ictx->cct, ictx->format_string, &ictx->layout,
-			       p->first, len, object_extents, buffer_ofs);
+      if (use_log) {
+	vector<pair<uint64_t,uint64_t> > misses;
+	map<uint64_t, bufferlist> hits;
+	r = ictx->write_log->read(p->first, len, &misses, &hits);
+	if (r < 0)
+	  return r;
+	for (vector<pair<uint64_t,uint64_t> >::iterator q = misses.begin();
+	     q != misses.end();
+	     ++q)
+	  Striper::file_to_extents(ictx->cct, ictx->format_string,
+				   &ictx->layout, q->first, q->second,
+				   object_extents,
+				   buffer_ofs + q->first - p->first);
+	for (map<uint64_t, bufferlist>::iterator q = hits.begin();
+	     q != hits.end();
+	     ++q)
+	  log_hits[buffer_ofs + q->first - p->first].claim(q->second);
+      } else {
+	Striper::file_to_extents(ictx->cct, ictx->format_string, &ictx->layout,
+				 p->first, len, object_extents, buffer_ofs);
+      }
       buffer_ofs += len;
     }
 
+    if (!ictx->cache_shards.empty())
+      readahead(ictx, image_extents);
+
     int64_t ret;
 
     c->read_buf = buf;
@@ -2715,6 +3716,18 @@ reprotect_and_return_err:
 
     c->get();
     c->init_time(ictx, AIO_TYPE_READ);
+    for (map<uint64_t, bufferlist>::iterator p = log_hits.begin();
+	 p != log_hits.end();
+	 ++p) {
+      uint64_t len = p->second.length();
+      vector<pair<uint64_t,uint64_t> > buffer_extents(1, make_pair(p->first,
+								   len));
+      c->add_request();
+      c->lock.Lock();
+      c->destriper.add_partial_result(ictx->cct, p->second, buffer_extents);
+      c->lock.Unlock();
+      c->complete_request(ictx->cct, len);
+    }
     for (map<object_t,vector<ObjectExtent> >::iterator p = object_extents.begin(); p != object_extents.end(); ++p) {
       for (vector<ObjectExtent>::iterator q = p->second.begin(); q != p->second.end(); ++q) {
 	ldout(ictx->cct, 20) << " oid " << q->oid << " " << q->offset << "~" << q->length
@@ -2728,9 +3741,9 @@ reprotect_and_return_err:
 	req_comp->set_req(req);
 	c->add_request();
 
-	if (ictx->object_cacher) {
+	if (!ictx->cache_shards.empty()) {
 	  C_CacheRead *cache_comp = new C_CacheRead(req_comp, req);
-	  ictx->aio_read_from_cache(q->oid, &req->data(),
+	  ictx->aio_read_from_cache(q->oid, q->objectno, &req->data(),
 				    q->length, q->offset,
 				    cache_comp);
 	} else {
@@ -45,9 +45,27 @@ enum {
   l_librbd_notify,
   l_librbd_resize,
 
+  l_librbd_readahead,            // readaheads issued
+  l_librbd_readahead_bytes,      // bytes read ahead
+  l_librbd_readahead_hit_bytes,  // bytes read that had been read ahead
+
+  l_librbd_copyup_on_read,            // objects copied up after a read
+  l_librbd_copyup_on_read_bytes,
+  l_librbd_copyup_on_read_throttled,  // copyups skipped, too many in flight
+
+  l_librbd_pcache_wr,              // writes and discards logged
+  l_librbd_pcache_wr_bytes,
+  l_librbd_pcache_wr_latency,
+  l_librbd_pcache_rd_hit_bytes,    // bytes read from the log
+  l_librbd_pcache_writeback,       // log entries written back
+  l_librbd_pcache_writeback_bytes,
+  l_librbd_pcache_full,            // appends that waited for free space
+
   l_librbd_last,
 };
 
+class Context;
+
 namespace librbd {
 
   struct AioCompletion;
@@ -122,6 +140,9 @@ namespace librbd {
   int copyup_block(ImageCtx *ictx, uint64_t offset, size_t len,
 		   const char *buf);
   int flatten(ImageCtx *ictx, ProgressContext &prog_ctx);
+  int rebuild_object_map(ImageCtx *ictx, ProgressContext &prog_ctx);
+  int check_object_map(ImageCtx *ictx, ProgressContext &prog_ctx,
+		       uint64_t *missing, uint64_t *stale);
 
   /* cooperative locking */
   int list_lockers(ImageCtx *ictx,
@@ -136,7 +157,7 @@ namespace librbd {
   int break_lock(ImageCtx *ictx, const std::string& client,
 		 const std::string& cookie);
 
-  void trim_image(ImageCtx *ictx, uint64_t newsize, ProgressContext& prog_ctx);
+  int trim_image(ImageCtx *ictx, uint64_t newsize, ProgressContext& prog_ctx);
   int read_rbd_info(librados::IoCtx& io_ctx, const std::string& info_oid,
 		    struct rbd_info *info);
 
@@ -165,6 +186,10 @@ namespace librbd {
   int64_t read_iterate(ImageCtx *ictx, uint64_t off, size_t len,
 		       int (*cb)(uint64_t, size_t, const char *, void *),
 		       void *arg);
+  int diff_iterate(ImageCtx *ictx, const char *fromsnapname,
+		   uint64_t off, uint64_t len,
+		   int (*cb)(uint64_t, size_t, int, void *),
+		   void *arg);
   ssize_t read(ImageCtx *ictx, uint64_t off, size_t len, char *buf);
   ssize_t read(ImageCtx *ictx, const vector<pair<uint64_t,uint64_t> >& image_extents,
 	       char *buf, bufferlist *pbl);
@@ -179,6 +204,8 @@ namespace librbd {
 	       char *buf, bufferlist *pbl, AioCompletion *c);
   int flush(ImageCtx *ictx);
   int _flush(ImageCtx *ictx);
+  void aio_writeback(ImageCtx *ictx, uint64_t off, uint64_t len,
+		     const char *buf, Context *ctx);
 
   ssize_t handle_sparse_read(CephContext *cct,
 			     ceph::bufferlist data_bl,
@@ -196,6 +223,7 @@ namespace librbd {
   // raw callbacks
   int simple_read_cb(uint64_t ofs, size_t len, const char *buf, void *arg);
   void rados_req_cb(rados_completion_t cb, void *arg);
+  void rados_ctx_cb(rados_completion_t cb, void *arg);
   void rbd_req_cb(completion_t cb, void *arg);
 }
 
@@ -321,6 +321,19 @@ namespace librbd {
     return librbd::flatten(ictx, prog_ctx);
   }
 
+  int Image::rebuild_object_map(librbd::ProgressContext& prog_ctx)
+  {
+    ImageCtx *ictx = (ImageCtx *)ctx;
+    return librbd::rebuild_object_map(ictx, prog_ctx);
+  }
+
+  int Image::check_object_map(librbd::ProgressContext& prog_ctx,
+			      uint64_t *missing, uint64_t *stale)
+  {
+    ImageCtx *ictx = (ImageCtx *)ctx;
+    return librbd::check_object_map(ictx, prog_ctx, missing, stale);
+  }
+
   int Image::list_children(set<pair<string, string> > *children)
   {
     ImageCtx *ictx = (ImageCtx *)ctx;
@@ -430,6 +443,13 @@ namespace librbd {
     return librbd::read_iterate(ictx, ofs, len, cb, arg);
   }
 
+  int Image::diff_iterate(const char *fromsnapname, uint64_t ofs, uint64_t len,
+			  int (*cb)(uint64_t, size_t, int, void *), void *arg)
+  {
+    ImageCtx *ictx = (ImageCtx *)ctx;
+    return librbd::diff_iterate(ictx, fromsnapname, ofs, len, cb, arg);
+  }
+
   ssize_t Image::write(uint64_t ofs, size_t len, bufferlist& bl)
   {
     ImageCtx *ictx = (ImageCtx *)ctx;
@@ -638,6 +658,23 @@ extern "C" int rbd_flatten_with_progress(rbd_image_t image,
   return librbd::flatten(ictx, prog_ctx);
 }
 
+extern "C" int rbd_rebuild_object_map(rbd_image_t image,
+				      librbd_progress_fn_t cb, void *cbdata)
+{
+  librbd::ImageCtx *ictx = (librbd::ImageCtx *)image;
+  librbd::CProgressContext prog_ctx(cb, cbdata);
+  return librbd::rebuild_object_map(ictx, prog_ctx);
+}
+
+extern "C" int rbd_check_object_map(rbd_image_t image,
+				    librbd_progress_fn_t cb, void *cbdata,
+				    uint64_t *missing, uint64_t *stale)
+{
+  librbd::ImageCtx *ictx = (librbd::ImageCtx *)image;
+  librbd::CProgressContext prog_ctx(cb, cbdata);
+  return librbd::check_object_map(ictx, prog_ctx, missing, stale);
+}
+
 extern "C" int rbd_rename(rados_ioctx_t src_p, const char *srcname,
 			  const char *destname)
 {
@@ -1005,6 +1042,15 @@ extern "C" int64_t rbd_read_iterate(rbd_image_t image, uint64_t ofs, size_t len,
   return librbd::read_iterate(ictx, ofs, len, cb, arg);
 }
 
+extern "C" int rbd_diff_iterate(rbd_image_t image, const char *fromsnapname,
+				uint64_t ofs, uint64_t len,
+				int (*cb)(uint64_t, size_t, int, void *),
+				void *arg)
+{
+  librbd::ImageCtx *ictx = (librbd::ImageCtx *)image;
+  return librbd::diff_iterate(ictx, fromsnapname, ofs, len, cb, arg);
+}
+
 extern "C" ssize_t rbd_write(rbd_image_t image, uint64_t ofs, size_t len,
 			     const char *buf)
 {
@@ -21,7 +21,7 @@
 
 class MOSDFailure : public PaxosServiceMessage {
 
-  static const int HEAD_VERSION = 3;
+  static const int HEAD_VERSION = 4;
 
  public:
   uuid_d fsid;
@@ -29,11 +29,14 @@ class MOSDFailure : public PaxosServiceMessage {
   __u8 is_failed;
   epoch_t       epoch;
   int32_t failed_for;  // known to be failed since at least this long
+  double grace;        // reporter's grace period for the target, 0 if unknown
 
-  MOSDFailure() : PaxosServiceMessage(MSG_OSD_FAILURE, 0, HEAD_VERSION) { }
-  MOSDFailure(const uuid_d &fs, const entity_inst_t& f, int duration, epoch_t e)
+  MOSDFailure() : PaxosServiceMessage(MSG_OSD_FAILURE, 0, HEAD_VERSION), grace(0) { }
+  MOSDFailure(const uuid_d &fs, const entity_inst_t& f, int duration, epoch_t e,
+	      double g = 0)
     : PaxosServiceMessage(MSG_OSD_FAILURE, e, HEAD_VERSION),
-      fsid(fs), target_osd(f), is_failed(true), epoch(e), failed_for(duration) { }
+      fsid(fs), target_osd(f), is_failed(true), epoch(e), failed_for(duration),
+      grace(g) { }
 private:
   ~MOSDFailure() {}
 
@@ -56,6 +59,10 @@ public:
       ::decode(failed_for, p);
     else
       failed_for = 0;
+    if (header.version >= 4)
+      ::decode(grace, p);
+    else
+      grace = 0;
   }
   void encode_payload(uint64_t features) {
     paxos_encode();
@@ -64,13 +71,17 @@ public:
     ::encode(epoch, payload);
     ::encode(is_failed, payload);
     ::encode(failed_for, payload);
+    ::encode(grace, payload);
   }
 
   const char *get_type_name() const { return "osd_failure"; }
   void print(ostream& out) const {
     out << "osd_failure("
 	<< (is_failed ? "failed " : "recovered ")
-	<< target_osd << " for " << failed_for << "sec e" << epoch
+	<< target_osd << " for " << failed_for << "sec";
+    if (grace)
+      out << " grace " << grace;
+    out << " e" << epoch
 	<< " v" << version << ")";
   }
 };
@@ -18,7 +18,7 @@
 #include "msg/Message.h"
 
 class MRecoveryReserve : public Message {
-  static const int HEAD_VERSION = 1;
+  static const int HEAD_VERSION = 2;
   static const int COMPAT_VERSION = 1;
 public:
   pg_t pgid;
@@ -29,16 +29,18 @@ public:
     RELEASE = 2,
   };
   int type;
+  unsigned priority;  ///< of the REQUEST; 0 from peers that predate it
 
   MRecoveryReserve()
     : Message(MSG_OSD_RECOVERY_RESERVE, HEAD_VERSION, COMPAT_VERSION),
-      query_epoch(0), type(-1) {}
+      query_epoch(0), type(-1), priority(0) {}
   MRecoveryReserve(int type,
 		   pg_t pgid,
-		   epoch_t query_epoch)
+		   epoch_t query_epoch,
+		   unsigned prio = 0)
     : Message(MSG_OSD_RECOVERY_RESERVE, HEAD_VERSION, COMPAT_VERSION),
       pgid(pgid), query_epoch(query_epoch),
-      type(type) {}
+      type(type), priority(prio) {}
 
   const char *get_type_name() const {
     return "MRecoveryReserve";
@@ -58,6 +60,8 @@ public:
       break;
     }
     out << " pgid: " << pgid << ", query_epoch: " << query_epoch;
+    if (type == REQUEST)
+      out << ", priority: " << priority;
     return;
   }
 
@@ -66,12 +70,15 @@ public:
     ::decode(pgid, p);
     ::decode(query_epoch, p);
     ::decode(type, p);
+    if (header.version >= 2)
+      ::decode(priority, p);
   }
 
   void encode_payload(uint64_t features) {
     ::encode(pgid, payload);
     ::encode(query_epoch, payload);
     ::encode(type, payload);
+    ::encode(priority, payload);
   }
 };
 
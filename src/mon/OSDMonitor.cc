@@ -127,10 +127,15 @@ void OSDMonitor::update_from_paxos()
     OSDMap::Incremental inc(inc_bl);
     osdmap.apply_incremental(inc);
 
-    // write out the full map for all past epochs
-    bufferlist full_bl;
-    osdmap.encode(full_bl);
-    put_version_full(&t, osdmap.epoch, full_bl);
+    // write out a full map every mon_osdmap_full_interval epochs; the
+    // others are rebuilt from incrementals (see get_full_map_bl())
+    if (osdmap.epoch == 1 ||
+	g_conf->mon_osdmap_full_interval <= 1 ||
+	osdmap.epoch % g_conf->mon_osdmap_full_interval == 0) {
+      bufferlist full_bl;
+      osdmap.encode(full_bl);
+      put_version_full(&t, osdmap.epoch, full_bl);
+    }
 
     // share
     dout(1) << osdmap << dendl;
@@ -522,6 +527,40 @@ void OSDMonitor::update_trim()
   }
 }
 
+/**
+ * trim old epochs, keeping a full map at the new first committed epoch
+ *
+ * Which epochs have a full map depends on each monitor's own
+ * mon_osdmap_full_interval, so the leader writes the full map for the
+ * trim target into the trim transaction itself; every monitor then has
+ * a full map to send and to rebuild the later epochs from.
+ */
+void OSDMonitor::encode_trim(MonitorDBStore::Transaction *t)
+{
+  epoch_t first = get_first_committed();
+  epoch_t trim_to = get_trim_to();
+  if (first >= trim_to)
+    return;
+
+  bufferlist bl;
+  int err = get_full_map_bl(trim_to, bl);
+  if (err < 0) {
+    derr << __func__ << " unable to get full map for " << trim_to << ": "
+	 << cpp_strerror(err) << ", not trimming" << dendl;
+    return;
+  }
+  dout(10) << __func__ << " " << first << " -> " << trim_to
+	   << ", full map " << bl.length() << " bytes" << dendl;
+  put_version_full(t, trim_to, bl);
+
+  // peons may hold full maps the leader never stored; drop them all
+  for (epoch_t e = first; e < trim_to; ++e) {
+    t->erase(get_service_name(), e);
+    t->erase(get_service_name(), mon->store->combine_strings("full", e));
+  }
+  put_first_committed(t, trim_to);
+}
+
 bool OSDMonitor::should_trim()
 {
   update_trim();
@@ -768,6 +807,11 @@ void OSDMonitor::check_failures(utime_t now)
 bool OSDMonitor::check_failure(utime_t now, int target_osd, failure_info_t& fi)
 {
   utime_t orig_grace(g_conf->osd_heartbeat_grace, 0);
+  // the reporters may have learned that the target answers reliably
+  // within a shorter grace period
+  double reporter_grace = fi.get_reporter_grace();
+  if (reporter_grace > 0 && reporter_grace < (double)orig_grace)
+    orig_grace.set_from_double(reporter_grace);
   utime_t max_failed_since = fi.get_failed_since();
   utime_t failed_for = now - max_failed_since;
 
@@ -842,7 +886,12 @@ bool OSDMonitor::prepare_failure(MOSDFailure *m)
 
   // calculate failure time
   utime_t now = ceph_clock_now(g_ceph_context);
-  utime_t failed_since = m->get_recv_stamp() - utime_t(m->failed_for ? m->failed_for : g_conf->osd_heartbeat_grace, 0);
+  utime_t failed_for;
+  if (m->grace > 0)  // failed_for is in whole seconds; grace may be less
+    failed_for.set_from_double(MAX((double)m->failed_for, m->grace));
+  else
+    failed_for = utime_t(m->failed_for ? m->failed_for : g_conf->osd_heartbeat_grace, 0);
+  utime_t failed_since = m->get_recv_stamp() - failed_for;
   
   if (m->if_osd_failed()) {
     // add a report
@@ -1077,6 +1126,8 @@ bool OSDMonitor::prepare_boot(MOSDBoot *m)
 	xi.laggy_probability * (1.0 - g_conf->mon_osd_laggy_weight);
       dout(10) << " laggy, now xi " << xi << dendl;
     }
+    // record the features so we know what the up osds can all do
+    xi.features = m->get_connection()->get_features();
     pending_inc.new_xinfo[from] = xi;
 
     // wait
@@ -1371,9 +1422,8 @@ MOSDMap *OSDMonitor::build_incremental(epoch_t from, epoch_t to)
     } else {
       assert(err == -ENOENT);
       assert(!bl.length());
-      get_version("full", e, bl);
+      get_full_map_bl(e, bl);
       if (bl.length() > 0) {
-      //else if (get_version("full", e, bl) > 0) {
       dout(20) << "build_incremental   full " << e << " "
 	       << bl.length() << " bytes" << dendl;
       m->maps[e] = bl;
@@ -1385,6 +1435,81 @@ MOSDMap *OSDMonitor::build_incremental(epoch_t from, epoch_t to)
   return m;
 }
 
+/**
+ * get the full map for epoch @e
+ *
+ * Only every mon_osdmap_full_interval'th full map is stored; the others
+ * are rebuilt from the closest earlier full map and the incrementals
+ * after it.
+ */
+int OSDMonitor::get_full_map_bl(epoch_t e, bufferlist& bl)
+{
+  if (e == osdmap.get_epoch()) {
+    osdmap.encode(bl);
+    return 0;
+  }
+  if (get_version_full(e, bl) == 0)
+    return 0;
+  if (e > osdmap.get_epoch() || e < get_first_committed())
+    return -ENOENT;
+
+  epoch_t base = e;
+  bufferlist base_bl;
+  while (base > get_first_committed()) {
+    --base;
+    if (get_version_full(base, base_bl) == 0)
+      break;
+  }
+  if (!base_bl.length())
+    return -ENOENT;
+  dout(20) << "get_full_map_bl rebuilding " << e << " from " << base << dendl;
+
+  OSDMap m;
+  m.decode(base_bl);
+  for (epoch_t i = base + 1; i <= e; ++i) {
+    bufferlist inc_bl;
+    int err = get_version(i, inc_bl);
+    if (err < 0)
+      return err;
+    OSDMap::Incremental inc(inc_bl);
+    m.apply_incremental(inc);
+  }
+  m.encode(bl);
+  return 0;
+}
+
+/**
+ * get the oldest full map we can serve
+ *
+ * That is the one at the first committed epoch.  Should it be missing
+ * (a store trimmed before the trim transaction carried the full map)
+ * fall back to the nearest full map we do have after it, and finally
+ * to the current map.
+ *
+ * @param bl [out] the encoded full map
+ * @return the epoch of the map in @bl
+ */
+epoch_t OSDMonitor::get_oldest_full_map_bl(bufferlist& bl)
+{
+  epoch_t e = get_first_committed();
+  if (get_full_map_bl(e, bl) == 0)
+    return e;
+  while (++e < osdmap.get_epoch()) {
+    bl.clear();
+    if (get_version_full(e, bl) == 0 && bl.length()) {
+      derr << __func__ << " no full map for first committed "
+	   << get_first_committed() << ", falling back to " << e << dendl;
+      return e;
+    }
+  }
+  derr << __func__ << " no full map for first committed "
+       << get_first_committed() << ", falling back to current "
+       << osdmap.get_epoch() << dendl;
+  bl.clear();
+  osdmap.encode(bl);
+  return osdmap.get_epoch();
+}
+
 void OSDMonitor::send_full(PaxosServiceMessage *m)
 {
   dout(5) << "send_full to " << m->get_orig_source_inst() << dendl;
@@ -1403,11 +1528,8 @@ void OSDMonitor::send_incremental(PaxosServiceMessage *req, epoch_t first)
   dout(5) << "send_incremental [" << first << ".." << osdmap.get_epoch() << "]"
 	  << " to " << req->get_orig_source_inst() << dendl;
   if (first < get_first_committed()) {
-    first = get_first_committed();
     bufferlist bl;
-    int err = get_version("full", first, bl);
-    assert(err == 0);
-    assert(bl.length());
+    first = get_oldest_full_map_bl(bl);
 
     dout(20) << "send_incremental starting with base full "
 	     << first << " " << bl.length() << " bytes" << dendl;
@@ -1435,11 +1557,8 @@ void OSDMonitor::send_incremental(epoch_t first, entity_inst_t& dest, bool oneti
 	  << " to " << dest << dendl;
 
   if (first < get_first_committed()) {
-    first = get_first_committed();
     bufferlist bl;
-    int err = get_version("full", first, bl);
-    assert(err == 0);
-    assert(bl.length());
+    first = get_oldest_full_map_bl(bl);
 
     dout(20) << "send_incremental starting with base full "
 	     << first << " " << bl.length() << " bytes" << dendl;
@@ -1594,8 +1713,8 @@ void OSDMonitor::tick()
   }
 
   // expire blacklisted items?
-  for (hash_map<entity_addr_t,utime_t>::iterator p = osdmap.blacklist.begin();
-       p != osdmap.blacklist.end();
+  for (hash_map<entity_addr_t,utime_t>::iterator p = osdmap.blacklist->begin();
+       p != osdmap.blacklist->end();
        p++) {
     if (p->second < now) {
       dout(10) << "expiring blacklist item " << p->first << " expired " << p->second << " < now " << now << dendl;
@@ -1809,7 +1928,7 @@ bool OSDMonitor::preprocess_command(MMonCommand *m)
       OSDMap *p = &osdmap;
       if (epoch) {
 	bufferlist b;
-	int err = get_version("full", epoch, b);
+	int err = get_full_map_bl(epoch, b);
 	if (err == -ENOENT) {
 	  p = 0;
 	  r = -ENOENT;
@@ -2041,8 +2160,8 @@ bool OSDMonitor::preprocess_command(MMonCommand *m)
       r = 0;
     }
     else if (m->cmd.size() == 3 && m->cmd[1] == "blacklist" && m->cmd[2] == "ls") {
-      for (hash_map<entity_addr_t,utime_t>::iterator p = osdmap.blacklist.begin();
-	   p != osdmap.blacklist.end();
+      for (hash_map<entity_addr_t,utime_t>::iterator p = osdmap.blacklist->begin();
+	   p != osdmap.blacklist->end();
 	   p++) {
 	stringstream ss;
 	string s;
@@ -2051,7 +2170,7 @@ bool OSDMonitor::preprocess_command(MMonCommand *m)
 	s += "\n";
 	rdata.append(s);
       }
-      ss << "listed " << osdmap.blacklist.size() << " entries";
+      ss << "listed " << osdmap.blacklist->size() << " entries";
       r = 0;
     }
     else if (m->cmd.size() >= 4 && m->cmd[1] == "crush" && m->cmd[2] == "rule" && (m->cmd[3] == "list" ||
@@ -2909,6 +3028,9 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
 	      (pp && pp->snap_exists(snapname.c_str()))) {
 	    ss << "pool " << m->cmd[3] << " snap " << snapname << " already exists";
 	    err = -EEXIST;
+	  } else if (p->is_tier() || p->has_tiers()) {
+	    ss << "pool " << m->cmd[3] << " is in a cache tier; snapshots are not supported";
+	    err = -ENOTSUP;
 	  } else {
 	    if (!pp) {
 	      pp = &pending_inc.new_pools[pool];
@@ -3032,6 +3154,8 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
 	int ret = _prepare_remove_pool(pool);
 	if (ret == 0)
 	  ss << "pool '" << m->cmd[3] << "' deleted";
+	else if (ret == -EBUSY)
+	  ss << "pool '" << m->cmd[3] << "' is in a cache tier; remove the tier first";
 	getline(ss, rs);
 	wait_for_finished_proposal(new Monitor::C_Command(mon, m, ret, rs, get_version()));
 	return true;
@@ -3155,6 +3279,37 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
 		ss << "crush ruleset " << n << " does not exist";
 		err = -ENOENT;
 	      }
+	    } else if (m->cmd[4] == "qos_reservation" ||
+		       m->cmd[4] == "qos_weight" ||
+		       m->cmd[4] == "qos_limit") {
+	      if (pending_inc.new_pools.count(pool) == 0)
+		pending_inc.new_pools[pool] = *p;
+	      if (m->cmd[4] == "qos_reservation")
+		pending_inc.new_pools[pool].qos_reservation = n;
+	      else if (m->cmd[4] == "qos_weight")
+		pending_inc.new_pools[pool].qos_weight = n;
+	      else
+		pending_inc.new_pools[pool].qos_limit = n;
+	      ss << "set pool " << pool << " " << m->cmd[4] << " to " << n;
+	      getline(ss, rs);
+	      wait_for_finished_proposal(new Monitor::C_Command(mon, m, 0, rs, get_version()));
+	      return true;
+	    } else if (m->cmd[4] == "hit_set_period" ||
+		       m->cmd[4] == "hit_set_count" ||
+		       m->cmd[4] == "target_max_objects") {
+	      if (pending_inc.new_pools.count(pool) == 0)
+		pending_inc.new_pools[pool] = *p;
+	      if (m->cmd[4] == "hit_set_period")
+		pending_inc.new_pools[pool].hit_set_period = n;
+	      else if (m->cmd[4] == "hit_set_count")
+		pending_inc.new_pools[pool].hit_set_count = n;
+	      else
+		pending_inc.new_pools[pool].target_max_objects = n;
+	      pending_inc.new_pools[pool].last_change = pending_inc.epoch;
+	      ss << "set pool " << pool << " " << m->cmd[4] << " to " << n;
+	      getline(ss, rs);
+	      wait_for_finished_proposal(new Monitor::C_Command(mon, m, 0, rs, get_version()));
+	      return true;
 	    } else {
 	      ss << "unrecognized pool field " << m->cmd[4];
 	    }
@@ -3205,10 +3360,237 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
 	  err = 0;
 	  goto out;
 	}
+	if (m->cmd[4] == "qos_reservation") {
+	  ss << "qos_reservation: " << p->qos_reservation;
+	  err = 0;
+	  goto out;
+	}
+	if (m->cmd[4] == "qos_weight") {
+	  ss << "qos_weight: " << p->qos_weight;
+	  err = 0;
+	  goto out;
+	}
+	if (m->cmd[4] == "qos_limit") {
+	  ss << "qos_limit: " << p->qos_limit;
+	  err = 0;
+	  goto out;
+	}
+	if (m->cmd[4] == "hit_set_period") {
+	  ss << "hit_set_period: " << p->hit_set_period;
+	  err = 0;
+	  goto out;
+	}
+	if (m->cmd[4] == "hit_set_count") {
+	  ss << "hit_set_count: " << p->hit_set_count;
+	  err = 0;
+	  goto out;
+	}
+	if (m->cmd[4] == "target_max_objects") {
+	  ss << "target_max_objects: " << p->target_max_objects;
+	  err = 0;
+	  goto out;
+	}
 	ss << "don't know how to get pool field " << m->cmd[4];
 	goto out;
       }
     }
+    else if (m->cmd[1] == "tier" && m->cmd.size() >= 4) {
+      int64_t pool_id = osdmap.lookup_pg_pool_name(m->cmd[3].c_str());
+      if (pool_id < 0) {
+	ss << "unrecognized pool '" << m->cmd[3] << "'";
+	err = -ENOENT;
+	goto out;
+      }
+      const pg_pool_t *p = osdmap.get_pg_pool(pool_id);
+      if (pending_inc.new_pools.count(pool_id))
+	p = &pending_inc.new_pools[pool_id];
+
+      // taking tiering apart is always allowed; setting it up needs
+      // every mon and osd to understand it
+      if (m->cmd[2] == "add" || m->cmd[2] == "set-overlay" ||
+	  m->cmd[2] == "cache-mode") {
+	if ((mon->get_quorum_features() & CEPH_FEATURE_OSD_CACHEPOOL) == 0) {
+	  ss << "not all monitors in quorum support cache pools";
+	  err = -EPERM;
+	  goto out;
+	}
+	if ((osdmap.get_up_osd_features() & CEPH_FEATURE_OSD_CACHEPOOL) == 0) {
+	  ss << "not all up osds support cache pools";
+	  err = -EPERM;
+	  goto out;
+	}
+      }
+
+      if ((m->cmd[2] == "add" || m->cmd[2] == "remove" ||
+	   m->cmd[2] == "set-overlay") && m->cmd.size() == 5) {
+	// osd tier {add,remove,set-overlay} <pool> <tierpool>
+	int64_t tierpool_id = osdmap.lookup_pg_pool_name(m->cmd[4].c_str());
+	if (tierpool_id < 0) {
+	  ss << "unrecognized pool '" << m->cmd[4] << "'";
+	  err = -ENOENT;
+	  goto out;
+	}
+	const pg_pool_t *tp = osdmap.get_pg_pool(tierpool_id);
+	if (pending_inc.new_pools.count(tierpool_id))
+	  tp = &pending_inc.new_pools[tierpool_id];
+
+	if (m->cmd[2] == "add") {
+	  if (p->tiers.count(tierpool_id)) {
+	    assert(tp->tier_of == pool_id);
+	    ss << "pool '" << m->cmd[4] << "' is now (or already was) a tier of '"
+	       << m->cmd[3] << "'";
+	    err = 0;
+	    goto out;
+	  }
+	  if (pool_id == tierpool_id) {
+	    ss << "a pool cannot be a tier of itself";
+	    err = -EINVAL;
+	    goto out;
+	  }
+	  if (tp->is_tier()) {
+	    ss << "tier pool '" << m->cmd[4] << "' is already a tier of '"
+	       << osdmap.get_pool_name(tp->tier_of) << "'";
+	    err = -EINVAL;
+	    goto out;
+	  }
+	  if (p->is_tier() || tp->has_tiers()) {
+	    ss << "tiers may not be stacked";
+	    err = -EINVAL;
+	    goto out;
+	  }
+	  if (!p->snaps.empty() || !p->removed_snaps.empty() ||
+	      !tp->snaps.empty() || !tp->removed_snaps.empty()) {
+	    ss << "cache tiering does not support pools with snapshots";
+	    err = -ENOTSUP;
+	    goto out;
+	  }
+	  if (!tp->is_rep()) {
+	    ss << "tier pool '" << m->cmd[4] << "' must be a replicated pool";
+	    err = -EINVAL;
+	    goto out;
+	  }
+	  if (pending_inc.new_pools.count(pool_id) == 0)
+	    pending_inc.new_pools[pool_id] = *osdmap.get_pg_pool(pool_id);
+	  if (pending_inc.new_pools.count(tierpool_id) == 0)
+	    pending_inc.new_pools[tierpool_id] = *osdmap.get_pg_pool(tierpool_id);
+	  pending_inc.new_pools[pool_id].tiers.insert(tierpool_id);
+	  pending_inc.new_pools[pool_id].last_change = pending_inc.epoch;
+	  pending_inc.new_pools[tierpool_id].tier_of = pool_id;
+	  pending_inc.new_pools[tierpool_id].last_change = pending_inc.epoch;
+	  ss << "pool '" << m->cmd[4] << "' is now (or already was) a tier of '"
+	     << m->cmd[3] << "'";
+	} else if (m->cmd[2] == "remove") {
+	  if (p->tiers.count(tierpool_id) == 0) {
+	    ss << "pool '" << m->cmd[4] << "' is now (or already was) not a tier of '"
+	       << m->cmd[3] << "'";
+	    err = 0;
+	    goto out;
+	  }
+	  if (p->read_tier == tierpool_id || p->write_tier == tierpool_id) {
+	    ss << "tier pool '" << m->cmd[4] << "' is the overlay for '"
+	       << m->cmd[3] << "'; please remove-overlay first";
+	    err = -EBUSY;
+	    goto out;
+	  }
+	  if (pending_inc.new_pools.count(pool_id) == 0)
+	    pending_inc.new_pools[pool_id] = *osdmap.get_pg_pool(pool_id);
+	  if (pending_inc.new_pools.count(tierpool_id) == 0)
+	    pending_inc.new_pools[tierpool_id] = *osdmap.get_pg_pool(tierpool_id);
+	  pending_inc.new_pools[pool_id].tiers.erase(tierpool_id);
+	  pending_inc.new_pools[pool_id].last_change = pending_inc.epoch;
+	  pending_inc.new_pools[tierpool_id].clear_tier();
+	  pending_inc.new_pools[tierpool_id].last_change = pending_inc.epoch;
+	  ss << "pool '" << m->cmd[4] << "' is now (or already was) not a tier of '"
+	     << m->cmd[3] << "'";
+	} else {
+	  // set-overlay
+	  if (p->tiers.count(tierpool_id) == 0) {
+	    ss << "pool '" << m->cmd[4] << "' is not a tier of '" << m->cmd[3] << "'";
+	    err = -EINVAL;
+	    goto out;
+	  }
+	  if (pending_inc.new_pools.count(pool_id) == 0)
+	    pending_inc.new_pools[pool_id] = *osdmap.get_pg_pool(pool_id);
+	  pending_inc.new_pools[pool_id].read_tier = tierpool_id;
+	  // a readonly cache forwards writes to the base pool
+	  if (tp->cache_mode == pg_pool_t::CACHEMODE_READONLY)
+	    pending_inc.new_pools[pool_id].clear_write_tier();
+	  else
+	    pending_inc.new_pools[pool_id].write_tier = tierpool_id;
+	  pending_inc.new_pools[pool_id].last_change = pending_inc.epoch;
+	  ss << "overlay for '" << m->cmd[3] << "' is now (or already was) '"
+	     << m->cmd[4] << "'";
+	}
+      } else if (m->cmd[2] == "remove-overlay" && m->cmd.size() == 4) {
+	// osd tier remove-overlay <pool>
+	if (!p->has_read_tier() && !p->has_write_tier()) {
+	  ss << "there is now (or already was) no overlay for '" << m->cmd[3] << "'";
+	  err = 0;
+	  goto out;
+	}
+	if (pending_inc.new_pools.count(pool_id) == 0)
+	  pending_inc.new_pools[pool_id] = *osdmap.get_pg_pool(pool_id);
+	pending_inc.new_pools[pool_id].clear_read_tier();
+	pending_inc.new_pools[pool_id].clear_write_tier();
+	pending_inc.new_pools[pool_id].last_change = pending_inc.epoch;
+	ss << "there is now (or already was) no overlay for '" << m->cmd[3] << "'";
+      } else if (m->cmd[2] == "cache-mode" && m->cmd.size() == 5) {
+	// osd tier cache-mode <pool> <mode>
+	pg_pool_t::cache_mode_t mode = pg_pool_t::get_cache_mode_from_str(m->cmd[4]);
+	if ((int)mode < 0) {
+	  ss << "'" << m->cmd[4] << "' is not a valid cache mode";
+	  err = -EINVAL;
+	  goto out;
+	}
+	if (mode != pg_pool_t::CACHEMODE_NONE && !p->is_tier()) {
+	  ss << "pool '" << m->cmd[3] << "' is not a tier";
+	  err = -EINVAL;
+	  goto out;
+	}
+	if (p->cache_mode == pg_pool_t::CACHEMODE_WRITEBACK &&
+	    mode == pg_pool_t::CACHEMODE_READONLY) {
+	  // a readonly cache would serve reads from, and then evict, the
+	  // only up to date copy of anything not yet flushed
+	  const PGMap& pg_map = mon->pgmon()->pg_map;
+	  hash_map<int,pool_stat_t>::const_iterator sum =
+	    pg_map.pg_pool_sum.find(pool_id);
+	  if (sum != pg_map.pg_pool_sum.end() &&
+	      sum->second.stats.sum.num_objects_dirty > 0) {
+	    ss << "unable to set cache-mode '" << m->cmd[4] << "' on pool '"
+	       << m->cmd[3] << "': " << sum->second.stats.sum.num_objects_dirty
+	       << " dirty objects have not been flushed yet";
+	    err = -EBUSY;
+	    goto out;
+	  }
+	}
+	if (pending_inc.new_pools.count(pool_id) == 0)
+	  pending_inc.new_pools[pool_id] = *osdmap.get_pg_pool(pool_id);
+	pending_inc.new_pools[pool_id].cache_mode = mode;
+	pending_inc.new_pools[pool_id].last_change = pending_inc.epoch;
+	if (p->is_tier()) {
+	  // keep the base pool's write overlay in line with the mode
+	  int64_t base_id = p->tier_of;
+	  if (pending_inc.new_pools.count(base_id) == 0)
+	    pending_inc.new_pools[base_id] = *osdmap.get_pg_pool(base_id);
+	  if (pending_inc.new_pools[base_id].read_tier == pool_id) {
+	    if (mode == pg_pool_t::CACHEMODE_READONLY)
+	      pending_inc.new_pools[base_id].clear_write_tier();
+	    else
+	      pending_inc.new_pools[base_id].write_tier = pool_id;
+	    pending_inc.new_pools[base_id].last_change = pending_inc.epoch;
+	  }
+	}
+	ss << "set cache-mode for pool '" << m->cmd[3] << "' to "
+	   << pg_pool_t::get_cache_mode_name(mode);
+      } else {
+	ss << "unrecognized tier command";
+	err = -EINVAL;
+	goto out;
+      }
+      getline(ss, rs);
+      wait_for_finished_proposal(new Monitor::C_Command(mon, m, 0, rs, get_version()));
+      return true;
+    }
     else if ((m->cmd.size() > 1) &&
 	     (m->cmd[1] == "reweight-by-utilization")) {
       int oload = 120;
@@ -3459,6 +3841,11 @@ int OSDMonitor::_prepare_remove_pool(uint64_t pool)
     dout(10) << "_prepare_remove_pool " << pool << " pending removal" << dendl;    
     return 0;  // already removed
   }
+  const pg_pool_t *p = osdmap.get_pg_pool(pool);
+  if (p && (p->is_tier() || p->has_tiers())) {
+    dout(10) << "_prepare_remove_pool " << pool << " is in a cache tier" << dendl;
+    return -EBUSY;
+  }
   pending_inc.old_pools.insert(pool);
 
   // remove any pg_temp mappings for this pool too
@@ -41,10 +41,11 @@ class Monitor;
 struct failure_reporter_t {
   int num_reports;          ///< reports from this reporter
   utime_t failed_since;     ///< when they think it failed
+  double grace;             ///< their grace period for the target, 0 if unknown
   MOSDFailure *msg;         ///< most recent failure message
 
-  failure_reporter_t() : num_reports(0), msg(NULL) {}
-  failure_reporter_t(utime_t s) : num_reports(1), failed_since(s), msg(NULL) {}
+  failure_reporter_t() : num_reports(0), grace(0), msg(NULL) {}
+  failure_reporter_t(utime_t s) : num_reports(1), failed_since(s), grace(0), msg(NULL) {}
 };
 
 /// information about all failure reports for one osd
@@ -67,6 +68,20 @@ struct failure_info_t {
     return max_failed_since;
   }
 
+  /// the longest grace period of the reporters, 0 if any did not tell us
+  double get_reporter_grace() const {
+    double grace = 0;
+    for (map<int, failure_reporter_t>::const_iterator p = reporters.begin();
+	 p != reporters.end();
+	 ++p) {
+      if (p->second.grace <= 0)
+	return 0;
+      if (p->second.grace > grace)
+	grace = p->second.grace;
+    }
+    return grace;
+  }
+
   // set the message for the latest report.  return any old message we had,
   // if any, so we can discard it.
   MOSDFailure *add_report(int who, utime_t failed_since, MOSDFailure *msg) {
@@ -82,6 +97,8 @@ struct failure_info_t {
     }
     num_reports++;
 
+    if (msg)
+      p->second.grace = msg->grace;
     MOSDFailure *ret = p->second.msg;
     p->second.msg = msg;
     return ret;
@@ -153,6 +170,7 @@ private:
   bool should_propose(double &delay);
 
   void update_trim();
+  void encode_trim(MonitorDBStore::Transaction *t);
   bool should_trim();
 
   bool can_mark_down(int o);
@@ -164,6 +182,8 @@ private:
   void send_to_waiting();     // send current map to waiters.
   MOSDMap *build_latest_full();
   MOSDMap *build_incremental(epoch_t first, epoch_t last);
+  int get_full_map_bl(epoch_t e, bufferlist& bl);
+  epoch_t get_oldest_full_map_bl(bufferlist& bl);
   void send_full(PaxosServiceMessage *m);
   void send_incremental(PaxosServiceMessage *m, epoch_t first);
   void send_incremental(epoch_t first, entity_inst_t& dest, bool onetime);
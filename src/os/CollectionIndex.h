@@ -151,6 +151,13 @@ protected:
     int *exist	           ///< [out] True if the object exists, else false
     ) = 0;
 
+  /// what a split moved
+  struct split_stats_t {
+    uint64_t dirs;     ///< subdirectories moved as a whole
+    uint64_t objects;  ///< objects moved one by one
+    split_stats_t() : dirs(0), objects(0) {}
+  };
+
   /**
    * Moves objects matching <match> in the lsb <bits>
    *
@@ -161,7 +168,8 @@ protected:
   virtual int split(
     uint32_t match,                             //< [in] value to match
     uint32_t bits,                              //< [in] bits to check
-    std::tr1::shared_ptr<CollectionIndex> dest  //< [in] destination index
+    std::tr1::shared_ptr<CollectionIndex> dest, //< [in] destination index
+    split_stats_t *stats = 0                    //< [out] what was moved
     ) { assert(0); return 0; }
 
 
@@ -459,6 +459,11 @@ FileStore::FileStore(const std::string &base, const std::string &jdev, const cha
   plb.add_time_avg(l_os_commit_lat, "commitcycle_latency");
   plb.add_u64_counter(l_os_j_full, "journal_full");
 
+  plb.add_u64_counter(l_os_split, "split_collection");
+  plb.add_time_avg(l_os_split_lat, "split_collection_latency");
+  plb.add_u64_counter(l_os_split_dirs, "split_collection_dirs");  // directories moved whole
+  plb.add_u64_counter(l_os_split_objs, "split_collection_objects"); // objects moved one by one
+
   logger = plb.create_perf_counters();
 }
 
@@ -2754,6 +2759,21 @@ int FileStore::read(coll_t cid, const hobject_t& oid,
   return got;
 }
 
+int FileStore::readahead(coll_t cid, const hobject_t& oid,
+			 uint64_t offset, size_t len)
+{
+  dout(15) << "readahead " << cid << "/" << oid << " " << offset << "~" << len << dendl;
+  int fd = lfn_open(cid, oid, O_RDONLY);
+  if (fd < 0)
+    return fd;
+  int r = 0;
+#ifdef HAVE_POSIX_FADVISE
+  r = -posix_fadvise(fd, offset, len, POSIX_FADV_WILLNEED);
+#endif
+  lfn_close(fd);
+  return r;
+}
+
 int FileStore::fiemap(coll_t cid, const hobject_t& oid,
                     uint64_t offset, size_t len,
                     bufferlist& bl)
@@ -4677,6 +4697,7 @@ int FileStore::_split_collection(coll_t cid,
   _set_replay_guard(cid, spos, true);
   _set_replay_guard(dest, spos, true);
 
+  utime_t start = ceph_clock_now(g_ceph_context);
   Index from;
   int r = get_index(cid, &from);
 
@@ -4684,11 +4705,21 @@ int FileStore::_split_collection(coll_t cid,
   if (!r)
     r = get_index(dest, &to);
 
+  CollectionIndex::split_stats_t stats;
   if (!r)
-    r = from->split(rem, bits, to);
+    r = from->split(rem, bits, to, &stats);
 
   _close_replay_guard(cid, spos);
   _close_replay_guard(dest, spos);
+
+  utime_t lat = ceph_clock_now(g_ceph_context) - start;
+  dout(10) << __func__ << " " << cid << " -> " << dest << " moved "
+	   << stats.dirs << " dirs and " << stats.objects << " objects in "
+	   << lat << dendl;
+  logger->inc(l_os_split);
+  logger->tinc(l_os_split_lat, lat);
+  logger->inc(l_os_split_dirs, stats.dirs);
+  logger->inc(l_os_split_objs, stats.objects);
   return r;
 }
 
@@ -370,6 +370,7 @@ public:
   int stat(coll_t cid, const hobject_t& oid, struct stat *st);
   int read(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, bufferlist& bl);
   int fiemap(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, bufferlist& bl);
+  int readahead(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len);
 
   int _touch(coll_t cid, const hobject_t& oid);
   int _write(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, const bufferlist& bl);
@@ -88,7 +88,8 @@ int HashIndex::col_split_level(
   const vector<string> &path,
   uint32_t inbits,
   uint32_t match,
-  unsigned *mkdirred)
+  unsigned *mkdirred,
+  split_stats_t *stats)
 {
   /* For each subdir, move, recurse, or ignore based on comparing the low order
    * bits of the hash represented by the subdir path with inbits, match passed
@@ -120,7 +121,8 @@ int HashIndex::col_split_level(
 	  sub_path,
 	  inbits,
 	  match,
-	  mkdirred);
+	  mkdirred,
+	  stats);
 	if (r < 0)
 	  return r;
 	if (*mkdirred > path.size())
@@ -197,18 +199,16 @@ int HashIndex::col_split_level(
     r = move_subdir(from, to, path, *i);
     if (r < 0)
       return r;
+    stats->dirs++;
   }
 
-  for (map<string, hobject_t>::iterator i = objs_to_move.begin();
-       i != objs_to_move.end();
-       ++i) {
-    from_info.objs--;
-    to_info.objs++;
-    r = move_object(from, to, path, *i);
-    if (r < 0)
-      return r;
-  }
-       
+  // objects in this directory have to move one by one
+  from_info.objs -= objs_to_move.size();
+  to_info.objs += objs_to_move.size();
+  r = move_objects(from, to, path, objs_to_move);
+  if (r < 0)
+    return r;
+  stats->objects += objs_to_move.size();
 
   r = to.set_info(path, to_info);
   if (r < 0)
@@ -224,7 +224,8 @@ int HashIndex::col_split_level(
 int HashIndex::_split(
   uint32_t match,
   uint32_t bits,
-  std::tr1::shared_ptr<CollectionIndex> dest) {
+  std::tr1::shared_ptr<CollectionIndex> dest,
+  split_stats_t *stats) {
   assert(collection_version() == dest->collection_version());
   unsigned mkdirred = 0;
   return col_split_level(
@@ -233,7 +234,8 @@ int HashIndex::_split(
     vector<string>(),
     bits,
     match,
-    &mkdirred);
+    &mkdirred,
+    stats);
 }
 
 int HashIndex::_init() {
@@ -155,7 +155,8 @@ public:
   int _split(
     uint32_t match,
     uint32_t bits,
-    std::tr1::shared_ptr<CollectionIndex> dest
+    std::tr1::shared_ptr<CollectionIndex> dest,
+    split_stats_t *stats
     );
 	
 protected:
@@ -273,7 +274,8 @@ private:
     const vector<string> &path, ///< [in] path to split
     uint32_t bits,              ///< [in] num bits to match
     uint32_t match,             ///< [in] bits to match
-    unsigned *mkdirred          ///< [in,out] path[:mkdirred] has been mkdirred
+    unsigned *mkdirred,         ///< [in,out] path[:mkdirred] has been mkdirred
+    split_stats_t *stats        ///< [out] what was moved
     );
     
 
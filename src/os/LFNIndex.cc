@@ -315,33 +315,44 @@ int LFNIndex::move_subdir(
   return 0;
 }
 
-int LFNIndex::move_object(
+int LFNIndex::move_objects(
   LFNIndex &from,
   LFNIndex &dest,
   const vector<string> &path,
-  const pair<string, hobject_t> &obj
+  const map<string, hobject_t> &objs
   ) {
-  string from_path(from.get_full_path(path, obj.first));
-  string to_path;
-  string to_name;
-  int exists;
-  int r = dest.lfn_get_name(path, obj.second, &to_name, &to_path, &exists);
-  if (r < 0)
-    return r;
-  if (!exists) {
-    r = ::link(from_path.c_str(), to_path.c_str());
+  if (objs.empty())
+    return 0;
+  int r;
+  for (map<string, hobject_t>::const_iterator i = objs.begin();
+       i != objs.end();
+       ++i) {
+    string from_path(from.get_full_path(path, i->first));
+    string to_path;
+    string to_name;
+    int exists;
+    r = dest.lfn_get_name(path, i->second, &to_name, &to_path, &exists);
+    if (r < 0)
+      return r;
+    if (!exists) {
+      r = ::link(from_path.c_str(), to_path.c_str());
+      if (r < 0)
+	return -errno;
+    }
+    r = dest.lfn_created(path, i->second, to_name);
     if (r < 0)
       return r;
   }
-  r = dest.lfn_created(path, obj.second, to_name);
-  if (r < 0)
-    return r;
   r = dest.fsync_dir(path);
   if (r < 0)
     return r;
-  r = from.remove_object(path, obj.second);
-  if (r < 0)
-    return r;
+  for (map<string, hobject_t>::const_iterator i = objs.begin();
+       i != objs.end();
+       ++i) {
+    r = from.remove_object(path, i->second);
+    if (r < 0)
+      return r;
+  }
   return from.fsync_dir(path);
 }
 
@@ -199,17 +199,20 @@ public:
   virtual int _split(
     uint32_t match,                             //< [in] value to match
     uint32_t bits,                              //< [in] bits to check
-    std::tr1::shared_ptr<CollectionIndex> dest  //< [in] destination index
+    std::tr1::shared_ptr<CollectionIndex> dest, //< [in] destination index
+    split_stats_t *stats                        //< [out] what was moved
     ) = 0;
   
   /// @see CollectionIndex
   int split(
     uint32_t match,
     uint32_t bits,
-    std::tr1::shared_ptr<CollectionIndex> dest
+    std::tr1::shared_ptr<CollectionIndex> dest,
+    split_stats_t *stats = 0
     ) {
+    split_stats_t dummy;
     WRAP_RETRY(
-      r = _split(match, bits, dest);
+      r = _split(match, bits, dest, stats ? stats : &dummy);
       goto out;
       );
   }
@@ -347,12 +350,17 @@ protected:
     string dir                  ///< [in] dir to move
     );
 
-  /// do move object from from to dest
-  static int move_object(
+  /**
+   * do move objects from from to dest
+   *
+   * All objects are linked into dest before any is removed from from,
+   * so that each directory is only synced once per batch.
+   */
+  static int move_objects(
     LFNIndex &from,             ///< [in] from index
     LFNIndex &dest,             ///< [in] to index
     const vector<string> &path, ///< [in] path to split
-    const pair<string, hobject_t> &obj ///< [in] obj to move
+    const map<string, hobject_t> &objs ///< [in] objs to move
     );
 
   /**
@@ -67,6 +67,10 @@ enum {
   l_os_commit_len,
   l_os_commit_lat,
   l_os_j_full,
+  l_os_split,
+  l_os_split_lat,
+  l_os_split_dirs,
+  l_os_split_objs,
   l_os_last,
 };
 
@@ -721,6 +725,13 @@ public:
   virtual int stat(coll_t cid, const hobject_t& oid, struct stat *st) = 0;     // struct stat?
   virtual int read(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, bufferlist& bl) = 0;
   virtual int fiemap(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len, bufferlist& bl) = 0;
+  /**
+   * hint that a range of an object will be read soon
+   *
+   * The default does nothing; a store may start reading the data in
+   * the background.  len == 0 means up to the end of the object.
+   */
+  virtual int readahead(coll_t cid, const hobject_t& oid, uint64_t offset, size_t len) { return 0; }
 
   virtual int getattr(coll_t cid, const hobject_t& oid, const char *name, bufferptr& value) = 0;
   int getattr(coll_t cid, const hobject_t& oid, const char *name, bufferlist& value) {
@@ -0,0 +1,84 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2013 Inktank
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <errno.h>
+
+#include "include/types.h"
+#include "ECUtil.h"
+
+int ECUtil::encode(const stripe_info_t &sinfo,
+		   ErasureCodeInterfaceRef &ec_impl,
+		   bufferlist &in,
+		   const set<int> &want,
+		   map<int, bufferlist> *out)
+{
+  uint64_t width = sinfo.get_stripe_width();
+  if (in.length() % width)
+    in.append_zero(width - in.length() % width);
+
+  for (uint64_t off = 0; off < in.length(); off += width) {
+    bufferlist stripe;
+    stripe.substr_of(in, off, width);
+    map<int, bufferlist> encoded;
+    int r = ec_impl->encode(want, stripe, &encoded);
+    if (r < 0)
+      return r;
+    for (map<int, bufferlist>::iterator p = encoded.begin();
+	 p != encoded.end();
+	 ++p) {
+      assert(p->second.length() == sinfo.get_chunk_size());
+      (*out)[p->first].claim_append(p->second);
+    }
+  }
+  return 0;
+}
+
+int ECUtil::decode(const stripe_info_t &sinfo,
+		   ErasureCodeInterfaceRef &ec_impl,
+		   map<int, bufferlist> &to_decode,
+		   bufferlist *out)
+{
+  if (to_decode.empty())
+    return -EIO;
+
+  uint64_t chunk_size = sinfo.get_chunk_size();
+  uint64_t total = to_decode.begin()->second.length();
+  if (total % chunk_size)
+    return -EINVAL;
+  for (map<int, bufferlist>::iterator p = to_decode.begin();
+       p != to_decode.end();
+       ++p)
+    if (p->second.length() != total)
+      return -EINVAL;
+
+  set<int> want;
+  unsigned k = ec_impl->get_data_chunk_count();
+  for (unsigned i = 0; i < k; i++)
+    want.insert(i);
+
+  for (uint64_t off = 0; off < total; off += chunk_size) {
+    map<int, bufferlist> chunks;
+    for (map<int, bufferlist>::iterator p = to_decode.begin();
+	 p != to_decode.end();
+	 ++p)
+      chunks[p->first].substr_of(p->second, off, chunk_size);
+    map<int, bufferlist> decoded;
+    int r = ec_impl->decode(want, chunks, &decoded);
+    if (r < 0)
+      return r;
+    for (unsigned i = 0; i < k; i++)
+      out->claim_append(decoded[i]);
+  }
+  return 0;
+}
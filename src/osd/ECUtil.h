@@ -0,0 +1,104 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2013 Inktank
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_ECUTIL_H
+#define CEPH_ECUTIL_H
+
+#include "include/types.h"
+#include "ErasureCodeInterface.h"
+
+/**
+ * Striping of objects in erasure coded pools
+ *
+ * An object is cut into stripes of stripe_width logical bytes.  Each
+ * stripe is encoded independently into K+M chunks of
+ * stripe_width / K bytes, and chunk i of every stripe is appended to
+ * the shard stored on the i-th OSD of the acting set.  Writes and
+ * appends therefore only need to touch whole stripes, and a read of
+ * a logical extent maps to the same extent (scaled by 1/K) on every
+ * shard.
+ */
+namespace ECUtil {
+
+class stripe_info_t {
+  const uint64_t stripe_width;
+  const uint64_t chunk_size;
+public:
+  stripe_info_t(uint64_t k, uint64_t stripe_width)
+    : stripe_width(stripe_width),
+      chunk_size(stripe_width / k) {
+    assert(stripe_width % k == 0);
+  }
+  uint64_t get_stripe_width() const {
+    return stripe_width;
+  }
+  uint64_t get_chunk_size() const {
+    return chunk_size;
+  }
+  uint64_t logical_to_prev_stripe_offset(uint64_t offset) const {
+    return offset - (offset % stripe_width);
+  }
+  uint64_t logical_to_next_stripe_offset(uint64_t offset) const {
+    return (offset + stripe_width - 1) / stripe_width * stripe_width;
+  }
+  uint64_t logical_to_prev_chunk_offset(uint64_t offset) const {
+    return (offset / stripe_width) * chunk_size;
+  }
+  uint64_t logical_to_next_chunk_offset(uint64_t offset) const {
+    return logical_to_next_stripe_offset(offset) / stripe_width * chunk_size;
+  }
+  uint64_t aligned_logical_offset_to_chunk_offset(uint64_t offset) const {
+    assert(offset % stripe_width == 0);
+    return (offset / stripe_width) * chunk_size;
+  }
+  uint64_t aligned_chunk_offset_to_logical_offset(uint64_t offset) const {
+    assert(offset % chunk_size == 0);
+    return (offset / chunk_size) * stripe_width;
+  }
+  /// smallest stripe aligned extent covering [off, off+len)
+  pair<uint64_t, uint64_t> offset_len_to_stripe_bounds(uint64_t off,
+						       uint64_t len) const {
+    uint64_t start = logical_to_prev_stripe_offset(off);
+    uint64_t end = logical_to_next_stripe_offset(off + len);
+    return make_pair(start, end - start);
+  }
+};
+
+/**
+ * encode stripe aligned logical data @in into per shard buffers
+ *
+ * the chunks for @want are appended to @out, one chunk per stripe.
+ * @in is zero padded to a whole number of stripes.
+ */
+int encode(const stripe_info_t &sinfo,
+	   ErasureCodeInterfaceRef &ec_impl,
+	   bufferlist &in,
+	   const set<int> &want,
+	   map<int, bufferlist> *out);
+
+/**
+ * rebuild logical data from shard buffers
+ *
+ * every buffer in @to_decode must hold the same, chunk aligned,
+ * range of its shard.  missing data chunks are reconstructed from the
+ * coding chunks, so any K shards are enough.
+ */
+int decode(const stripe_info_t &sinfo,
+	   ErasureCodeInterfaceRef &ec_impl,
+	   map<int, bufferlist> &to_decode,
+	   bufferlist *out);
+
+}
+
+#endif
@@ -0,0 +1,92 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2013 Inktank
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_ERASURE_CODE_INTERFACE_H
+#define CEPH_ERASURE_CODE_INTERFACE_H
+
+/**
+ * Erasure code abstraction
+ *
+ * An erasure code splits an object into K data chunks and computes M
+ * coding chunks such that the object can be rebuilt from any K of the
+ * K+M chunks.  Chunks are numbered 0..K-1 for data and K..K+M-1 for
+ * coding; chunk i of an object is stored on the OSD at position i of
+ * the PG acting set.
+ *
+ * Implementations are created by name through the
+ * ErasureCodePluginRegistry and must be safe to use concurrently
+ * from several threads once constructed.
+ */
+
+#include <map>
+#include <set>
+#include <string>
+#include <tr1/memory>
+
+#include "include/buffer.h"
+
+using std::map;
+using std::set;
+using std::string;
+
+class ErasureCodeInterface {
+public:
+  virtual ~ErasureCodeInterface() {}
+
+  /// K+M
+  virtual unsigned int get_chunk_count() const = 0;
+
+  /// K
+  virtual unsigned int get_data_chunk_count() const = 0;
+
+  /**
+   * size of each chunk when encoding an object of @object_size
+   * bytes.  the object is padded with zeros to K * chunk size.
+   */
+  virtual unsigned int get_chunk_size(unsigned int object_size) const = 0;
+
+  /**
+   * compute the smallest set of chunks that must be read to be able
+   * to decode @want_to_read given the chunks in @available.
+   *
+   * @return 0 on success, -EIO if @available is not enough
+   */
+  virtual int minimum_to_decode(const set<int> &want_to_read,
+				const set<int> &available,
+				set<int> *minimum) = 0;
+
+  /**
+   * encode @in and return the chunks listed in @want_to_encode.
+   *
+   * @return 0 on success, negative error code otherwise
+   */
+  virtual int encode(const set<int> &want_to_encode,
+		     const bufferlist &in,
+		     map<int, bufferlist> *encoded) = 0;
+
+  /**
+   * rebuild the chunks listed in @want_to_read from @chunks, which
+   * must all be the same size.  chunks present in @chunks are
+   * returned as is; missing ones are reconstructed.
+   *
+   * @return 0 on success, -EIO if there are not enough chunks
+   */
+  virtual int decode(const set<int> &want_to_read,
+		     const map<int, bufferlist> &chunks,
+		     map<int, bufferlist> *decoded) = 0;
+};
+
+typedef std::tr1::shared_ptr<ErasureCodeInterface> ErasureCodeInterfaceRef;
+
+#endif
@@ -0,0 +1,86 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2013 Inktank
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "ErasureCodePlugin.h"
+#include "ErasureCodeReedSolomon.h"
+
+namespace {
+
+int get_int_parameter(const map<string,string> &parameters,
+		      const char *name, int def)
+{
+  map<string,string>::const_iterator p = parameters.find(name);
+  if (p == parameters.end())
+    return def;
+  char *end;
+  long v = strtol(p->second.c_str(), &end, 10);
+  if (*end || p->second.empty())
+    return -1;
+  return v;
+}
+
+class ErasureCodePluginReedSolomon : public ErasureCodePlugin {
+public:
+  int factory(const map<string,string> &parameters,
+	      ErasureCodeInterfaceRef *erasure_code) {
+    int k = get_int_parameter(parameters, "k", 2);
+    int m = get_int_parameter(parameters, "m", 1);
+    if (k < 1 || m < 0 || k + m > 256)
+      return -EINVAL;
+    erasure_code->reset(new ErasureCodeReedSolomon(k, m));
+    return 0;
+  }
+};
+
+}
+
+ErasureCodePluginRegistry ErasureCodePluginRegistry::singleton;
+
+ErasureCodePluginRegistry::ErasureCodePluginRegistry()
+  : lock("ErasureCodePluginRegistry::lock")
+{
+  plugins["reed_solomon"] = new ErasureCodePluginReedSolomon;
+}
+
+ErasureCodePluginRegistry::~ErasureCodePluginRegistry()
+{
+  for (map<string, ErasureCodePlugin*>::iterator p = plugins.begin();
+       p != plugins.end();
+       ++p)
+    delete p->second;
+}
+
+int ErasureCodePluginRegistry::add(const string &name,
+				   ErasureCodePlugin *plugin)
+{
+  Mutex::Locker l(lock);
+  if (plugins.count(name))
+    return -EEXIST;
+  plugins[name] = plugin;
+  return 0;
+}
+
+int ErasureCodePluginRegistry::factory(const string &plugin_name,
+				       const map<string,string> &parameters,
+				       ErasureCodeInterfaceRef *erasure_code)
+{
+  Mutex::Locker l(lock);
+  map<string, ErasureCodePlugin*>::iterator p = plugins.find(plugin_name);
+  if (p == plugins.end())
+    return -ENOENT;
+  return p->second->factory(parameters, erasure_code);
+}
@@ -0,0 +1,62 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2013 Inktank
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_ERASURE_CODE_PLUGIN_H
+#define CEPH_ERASURE_CODE_PLUGIN_H
+
+#include "common/Mutex.h"
+#include "ErasureCodeInterface.h"
+
+/**
+ * factory for one family of erasure codes
+ *
+ * @parameters are the erasure_code_properties of the pool, e.g.
+ * k=4 m=2.
+ */
+class ErasureCodePlugin {
+public:
+  virtual ~ErasureCodePlugin() {}
+
+  virtual int factory(const map<string,string> &parameters,
+		      ErasureCodeInterfaceRef *erasure_code) = 0;
+};
+
+/**
+ * process wide table of erasure code plugins, indexed by the name
+ * stored in pg_pool_t::erasure_code_plugin.  the builtin reed_solomon
+ * plugin is always registered.
+ */
+class ErasureCodePluginRegistry {
+  Mutex lock;
+  map<string, ErasureCodePlugin*> plugins;
+
+  static ErasureCodePluginRegistry singleton;
+
+  ErasureCodePluginRegistry();
+  ~ErasureCodePluginRegistry();
+
+public:
+  static ErasureCodePluginRegistry &instance() {
+    return singleton;
+  }
+
+  /// register @plugin under @name; the registry takes ownership
+  int add(const string &name, ErasureCodePlugin *plugin);
+
+  int factory(const string &plugin_name,
+	      const map<string,string> &parameters,
+	      ErasureCodeInterfaceRef *erasure_code);
+};
+
+#endif
@@ -0,0 +1,367 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2013 Inktank
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
+#include "include/assert.h"
+#include "ErasureCodeReedSolomon.h"
+
+// -- GF(2^8) --
+
+namespace {
+
+struct galois_field_t {
+  uint8_t exp[512];
+  uint8_t log[256];
+  uint8_t mul[256][256];
+
+  galois_field_t() {
+    unsigned x = 1;
+    for (unsigned i = 0; i < 255; i++) {
+      exp[i] = x;
+      exp[i + 255] = x;
+      log[x] = i;
+      x <<= 1;
+      if (x & 0x100)
+	x ^= 0x11d;
+    }
+    exp[510] = exp[511] = 0;
+    log[0] = 0;
+    for (unsigned a = 0; a < 256; a++)
+      for (unsigned b = 0; b < 256; b++)
+	mul[a][b] = (a && b) ? exp[log[a] + log[b]] : 0;
+  }
+};
+
+const galois_field_t gf;
+
+}
+
+uint8_t ErasureCodeReedSolomon::gf_mul(uint8_t a, uint8_t b)
+{
+  return gf.mul[a][b];
+}
+
+uint8_t ErasureCodeReedSolomon::gf_inv(uint8_t a)
+{
+  assert(a != 0);
+  return gf.exp[255 - gf.log[a]];
+}
+
+void ErasureCodeReedSolomon::region_multiply(uint8_t c, const char *src,
+					     char *dst, unsigned len,
+					     bool accumulate)
+{
+  if (c == 0) {
+    if (!accumulate)
+      memset(dst, 0, len);
+    return;
+  }
+  if (c == 1) {
+    if (!accumulate) {
+      memcpy(dst, src, len);
+      return;
+    }
+    unsigned words = len / sizeof(uint64_t);
+    const uint64_t *s = reinterpret_cast<const uint64_t*>(src);
+    uint64_t *d = reinterpret_cast<uint64_t*>(dst);
+    for (unsigned i = 0; i < words; i++)
+      d[i] ^= s[i];
+    for (unsigned i = words * sizeof(uint64_t); i < len; i++)
+      dst[i] ^= src[i];
+    return;
+  }
+
+  const uint8_t *table = gf.mul[c];
+  const uint8_t *s = reinterpret_cast<const uint8_t*>(src);
+  uint8_t *d = reinterpret_cast<uint8_t*>(dst);
+  unsigned i = 0;
+
+#ifdef __SSSE3__
+  {
+    // c * x == c * (x & 0x0f) ^ c * (x & 0xf0)
+    uint8_t lo[16], hi[16];
+    for (unsigned n = 0; n < 16; n++) {
+      lo[n] = table[n];
+      hi[n] = table[n << 4];
+    }
+    __m128i tlo = _mm_loadu_si128((const __m128i*)lo);
+    __m128i thi = _mm_loadu_si128((const __m128i*)hi);
+    __m128i mask = _mm_set1_epi8(0x0f);
+    for (; i + 16 <= len; i += 16) {
+      __m128i x = _mm_loadu_si128((const __m128i*)(s + i));
+      __m128i l = _mm_shuffle_epi8(tlo, _mm_and_si128(x, mask));
+      __m128i h = _mm_shuffle_epi8(thi,
+				   _mm_and_si128(_mm_srli_epi64(x, 4), mask));
+      __m128i r = _mm_xor_si128(l, h);
+      if (accumulate)
+	r = _mm_xor_si128(r, _mm_loadu_si128((const __m128i*)(d + i)));
+      _mm_storeu_si128((__m128i*)(d + i), r);
+    }
+  }
+#endif
+
+  if (accumulate) {
+    for (; i + 8 <= len; i += 8) {
+      d[i] ^= table[s[i]];
+      d[i+1] ^= table[s[i+1]];
+      d[i+2] ^= table[s[i+2]];
+      d[i+3] ^= table[s[i+3]];
+      d[i+4] ^= table[s[i+4]];
+      d[i+5] ^= table[s[i+5]];
+      d[i+6] ^= table[s[i+6]];
+      d[i+7] ^= table[s[i+7]];
+    }
+    for (; i < len; i++)
+      d[i] ^= table[s[i]];
+  } else {
+    for (; i + 8 <= len; i += 8) {
+      d[i] = table[s[i]];
+      d[i+1] = table[s[i+1]];
+      d[i+2] = table[s[i+2]];
+      d[i+3] = table[s[i+3]];
+      d[i+4] = table[s[i+4]];
+      d[i+5] = table[s[i+5]];
+      d[i+6] = table[s[i+6]];
+      d[i+7] = table[s[i+7]];
+    }
+    for (; i < len; i++)
+      d[i] = table[s[i]];
+  }
+}
+
+int ErasureCodeReedSolomon::invert_matrix(std::vector<uint8_t> &a, unsigned n)
+{
+  assert(a.size() == n * n);
+  std::vector<uint8_t> inv(n * n, 0);
+  for (unsigned i = 0; i < n; i++)
+    inv[i * n + i] = 1;
+
+  // gauss-jordan elimination
+  for (unsigned col = 0; col < n; col++) {
+    unsigned pivot = col;
+    while (pivot < n && a[pivot * n + col] == 0)
+      pivot++;
+    if (pivot == n)
+      return -EINVAL;
+    if (pivot != col) {
+      for (unsigned j = 0; j < n; j++) {
+	std::swap(a[pivot * n + j], a[col * n + j]);
+	std::swap(inv[pivot * n + j], inv[col * n + j]);
+      }
+    }
+    uint8_t f = gf_inv(a[col * n + col]);
+    for (unsigned j = 0; j < n; j++) {
+      a[col * n + j] = gf_mul(a[col * n + j], f);
+      inv[col * n + j] = gf_mul(inv[col * n + j], f);
+    }
+    for (unsigned r = 0; r < n; r++) {
+      if (r == col || a[r * n + col] == 0)
+	continue;
+      uint8_t g = a[r * n + col];
+      for (unsigned j = 0; j < n; j++) {
+	a[r * n + j] ^= gf_mul(g, a[col * n + j]);
+	inv[r * n + j] ^= gf_mul(g, inv[col * n + j]);
+      }
+    }
+  }
+  a.swap(inv);
+  return 0;
+}
+
+
+// -- ErasureCodeReedSolomon --
+
+ErasureCodeReedSolomon::ErasureCodeReedSolomon(unsigned k_, unsigned m_)
+  : k(k_), m(m_), matrix((k_ + m_) * k_, 0)
+{
+  assert(k > 0);
+  assert(k + m <= 256);
+  for (unsigned i = 0; i < k; i++)
+    matrix[i * k + i] = 1;
+  // cauchy matrix: 1 / (x_i + y_j), x_i = k + i, y_j = j
+  for (unsigned i = 0; i < m; i++)
+    for (unsigned j = 0; j < k; j++)
+      matrix[(k + i) * k + j] = gf_inv((k + i) ^ j);
+}
+
+unsigned int ErasureCodeReedSolomon::get_chunk_size(unsigned int object_size) const
+{
+  unsigned chunk_size = (object_size + k - 1) / k;
+  return (chunk_size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+int ErasureCodeReedSolomon::minimum_to_decode(const set<int> &want_to_read,
+					      const set<int> &available,
+					      set<int> *minimum)
+{
+  bool all = true;
+  for (set<int>::const_iterator p = want_to_read.begin();
+       p != want_to_read.end();
+       ++p) {
+    if (!available.count(*p)) {
+      all = false;
+      break;
+    }
+  }
+  if (all) {
+    *minimum = want_to_read;
+    return 0;
+  }
+
+  if (available.size() < k)
+    return -EIO;
+
+  // prefer the chunks we want anyway, then the data chunks
+  minimum->clear();
+  for (set<int>::const_iterator p = want_to_read.begin();
+       p != want_to_read.end() && minimum->size() < k;
+       ++p)
+    if (available.count(*p))
+      minimum->insert(*p);
+  for (set<int>::const_iterator p = available.begin();
+       p != available.end() && minimum->size() < k;
+       ++p)
+    minimum->insert(*p);
+  return 0;
+}
+
+void ErasureCodeReedSolomon::encode_chunks(const std::vector<const char*> &data,
+					   const set<int> &want,
+					   unsigned chunk_size,
+					   map<int, bufferlist> *encoded) const
+{
+  for (set<int>::const_iterator p = want.begin(); p != want.end(); ++p) {
+    unsigned i = *p;
+    if (i < k)
+      continue;
+    bufferptr coding(buffer::create_page_aligned(chunk_size));
+    const uint8_t *r = row(i);
+    for (unsigned j = 0; j < k; j++)
+      region_multiply(r[j], data[j], coding.c_str(), chunk_size, j > 0);
+    (*encoded)[i].push_back(coding);
+  }
+}
+
+int ErasureCodeReedSolomon::encode(const set<int> &want_to_encode,
+				   const bufferlist &in,
+				   map<int, bufferlist> *encoded)
+{
+  for (set<int>::const_iterator p = want_to_encode.begin();
+       p != want_to_encode.end();
+       ++p)
+    if (*p < 0 || *p >= (int)(k + m))
+      return -EINVAL;
+
+  unsigned chunk_size = get_chunk_size(in.length());
+  bufferlist padded;
+  padded.append(in);
+  if (padded.length() < k * chunk_size)
+    padded.append_zero(k * chunk_size - padded.length());
+  padded.rebuild_page_aligned();
+
+  std::vector<const char*> data(k);
+  for (unsigned j = 0; j < k; j++) {
+    data[j] = padded.c_str() + j * chunk_size;
+    if (want_to_encode.count(j))
+      (*encoded)[j].substr_of(padded, j * chunk_size, chunk_size);
+  }
+  encode_chunks(data, want_to_encode, chunk_size, encoded);
+  return 0;
+}
+
+int ErasureCodeReedSolomon::decode(const set<int> &want_to_read,
+				   const map<int, bufferlist> &chunks,
+				   map<int, bufferlist> *decoded)
+{
+  if (chunks.empty())
+    return -EIO;
+  unsigned chunk_size = chunks.begin()->second.length();
+
+  set<int> missing;
+  for (set<int>::const_iterator p = want_to_read.begin();
+       p != want_to_read.end();
+       ++p) {
+    if (*p < 0 || *p >= (int)(k + m))
+      return -EINVAL;
+    map<int, bufferlist>::const_iterator c = chunks.find(*p);
+    if (c != chunks.end())
+      (*decoded)[*p] = c->second;
+    else
+      missing.insert(*p);
+  }
+  if (missing.empty())
+    return 0;
+  if (chunks.size() < k)
+    return -EIO;
+
+  // pick k surviving chunks; data chunks sort first, which keeps the
+  // submatrix as close to the identity as possible
+  std::vector<int> survivors;
+  std::vector<bufferlist> survivor_bl;
+  for (map<int, bufferlist>::const_iterator p = chunks.begin();
+       p != chunks.end() && survivors.size() < k;
+       ++p) {
+    if (p->second.length() != chunk_size)
+      return -EINVAL;
+    survivors.push_back(p->first);
+    survivor_bl.push_back(p->second);
+  }
+
+  std::vector<uint8_t> sub(k * k);
+  for (unsigned i = 0; i < k; i++)
+    memcpy(&sub[i * k], row(survivors[i]), k);
+  int r = invert_matrix(sub, k);
+  if (r < 0)
+    return r;
+
+  // rebuild the data chunks we need: the missing wanted ones, or all
+  // of them if a coding chunk must be recomputed
+  bool need_all = false;
+  for (set<int>::iterator p = missing.begin(); p != missing.end(); ++p)
+    if (*p >= (int)k)
+      need_all = true;
+
+  std::vector<const char*> data(k);
+  std::vector<bufferlist> rebuilt(k);
+  for (unsigned i = 0; i < k; i++) {
+    map<int, bufferlist>::const_iterator c = chunks.find(i);
+    if (c != chunks.end()) {
+      rebuilt[i] = c->second;
+      data[i] = rebuilt[i].c_str();
+      continue;
+    }
+    if (!need_all && !missing.count(i)) {
+      data[i] = NULL;
+      continue;
+    }
+    bufferptr chunk(buffer::create_page_aligned(chunk_size));
+    for (unsigned j = 0; j < k; j++)
+      region_multiply(sub[i * k + j], survivor_bl[j].c_str(), chunk.c_str(),
+		      chunk_size, j > 0);
+    rebuilt[i].push_back(chunk);
+    data[i] = rebuilt[i].c_str();
+    if (missing.count(i))
+      (*decoded)[i] = rebuilt[i];
+  }
+
+  if (need_all)
+    encode_chunks(data, missing, chunk_size, decoded);
+  return 0;
+}
@@ -0,0 +1,94 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2013 Inktank
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_ERASURE_CODE_REED_SOLOMON_H
+#define CEPH_ERASURE_CODE_REED_SOLOMON_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "ErasureCodeInterface.h"
+
+/**
+ * Systematic Reed-Solomon code over GF(2^8)
+ *
+ * The generator matrix is the K x K identity stacked on top of an
+ * M x K Cauchy matrix, so that every K x K submatrix is invertible
+ * and any K chunks are enough to rebuild the object.  K + M must not
+ * exceed 256.
+ *
+ * All the work happens in region_multiply(), which multiplies a
+ * buffer by a constant and xors it into another.  When built with
+ * SSSE3 it uses the split 4-bit table method (two PSHUFB per 16
+ * bytes); otherwise it falls back to a full 256 byte lookup table
+ * per coefficient.
+ */
+class ErasureCodeReedSolomon : public ErasureCodeInterface {
+public:
+  /// chunk sizes are rounded up to a multiple of this many bytes
+  static const unsigned ALIGNMENT = 16;
+
+private:
+  unsigned k, m;
+  std::vector<uint8_t> matrix;   ///< (k+m) x k generator matrix, row major
+
+  const uint8_t *row(unsigned chunk) const {
+    return &matrix[chunk * k];
+  }
+
+  void encode_chunks(const std::vector<const char*> &data,
+		     const set<int> &want,
+		     unsigned chunk_size,
+		     map<int, bufferlist> *encoded) const;
+
+public:
+  ErasureCodeReedSolomon(unsigned k_, unsigned m_);
+
+  unsigned int get_chunk_count() const {
+    return k + m;
+  }
+  unsigned int get_data_chunk_count() const {
+    return k;
+  }
+  unsigned int get_chunk_size(unsigned int object_size) const;
+
+  int minimum_to_decode(const set<int> &want_to_read,
+			const set<int> &available,
+			set<int> *minimum);
+  int encode(const set<int> &want_to_encode,
+	     const bufferlist &in,
+	     map<int, bufferlist> *encoded);
+  int decode(const set<int> &want_to_read,
+	     const map<int, bufferlist> &chunks,
+	     map<int, bufferlist> *decoded);
+
+  // GF(2^8) arithmetic, polynomial x^8 + x^4 + x^3 + x^2 + 1
+  static uint8_t gf_mul(uint8_t a, uint8_t b);
+  static uint8_t gf_inv(uint8_t a);
+
+  /**
+   * dst = c * src (or dst ^= c * src if @accumulate) over @len bytes
+   */
+  static void region_multiply(uint8_t c, const char *src, char *dst,
+			      unsigned len, bool accumulate);
+
+  /**
+   * invert the @n x @n matrix @a in place
+   *
+   * @return 0 on success, -EINVAL if @a is singular
+   */
+  static int invert_matrix(std::vector<uint8_t> &a, unsigned n);
+};
+
+#endif
@@ -0,0 +1,87 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2013 Inktank
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OSD_HITSET_H
+#define CEPH_OSD_HITSET_H
+
+#include <list>
+#include <ext/hash_set>
+
+#include "include/types.h"
+#include "include/utime.h"
+#include "os/hobject.h"
+
+/**
+ * set of objects accessed during an interval
+ *
+ * Objects are recorded by their 32-bit hash, so a collision may make
+ * a cold object look hot; that only delays its eviction.
+ */
+struct HitSet {
+  utime_t begin;
+  __gnu_cxx::hash_set<uint32_t> hits;
+
+  HitSet() {}
+  HitSet(utime_t b) : begin(b) {}
+
+  void insert(const hobject_t& o) {
+    hits.insert(o.hash);
+  }
+  bool contains(const hobject_t& o) const {
+    return hits.count(o.hash);
+  }
+  unsigned size() const {
+    return hits.size();
+  }
+};
+
+/**
+ * the current HitSet and the ones before it
+ *
+ * A new set is started every @period seconds, and the most recent
+ * @count sets (including the current one) are kept.
+ */
+class HitSetHistory {
+  std::list<HitSet> sets;  ///< newest first
+
+public:
+  /// start a new set if the current one covers @period; true if we did
+  bool maybe_rotate(utime_t now, unsigned period, unsigned count) {
+    if (!sets.empty() && now - sets.front().begin < utime_t(period, 0))
+      return false;
+    sets.push_front(HitSet(now));
+    while (sets.size() > (count ? count : 1))
+      sets.pop_back();
+    return true;
+  }
+  void insert(const hobject_t& o) {
+    if (!sets.empty())
+      sets.front().insert(o);
+  }
+  /// true if @o was accessed in any of the retained sets
+  bool contains(const hobject_t& o) const {
+    for (std::list<HitSet>::const_iterator p = sets.begin(); p != sets.end(); ++p)
+      if (p->contains(o))
+	return true;
+    return false;
+  }
+  unsigned num_sets() const {
+    return sets.size();
+  }
+  void clear() {
+    sets.clear();
+  }
+};
+
+#endif
@@ -152,26 +152,40 @@ OSDService::OSDService(OSD *osd) :
   infos_oid(sobject_t("infos", CEPH_NOSNAP)),
   cluster_messenger(osd->cluster_messenger),
   client_messenger(osd->client_messenger),
+  objecter_messenger(osd->objecter_messenger),
   logger(osd->logger),
   monc(osd->monc),
   op_wq(osd->op_wq),
   peering_wq(osd->peering_wq),
   recovery_wq(osd->recovery_wq),
   snap_trim_wq(osd->snap_trim_wq),
+  agent_wq(osd->agent_wq),
   scrub_wq(osd->scrub_wq),
   scrub_finalize_wq(osd->scrub_finalize_wq),
   rep_scrub_wq(osd->rep_scrub_wq),
+  scrub_hash_wq(osd->scrub_hash_wq),
   class_handler(osd->class_handler),
   publish_lock("OSDService::publish_lock"),
   pre_publish_lock("OSDService::pre_publish_lock"),
+  pg_epoch_lock("OSDService::pg_epoch_lock"),
   sched_scrub_lock("OSDService::sched_scrub_lock"), scrubs_pending(0),
   scrubs_active(0),
+  scrub_throttle_lock("OSDService::scrub_throttle_lock"),
+  scrub_throttle_rate(0), scrub_throttle_avail(0),
+  scrub_throttle_stopping(false),
   watch_lock("OSD::watch_lock"),
   watch_timer(osd->client_messenger->cct, watch_lock),
   backfill_request_lock("OSD::backfill_request_lock"),
   backfill_request_timer(g_ceph_context, backfill_request_lock, false),
   last_tid(0),
   tid_lock("OSDService::tid_lock"),
+  objecter_lock("OSD::objecter_lock"),
+  objecter_timer(osd->client_messenger->cct, objecter_lock),
+  objecter(new Objecter(osd->client_messenger->cct, osd->objecter_messenger,
+			osd->monc, &objecter_osdmap, objecter_lock,
+			objecter_timer)),
+  objecter_finisher(osd->client_messenger->cct),
+  objecter_dispatcher(this),
   reserver_finisher(g_ceph_context),
   local_reserver(&reserver_finisher, g_conf->osd_max_backfills),
   remote_reserver(&reserver_finisher, g_conf->osd_max_backfills),
@@ -183,6 +197,11 @@ OSDService::OSDService(OSD *osd) :
   in_progress_split_lock("OSDService::in_progress_split_lock")
 {}
 
+OSDService::~OSDService()
+{
+  delete objecter;
+}
+
 void OSDService::_start_split(const set<pg_t> &pgs)
 {
   for (set<pg_t>::const_iterator i = pgs.begin();
@@ -248,15 +267,78 @@ void OSDService::pg_stat_queue_dequeue(PG *pg)
 void OSDService::shutdown()
 {
   reserver_finisher.stop();
+  {
+    Mutex::Locker l(scrub_throttle_lock);
+    scrub_throttle_stopping = true;
+    scrub_delayed.clear();
+  }
   watch_lock.Lock();
   watch_timer.shutdown();
   watch_lock.Unlock();
+  {
+    Mutex::Locker l(objecter_lock);
+    objecter->shutdown_locked();
+    objecter_timer.shutdown();
+  }
+  objecter->shutdown_unlocked();
+  objecter_finisher.stop();
 }
 
 void OSDService::init()
 {
   reserver_finisher.start();
   watch_timer.init();
+  objecter_finisher.start();
+  objecter_messenger->add_dispatcher_head(&objecter_dispatcher);
+  objecter->init_unlocked();
+  Mutex::Locker l(objecter_lock);
+  objecter_timer.init();
+  objecter->set_client_incarnation(0);
+  objecter->init_locked();
+}
+
+bool OSDService::ObjecterDispatcher::ms_dispatch(Message *m)
+{
+  Mutex::Locker l(osd->objecter_lock);
+  switch (m->get_type()) {
+  case CEPH_MSG_OSD_OPREPLY:
+    osd->objecter->handle_osd_op_reply(static_cast<MOSDOpReply*>(m));
+    return true;
+  case CEPH_MSG_OSD_MAP:
+    osd->objecter->handle_osd_map(static_cast<MOSDMap*>(m));
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool OSDService::ObjecterDispatcher::ms_handle_reset(Connection *con)
+{
+  Mutex::Locker l(osd->objecter_lock);
+  osd->objecter->ms_handle_reset(con);
+  return true;
+}
+
+void OSDService::ObjecterDispatcher::ms_handle_remote_reset(Connection *con)
+{
+  Mutex::Locker l(osd->objecter_lock);
+  osd->objecter->ms_handle_remote_reset(con);
+}
+
+void OSDService::ObjecterDispatcher::ms_handle_connect(Connection *con)
+{
+  Mutex::Locker l(osd->objecter_lock);
+  osd->objecter->ms_handle_connect(con);
+}
+
+bool OSDService::ObjecterDispatcher::ms_get_authorizer(int dest_type,
+						       AuthAuthorizer **authorizer,
+						       bool force_new)
+{
+  if (dest_type == CEPH_ENTITY_TYPE_MON)
+    return true;
+  *authorizer = osd->monc->auth->build_authorizer(dest_type);
+  return *authorizer != NULL;
 }
 
 ObjectStore *OSD::create_object_store(const std::string &dev, const std::string &jdev)
@@ -739,7 +821,9 @@ int OSD::peek_journal_fsid(string path, uuid_d& fsid)
 // cons/des
 
 OSD::OSD(int id, Messenger *internal_messenger, Messenger *external_messenger,
-	 Messenger *hbclientm, Messenger *hbserverm, MonClient *mc,
+	 Messenger *hbclientm, Messenger *hbserverm,
+	 Messenger *osdc_messenger,
+	 MonClient *mc,
 	 const std::string &dev, const std::string &jdev) :
   Dispatcher(external_messenger->cct),
   osd_lock("OSD::osd_lock"),
@@ -754,6 +838,7 @@ OSD::OSD(int id, Messenger *internal_messenger, Messenger *external_messenger,
 								      cct->_conf->auth_service_required)),
   cluster_messenger(internal_messenger),
   client_messenger(external_messenger),
+  objecter_messenger(osdc_messenger),
   monc(mc),
   logger(NULL),
   store(NULL),
@@ -765,9 +850,11 @@ OSD::OSD(int id, Messenger *internal_messenger, Messenger *external_messenger,
   osd_compat(get_osd_compat_set()),
   state(STATE_INITIALIZING), boot_epoch(0), up_epoch(0), bind_epoch(0),
   op_tp(external_messenger->cct, "OSD::op_tp", g_conf->osd_op_threads, "osd_op_threads"),
+  peering_tp(external_messenger->cct, "OSD::peering_tp", g_conf->osd_peering_wq_threads, "osd_peering_wq_threads"),
   recovery_tp(external_messenger->cct, "OSD::recovery_tp", g_conf->osd_recovery_threads, "osd_recovery_threads"),
   disk_tp(external_messenger->cct, "OSD::disk_tp", g_conf->osd_disk_threads, "osd_disk_threads"),
   command_tp(external_messenger->cct, "OSD::command_tp", 1),
+  scrub_hash_tp(external_messenger->cct, "OSD::scrub_hash_tp", g_conf->osd_deep_scrub_threads, "osd_deep_scrub_threads"),
   paused_recovery(false),
   heartbeat_lock("OSD::heartbeat_lock"),
   heartbeat_stop(false), heartbeat_need_update(true), heartbeat_epoch(0),
@@ -778,7 +865,8 @@ OSD::OSD(int id, Messenger *internal_messenger, Messenger *external_messenger,
   stat_lock("OSD::stat_lock"),
   finished_lock("OSD::finished_lock"),
   op_wq(this, g_conf->osd_op_thread_timeout, &op_tp),
-  peering_wq(this, g_conf->osd_op_thread_timeout, &op_tp, 200),
+  peering_wq(this, g_conf->osd_op_thread_timeout, &peering_tp,
+	     g_conf->osd_peering_wq_batch_size),
   map_lock("OSD::map_lock"),
   peer_map_epoch_lock("OSD::peer_map_epoch_lock"),
   debug_drop_pg_create_probability(g_conf->osd_debug_drop_pg_create_probability),
@@ -794,9 +882,12 @@ OSD::OSD(int id, Messenger *internal_messenger, Messenger *external_messenger,
   recovery_wq(this, g_conf->osd_recovery_thread_timeout, &recovery_tp),
   replay_queue_lock("OSD::replay_queue_lock"),
   snap_trim_wq(this, g_conf->osd_snap_trim_thread_timeout, &disk_tp),
+  agent_wq(this, g_conf->osd_tier_agent_thread_timeout, &disk_tp),
+  scrub_load_ops(0),
   scrub_wq(this, g_conf->osd_scrub_thread_timeout, &disk_tp),
   scrub_finalize_wq(this, g_conf->osd_scrub_finalize_thread_timeout, &op_tp),
   rep_scrub_wq(this, g_conf->osd_scrub_thread_timeout, &disk_tp),
+  scrub_hash_wq(this, g_conf->osd_scrub_thread_timeout, &scrub_hash_tp),
   remove_wq(store, g_conf->osd_remove_thread_timeout, &disk_tp),
   next_removal_seq(0),
   service(this)
@@ -865,12 +956,39 @@ bool OSD::asok_command(string command, string args, ostream& ss)
     op_tracker.dump_ops_in_flight(ss);
   } else if (command == "dump_historic_ops") {
     op_tracker.dump_historic_ops(ss);
+  } else if (command == "dump_op_stage_latency") {
+    op_tracker.dump_stage_histograms(ss);
+  } else if (command == "reset_op_stage_latency") {
+    op_tracker.reset_stage_histograms();
   } else if (command == "dump_op_pq_state") {
     JSONFormatter f(true);
     f.open_object_section("pq");
     op_wq.dump(&f);
     f.close_section();
     f.flush(ss);
+  } else if (command == "dump_map_cache") {
+    JSONFormatter f(true);
+    f.open_object_section("map_cache");
+    service.dump_map_cache(&f);
+    f.close_section();
+    f.flush(ss);
+  } else if (command == "dump_heartbeat_peers") {
+    JSONFormatter f(true);
+    f.open_object_section("heartbeat_peers");
+    dump_heartbeat_peers(&f);
+    f.close_section();
+    f.flush(ss);
+  } else if (command == "dump_reservations") {
+    JSONFormatter f(true);
+    f.open_object_section("reservations");
+    f.open_object_section("local_reservations");
+    service.local_reserver.dump(&f);
+    f.close_section();
+    f.open_object_section("remote_reservations");
+    service.remote_reserver.dump(&f);
+    f.close_section();
+    f.close_section();
+    f.flush(ss);
   } else {
     assert(0 == "broken asok registration");
   }
@@ -970,6 +1088,7 @@ int OSD::init()
   }
 
   create_logger();
+  op_tracker.create_logger(cct);
     
   // i'm ready!
   client_messenger->add_dispatcher_head(this);
@@ -987,9 +1106,11 @@ int OSD::init()
   monc->set_log_client(&clog);
 
   op_tp.start();
+  peering_tp.start();
   recovery_tp.start();
   disk_tp.start();
   command_tp.start();
+  scrub_hash_tp.start();
 
   // start the heartbeat
   heartbeat_thread.create();
@@ -1008,6 +1129,21 @@ int OSD::init()
   r = admin_socket->register_command("dump_op_pq_state", asok_hook,
 				     "dump op priority queue state");
   assert(r == 0);
+  r = admin_socket->register_command("dump_op_stage_latency", asok_hook,
+				     "show per-stage op latency histograms");
+  assert(r == 0);
+  r = admin_socket->register_command("reset_op_stage_latency", asok_hook,
+				     "clear the per-stage op latency histograms");
+  assert(r == 0);
+  r = admin_socket->register_command("dump_map_cache", asok_hook,
+				     "show osdmap cache size and memory usage");
+  assert(r == 0);
+  r = admin_socket->register_command("dump_heartbeat_peers", asok_hook,
+				     "show heartbeat peers, ping round trip times and grace periods");
+  assert(r == 0);
+  r = admin_socket->register_command("dump_reservations", asok_hook,
+				     "show recovery reservations, granted and queued");
+  assert(r == 0);
   test_ops_hook = new TestOpsSocketHook(&(this->service), this->store);
   r = admin_socket->register_command("setomapval", test_ops_hook,
                               "setomapval <pool-id> <obj-name> <key> <val>");
@@ -1060,6 +1196,9 @@ void OSD::create_logger()
   PerfCountersBuilder osd_plb(g_ceph_context, "osd", l_osd_first, l_osd_last);
 
   osd_plb.add_u64(l_osd_opq, "opq");       // op queue length (waiting to be processed yet)
+  osd_plb.add_time_avg(l_osd_opq_client_lat, "opq_client_latency");     // time client ops wait in the op queue
+  osd_plb.add_time_avg(l_osd_opq_recovery_lat, "opq_recovery_latency"); // time push/pull ops wait in the op queue
+  osd_plb.add_time_avg(l_osd_opq_subop_lat, "opq_subop_latency");       // time other ops wait in the op queue
   osd_plb.add_u64(l_osd_op_wip, "op_wip");   // rep ops currently being processed (primary)
 
   osd_plb.add_u64_counter(l_osd_op,       "op");           // client ops
@@ -1070,6 +1209,8 @@ void OSD::create_logger()
   osd_plb.add_u64_counter(l_osd_op_r,      "op_r");        // client reads
   osd_plb.add_u64_counter(l_osd_op_r_outb, "op_r_out_bytes");   // client read out bytes
   osd_plb.add_time_avg(l_osd_op_r_lat,  "op_r_latency");    // client read latency
+  osd_plb.add_u64_counter(l_osd_op_r_replica, "op_r_replica");   // client reads served by a replica
+  osd_plb.add_u64_counter(l_osd_op_r_replica_bounce, "op_r_replica_bounce");   // replica reads sent back to the primary
   osd_plb.add_u64_counter(l_osd_op_w,      "op_w");        // client writes
   osd_plb.add_u64_counter(l_osd_op_w_inb,  "op_w_in_bytes");    // client write in bytes
   osd_plb.add_time_avg(l_osd_op_w_rlat, "op_w_rlat");   // client write readable/applied latency
@@ -1102,6 +1243,26 @@ void OSD::create_logger()
 
   osd_plb.add_u64_counter(l_osd_rop, "recovery_ops");       // recovery ops (started)
 
+  osd_plb.add_u64_counter(l_osd_backfill_scan, "backfill_scan");           // backfill ranges listed
+  osd_plb.add_u64_counter(l_osd_backfill_scan_objs, "backfill_scan_objects"); // objects listed by backfill
+  osd_plb.add_time_avg(l_osd_backfill_scan_lat, "backfill_scan_latency");    // time to list and stat a range
+  osd_plb.add_u64_counter(l_osd_backfill_update, "backfill_scan_updates"); // ranges updated from the log instead
+  osd_plb.add_u64_avg(l_osd_backfill_inflight, "backfill_push_inflight");  // objects being pushed per backfill pass
+  osd_plb.add_u64_counter(l_osd_backfill_preempt, "backfill_preempted"); // backfills that gave up their reservation
+
+  osd_plb.add_u64(l_osd_resv_wait_misplaced, "reservation_wait_misplaced"); // queued reservations, by priority band
+  osd_plb.add_u64(l_osd_resv_wait_degraded, "reservation_wait_degraded");
+  osd_plb.add_u64(l_osd_resv_wait_critical, "reservation_wait_critical");
+
+  osd_plb.add_u64_counter(l_osd_tier_promote, "tier_promote");   // objects promoted into a cache pool
+  osd_plb.add_u64_counter(l_osd_tier_flush, "tier_flush");       // dirty objects flushed to the base pool
+  osd_plb.add_u64_counter(l_osd_tier_flush_fail, "tier_flush_fail"); // failed flushes
+  osd_plb.add_u64_counter(l_osd_tier_evict, "tier_evict");       // objects evicted from a cache pool
+  osd_plb.add_u64_counter(l_osd_tier_delay, "tier_delay");       // ops that waited on a promote or flush
+
+  osd_plb.add_u64_counter(l_osd_deep_scrub_bytes, "deep_scrub_bytes");   // object data read by deep scrub
+  osd_plb.add_u64_counter(l_osd_deep_scrub_throttle, "deep_scrub_throttle"); // scrub chunks delayed by the throttle
+
   osd_plb.add_u64(l_osd_loadavg, "loadavg");
   osd_plb.add_u64(l_osd_buf, "buffer_bytes");       // total ceph::buffer bytes
 
@@ -1111,9 +1272,15 @@ void OSD::create_logger()
   osd_plb.add_u64(l_osd_pg_stray, "numpg_stray");   // num stray pgs
   osd_plb.add_u64(l_osd_hb_to, "heartbeat_to_peers");     // heartbeat peers we send to
   osd_plb.add_u64(l_osd_hb_from, "heartbeat_from_peers"); // heartbeat peers we recv from
+  osd_plb.add_time_avg(l_osd_hb_rtt, "heartbeat_rtt");    // ping round trip time
   osd_plb.add_u64_counter(l_osd_map, "map_messages");           // osdmap messages
   osd_plb.add_u64_counter(l_osd_mape, "map_message_epochs");         // osdmap epochs
   osd_plb.add_u64_counter(l_osd_mape_dup, "map_message_epoch_dups"); // dup osdmap epochs
+  osd_plb.add_u64_counter(l_osd_map_rebuild, "map_rebuilds"); // osdmaps rebuilt from incrementals
+
+  osd_plb.add_time_avg(l_osd_pg_advance_lat, "pg_advance_latency"); // time to advance a pg through a batch of epochs
+  osd_plb.add_u64_counter(l_osd_pg_advance_epochs, "pg_advance_epochs"); // epochs pgs advanced through
+  osd_plb.add_u64(l_osd_pg_min_epoch, "pg_min_epoch");    // oldest map epoch of any pg
 
   logger = osd_plb.create_perf_counters();
   g_ceph_context->get_perfcounters_collection()->add(logger);
@@ -1131,6 +1298,7 @@ void OSD::suicide(int exitcode)
 
   derr << " pausing thread pools" << dendl;
   op_tp.pause();
+  peering_tp.pause();
   disk_tp.pause();
   recovery_tp.pause();
   command_tp.pause();
@@ -1181,6 +1349,11 @@ int OSD::shutdown()
   cct->get_admin_socket()->unregister_command("dump_ops_in_flight");
   cct->get_admin_socket()->unregister_command("dump_historic_ops");
   cct->get_admin_socket()->unregister_command("dump_op_pq_state");
+  cct->get_admin_socket()->unregister_command("dump_op_stage_latency");
+  cct->get_admin_socket()->unregister_command("reset_op_stage_latency");
+  cct->get_admin_socket()->unregister_command("dump_map_cache");
+  cct->get_admin_socket()->unregister_command("dump_reservations");
+  cct->get_admin_socket()->unregister_command("dump_heartbeat_peers");
   delete asok_hook;
   asok_hook = NULL;
 
@@ -1195,6 +1368,8 @@ int OSD::shutdown()
   dout(10) << "recovery tp stopped" << dendl;
   op_tp.stop();
   dout(10) << "op tp stopped" << dendl;
+  peering_tp.stop();
+  dout(10) << "peering tp stopped" << dendl;
 
   // pause _new_ disk work first (to avoid racing with thread pool),
   disk_tp.pause_new();
@@ -1215,6 +1390,10 @@ int OSD::shutdown()
   disk_tp.stop();
   dout(10) << "disk tp stopped" << dendl;
 
+  // no scrub can be waiting for its hashes now
+  scrub_hash_tp.stop();
+  dout(10) << "scrub hash tp stopped" << dendl;
+
   // tell pgs we're shutting down
   for (hash_map<pg_t, PG*>::iterator p = pg_map.begin();
        p != pg_map.end();
@@ -1271,6 +1450,7 @@ int OSD::shutdown()
   cluster_messenger->shutdown();
   hbclient_messenger->shutdown();
   hbserver_messenger->shutdown();
+  objecter_messenger->shutdown();
 
   monc->shutdown();
   return r;
@@ -1387,6 +1567,7 @@ PG *OSD::_open_lock_pg(
   PG* pg = _make_pg(createmap, pgid);
 
   pg_map[pgid] = pg;
+  service.pg_add_epoch(pgid, pg->get_osdmap()->get_epoch());
 
   if (hold_map_lock)
     pg->lock_with_map_lock_held(no_lockdep_check);
@@ -1421,6 +1602,7 @@ void OSD::add_newly_split_pg(PG *pg, PG::RecoveryCtx *rctx)
   epoch_t e(service.get_osdmap()->get_epoch());
   pg->get();  // For pg_map
   pg_map[pg->info.pgid] = pg;
+  service.pg_add_epoch(pg->info.pgid, pg->get_osdmap()->get_epoch());
   dout(10) << "Adding newly split pg " << *pg << dendl;
   vector<int> up, acting;
   pg->get_osdmap()->pg_to_up_acting_osds(pg->info.pgid, up, acting);
@@ -2133,6 +2315,9 @@ void OSD::handle_osd_ping(MOSDPing *m)
 		 << " last_rx " << i->second.last_rx << " -> " << m->stamp
 		 << dendl;
 	i->second.last_rx = m->stamp;
+	utime_t rtt = ceph_clock_now(g_ceph_context) - m->stamp;
+	i->second.add_rtt(rtt);
+	logger->tinc(l_osd_hb_rtt, rtt);
       }
 
       if (m->map_epoch &&
@@ -2174,7 +2359,8 @@ void OSD::heartbeat_entry()
   while (!heartbeat_stop) {
     heartbeat();
 
-    double wait = .5 + ((float)(rand() % 10)/10.0) * (float)g_conf->osd_heartbeat_interval;
+    double interval = g_conf->osd_heartbeat_interval;
+    double wait = MIN(.5, interval / 2) + ((double)(rand() % 10)/10.0) * interval;
     utime_t w;
     w.set_from_double(wait);
     dout(30) << "heartbeat_entry sleeping for " << wait << dendl;
@@ -2184,16 +2370,35 @@ void OSD::heartbeat_entry()
   heartbeat_lock.Unlock();
 }
 
+/*
+ * A peer that has answered our pings reliably for a while gets a
+ * grace period sized to its measured round trip times instead of the
+ * fixed osd_heartbeat_grace, so that we can report it sooner if it
+ * stops.  A peer with jittery round trips (e.g. because it is loaded)
+ * keeps a longer grace.
+ */
+double OSD::heartbeat_grace(const HeartbeatInfo& hi) const
+{
+  double max_grace = g_conf->osd_heartbeat_grace;
+  double min_grace = g_conf->osd_heartbeat_min_grace;
+  if (min_grace >= max_grace || hi.rtt_hist.count() < 10)
+    return max_grace;
+  double grace = 2 * g_conf->osd_heartbeat_interval + hi.srtt +
+    g_conf->osd_heartbeat_rtt_grace_mult * hi.rttvar;
+  return MIN(MAX(grace, min_grace), max_grace);
+}
+
 void OSD::heartbeat_check()
 {
   assert(heartbeat_lock.is_locked());
 
   // check for incoming heartbeats (move me elsewhere?)
-  utime_t cutoff = ceph_clock_now(g_ceph_context);
-  cutoff -= g_conf->osd_heartbeat_grace;
+  utime_t now = ceph_clock_now(g_ceph_context);
   for (map<int,HeartbeatInfo>::iterator p = heartbeat_peers.begin();
        p != heartbeat_peers.end();
        p++) {
+    utime_t cutoff = now;
+    cutoff -= heartbeat_grace(p->second);
     dout(25) << "heartbeat_check osd." << p->first
 	     << " first_tx " << p->second.first_tx
 	     << " last_tx " << p->second.last_tx
@@ -2280,6 +2485,30 @@ void OSD::heartbeat()
   dout(30) << "heartbeat done" << dendl;
 }
 
+void OSD::dump_heartbeat_peers(Formatter *f)
+{
+  Mutex::Locker l(heartbeat_lock);
+  f->open_array_section("peers");
+  for (map<int,HeartbeatInfo>::iterator p = heartbeat_peers.begin();
+       p != heartbeat_peers.end();
+       ++p) {
+    const HeartbeatInfo& hi = p->second;
+    f->open_object_section("peer");
+    f->dump_int("osd", p->first);
+    f->dump_stream("first_tx") << hi.first_tx;
+    f->dump_stream("last_tx") << hi.last_tx;
+    f->dump_stream("last_rx") << hi.last_rx;
+    f->dump_float("srtt", hi.srtt);
+    f->dump_float("rttvar", hi.rttvar);
+    f->dump_float("grace", heartbeat_grace(hi));
+    f->open_object_section("rtt_usec");
+    hi.rtt_hist.dump(f);
+    f->close_section();
+    f->close_section();
+  }
+  f->close_section();
+}
+
 bool OSD::heartbeat_reset(Connection *con)
 {
   HeartbeatSession *s = static_cast<HeartbeatSession*>(con->get_priv());
@@ -2344,6 +2573,14 @@ void OSD::tick()
 
     check_replay_queue();
 
+    queue_agent_work();
+
+    update_deep_scrub_rate();
+
+    logger->set(l_osd_pg_min_epoch, service.get_min_pg_epoch());
+
+    update_reservation_stats();
+
     // mon report?
     utime_t now = ceph_clock_now(g_ceph_context);
     if (outstanding_pg_stats &&
@@ -2379,6 +2616,17 @@ void OSD::tick()
   timer.add_event_after(1.0, new C_Tick(this));
 }
 
+void OSD::queue_agent_work()
+{
+  for (hash_map<pg_t, PG*>::iterator p = pg_map.begin();
+       p != pg_map.end();
+       ++p) {
+    const pg_pool_t *pi = osdmap->get_pg_pool(p->first.pool());
+    if (pi && pi->cache_mode != pg_pool_t::CACHEMODE_NONE)
+      agent_wq.queue(p->second);
+  }
+}
+
 void OSD::check_ops_in_flight()
 {
   vector<string> warnings;
@@ -2772,8 +3020,13 @@ void OSD::send_failures()
   while (!failure_queue.empty()) {
     int osd = failure_queue.begin()->first;
     int failed_for = (int)(double)(now - failure_queue.begin()->second);
+    double grace = 0;
+    map<int,HeartbeatInfo>::iterator p = heartbeat_peers.find(osd);
+    if (p != heartbeat_peers.end())
+      grace = heartbeat_grace(p->second);
     entity_inst_t i = osdmap->get_inst(osd);
-    monc->send_mon_message(new MOSDFailure(monc->get_fsid(), i, failed_for, osdmap->get_epoch()));
+    monc->send_mon_message(new MOSDFailure(monc->get_fsid(), i, failed_for,
+					   osdmap->get_epoch(), grace));
     failure_pending[osd] = i;
     failure_queue.erase(osd);
   }
@@ -3753,6 +4006,119 @@ void OSDService::dec_scrubs_active()
   sched_scrub_lock.Unlock();
 }
 
+void OSDService::_refill_scrub_throttle(utime_t now)
+{
+  assert(scrub_throttle_lock.is_locked());
+  if (scrub_throttle_stamp != utime_t() && scrub_throttle_rate > 0) {
+    // allow a burst of at most one second worth of bytes
+    scrub_throttle_avail += scrub_throttle_rate * (double)(now - scrub_throttle_stamp);
+    if (scrub_throttle_avail > scrub_throttle_rate)
+      scrub_throttle_avail = scrub_throttle_rate;
+  }
+  scrub_throttle_stamp = now;
+}
+
+void OSDService::set_deep_scrub_rate(double rate)
+{
+  Mutex::Locker l(scrub_throttle_lock);
+  _refill_scrub_throttle(ceph_clock_now(g_ceph_context));
+  if (rate != scrub_throttle_rate)
+    dout(20) << "set_deep_scrub_rate " << scrub_throttle_rate << " -> " << rate
+	     << " bytes/sec" << dendl;
+  scrub_throttle_rate = rate;
+  if (rate <= 0)
+    scrub_throttle_avail = 0;
+}
+
+void OSDService::deep_scrub_charge(uint64_t bytes)
+{
+  logger->inc(l_osd_deep_scrub_bytes, bytes);
+  Mutex::Locker l(scrub_throttle_lock);
+  if (scrub_throttle_rate <= 0)
+    return;
+  _refill_scrub_throttle(ceph_clock_now(g_ceph_context));
+  scrub_throttle_avail -= bytes;
+}
+
+bool OSDService::deep_scrub_delay(PG *pg)
+{
+  Mutex::Locker l(scrub_throttle_lock);
+  if (scrub_throttle_rate <= 0 || scrub_throttle_stopping)
+    return false;
+  utime_t now = ceph_clock_now(g_ceph_context);
+  _refill_scrub_throttle(now);
+  if (scrub_throttle_avail >= 0)
+    return false;
+  utime_t when = now;
+  when += -scrub_throttle_avail / scrub_throttle_rate;
+  dout(20) << "deep_scrub_delay " << pg->info.pgid << " until " << when
+	   << " (" << scrub_throttle_avail << " bytes over)" << dendl;
+  scrub_delayed.insert(make_pair(when, PGRef(pg)));
+  logger->inc(l_osd_deep_scrub_throttle);
+  return true;
+}
+
+void OSDService::requeue_delayed_scrubs(utime_t now)
+{
+  Mutex::Locker l(scrub_throttle_lock);
+  while (!scrub_delayed.empty() &&
+	 scrub_delayed.begin()->first <= now) {
+    PGRef pg = scrub_delayed.begin()->second;
+    scrub_delayed.erase(scrub_delayed.begin());
+    dout(20) << "requeue_delayed_scrubs " << pg->info.pgid << dendl;
+    scrub_wq.queue(pg.get());
+  }
+}
+
+void OSD::update_deep_scrub_rate()
+{
+  utime_t now = ceph_clock_now(g_ceph_context);
+  uint64_t ops = logger->get(l_osd_op);
+  double client_rate = 0;
+  if (scrub_load_stamp != utime_t() && now > scrub_load_stamp)
+    client_rate = (double)(ops - scrub_load_ops) / (double)(now - scrub_load_stamp);
+  scrub_load_ops = ops;
+  scrub_load_stamp = now;
+
+  double rate = g_conf->osd_deep_scrub_max_bytes_per_sec;
+  if (rate > 0 && g_conf->osd_deep_scrub_client_op_rate > 0) {
+    // back off linearly as client load approaches osd_deep_scrub_client_op_rate
+    double ratio = 1.0 - client_rate / g_conf->osd_deep_scrub_client_op_rate;
+    if (ratio < g_conf->osd_deep_scrub_min_bandwidth_ratio)
+      ratio = g_conf->osd_deep_scrub_min_bandwidth_ratio;
+    if (ratio > 1.0)
+      ratio = 1.0;
+    rate *= ratio;
+  }
+  dout(20) << "update_deep_scrub_rate client " << client_rate << " ops/sec, deep scrub "
+	   << rate << " bytes/sec" << dendl;
+  service.set_deep_scrub_rate(rate);
+  service.requeue_delayed_scrubs(now);
+}
+
+void OSD::update_reservation_stats()
+{
+  uint64_t waiting[3] = { 0, 0, 0 };  // misplaced, degraded, critical
+  map<unsigned, unsigned> depths;
+  for (int i = 0; i < 2; ++i) {
+    if (i == 0)
+      service.local_reserver.get_queue_depths(&depths);
+    else
+      service.remote_reserver.get_queue_depths(&depths);
+    for (map<unsigned, unsigned>::iterator p = depths.begin(); p != depths.end(); ++p) {
+      if (p->first >= PG::RECOVERY_PRIORITY_CRITICAL)
+	waiting[2] += p->second;
+      else if (p->first >= PG::RECOVERY_PRIORITY_DEGRADED)
+	waiting[1] += p->second;
+      else
+	waiting[0] += p->second;
+    }
+  }
+  logger->set(l_osd_resv_wait_misplaced, waiting[0]);
+  logger->set(l_osd_resv_wait_degraded, waiting[1]);
+  logger->set(l_osd_resv_wait_critical, waiting[2]);
+}
+
 // =====================================================
 // MAP
 
@@ -3829,6 +4195,13 @@ void OSD::handle_osd_map(MOSDMap *m)
   if (session)
     session->put();
 
+  // share with the objecter used for cache tiering
+  {
+    Mutex::Locker l(service.objecter_lock);
+    m->get();
+    service.objecter->handle_osd_map(m);
+  }
+
   epoch_t first = m->get_first();
   epoch_t last = m->get_last();
   dout(3) << "handle_osd_map epochs [" << first << "," << last << "], i have "
@@ -3867,6 +4240,7 @@ void OSD::handle_osd_map(MOSDMap *m)
   ObjectStore::Transaction &t = *_t;
 
   // store new maps: queue for disk and put in the osdmap cache
+  set<epoch_t> full_written;
   epoch_t start = MAX(osdmap->get_epoch() + 1, first);
   for (epoch_t e = start; e <= last; e++) {
     map<epoch_t,bufferlist>::iterator p;
@@ -3882,6 +4256,7 @@ void OSD::handle_osd_map(MOSDMap *m)
       hobject_t fulloid = get_osdmap_pobject_name(e);
       t.write(coll_t::META_COLL, fulloid, 0, bl.length(), bl);
       pin_map_bl(e, bl);
+      full_written.insert(e);
       continue;
     }
 
@@ -3911,12 +4286,15 @@ void OSD::handle_osd_map(MOSDMap *m)
 
       pinned_maps.push_back(add_map(o));
 
-      bufferlist fbl;
-      o->encode(fbl);
+      if (OSDService::is_full_map_checkpoint(e)) {
+	bufferlist fbl;
+	o->encode(fbl);
 
-      hobject_t fulloid = get_osdmap_pobject_name(e);
-      t.write(coll_t::META_COLL, fulloid, 0, fbl.length(), fbl);
-      pin_map_bl(e, fbl);
+	hobject_t fulloid = get_osdmap_pobject_name(e);
+	t.write(coll_t::META_COLL, fulloid, 0, fbl.length(), fbl);
+	pin_map_bl(e, fbl);
+	full_written.insert(e);
+      }
       continue;
     }
 
@@ -3928,6 +4306,9 @@ void OSD::handle_osd_map(MOSDMap *m)
     epoch_t min(
       MIN(m->oldest_map,
 	  service.map_cache.cached_key_lower_bound()));
+    epoch_t min_pg_epoch = service.get_min_pg_epoch();
+    if (min_pg_epoch && min_pg_epoch < min)
+      min = min_pg_epoch;
     for (epoch_t e = superblock.oldest_map; e < min; ++e) {
       dout(20) << " removing old osdmap epoch " << e << dendl;
       t.remove(coll_t::META_COLL, get_osdmap_pobject_name(e));
@@ -3938,6 +4319,20 @@ void OSD::handle_osd_map(MOSDMap *m)
 	  (uint64_t)num > (last - first))  // make sure we at least keep pace with incoming maps
 	break;
     }
+
+    // the oldest map we keep is the base for rebuilding the others
+    epoch_t oldest = superblock.oldest_map;
+    if (num && !skip_maps && oldest <= last &&
+	!full_written.count(oldest) &&
+	!store->exists(coll_t::META_COLL, get_osdmap_pobject_name(oldest))) {
+      dout(20) << " storing full osdmap epoch " << oldest
+	       << " as the new oldest" << dendl;
+      bufferlist fbl;
+      get_map(oldest)->encode(fbl);
+      t.write(coll_t::META_COLL, get_osdmap_pobject_name(oldest), 0,
+	      fbl.length(), fbl);
+      pin_map_bl(oldest, fbl);
+    }
   }
 
   if (!superblock.oldest_map || skip_maps)
@@ -4117,7 +4512,14 @@ void OSD::check_osdmap_features()
   }
 }
 
-void OSD::advance_pg(
+/*
+ * advance @pg toward @osd_epoch
+ *
+ * a pg never gets more than osd_map_max_advance epochs ahead of the
+ * slowest pg, so that the maps all pgs still need stay cached.
+ * returns false if the pg has not caught up and must be requeued.
+ */
+bool OSD::advance_pg(
   epoch_t osd_epoch, PG *pg,
   ThreadPool::TPHandle &handle,
   PG::RecoveryCtx *rctx,
@@ -4128,11 +4530,22 @@ void OSD::advance_pg(
   OSDMapRef lastmap = pg->get_osdmap();
 
   if (lastmap->get_epoch() == osd_epoch)
-    return;
+    return true;
   assert(lastmap->get_epoch() < osd_epoch);
 
+  utime_t start = ceph_clock_now(g_ceph_context);
+  epoch_t first_epoch = next_epoch;
+  epoch_t min_epoch = service.get_min_pg_epoch();
+  epoch_t max;
+  if (min_epoch)
+    max = min_epoch + g_conf->osd_map_max_advance;
+  else
+    max = next_epoch + g_conf->osd_map_max_advance;
+  if (max < next_epoch)
+    max = next_epoch;  // the slowest pg can always make progress
+
   for (;
-       next_epoch <= osd_epoch;
+       next_epoch <= osd_epoch && next_epoch <= max;
        ++next_epoch) {
     OSDMapRef nextmap = get_map(next_epoch);
 
@@ -4154,7 +4567,18 @@ void OSD::advance_pg(
     lastmap = nextmap;
     handle.reset_tp_timeout();
   }
+  logger->inc(l_osd_pg_advance_epochs, next_epoch - first_epoch);
+  service.pg_update_epoch(pg->info.pgid, lastmap->get_epoch());
   pg->handle_activate_map(rctx);
+  logger->tinc(l_osd_pg_advance_lat, ceph_clock_now(g_ceph_context) - start);
+
+  if (next_epoch <= osd_epoch) {
+    dout(10) << "advance_pg advanced to max " << max
+	     << " past min epoch " << min_epoch
+	     << ", will requeue " << *pg << dendl;
+    return false;
+  }
+  return true;
 }
 
 /** 
@@ -4290,6 +4714,7 @@ void OSD::consume_map()
 
   service.pre_publish_map(osdmap);
   service.publish_map(osdmap);
+  op_wq.update_qos(osdmap);
 
   // scan pg's
   for (hash_map<pg_t,PG*>::iterator it = pg_map.begin();
@@ -4411,9 +4836,23 @@ bool OSDService::_get_map_bl(epoch_t e, bufferlist& bl)
   return found;
 }
 
-bool OSDService::get_inc_map_bl(epoch_t e, bufferlist& bl)
+bool OSDService::get_map_bl(epoch_t e, bufferlist& bl)
 {
   Mutex::Locker l(map_cache_lock);
+  if (_get_map_bl(e, bl))
+    return true;
+
+  // not a checkpoint; rebuild it, if we have the incremental
+  bufferlist ibl;
+  if (!_get_inc_map_bl(e, ibl))
+    return false;
+  _get_map(e)->encode(bl);
+  _add_map_bl(e, bl);
+  return true;
+}
+
+bool OSDService::_get_inc_map_bl(epoch_t e, bufferlist& bl)
+{
   bool found = map_bl_inc_cache.lookup(e, &bl);
   if (found)
     return true;
@@ -4473,6 +4912,11 @@ OSDMapRef OSDService::_add_map(OSDMap *o)
 OSDMapRef OSDService::get_map(epoch_t epoch)
 {
   Mutex::Locker l(map_cache_lock);
+  return _get_map(epoch);
+}
+
+OSDMapRef OSDService::_get_map(epoch_t epoch)
+{
   OSDMapRef retval = map_cache.lookup(epoch);
   if (retval) {
     dout(30) << "get_map " << epoch << " -cached" << dendl;
@@ -4481,16 +4925,84 @@ OSDMapRef OSDService::get_map(epoch_t epoch)
 
   OSDMap *map = new OSDMap;
   if (epoch > 0) {
-    dout(20) << "get_map " << epoch << " - loading and decoding " << map << dendl;
     bufferlist bl;
-    assert(_get_map_bl(epoch, bl));
-    map->decode(bl);
+    if (_get_map_bl(epoch, bl)) {
+      dout(20) << "get_map " << epoch << " - loading and decoding " << map << dendl;
+      map->decode(bl);
+    } else {
+      _build_map(epoch, map);
+    }
   } else {
     dout(20) << "get_map " << epoch << " - return initial " << map << dendl;
   }
   return _add_map(map);
 }
 
+/*
+ * Only every osd_map_full_interval'th full map is stored; rebuild the
+ * others from the closest earlier map we have, cached or stored, and
+ * the incrementals after it.
+ */
+void OSDService::_build_map(epoch_t epoch, OSDMap *map)
+{
+  epoch_t base = epoch;
+  bufferlist bl;
+  while (--base > 0) {
+    OSDMapRef cached = map_cache.lookup(base);
+    if (cached) {
+      cached->encode(bl);
+      break;
+    }
+    if (_get_map_bl(base, bl))
+      break;
+  }
+  dout(20) << "get_map " << epoch << " - rebuilding from " << base
+	   << " " << map << dendl;
+  if (bl.length())
+    map->decode(bl);
+
+  for (epoch_t e = base + 1; e <= epoch; ++e) {
+    bufferlist ibl;
+    bool found = _get_inc_map_bl(e, ibl);
+    assert(found);
+    OSDMap::Incremental inc;
+    bufferlist::iterator p = ibl.begin();
+    inc.decode(p);
+    int r = map->apply_incremental(inc);
+    assert(r == 0);
+  }
+  logger->inc(l_osd_map_rebuild);
+}
+
+void OSDService::dump_map_cache(Formatter *f)
+{
+  Mutex::Locker l(map_cache_lock);
+  list<OSDMapRef> maps;
+  map_cache.get_values(&maps);
+  set<const void*> seen;
+  uint64_t bytes = 0;
+  for (list<OSDMapRef>::iterator p = maps.begin(); p != maps.end(); ++p)
+    bytes += (*p)->get_approx_bytes(&seen);
+  f->dump_unsigned("maps", maps.size());
+  f->dump_unsigned("map_bytes", bytes);
+
+  map<epoch_t, bufferlist> bls;
+  map_bl_cache.get_values(&bls);
+  bytes = 0;
+  for (map<epoch_t, bufferlist>::iterator p = bls.begin(); p != bls.end(); ++p)
+    bytes += p->second.length();
+  f->dump_unsigned("full_bls", bls.size());
+  f->dump_unsigned("full_bl_bytes", bytes);
+
+  bls.clear();
+  map_bl_inc_cache.get_values(&bls);
+  bytes = 0;
+  for (map<epoch_t, bufferlist>::iterator p = bls.begin(); p != bls.end(); ++p)
+    bytes += p->second.length();
+  f->dump_unsigned("inc_bls", bls.size());
+  f->dump_unsigned("inc_bl_bytes", bytes);
+}
+
 bool OSD::require_mon_peer(Message *m)
 {
   if (!m->get_connection()->peer_is_mon()) {
@@ -5370,26 +5882,41 @@ void OSD::handle_pg_backfill_reserve(OpRequestRef op)
   assert(pg);
 
   if (m->type == MBackfillReserve::REQUEST) {
+    if (m->get_header().version >= 2)
+      pg->queue_peering_event(
+	PG::CephPeeringEvtRef(
+	  new PG::CephPeeringEvt(
+	    m->query_epoch,
+	    m->query_epoch,
+	    PG::RequestBackfillPrio(m->priority))));
+    else
+      pg->queue_peering_event(
+	PG::CephPeeringEvtRef(
+	  new PG::CephPeeringEvt(
+	    m->query_epoch,
+	    m->query_epoch,
+	    PG::RequestBackfill())));
+  } else if (m->type == MBackfillReserve::GRANT) {
     pg->queue_peering_event(
       PG::CephPeeringEvtRef(
 	new PG::CephPeeringEvt(
 	  m->query_epoch,
 	  m->query_epoch,
-	  PG::RequestBackfill())));
-  } else if (m->type == MBackfillReserve::GRANT) {
+	  PG::RemoteBackfillReserved())));
+  } else if (m->type == MBackfillReserve::REJECT) {
     pg->queue_peering_event(
       PG::CephPeeringEvtRef(
 	new PG::CephPeeringEvt(
 	  m->query_epoch,
 	  m->query_epoch,
-	  PG::RemoteBackfillReserved())));
-  } else if (m->type == MBackfillReserve::REJECT) {
+	  PG::RemoteReservationRejected())));
+  } else if (m->type == MBackfillReserve::REVOKE) {
     pg->queue_peering_event(
       PG::CephPeeringEvtRef(
 	new PG::CephPeeringEvt(
 	  m->query_epoch,
 	  m->query_epoch,
-	  PG::RemoteReservationRejected())));
+	  PG::RemoteReservationRevoked())));
   } else {
     assert(0);
   }
@@ -5420,7 +5947,7 @@ void OSD::handle_pg_recovery_reserve(OpRequestRef op)
 	new PG::CephPeeringEvt(
 	  m->query_epoch,
 	  m->query_epoch,
-	  PG::RequestRecovery())));
+	  PG::RequestRecoveryPrio(m->priority))));
   } else if (m->type == MRecoveryReserve::GRANT) {
     pg->queue_peering_event(
       PG::CephPeeringEvtRef(
@@ -5637,6 +6164,7 @@ void OSD::_remove_pg(PG *pg)
   scrub_wq.dequeue(pg);
   scrub_finalize_wq.dequeue(pg);
   snap_trim_wq.dequeue(pg);
+  agent_wq.dequeue(pg);
   pg_stat_queue_dequeue(pg);
   op_wq.dequeue(pg);
   peering_wq.dequeue(pg);
@@ -5647,6 +6175,7 @@ void OSD::_remove_pg(PG *pg)
 
   // remove from map
   pg_map.erase(pg->info.pgid);
+  service.pg_remove_epoch(pg->info.pgid);
   pg->put(); // since we've taken it out of map
 }
 
@@ -5816,6 +6345,19 @@ void OSD::finish_recovery_op(PG *pg, const hobject_t& soid, bool dequeue)
   recovery_wq.unlock();
 }
 
+void OSD::set_recovery_priority(PG *pg, unsigned priority)
+{
+  recovery_wq.lock();
+  if (priority != pg->recovery_priority && pg->recovery_item.is_on_list()) {
+    recovery_wq._remove(pg);
+    pg->recovery_priority = priority;
+    recovery_wq._push(pg, false);
+  } else {
+    pg->recovery_priority = priority;
+  }
+  recovery_wq.unlock();
+}
+
 void OSD::defer_recovery(PG *pg)
 {
   dout(10) << "defer_recovery " << *pg << dendl;
@@ -6094,21 +6636,116 @@ void OSD::enqueue_op(PG *pg, OpRequestRef op)
 	   << " cost " << op->request->get_cost()
 	   << " latency " << latency
 	   << " " << *(op->request) << dendl;
+  op->mark_queued_for_pg();
   op_wq.queue(make_pair(PGRef(pg), op));
 }
 
+int OSD::OpWQ::get_queue_lat_counter(OpRequestRef op)
+{
+  switch (op->request->get_type()) {
+  case CEPH_MSG_OSD_OP:
+    return l_osd_opq_client_lat;
+  case MSG_OSD_SUBOP:
+    {
+      MOSDSubOp *m = static_cast<MOSDSubOp*>(op->request);
+      if (m->ops.size() >= 1 &&
+	  (m->ops[0].op.op == CEPH_OSD_OP_PUSH ||
+	   m->ops[0].op.op == CEPH_OSD_OP_PULL))
+	return l_osd_opq_recovery_lat;
+    }
+    return l_osd_opq_subop_lat;
+  case MSG_OSD_PG_SCAN:
+  case MSG_OSD_PG_BACKFILL:
+    return l_osd_opq_recovery_lat;
+  default:
+    return l_osd_opq_subop_lat;
+  }
+}
+
+/*
+ * client ops are scheduled per (pool, client) with the pool's qos
+ * settings, falling back to the osd defaults; everything else is
+ * scheduled per sending osd with the recovery settings.
+ *
+ * called with the work queue lock held.
+ */
+OSD::OpWQ::mqueue_t::ClientInfo OSD::OpWQ::get_qos(PGRef pg, OpRequestRef op,
+						   qos_class_t *cl)
+{
+  if (op->request->get_type() != CEPH_MSG_OSD_OP) {
+    *cl = make_pair((int64_t)-1, op->request->get_source_inst());
+    return recov_qos;
+  }
+
+  int64_t pool = pg->info.pgid.pool();
+  *cl = make_pair(pool, op->request->get_source_inst());
+  map<int64_t, mqueue_t::ClientInfo>::iterator p = pool_qos.find(pool);
+  if (p != pool_qos.end())
+    return p->second;
+  return client_qos;
+}
+
+/*
+ * called when a new map is published or the qos config changes, so that
+ * enqueue need not look at either.
+ */
+void OSD::OpWQ::update_qos(OSDMapRef osdmap)
+{
+  md_config_t *conf = osd->cct->_conf;
+  mqueue_t::ClientInfo client(conf->osd_op_queue_mclock_client_op_res,
+			      conf->osd_op_queue_mclock_client_op_wgt,
+			      conf->osd_op_queue_mclock_client_op_lim);
+  mqueue_t::ClientInfo recov(conf->osd_op_queue_mclock_recov_res,
+			     conf->osd_op_queue_mclock_recov_wgt,
+			     conf->osd_op_queue_mclock_recov_lim);
+  map<int64_t, mqueue_t::ClientInfo> pools;
+  if (osdmap) {
+    const map<int64_t, pg_pool_t>& all = osdmap->get_pools();
+    for (map<int64_t, pg_pool_t>::const_iterator p = all.begin();
+	 p != all.end();
+	 ++p) {
+      const pg_pool_t& pi = p->second;
+      if (!pi.qos_reservation && !pi.qos_weight && !pi.qos_limit)
+	continue;
+      mqueue_t::ClientInfo info = client;
+      if (pi.qos_reservation)
+	info.reservation = pi.qos_reservation;
+      if (pi.qos_weight)
+	info.weight = pi.qos_weight;
+      if (pi.qos_limit)
+	info.limit = pi.qos_limit;
+      pools[p->first] = info;
+    }
+  }
+
+  lock();
+  pool_qos.swap(pools);
+  client_qos = client;
+  recov_qos = recov;
+  unlock();
+}
+
 void OSD::OpWQ::_enqueue(pair<PGRef, OpRequestRef> item)
 {
   unsigned priority = item.second->request->get_priority();
   unsigned cost = item.second->request->get_cost();
-  if (priority >= CEPH_MSG_PRIO_LOW)
+  item.second->queued_time = ceph_clock_now(g_ceph_context);
+  if (use_mclock) {
+    qos_class_t cl;
+    mqueue_t::ClientInfo info = get_qos(item.first, item.second, &cl);
+    if (priority >= CEPH_MSG_PRIO_LOW)
+      mqueue.enqueue_strict(cl, priority, item);
+    else
+      mqueue.enqueue(cl, info, cost, item);
+  } else if (priority >= CEPH_MSG_PRIO_LOW) {
     pqueue.enqueue_strict(
       item.second->request->get_source_inst(),
       priority, item);
-  else
+  } else {
     pqueue.enqueue(item.second->request->get_source_inst(),
       priority, cost, item);
-  osd->logger->set(l_osd_opq, pqueue.length());
+  }
+  osd->logger->set(l_osd_opq, _length());
 }
 
 void OSD::OpWQ::_enqueue_front(pair<PGRef, OpRequestRef> item)
@@ -6123,27 +6760,41 @@ void OSD::OpWQ::_enqueue_front(pair<PGRef, OpRequestRef> item)
   }
   unsigned priority = item.second->request->get_priority();
   unsigned cost = item.second->request->get_cost();
-  if (priority >= CEPH_MSG_PRIO_LOW)
+  item.second->queued_time = ceph_clock_now(g_ceph_context);
+  if (use_mclock) {
+    qos_class_t cl;
+    mqueue_t::ClientInfo info = get_qos(item.first, item.second, &cl);
+    if (priority >= CEPH_MSG_PRIO_LOW)
+      mqueue.enqueue_strict_front(cl, priority, item);
+    else
+      mqueue.enqueue_front(cl, info, cost, item);
+  } else if (priority >= CEPH_MSG_PRIO_LOW) {
     pqueue.enqueue_strict_front(
       item.second->request->get_source_inst(),
       priority, item);
-  else
+  } else {
     pqueue.enqueue_front(item.second->request->get_source_inst(),
       priority, cost, item);
-  osd->logger->set(l_osd_opq, pqueue.length());
+  }
+  osd->logger->set(l_osd_opq, _length());
 }
 
 PGRef OSD::OpWQ::_dequeue()
 {
-  assert(!pqueue.empty());
+  assert(!_empty());
   PGRef pg;
+  OpRequestRef op;
   {
     Mutex::Locker l(qlock);
-    pair<PGRef, OpRequestRef> ret = pqueue.dequeue();
+    pair<PGRef, OpRequestRef> ret =
+      use_mclock ? mqueue.dequeue() : pqueue.dequeue();
     pg = ret.first;
+    op = ret.second;
     pg_for_processing[&*pg].push_back(ret.second);
   }
-  osd->logger->set(l_osd_opq, pqueue.length());
+  osd->logger->tinc(get_queue_lat_counter(op),
+		    ceph_clock_now(g_ceph_context) - op->queued_time);
+  osd->logger->set(l_osd_opq, _length());
   return pg;
 }
 
@@ -6245,8 +6896,10 @@ void OSD::process_peering_events(
       pg->unlock();
       continue;
     }
-    advance_pg(curmap->get_epoch(), pg, handle, &rctx, &split_pgs);
-    if (!pg->peering_queue.empty()) {
+    if (!advance_pg(curmap->get_epoch(), pg, handle, &rctx, &split_pgs)) {
+      // let the other pgs catch up before we go on
+      pg->queue_null(curmap->get_epoch(), curmap->get_epoch());
+    } else if (!pg->peering_queue.empty()) {
       PG::CephPeeringEvtRef evt = pg->peering_queue.front();
       pg->peering_queue.pop_front();
       pg->handle_peering_event(evt, &rctx);
@@ -6281,6 +6934,12 @@ const char** OSD::get_tracked_conf_keys() const
 {
   static const char* KEYS[] = {
     "osd_max_backfills",
+    "osd_op_queue_mclock_client_op_res",
+    "osd_op_queue_mclock_client_op_wgt",
+    "osd_op_queue_mclock_client_op_lim",
+    "osd_op_queue_mclock_recov_res",
+    "osd_op_queue_mclock_recov_wgt",
+    "osd_op_queue_mclock_recov_lim",
     NULL
   };
   return KEYS;
@@ -6293,6 +6952,14 @@ void OSD::handle_conf_change(const struct md_config_t *conf,
     service.local_reserver.set_max(g_conf->osd_max_backfills);
     service.remote_reserver.set_max(g_conf->osd_max_backfills);
   }
+  if (changed.count("osd_op_queue_mclock_client_op_res") ||
+      changed.count("osd_op_queue_mclock_client_op_wgt") ||
+      changed.count("osd_op_queue_mclock_client_op_lim") ||
+      changed.count("osd_op_queue_mclock_recov_res") ||
+      changed.count("osd_op_queue_mclock_recov_wgt") ||
+      changed.count("osd_op_queue_mclock_recov_lim")) {
+    op_wq.update_qos(service.get_osdmap());
+  }
 }
 
 // --------------------------------
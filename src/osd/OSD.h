@@ -27,6 +27,7 @@
 #include "common/WorkQueue.h"
 #include "common/LogClient.h"
 #include "common/AsyncReserver.h"
+#include "common/histogram.h"
 
 #include "os/ObjectStore.h"
 #include "OSDCap.h"
@@ -38,9 +39,11 @@
 #include "auth/KeyRing.h"
 #include "messages/MOSDRepScrub.h"
 #include "OpRequest.h"
+#include "osdc/Objecter.h"
 
 #include <map>
 #include <memory>
+#include <math.h>
 #include <tr1/memory>
 using namespace std;
 
@@ -53,6 +56,7 @@ using namespace __gnu_cxx;
 #include "common/simple_cache.hpp"
 #include "common/sharedptr_registry.hpp"
 #include "common/PrioritizedQueue.h"
+#include "common/mClockQueue.h"
 
 #define CEPH_OSD_PROTOCOL    10 /* cluster internal */
 
@@ -60,6 +64,9 @@ using namespace __gnu_cxx;
 enum {
   l_osd_first = 10000,
   l_osd_opq,
+  l_osd_opq_client_lat,
+  l_osd_opq_recovery_lat,
+  l_osd_opq_subop_lat,
   l_osd_op_wip,
   l_osd_op,
   l_osd_op_inb,
@@ -68,6 +75,8 @@ enum {
   l_osd_op_r,
   l_osd_op_r_outb,
   l_osd_op_r_lat,
+  l_osd_op_r_replica,
+  l_osd_op_r_replica_bounce,
   l_osd_op_w,
   l_osd_op_w_inb,
   l_osd_op_w_rlat,
@@ -99,6 +108,26 @@ enum {
 
   l_osd_rop,
 
+  l_osd_backfill_scan,
+  l_osd_backfill_scan_objs,
+  l_osd_backfill_scan_lat,
+  l_osd_backfill_update,
+  l_osd_backfill_inflight,
+  l_osd_backfill_preempt,
+
+  l_osd_resv_wait_misplaced,
+  l_osd_resv_wait_degraded,
+  l_osd_resv_wait_critical,
+
+  l_osd_tier_promote,
+  l_osd_tier_flush,
+  l_osd_tier_flush_fail,
+  l_osd_tier_evict,
+  l_osd_tier_delay,
+
+  l_osd_deep_scrub_bytes,
+  l_osd_deep_scrub_throttle,
+
   l_osd_loadavg,
   l_osd_buf,
 
@@ -108,9 +137,15 @@ enum {
   l_osd_pg_stray,
   l_osd_hb_to,
   l_osd_hb_from,
+  l_osd_hb_rtt,
   l_osd_map,
   l_osd_mape,
   l_osd_mape_dup,
+  l_osd_map_rebuild,
+
+  l_osd_pg_advance_lat,
+  l_osd_pg_advance_epochs,
+  l_osd_pg_min_epoch,
 
   l_osd_last,
 };
@@ -174,6 +209,7 @@ public:
 private:
   Messenger *&cluster_messenger;
   Messenger *&client_messenger;
+  Messenger *&objecter_messenger;
 public:
   PerfCounters *&logger;
   MonClient   *&monc;
@@ -181,9 +217,11 @@ public:
   ThreadPool::BatchWorkQueue<PG> &peering_wq;
   ThreadPool::WorkQueue<PG> &recovery_wq;
   ThreadPool::WorkQueue<PG> &snap_trim_wq;
+  ThreadPool::WorkQueue<PG> &agent_wq;
   ThreadPool::WorkQueue<PG> &scrub_wq;
   ThreadPool::WorkQueue<PG> &scrub_finalize_wq;
   ThreadPool::WorkQueue<MOSDRepScrub> &rep_scrub_wq;
+  ThreadPool::WorkQueue<ScrubHashJob> &scrub_hash_wq;
   ClassHandler  *&class_handler;
 
   void dequeue_pg(PG *pg, list<OpRequestRef> *dequeued);
@@ -207,8 +245,16 @@ public:
     Mutex::Locker l(publish_lock);
     return osdmap;
   }
+  /*
+   * only the published map caches its pg mappings: older maps are still
+   * used by pgs catching up, but not enough to pay for a table each.
+   */
   void publish_map(OSDMapRef map) {
     Mutex::Locker l(publish_lock);
+    if (osdmap && osdmap != map)
+      osdmap->disable_pg_mapping_cache();
+    if (g_conf->osd_map_cache_pg_mapping)
+      map->enable_pg_mapping_cache();
     osdmap = map;
   }
 
@@ -231,6 +277,47 @@ public:
     Mutex::Locker l(pre_publish_lock);
     next_osdmap = map;
   }
+
+  /*
+   * epoch of the map each pg has advanced to.  pgs advance
+   * independently on the peering threads; the oldest of these epochs
+   * bounds both how far ahead other pgs may run and which maps we may
+   * trim.
+   */
+  Mutex pg_epoch_lock;
+  multiset<epoch_t> pg_epochs;
+  map<pg_t, epoch_t> pg_epoch;
+
+  void pg_add_epoch(pg_t pgid, epoch_t epoch) {
+    Mutex::Locker l(pg_epoch_lock);
+    map<pg_t, epoch_t>::iterator t = pg_epoch.find(pgid);
+    assert(t == pg_epoch.end());
+    pg_epoch[pgid] = epoch;
+    pg_epochs.insert(epoch);
+  }
+  void pg_update_epoch(pg_t pgid, epoch_t epoch) {
+    Mutex::Locker l(pg_epoch_lock);
+    map<pg_t, epoch_t>::iterator t = pg_epoch.find(pgid);
+    assert(t != pg_epoch.end());
+    pg_epochs.erase(pg_epochs.find(t->second));
+    t->second = epoch;
+    pg_epochs.insert(epoch);
+  }
+  void pg_remove_epoch(pg_t pgid) {
+    Mutex::Locker l(pg_epoch_lock);
+    map<pg_t, epoch_t>::iterator t = pg_epoch.find(pgid);
+    if (t != pg_epoch.end()) {
+      pg_epochs.erase(pg_epochs.find(t->second));
+      pg_epoch.erase(t);
+    }
+  }
+  /// oldest map epoch any pg is at, or 0 if we have no pgs
+  epoch_t get_min_pg_epoch() {
+    Mutex::Locker l(pg_epoch_lock);
+    if (pg_epochs.empty())
+      return 0;
+    return *pg_epochs.begin();
+  }
   ConnectionRef get_con_osd_cluster(int peer, epoch_t from_epoch);
   ConnectionRef get_con_osd_hb(int peer, epoch_t from_epoch);
   void send_message_osd_cluster(int peer, Message *m, epoch_t from_epoch);
@@ -289,6 +376,31 @@ public:
   void dec_scrubs_pending();
   void dec_scrubs_active();
 
+  // -- deep scrub throttle --
+  /*
+   * token bucket limiting the bytes read by deep scrubs.  every
+   * _scan_list charges what it read; a primary whose next chunk would
+   * go over budget parks the pg in scrub_delayed until OSD::tick
+   * requeues it, so that no pg lock is held while we wait.
+   */
+  Mutex scrub_throttle_lock;
+  double scrub_throttle_rate;    ///< bytes/sec, 0 for unlimited
+  double scrub_throttle_avail;   ///< bytes; negative when in debt
+  utime_t scrub_throttle_stamp;
+  set<pair<utime_t, PGRef> > scrub_delayed;
+  bool scrub_throttle_stopping;
+
+  void _refill_scrub_throttle(utime_t now);
+  void set_deep_scrub_rate(double rate);
+  double get_deep_scrub_rate() {
+    Mutex::Locker l(scrub_throttle_lock);
+    return scrub_throttle_rate;
+  }
+  void deep_scrub_charge(uint64_t bytes);
+  /// queue @pg for scrub once the budget allows; false if it already does
+  bool deep_scrub_delay(PG *pg);
+  void requeue_delayed_scrubs(utime_t now);
+
   void reply_op_error(OpRequestRef op, int err);
   void reply_op_error(OpRequestRef op, int err, eversion_t v);
   void handle_misdirected_op(PG *pg, OpRequestRef op);
@@ -318,6 +430,27 @@ public:
     return t;
   }
 
+  // -- Objecter, for tiering reads/writes from/to other OSDs --
+  Mutex objecter_lock;
+  SafeTimer objecter_timer;
+  OSDMap objecter_osdmap;
+  Objecter *objecter;
+  Finisher objecter_finisher;
+
+  struct ObjecterDispatcher : public Dispatcher {
+    OSDService *osd;
+    bool ms_dispatch(Message *m);
+    bool ms_handle_reset(Connection *con);
+    void ms_handle_remote_reset(Connection *con);
+    void ms_handle_connect(Connection *con);
+    bool ms_get_authorizer(int dest_type,
+			   AuthAuthorizer **authorizer,
+			   bool force_new);
+    ObjecterDispatcher(OSDService *o)
+      : Dispatcher(g_ceph_context), osd(o) {}
+  } objecter_dispatcher;
+  friend struct ObjecterDispatcher;
+
   // -- backfill_reservation --
   Finisher reserver_finisher;
   AsyncReserver<pg_t> local_reserver;
@@ -338,6 +471,9 @@ public:
   bool queue_for_snap_trim(PG *pg) {
     return snap_trim_wq.queue(pg);
   }
+  bool queue_for_agent(PG *pg) {
+    return agent_wq.queue(pg);
+  }
   bool queue_for_scrub(PG *pg) {
     return scrub_wq.queue(pg);
   }
@@ -349,6 +485,8 @@ public:
   SimpleLRU<epoch_t, bufferlist> map_bl_inc_cache;
 
   OSDMapRef get_map(epoch_t e);
+  OSDMapRef _get_map(epoch_t e);
+  void _build_map(epoch_t e, OSDMap *o);
   OSDMapRef add_map(OSDMap *o) {
     Mutex::Locker l(map_cache_lock);
     return _add_map(o);
@@ -361,10 +499,9 @@ public:
   }
   void pin_map_bl(epoch_t e, bufferlist &bl);
   void _add_map_bl(epoch_t e, bufferlist& bl);
-  bool get_map_bl(epoch_t e, bufferlist& bl) {
-    Mutex::Locker l(map_cache_lock);
-    return _get_map_bl(e, bl);
-  }
+  /// get the full map for @e, rebuilding it if only incrementals are stored
+  bool get_map_bl(epoch_t e, bufferlist& bl);
+  /// get the full map for @e from the cache or the store
   bool _get_map_bl(epoch_t e, bufferlist& bl);
 
   void add_map_inc_bl(epoch_t e, bufferlist& bl) {
@@ -373,7 +510,19 @@ public:
   }
   void pin_map_inc_bl(epoch_t e, bufferlist &bl);
   void _add_map_inc_bl(epoch_t e, bufferlist& bl);
-  bool get_inc_map_bl(epoch_t e, bufferlist& bl);
+  bool get_inc_map_bl(epoch_t e, bufferlist& bl) {
+    Mutex::Locker l(map_cache_lock);
+    return _get_inc_map_bl(e, bl);
+  }
+  bool _get_inc_map_bl(epoch_t e, bufferlist& bl);
+
+  /// true if a full map should be stored for @e
+  static bool is_full_map_checkpoint(epoch_t e) {
+    return g_conf->osd_map_full_interval <= 1 ||
+      e % g_conf->osd_map_full_interval == 0;
+  }
+
+  void dump_map_cache(Formatter *f);
 
   void clear_map_bl_cache_pins(epoch_t e);
 
@@ -399,6 +548,7 @@ public:
 		     OSDMapRef new_map);
 
   OSDService(OSD *osd);
+  ~OSDService();
 };
 class OSD : public Dispatcher,
 	    public md_config_obs_t {
@@ -418,6 +568,7 @@ protected:
 
   Messenger   *cluster_messenger;
   Messenger   *client_messenger;
+  Messenger   *objecter_messenger;
   MonClient   *monc;
   PerfCounters      *logger;
   ObjectStore *store;
@@ -517,9 +668,11 @@ public:
 private:
 
   ThreadPool op_tp;
+  ThreadPool peering_tp;
   ThreadPool recovery_tp;
   ThreadPool disk_tp;
   ThreadPool command_tp;
+  ThreadPool scrub_hash_tp;
 
   bool paused_recovery;
 
@@ -546,6 +699,23 @@ private:
     utime_t last_tx;    ///< last time we sent a ping request
     utime_t last_rx;    ///< last time we got a ping reply
     epoch_t epoch;      ///< most recent epoch we wanted this peer
+    double srtt;        ///< smoothed ping round trip time (seconds)
+    double rttvar;      ///< smoothed mean deviation of the round trip time
+    pow2_hist_t rtt_hist;  ///< ping round trip times (usec)
+
+    HeartbeatInfo() : peer(-1), con(NULL), epoch(0), srtt(0), rttvar(0) {}
+
+    /// fold a round trip time into the estimates (as TCP does, RFC 6298)
+    void add_rtt(double rtt) {
+      if (rtt_hist.empty()) {
+	srtt = rtt;
+	rttvar = rtt / 2;
+      } else {
+	rttvar = .75 * rttvar + .25 * fabs(srtt - rtt);
+	srtt = .875 * srtt + .125 * rtt;
+      }
+      rtt_hist.add((int64_t)(rtt * 1000000.0));
+    }
   };
   /// state attached to outgoing heartbeat connections
   struct HeartbeatSession : public RefCountedObject {
@@ -569,6 +739,8 @@ private:
   void heartbeat();
   void heartbeat_check();
   void heartbeat_entry();
+  double heartbeat_grace(const HeartbeatInfo& hi) const;
+  void dump_heartbeat_peers(Formatter *f);
   void need_heartbeat_peer_update();
 
   struct T_Heartbeat : public Thread {
@@ -647,27 +819,51 @@ private:
 
   struct OpWQ: public ThreadPool::WorkQueueVal<pair<PGRef, OpRequestRef>,
 					       PGRef > {
+    typedef pair<int64_t, entity_inst_t> qos_class_t;  // (pool, client)
+    typedef mClockQueue<pair<PGRef, OpRequestRef>, qos_class_t> mqueue_t;
+
     Mutex qlock;
     map<PG*, list<OpRequestRef> > pg_for_processing;
     OSD *osd;
+    bool use_mclock;   // osd_op_queue == "mclock"
     PrioritizedQueue<pair<PGRef, OpRequestRef>, entity_inst_t > pqueue;
+    mqueue_t mqueue;
+    // qos settings, resolved against the osd defaults by update_qos();
+    // protected by the work queue lock
+    map<int64_t, mqueue_t::ClientInfo> pool_qos;
+    mqueue_t::ClientInfo client_qos, recov_qos;
     OpWQ(OSD *o, time_t ti, ThreadPool *tp)
       : ThreadPool::WorkQueueVal<pair<PGRef, OpRequestRef>, PGRef >(
 	"OSD::OpWQ", ti, ti*10, tp),
 	qlock("OpWQ::qlock"),
 	osd(o),
+	use_mclock(o->cct->_conf->osd_op_queue == "mclock"),
 	pqueue(o->cct->_conf->osd_op_pq_max_tokens_per_priority,
+	       o->cct->_conf->osd_op_pq_min_cost),
+	mqueue(o->cct->_conf->osd_op_pq_max_tokens_per_priority,
 	       o->cct->_conf->osd_op_pq_min_cost)
     {}
 
     void dump(Formatter *f) {
       Mutex::Locker l(qlock);
-      pqueue.dump(f);
-    }
-
+      if (use_mclock)
+	mqueue.dump(f);
+      else
+	pqueue.dump(f);
+    }
+
+    /// perf counter for the queue latency of @op's class
+    static int get_queue_lat_counter(OpRequestRef op);
+    mqueue_t::ClientInfo get_qos(PGRef pg, OpRequestRef op,
+				  qos_class_t *cl);
+    /// refresh the cached qos settings from @osdmap and the config
+    void update_qos(OSDMapRef osdmap);
     void _enqueue_front(pair<PGRef, OpRequestRef> item);
     void _enqueue(pair<PGRef, OpRequestRef> item);
     PGRef _dequeue();
+    unsigned _length() {
+      return use_mclock ? mqueue.length() : pqueue.length();
+    }
 
     struct Pred {
       PG *pg;
@@ -679,11 +875,17 @@ private:
     void dequeue(PG *pg, list<OpRequestRef> *dequeued = 0) {
       lock();
       if (!dequeued) {
-	pqueue.remove_by_filter(Pred(pg));
+	if (use_mclock)
+	  mqueue.remove_by_filter(Pred(pg));
+	else
+	  pqueue.remove_by_filter(Pred(pg));
 	pg_for_processing.erase(pg);
       } else {
 	list<pair<PGRef, OpRequestRef> > _dequeued;
-	pqueue.remove_by_filter(Pred(pg), &_dequeued);
+	if (use_mclock)
+	  mqueue.remove_by_filter(Pred(pg), &_dequeued);
+	else
+	  pqueue.remove_by_filter(Pred(pg), &_dequeued);
 	for (list<pair<PGRef, OpRequestRef> >::iterator i = _dequeued.begin();
 	     i != _dequeued.end();
 	     ++i) {
@@ -699,7 +901,7 @@ private:
       unlock();
     }
     bool _empty() {
-      return pqueue.empty();
+      return use_mclock ? mqueue.empty() : pqueue.empty();
     }
     void _process(PGRef pg);
   } op_wq;
@@ -810,7 +1012,7 @@ private:
   void note_down_osd(int osd);
   void note_up_osd(int osd);
   
-  void advance_pg(
+  bool advance_pg(
     epoch_t advance_to, PG *pg,
     ThreadPool::TPHandle &handle,
     PG::RecoveryCtx *rctx,
@@ -1103,7 +1305,9 @@ protected:
   void do_command(Connection *con, tid_t tid, vector<string>& cmd, bufferlist& data);
 
   // -- pg recovery --
-  xlist<PG*> recovery_queue;
+  // pgs waiting to recover, keyed by recovery_priority; each list is in
+  // queue order.  protected by the RecoveryWQ lock.
+  map<unsigned, xlist<PG*>*> recovery_queue;
   utime_t defer_recovery_until;
   int recovery_ops_active;
 #ifdef DEBUG_RECOVERY_OIDS
@@ -1118,10 +1322,28 @@ protected:
     bool _empty() {
       return osd->recovery_queue.empty();
     }
+    void _push(PG *pg, bool front) {
+      xlist<PG*> *&l = osd->recovery_queue[pg->recovery_priority];
+      if (!l)
+	l = new xlist<PG*>;
+      if (front)
+	l->push_front(&pg->recovery_item);
+      else
+	l->push_back(&pg->recovery_item);
+    }
+    /// take @pg off the queue; it must be queued
+    void _remove(PG *pg) {
+      xlist<PG*> *l = pg->recovery_item.get_list();
+      pg->recovery_item.remove_myself();
+      if (l->empty()) {
+	osd->recovery_queue.erase(pg->recovery_priority);
+	delete l;
+      }
+    }
     bool _enqueue(PG *pg) {
       if (!pg->recovery_item.is_on_list()) {
 	pg->get();
-	osd->recovery_queue.push_back(&pg->recovery_item);
+	_push(pg, false);
 
 	if (g_conf->osd_recovery_delay_start > 0) {
 	  osd->defer_recovery_until = ceph_clock_now(g_ceph_context);
@@ -1132,8 +1354,10 @@ protected:
       return false;
     }
     void _dequeue(PG *pg) {
-      if (pg->recovery_item.remove_myself())
+      if (pg->recovery_item.is_on_list()) {
+	_remove(pg);
 	pg->put();
+      }
     }
     PG *_dequeue() {
       if (osd->recovery_queue.empty())
@@ -1142,14 +1366,15 @@ protected:
       if (!osd->_recover_now())
 	return NULL;
 
-      PG *pg = osd->recovery_queue.front();
-      osd->recovery_queue.pop_front();
+      // most degraded first, in queue order among equals
+      PG *pg = osd->recovery_queue.rbegin()->second->front();
+      _remove(pg);
       return pg;
     }
     void _queue_front(PG *pg) {
       if (!pg->recovery_item.is_on_list()) {
 	pg->get();
-	osd->recovery_queue.push_front(&pg->recovery_item);
+	_push(pg, true);
       }
     }
     void _process(PG *pg) {
@@ -1158,13 +1383,15 @@ protected:
     }
     void _clear() {
       while (!osd->recovery_queue.empty()) {
-	PG *pg = osd->recovery_queue.front();
-	osd->recovery_queue.pop_front();
+	PG *pg = osd->recovery_queue.begin()->second->front();
+	_remove(pg);
 	pg->put();
       }
     }
   } recovery_wq;
 
+  /// set @pg's recovery_priority, moving it within the recovery queue
+  void set_recovery_priority(PG *pg, unsigned priority);
   void start_recovery_op(PG *pg, const hobject_t& soid);
   void finish_recovery_op(PG *pg, const hobject_t& soid, bool dequeue);
   void defer_recovery(PG *pg);
@@ -1217,11 +1444,58 @@ protected:
   } snap_trim_wq;
 
 
+  // -- cache tier agent --
+  xlist<PG*> agent_queue;
+
+  struct AgentWQ : public ThreadPool::WorkQueue<PG> {
+    OSD *osd;
+    AgentWQ(OSD *o, time_t ti, ThreadPool *tp)
+      : ThreadPool::WorkQueue<PG>("OSD::AgentWQ", ti, 0, tp), osd(o) {}
+
+    bool _empty() {
+      return osd->agent_queue.empty();
+    }
+    bool _enqueue(PG *pg) {
+      if (pg->agent_item.is_on_list())
+	return false;
+      pg->get();
+      osd->agent_queue.push_back(&pg->agent_item);
+      return true;
+    }
+    void _dequeue(PG *pg) {
+      if (pg->agent_item.remove_myself())
+	pg->put();
+    }
+    PG *_dequeue() {
+      if (osd->agent_queue.empty())
+	return NULL;
+      PG *pg = osd->agent_queue.front();
+      osd->agent_queue.pop_front();
+      return pg;
+    }
+    void _process(PG *pg) {
+      pg->agent_work();
+      pg->put();
+    }
+    void _clear() {
+      osd->agent_queue.clear();
+    }
+  } agent_wq;
+
+  void queue_agent_work();
+
+
   // -- scrubbing --
   void sched_scrub();
   bool scrub_random_backoff();
   bool scrub_should_schedule();
 
+  uint64_t scrub_load_ops;   ///< l_osd_op at scrub_load_stamp
+  utime_t scrub_load_stamp;
+  void update_deep_scrub_rate();
+
+  void update_reservation_stats();
+
   xlist<PG*> scrub_queue;
 
   struct ScrubWQ : public ThreadPool::WorkQueue<PG> {
@@ -1359,6 +1633,45 @@ protected:
     }
   } rep_scrub_wq;
 
+  list<ScrubHashJob*> scrub_hash_queue;
+
+  struct ScrubHashWQ : public ThreadPool::WorkQueue<ScrubHashJob> {
+    OSD *osd;
+    ScrubHashWQ(OSD *o, time_t ti, ThreadPool *tp)
+      : ThreadPool::WorkQueue<ScrubHashJob>("OSD::ScrubHashWQ", ti, 0, tp), osd(o) {}
+
+    bool _empty() {
+      return osd->scrub_hash_queue.empty();
+    }
+    bool _enqueue(ScrubHashJob *job) {
+      osd->scrub_hash_queue.push_back(job);
+      return true;
+    }
+    void _dequeue(ScrubHashJob *job) {
+      assert(0); // Not applicable for this wq
+    }
+    ScrubHashJob *_dequeue() {
+      if (osd->scrub_hash_queue.empty())
+	return NULL;
+      ScrubHashJob *job = osd->scrub_hash_queue.front();
+      osd->scrub_hash_queue.pop_front();
+      return job;
+    }
+    void _process(ScrubHashJob *job) {
+      uint64_t bytes = PG::_scan_deep(job->store, job->coll, job->oid, *job->o);
+      ScrubHashBatch *batch = job->batch;
+      delete job;
+      Mutex::Locker l(batch->lock);
+      batch->bytes += bytes;
+      if (--batch->pending == 0)
+	batch->cond.Signal();
+    }
+    void _clear() {
+      // the scrubbing thread waits on its batch; never drop jobs
+      assert(osd->scrub_hash_queue.empty());
+    }
+  } scrub_hash_wq;
+
   // -- removing --
   struct RemoveWQ : public ThreadPool::WorkQueue<boost::tuple<coll_t, SequencerRef, DeletingStateRef> > {
     ObjectStore *&store;
@@ -1411,6 +1724,7 @@ protected:
   /* internal and external can point to the same messenger, they will still
    * be cleaned up properly*/
   OSD(int id, Messenger *internal, Messenger *external, Messenger *hbmin, Messenger *hbmout,
+      Messenger *osdc_messenger,
       MonClient *mc, const std::string &dev, const std::string &jdev);
   ~OSD();
 
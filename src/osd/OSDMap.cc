@@ -16,6 +16,7 @@
 
 #include "common/config.h"
 #include "common/Formatter.h"
+#include "common/Thread.h"
 #include "include/ceph_features.h"
 
 #include "common/code_environment.h"
@@ -90,26 +91,32 @@ void osd_xinfo_t::dump(Formatter *f) const
   f->dump_stream("down_stamp") << down_stamp;
   f->dump_float("laggy_probability", laggy_probability);
   f->dump_int("laggy_interval", laggy_interval);
+  f->dump_unsigned("features", features);
 }
 
 void osd_xinfo_t::encode(bufferlist& bl) const
 {
-  ENCODE_START(1, 1, bl);
+  ENCODE_START(2, 1, bl);
   ::encode(down_stamp, bl);
   __u32 lp = laggy_probability * 0xfffffffful;
   ::encode(lp, bl);
   ::encode(laggy_interval, bl);
+  ::encode(features, bl);
   ENCODE_FINISH(bl);
 }
 
 void osd_xinfo_t::decode(bufferlist::iterator& bl)
 {
-  DECODE_START(1, bl);
+  DECODE_START(2, bl);
   ::decode(down_stamp, bl);
   __u32 lp;
   ::decode(lp, bl);
   laggy_probability = (float)lp / (float)0xffffffff;
   ::decode(laggy_interval, bl);
+  if (struct_v >= 2)
+    ::decode(features, bl);
+  else
+    features = 0;
   DECODE_FINISH(bl);
 }
 
@@ -120,13 +127,15 @@ void osd_xinfo_t::generate_test_instances(list<osd_xinfo_t*>& o)
   o.back()->down_stamp = utime_t(2, 3);
   o.back()->laggy_probability = .123;
   o.back()->laggy_interval = 123456;
+  o.back()->features = CEPH_FEATURE_OSD_CACHEPOOL;
 }
 
 ostream& operator<<(ostream& out, const osd_xinfo_t& xi)
 {
   return out << "down_stamp " << xi.down_stamp
 	     << " laggy_probability " << xi.laggy_probability
-	     << " laggy_interval " << xi.laggy_interval;
+	     << " laggy_interval " << xi.laggy_interval
+	     << " features " << xi.features;
 }
 
 // ----------------------------------
@@ -596,18 +605,18 @@ void OSDMap::set_epoch(epoch_t e)
 
 bool OSDMap::is_blacklisted(const entity_addr_t& a) const
 {
-  if (blacklist.empty())
+  if (blacklist->empty())
     return false;
 
   // this specific instance?
-  if (blacklist.count(a))
+  if (blacklist->count(a))
     return true;
 
   // is entire ip blacklisted?
   entity_addr_t b = a;
   b.set_port(0);
   b.set_nonce(0);
-  return blacklist.count(b);
+  return blacklist->count(b);
 }
 
 void OSDMap::set_max_osd(int m)
@@ -621,7 +630,9 @@ void OSDMap::set_max_osd(int m)
     osd_weight[o] = CEPH_OSD_OUT;
   }
   osd_info.resize(m);
-  osd_xinfo.resize(m);
+  if (!osd_xinfo.unique())
+    osd_xinfo.reset(new vector<osd_xinfo_t>(*osd_xinfo));
+  osd_xinfo->resize(m);
   osd_addrs->client_addr.resize(m);
   osd_addrs->cluster_addr.resize(m);
   osd_addrs->hb_addr.resize(m);
@@ -724,20 +735,45 @@ uint64_t OSDMap::get_features(uint64_t *pmask) const
     features |= CEPH_FEATURE_CRUSH_TUNABLES;
   if (crush->has_nondefault_tunables2())
     features |= CEPH_FEATURE_CRUSH_TUNABLES2;
+  if (crush->has_v2_buckets())
+    features |= CEPH_FEATURE_CRUSH_V2;
   mask |= CEPH_FEATURES_CRUSH;
 
   for (map<int64_t,pg_pool_t>::const_iterator p = pools.begin(); p != pools.end(); ++p) {
     if (p->second.flags & pg_pool_t::FLAG_HASHPSPOOL) {
       features |= CEPH_FEATURE_OSDHASHPSPOOL;
     }
+    if (p->second.has_tiers() || p->second.is_tier() ||
+	p->second.has_read_tier() || p->second.has_write_tier()) {
+      features |= CEPH_FEATURE_OSD_CACHEPOOL;
+    }
   }
   mask |= CEPH_FEATURE_OSDHASHPSPOOL;
+  mask |= CEPH_FEATURE_OSD_CACHEPOOL;
 
   if (pmask)
     *pmask = mask;
   return features;
 }
 
+uint64_t OSDMap::get_up_osd_features() const
+{
+  bool first = true;
+  uint64_t features = 0;
+  for (int osd = 0; osd < max_osd; ++osd) {
+    if (!is_up(osd))
+      continue;
+    const osd_xinfo_t &xi = get_xinfo(osd);
+    if (first) {
+      features = xi.features;
+      first = false;
+    } else {
+      features &= xi.features;
+    }
+  }
+  return features;
+}
+
 void OSDMap::dedup(const OSDMap *o, OSDMap *n)
 {
   if (o->epoch == n->epoch)
@@ -788,10 +824,66 @@ void OSDMap::dedup(const OSDMap *o, OSDMap *n)
   if (o->osd_uuid->size() == n->osd_uuid->size() &&
       *o->osd_uuid == *n->osd_uuid)
     n->osd_uuid = o->osd_uuid;
+
+  // does xinfo match?
+  if (o->osd_xinfo->size() == n->osd_xinfo->size() &&
+      *o->osd_xinfo == *n->osd_xinfo)
+    n->osd_xinfo = o->osd_xinfo;
+
+  // does the blacklist match?
+  if (o->blacklist->size() == n->blacklist->size() &&
+      *o->blacklist == *n->blacklist)
+    n->blacklist = o->blacklist;
+}
+
+uint64_t OSDMap::get_approx_bytes(set<const void*> *seen) const
+{
+  uint64_t bytes = sizeof(*this);
+  bytes += osd_state.size() * sizeof(uint8_t);
+  bytes += osd_weight.size() * sizeof(__u32);
+  bytes += osd_info.size() * sizeof(osd_info_t);
+  bytes += pools.size() * (sizeof(int64_t) + sizeof(pg_pool_t));
+  for (map<int64_t,string>::const_iterator p = pool_name.begin();
+       p != pool_name.end();
+       ++p)
+    bytes += 2 * (sizeof(int64_t) + sizeof(string) + p->second.length());
+
+  if (seen->insert(osd_addrs.get()).second) {
+    bytes += sizeof(addrs_s);
+    for (int i = 0; i < max_osd; i++) {
+      if (seen->insert(osd_addrs->client_addr[i].get()).second)
+	bytes += sizeof(entity_addr_t);
+      if (seen->insert(osd_addrs->cluster_addr[i].get()).second)
+	bytes += sizeof(entity_addr_t);
+      if (seen->insert(osd_addrs->hb_addr[i].get()).second)
+	bytes += sizeof(entity_addr_t);
+    }
+  }
+  if (seen->insert(crush.get()).second) {
+    // the encoded map is a fair approximation of the decoded one
+    bufferlist bl;
+    crush->encode(bl);
+    bytes += sizeof(CrushWrapper) + bl.length();
+  }
+  if (seen->insert(pg_temp.get()).second) {
+    for (map<pg_t,vector<int> >::const_iterator p = pg_temp->begin();
+	 p != pg_temp->end();
+	 ++p)
+      bytes += sizeof(*p) + p->second.size() * sizeof(int);
+  }
+  if (seen->insert(osd_uuid.get()).second)
+    bytes += osd_uuid->size() * sizeof(uuid_d);
+  if (seen->insert(osd_xinfo.get()).second)
+    bytes += osd_xinfo->size() * sizeof(osd_xinfo_t);
+  if (seen->insert(blacklist.get()).second)
+    bytes += blacklist->size() * (sizeof(entity_addr_t) + sizeof(utime_t));
+  return bytes;
 }
 
 int OSDMap::apply_incremental(const Incremental &inc)
 {
+  pg_mapping.clear();
+
   if (inc.epoch == 1)
     fsid = inc.fsid;
   else if (inc.fsid != fsid)
@@ -850,6 +942,14 @@ int OSDMap::apply_incremental(const Incremental &inc)
       osd_state[i->first] &= ~(CEPH_OSD_AUTOOUT | CEPH_OSD_NEW);
   }
 
+  // xinfo and blacklist may be shared with other maps (see dedup())
+  if ((!inc.new_state.empty() || !inc.new_xinfo.empty()) &&
+      !osd_xinfo.unique())
+    osd_xinfo.reset(new vector<osd_xinfo_t>(*osd_xinfo));
+  if ((!inc.new_blacklist.empty() || !inc.old_blacklist.empty()) &&
+      !blacklist.unique())
+    blacklist.reset(new hash_map<entity_addr_t,utime_t>(*blacklist));
+
   // up/down
   for (map<int32_t,uint8_t>::const_iterator i = inc.new_state.begin();
        i != inc.new_state.end();
@@ -858,7 +958,7 @@ int OSDMap::apply_incremental(const Incremental &inc)
     if ((osd_state[i->first] & CEPH_OSD_UP) &&
 	(s & CEPH_OSD_UP)) {
       osd_info[i->first].down_at = epoch;
-      osd_xinfo[i->first].down_stamp = modified;
+      (*osd_xinfo)[i->first].down_stamp = modified;
     }
     if ((osd_state[i->first] & CEPH_OSD_EXISTS) &&
 	(s & CEPH_OSD_EXISTS))
@@ -898,7 +998,7 @@ int OSDMap::apply_incremental(const Incremental &inc)
 
   // xinfo
   for (map<int32_t,osd_xinfo_t>::const_iterator p = inc.new_xinfo.begin(); p != inc.new_xinfo.end(); ++p)
-    osd_xinfo[p->first] = p->second;
+    (*osd_xinfo)[p->first] = p->second;
 
   // uuid
   for (map<int32_t,uuid_d>::const_iterator p = inc.new_uuid.begin(); p != inc.new_uuid.end(); ++p) 
@@ -916,11 +1016,11 @@ int OSDMap::apply_incremental(const Incremental &inc)
   for (map<entity_addr_t,utime_t>::const_iterator p = inc.new_blacklist.begin();
        p != inc.new_blacklist.end();
        p++)
-    blacklist[p->first] = p->second;
+    (*blacklist)[p->first] = p->second;
   for (vector<entity_addr_t>::const_iterator p = inc.old_blacklist.begin();
        p != inc.old_blacklist.end();
        p++)
-    blacklist.erase(*p);
+    blacklist->erase(*p);
 
   // cluster snapshot?
   if (inc.cluster_snapshot.length()) {
@@ -988,15 +1088,38 @@ void OSDMap::_remove_nonexistent_osds(vector<int>& osds) const
 }
 
 int OSDMap::_pg_to_osds(const pg_pool_t& pool, pg_t pg, vector<int>& osds) const
+{
+  if (!pg_mapping.is_enabled())
+    return _crush_pg_to_osds(*crush, pool, pg, osds);
+
+  // the placement seed only depends on the folded ps
+  unsigned ps = pool.raw_pg_to_pg(pg).ps();
+  unsigned size = pool.get_size();
+  if (pg_mapping.lookup(pg.pool(), pool.get_pg_num(), size, ps, osds))
+    return osds.size();
+
+  _crush_pg_to_osds(*crush, pool, pg, osds);
+  if (osds.size() <= size) {
+    vector<int32_t> row(size + 1, -1);
+    row[0] = osds.size();
+    for (unsigned i = 0; i < osds.size(); i++)
+      row[i + 1] = osds[i];
+    pg_mapping.store(pg.pool(), pool.get_pg_num(), size, ps, &row[0], 1);
+  }
+  return osds.size();
+}
+
+int OSDMap::_crush_pg_to_osds(const CrushWrapper& c, const pg_pool_t& pool,
+			      pg_t pg, vector<int>& osds) const
 {
   // map to osds[]
   ps_t pps = pool.raw_pg_to_pps(pg);  // placement ps
   unsigned size = pool.get_size();
 
   // what crush rule?
-  int ruleno = crush->find_rule(pool.get_crush_ruleset(), pool.get_type(), size);
+  int ruleno = c.find_rule(pool.get_crush_ruleset(), pool.get_type(), size);
   if (ruleno >= 0)
-    crush->do_rule(ruleno, pps, osds, size, osd_weight);
+    c.do_rule(ruleno, pps, osds, size, osd_weight);
 
   _remove_nonexistent_osds(osds);
 
@@ -1030,6 +1153,100 @@ bool OSDMap::_raw_to_temp_osds(const pg_pool_t& pool, pg_t pg, vector<int>& raw,
   return false;
 }
 
+/// compute the cache rows of pgs [first, last) of @pool into @rows
+void OSDMap::_map_pg_range(const CrushWrapper& c, const pg_pool_t& pool,
+			   int64_t poolid, unsigned first, unsigned last,
+			   vector<int32_t> *rows) const
+{
+  unsigned size = pool.get_size();
+  rows->assign((size_t)(last - first) * (size + 1), -1);
+  vector<int> osds;
+  for (unsigned ps = first; ps < last; ++ps) {
+    _crush_pg_to_osds(c, pool, pg_t(ps, poolid, -1), osds);
+    if (osds.size() > size)
+      continue;  // leave it to be computed on lookup
+    int32_t *row = &(*rows)[(size_t)(ps - first) * (size + 1)];
+    row[0] = osds.size();
+    for (unsigned i = 0; i < osds.size(); i++)
+      row[i + 1] = osds[i];
+  }
+}
+
+/*
+ * CrushWrapper::do_rule serializes on its mapper_lock, so each thread
+ * maps its share of a pool with a private copy of the crush map.
+ */
+class PGMappingThread : public Thread {
+  const OSDMap *osdmap;
+  CrushWrapper crush;
+  const pg_pool_t *pool;
+  int64_t poolid;
+  unsigned first, last;
+public:
+  vector<int32_t> rows;
+  PGMappingThread(const OSDMap *m, bufferlist& crushbl,
+		  const pg_pool_t *p, int64_t id, unsigned f, unsigned l)
+    : osdmap(m), pool(p), poolid(id), first(f), last(l) {
+    bufferlist::iterator i = crushbl.begin();
+    crush.decode(i);
+  }
+  void *entry() {
+    osdmap->_map_pg_range(crush, *pool, poolid, first, last, &rows);
+    return 0;
+  }
+  unsigned get_first() const { return first; }
+  unsigned get_last() const { return last; }
+};
+
+void OSDMap::prime_pg_mapping(unsigned threads, int64_t only_pool) const
+{
+  if (!pg_mapping.is_enabled())
+    return;
+  bufferlist crushbl;
+  if (threads > 1)
+    crush->encode(crushbl);
+  for (map<int64_t,pg_pool_t>::const_iterator p = pools.begin();
+       p != pools.end();
+       ++p) {
+    if (only_pool >= 0 && p->first != only_pool)
+      continue;
+    const pg_pool_t& pool = p->second;
+    unsigned pg_num = pool.get_pg_num();
+    unsigned size = pool.get_size();
+    if (!pg_num)
+      continue;
+
+    // small pools are not worth a thread
+    unsigned n = threads;
+    if (n > pg_num / 256)
+      n = pg_num / 256;
+    if (n <= 1) {
+      vector<int32_t> rows;
+      _map_pg_range(*crush, pool, p->first, 0, pg_num, &rows);
+      pg_mapping.store(p->first, pg_num, size, 0, &rows[0], pg_num);
+      continue;
+    }
+
+    vector<PGMappingThread*> workers;
+    for (unsigned i = 0; i < n; i++) {
+      PGMappingThread *t = new PGMappingThread(this, crushbl, &pool, p->first,
+					       (uint64_t)pg_num * i / n,
+					       (uint64_t)pg_num * (i + 1) / n);
+      t->create();
+      workers.push_back(t);
+    }
+    for (vector<PGMappingThread*>::iterator i = workers.begin();
+	 i != workers.end();
+	 ++i) {
+      (*i)->join();
+      if ((*i)->get_last() > (*i)->get_first())
+	pg_mapping.store(p->first, pg_num, size, (*i)->get_first(),
+			 &(*i)->rows[0], (*i)->get_last() - (*i)->get_first());
+      delete *i;
+    }
+  }
+}
+
 int OSDMap::pg_to_osds(pg_t pg, vector<int>& raw) const
 {
   const pg_pool_t *pool = get_pg_pool(pg.pool());
@@ -1189,12 +1406,12 @@ void OSDMap::encode(bufferlist& bl, uint64_t features) const
   ::encode(ev, bl);
   ::encode(osd_addrs->hb_addr, bl);
   ::encode(osd_info, bl);
-  ::encode(blacklist, bl);
+  ::encode(*blacklist, bl);
   ::encode(osd_addrs->cluster_addr, bl);
   ::encode(cluster_snapshot_epoch, bl);
   ::encode(cluster_snapshot, bl);
   ::encode(*osd_uuid, bl);
-  ::encode(osd_xinfo, bl);
+  ::encode(*osd_xinfo, bl);
 }
 
 void OSDMap::decode(bufferlist& bl)
@@ -1205,6 +1422,8 @@ void OSDMap::decode(bufferlist& bl)
 
 void OSDMap::decode(bufferlist::iterator& p)
 {
+  pg_mapping.clear();
+
   __u32 n, t;
   __u16 v;
   ::decode(v, p);
@@ -1283,7 +1502,8 @@ void OSDMap::decode(bufferlist::iterator& p)
   if (v < 5)
     ::decode(pool_name, p);
 
-  ::decode(blacklist, p);
+  blacklist.reset(new hash_map<entity_addr_t,utime_t>);
+  ::decode(*blacklist, p);
   if (ev >= 6)
     ::decode(osd_addrs->cluster_addr, p);
   else
@@ -1299,10 +1519,11 @@ void OSDMap::decode(bufferlist::iterator& p)
   } else {
     osd_uuid->resize(max_osd);
   }
+  osd_xinfo.reset(new vector<osd_xinfo_t>);
   if (ev >= 9)
-    ::decode(osd_xinfo, p);
+    ::decode(*osd_xinfo, p);
   else
-    osd_xinfo.resize(max_osd);
+    osd_xinfo->resize(max_osd);
 
   // index pool names
   name_pool.clear();
@@ -1377,7 +1598,7 @@ void OSDMap::dump(Formatter *f) const
     if (exists(i)) {
       f->open_object_section("xinfo");
       f->dump_int("osd", i);
-      osd_xinfo[i].dump(f);
+      (*osd_xinfo)[i].dump(f);
       f->close_section();
     }
   }
@@ -1398,8 +1619,8 @@ void OSDMap::dump(Formatter *f) const
   f->close_section();
 
   f->open_array_section("blacklist");
-  for (hash_map<entity_addr_t,utime_t>::const_iterator p = blacklist.begin();
-       p != blacklist.end();
+  for (hash_map<entity_addr_t,utime_t>::const_iterator p = blacklist->begin();
+       p != blacklist->end();
        p++) {
     stringstream ss;
     ss << p->first;
@@ -1517,8 +1738,8 @@ void OSDMap::print(ostream& out) const
        p++)
     out << "pg_temp " << p->first << " " << p->second << "\n";
 
-  for (hash_map<entity_addr_t,utime_t>::const_iterator p = blacklist.begin();
-       p != blacklist.end();
+  for (hash_map<entity_addr_t,utime_t>::const_iterator p = blacklist->begin();
+       p != blacklist->end();
        p++)
     out << "blacklist " << p->first << " expires " << p->second << "\n";
 
@@ -26,7 +26,9 @@
 #include "osd_types.h"
 #include "msg/Message.h"
 #include "common/Mutex.h"
+#include "common/RWLock.h"
 #include "common/Clock.h"
+#include "include/atomic.h"
 
 #include "include/ceph_features.h"
 
@@ -91,19 +93,107 @@ struct osd_xinfo_t {
   utime_t down_stamp;      ///< timestamp when we were last marked down
   float laggy_probability; ///< encoded as __u32: 0 = definitely not laggy, 0xffffffff definitely laggy
   __u32 laggy_interval;    ///< average interval between being marked laggy and recovering
+  uint64_t features;       ///< features supported by this osd we should know about
 
-  osd_xinfo_t() : laggy_probability(0), laggy_interval(0) {}
+  osd_xinfo_t() : laggy_probability(0), laggy_interval(0), features(0) {}
 
   void dump(Formatter *f) const;
   void encode(bufferlist& bl) const;
   void decode(bufferlist::iterator& bl);
   static void generate_test_instances(list<osd_xinfo_t*>& o);
+
+  bool operator==(const osd_xinfo_t& o) const {
+    return down_stamp == o.down_stamp &&
+      laggy_probability == o.laggy_probability &&
+      laggy_interval == o.laggy_interval &&
+      features == o.features;
+  }
 };
 WRITE_CLASS_ENCODER(osd_xinfo_t)
 
 ostream& operator<<(ostream& out, const osd_xinfo_t& xi);
 
 
+/**
+ * raw pg -> osd mappings of one OSDMap, filled in lazily
+ *
+ * For each pool, a table with one row of pool size + 1 ints per pg:
+ * the number of osds CRUSH returned (-1 if not computed yet), then
+ * the osds.  The up and acting sets are cheap to derive from the raw
+ * set, so they are not stored.
+ *
+ * A copy of a map does not inherit the cache.  Disabling the cache
+ * frees the tables; nothing is stored while it is disabled.
+ */
+class PGMappingCache {
+  RWLock lock;
+  atomic_t enabled;
+  map<int64_t, vector<int32_t> > pools;
+
+public:
+  PGMappingCache() : lock("PGMappingCache::lock"), enabled(0) {}
+  PGMappingCache(const PGMappingCache& o)
+    : lock("PGMappingCache::lock"), enabled(0) {}
+  PGMappingCache& operator=(const PGMappingCache& o) {
+    disable();
+    return *this;
+  }
+
+  bool is_enabled() const {
+    return enabled.read();
+  }
+  void enable() {
+    RWLock::WLocker l(lock);
+    enabled.set(1);
+  }
+  void disable() {
+    RWLock::WLocker l(lock);
+    enabled.set(0);
+    pools.clear();
+  }
+  void clear() {
+    RWLock::WLocker l(lock);
+    pools.clear();
+  }
+
+  /// true and fill @osds if the mapping of @ps is known
+  bool lookup(int64_t pool, unsigned pg_num, unsigned size, unsigned ps,
+	      vector<int>& osds) {
+    RWLock::RLocker l(lock);
+    map<int64_t, vector<int32_t> >::const_iterator p = pools.find(pool);
+    if (p == pools.end() || p->second.size() != (size_t)pg_num * (size + 1))
+      return false;
+    const int32_t *row = &p->second[ps * (size + 1)];
+    if (row[0] < 0)
+      return false;
+    osds.assign(row + 1, row + 1 + row[0]);
+    return true;
+  }
+
+  /// store the mappings of [first, first + n) from @rows, laid out as above
+  void store(int64_t pool, unsigned pg_num, unsigned size, unsigned first,
+	     const int32_t *rows, unsigned n) {
+    RWLock::WLocker l(lock);
+    if (!enabled.read())
+      return;
+    vector<int32_t>& t = pools[pool];
+    if (t.size() != (size_t)pg_num * (size + 1))
+      t.assign((size_t)pg_num * (size + 1), -1);
+    memcpy(&t[first * (size + 1)], rows, sizeof(int32_t) * n * (size + 1));
+  }
+
+  /// bytes used by the tables
+  uint64_t get_bytes() {
+    RWLock::RLocker l(lock);
+    uint64_t b = 0;
+    for (map<int64_t, vector<int32_t> >::const_iterator p = pools.begin();
+	 p != pools.end();
+	 ++p)
+      b += p->second.size() * sizeof(int32_t);
+    return b;
+  }
+};
+
 /** OSDMap
  */
 class OSDMap {
@@ -195,13 +285,15 @@ private:
   map<string,int64_t> name_pool;
 
   std::tr1::shared_ptr< vector<uuid_d> > osd_uuid;
-  vector<osd_xinfo_t> osd_xinfo;
+  std::tr1::shared_ptr< vector<osd_xinfo_t> > osd_xinfo;
 
-  hash_map<entity_addr_t,utime_t> blacklist;
+  std::tr1::shared_ptr< hash_map<entity_addr_t,utime_t> > blacklist;
 
   epoch_t cluster_snapshot_epoch;
   string cluster_snapshot;
 
+  mutable PGMappingCache pg_mapping;
+
  public:
   std::tr1::shared_ptr<CrushWrapper> crush;       // hierarchical map
 
@@ -217,6 +309,8 @@ private:
 	     osd_addrs(new addrs_s),
 	     pg_temp(new map<pg_t,vector<int> >),
 	     osd_uuid(new vector<uuid_d>),
+	     osd_xinfo(new vector<osd_xinfo_t>),
+	     blacklist(new hash_map<entity_addr_t,utime_t>),
 	     cluster_snapshot_epoch(0),
 	     crush(new CrushWrapper) {
     memset(&fsid, 0, sizeof(fsid));
@@ -384,7 +478,7 @@ private:
 
   const osd_xinfo_t& get_xinfo(int osd) const {
     assert(osd < max_osd);
-    return osd_xinfo[osd];
+    return (*osd_xinfo)[osd];
   }
   
   int get_any_up_osd() const {
@@ -402,11 +496,28 @@ private:
    */
   uint64_t get_features(uint64_t *mask) const;
 
+  /**
+   * get the intersection of the features of all up osds, as reported
+   * when they booted
+   *
+   * @return features common to all up osds, 0 if none are up
+   */
+  uint64_t get_up_osd_features() const;
+
   int apply_incremental(const Incremental &inc);
 
   /// try to re-use/reference addrs in oldmap from newmap
   static void dedup(const OSDMap *oldmap, OSDMap *newmap);
 
+  /**
+   * rough estimate of the memory used by this map
+   *
+   * Structures shared with other maps (see dedup()) are only counted
+   * the first time they are seen in @seen, so that summing over a set
+   * of maps gives their total footprint.
+   */
+  uint64_t get_approx_bytes(set<const void*> *seen) const;
+
   // serialize, unserialize
 private:
   void encode_client_old(bufferlist& bl) const;
@@ -445,6 +556,12 @@ public:
 private:
   /// pg -> (raw osd list)
   int _pg_to_osds(const pg_pool_t& pool, pg_t pg, vector<int>& osds) const;
+  int _crush_pg_to_osds(const CrushWrapper& c, const pg_pool_t& pool, pg_t pg,
+			vector<int>& osds) const;
+  void _map_pg_range(const CrushWrapper& c, const pg_pool_t& pool,
+		     int64_t poolid, unsigned first, unsigned last,
+		     vector<int32_t> *rows) const;
+  friend class PGMappingThread;
   void _remove_nonexistent_osds(vector<int>& osds) const;
 
   /// pg -> (up osd list)
@@ -453,6 +570,30 @@ private:
   bool _raw_to_temp_osds(const pg_pool_t& pool, pg_t pg, vector<int>& raw, vector<int>& temp) const;
 
 public:
+  /**
+   * cache the CRUSH result of each pg the first time it is mapped
+   *
+   * Only enable this on maps that are never changed afterwards other
+   * than through decode() or apply_incremental(), which drop the
+   * cached mappings.  The cache does not change what the map says,
+   * so it may be turned on and off on a shared const map.
+   */
+  void enable_pg_mapping_cache() const {
+    pg_mapping.enable();
+  }
+  /// stop caching and free the cached mappings
+  void disable_pg_mapping_cache() const {
+    pg_mapping.disable();
+  }
+  bool pg_mapping_cache_enabled() const {
+    return pg_mapping.is_enabled();
+  }
+  /// map every pg of @pool (-1 for all pools) now, splitting large pools across @threads
+  void prime_pg_mapping(unsigned threads, int64_t pool = -1) const;
+  uint64_t get_pg_mapping_bytes() const {
+    return pg_mapping.get_bytes();
+  }
+
   int pg_to_osds(pg_t pg, vector<int>& raw) const;
   int pg_to_acting_osds(pg_t pg, vector<int>& acting) const;
   void pg_to_raw_up(pg_t pg, vector<int>& up) const;
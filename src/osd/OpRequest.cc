@@ -20,6 +20,45 @@ static ostream& _prefix(std::ostream* _dout)
   return *_dout << "--OSD::tracker-- ";
 }
 
+enum {
+  l_optracker_first = 10800,
+  // one time average per op type and stage
+  l_optracker_last = l_optracker_first + 1 +
+    OpTracker::NUM_OP_TYPES * OpTracker::NUM_STAGES,
+};
+
+static int stage_counter(int type, int stage)
+{
+  return l_optracker_first + 1 + type * OpTracker::NUM_STAGES + stage;
+}
+
+const char *OpTracker::get_stage_name(int s)
+{
+  switch (s) {
+  case STAGE_DISPATCH: return "dispatch";
+  case STAGE_QUEUED: return "queued";
+  case STAGE_REACHED_PG: return "reached_pg";
+  case STAGE_DELAYED: return "delayed";
+  case STAGE_STARTED: return "started";
+  case STAGE_SUB_OP_SENT: return "sub_op_sent";
+  case STAGE_COMMIT_SENT: return "commit_sent";
+  case STAGE_TOTAL: return "total";
+  default: return "???";
+  }
+}
+
+const char *OpTracker::get_op_type_name(int t)
+{
+  switch (t) {
+  case OP_TYPE_READ: return "read";
+  case OP_TYPE_WRITE: return "write";
+  case OP_TYPE_SUBOP: return "subop";
+  case OP_TYPE_PG: return "pg";
+  case OP_TYPE_OTHER: return "other";
+  default: return "???";
+  }
+}
+
 void OpHistory::insert(utime_t now, OpRequest *op)
 {
   duration.insert(make_pair(op->get_duration(), op));
@@ -68,6 +107,82 @@ void OpHistory::dump_ops(utime_t now, Formatter *f)
   f->close_section();
 }
 
+OpTracker::~OpTracker()
+{
+  if (logger) {
+    g_ceph_context->get_perfcounters_collection()->remove(logger);
+    delete logger;
+  }
+}
+
+void OpTracker::create_logger(CephContext *cct)
+{
+  assert(!logger);
+  PerfCountersBuilder plb(cct, "optracker", l_optracker_first, l_optracker_last);
+  counter_names.reserve(NUM_OP_TYPES * NUM_STAGES);
+  for (int t = 0; t < NUM_OP_TYPES; t++) {
+    for (int s = 0; s < NUM_STAGES; s++) {
+      counter_names.push_back(string(get_op_type_name(t)) + "_" +
+			      get_stage_name(s) + "_latency");
+      plb.add_time_avg(stage_counter(t, s), counter_names.back().c_str());
+    }
+  }
+  logger = plb.create_perf_counters();
+  cct->get_perfcounters_collection()->add(logger);
+
+  Mutex::Locker locker(ops_in_flight_lock);
+  stage_hist_since = ceph_clock_now(cct);
+}
+
+void OpTracker::record_stages(OpRequest *op)
+{
+  assert(ops_in_flight_lock.is_locked());
+  int t = op->get_op_type();
+  for (int s = 0; s < NUM_STAGES; s++) {
+    if (!(op->hit_stages & (1 << s)))
+      continue;
+    const utime_t &lat = op->stage_lat[s];
+    stage_hist[t][s].add(lat.to_nsec() / 1000);
+    if (logger)
+      logger->tinc(stage_counter(t, s), lat);
+  }
+}
+
+void OpTracker::dump_stage_histograms(ostream &ss)
+{
+  JSONFormatter jf(true);
+  Mutex::Locker locker(ops_in_flight_lock);
+  jf.open_object_section("op_stage_latency");
+  jf.dump_stream("since") << stage_hist_since;
+  jf.dump_string("units", "usec, log2 buckets");
+  for (int t = 0; t < NUM_OP_TYPES; t++) {
+    jf.open_object_section(get_op_type_name(t));
+    for (int s = 0; s < NUM_STAGES; s++) {
+      const pow2_hist_t &h = stage_hist[t][s];
+      if (h.empty())
+	continue;
+      jf.open_object_section(get_stage_name(s));
+      jf.dump_unsigned("count", h.count());
+      jf.dump_int("p50", h.percentile(.5));
+      jf.dump_int("p99", h.percentile(.99));
+      h.dump(&jf);
+      jf.close_section();
+    }
+    jf.close_section();
+  }
+  jf.close_section();
+  jf.flush(ss);
+}
+
+void OpTracker::reset_stage_histograms()
+{
+  Mutex::Locker locker(ops_in_flight_lock);
+  for (int t = 0; t < NUM_OP_TYPES; t++)
+    for (int s = 0; s < NUM_STAGES; s++)
+      stage_hist[t][s].clear();
+  stage_hist_since = ceph_clock_now(g_ceph_context);
+}
+
 void OpTracker::dump_historic_ops(ostream &ss)
 {
   JSONFormatter jf(true);
@@ -109,6 +224,8 @@ void OpTracker::unregister_inflight_op(OpRequest *i)
   utime_t now = ceph_clock_now(g_ceph_context);
   i->xitem.remove_myself();
   i->request->clear_data();
+  i->finish_stages(now);
+  record_stages(i);
   history.insert(now, i);
 }
 
@@ -246,6 +363,64 @@ OpRequestRef OpTracker::create_request(Message *ref)
   return retval;
 }
 
+int OpRequest::flag_stage(uint8_t flag)
+{
+  switch (flag) {
+  case flag_queued_for_pg: return OpTracker::STAGE_QUEUED;
+  case flag_reached_pg: return OpTracker::STAGE_REACHED_PG;
+  case flag_delayed: return OpTracker::STAGE_DELAYED;
+  case flag_started: return OpTracker::STAGE_STARTED;
+  case flag_sub_op_sent: return OpTracker::STAGE_SUB_OP_SENT;
+  case flag_commit_sent: return OpTracker::STAGE_COMMIT_SENT;
+  default: return OpTracker::STAGE_DISPATCH;
+  }
+}
+
+void OpRequest::mark_flag_point(uint8_t flag, const string &evt,
+				const string &state)
+{
+  utime_t now = ceph_clock_now(g_ceph_context);
+  {
+    Mutex::Locker l(lock);
+    events.push_back(make_pair(now, evt));
+    // the time since the last flag point was spent in its stage
+    int s = flag_stage(latest_flag_point);
+    stage_lat[s] += now - last_flag_stamp;
+    hit_stages |= 1 << s;
+    last_flag_stamp = now;
+  }
+  tracker->mark_event(this, evt);
+  current = state;
+  hit_flag_points |= flag;
+  latest_flag_point = flag;
+}
+
+void OpRequest::finish_stages(utime_t now)
+{
+  Mutex::Locker l(lock);
+  int s = flag_stage(latest_flag_point);
+  stage_lat[s] += now - last_flag_stamp;
+  hit_stages |= 1 << s;
+  last_flag_stamp = now;
+  stage_lat[OpTracker::STAGE_TOTAL] = now - received_time;
+  hit_stages |= 1 << OpTracker::STAGE_TOTAL;
+}
+
+int OpRequest::get_op_type()
+{
+  if (request->get_type() == MSG_OSD_SUBOP)
+    return OpTracker::OP_TYPE_SUBOP;
+  if (request->get_type() != CEPH_MSG_OSD_OP)
+    return OpTracker::OP_TYPE_OTHER;
+  if (includes_pg_op())
+    return OpTracker::OP_TYPE_PG;
+  if (may_write())
+    return OpTracker::OP_TYPE_WRITE;
+  if (may_read())
+    return OpTracker::OP_TYPE_READ;
+  return OpTracker::OP_TYPE_OTHER;
+}
+
 void OpRequest::mark_event(const string &event)
 {
   utime_t now = ceph_clock_now(g_ceph_context);
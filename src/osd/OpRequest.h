@@ -23,6 +23,8 @@
 #include "msg/Message.h"
 #include <tr1/memory>
 #include "common/TrackedOp.h"
+#include "common/histogram.h"
+#include "common/perf_counters.h"
 #include "osd/osd_types.h"
 
 class OpRequest;
@@ -39,6 +41,31 @@ public:
 class OpRequest;
 typedef std::tr1::shared_ptr<OpRequest> OpRequestRef;
 class OpTracker {
+public:
+  /// where an op spends its time, named after the flag point it is past
+  enum stage_t {
+    STAGE_DISPATCH = 0,   ///< received, not queued yet
+    STAGE_QUEUED,         ///< in the op queue
+    STAGE_REACHED_PG,     ///< dequeued, not started yet
+    STAGE_DELAYED,        ///< waiting on an object, peering, the pg mode...
+    STAGE_STARTED,        ///< executing
+    STAGE_SUB_OP_SENT,    ///< waiting for the replicas
+    STAGE_COMMIT_SENT,    ///< replied, cleaning up
+    STAGE_TOTAL,          ///< received to done
+    NUM_STAGES
+  };
+  enum op_type_t {
+    OP_TYPE_READ = 0,
+    OP_TYPE_WRITE,
+    OP_TYPE_SUBOP,
+    OP_TYPE_PG,
+    OP_TYPE_OTHER,
+    NUM_OP_TYPES
+  };
+  static const char *get_stage_name(int s);
+  static const char *get_op_type_name(int t);
+
+private:
   class RemoveOnDelete {
     OpTracker *tracker;
   public:
@@ -51,10 +78,23 @@ class OpTracker {
   xlist<OpRequest *> ops_in_flight;
   OpHistory history;
 
+  /// per op type and stage, in microseconds; under ops_in_flight_lock
+  pow2_hist_t stage_hist[NUM_OP_TYPES][NUM_STAGES];
+  utime_t stage_hist_since;
+  PerfCounters *logger;
+  std::vector<std::string> counter_names;  ///< logger keeps pointers into these
+
+  void record_stages(OpRequest *op);
+
 public:
-  OpTracker() : seq(0), ops_in_flight_lock("OpTracker mutex") {}
+  OpTracker() : seq(0), ops_in_flight_lock("OpTracker mutex"), logger(NULL) {}
+  ~OpTracker();
+  /// publish per-stage average latencies as the "optracker" perf counters
+  void create_logger(CephContext *cct);
   void dump_ops_in_flight(std::ostream& ss);
   void dump_historic_ops(std::ostream& ss);
+  void dump_stage_histograms(std::ostream& ss);
+  void reset_stage_histograms();
   void register_inflight_op(xlist<OpRequest*>::item *i);
   void unregister_inflight_op(OpRequest *i);
 
@@ -113,6 +153,10 @@ struct OpRequest : public TrackedOp {
   void set_pg_op() { rmw_flags |= CEPH_OSD_RMW_FLAG_PGOP; }
 
   utime_t received_time;
+  utime_t queued_time;   ///< when the op was last put on the op queue
+  utime_t last_flag_stamp;  ///< when the latest flag point was reached
+  utime_t stage_lat[OpTracker::NUM_STAGES];  ///< time spent in each stage
+  uint16_t hit_stages;   ///< bitmask of the stages we spent time in
   uint8_t warn_interval_multiplier;
   utime_t get_arrived() const {
     return received_time;
@@ -141,15 +185,22 @@ private:
   static const uint8_t flag_sub_op_sent = 1 << 4;
   static const uint8_t flag_commit_sent = 1 << 5;
 
+  static int flag_stage(uint8_t flag);
+  void mark_flag_point(uint8_t flag, const string &evt, const string &state);
+  void finish_stages(utime_t now);
+  int get_op_type();
+
   OpRequest(Message *req, OpTracker *tracker) :
     request(req), xitem(this),
     rmw_flags(0),
+    hit_stages(0),
     warn_interval_multiplier(1),
     lock("OpRequest::lock"),
     tracker(tracker),
     hit_flag_points(0), latest_flag_point(0),
     seq(0) {
     received_time = request->get_recv_stamp();
+    last_flag_stamp = received_time;
     tracker->register_inflight_op(&xitem);
   }
 public:
@@ -185,40 +236,22 @@ public:
   }
 
   void mark_queued_for_pg() {
-    mark_event("queued_for_pg");
-    current = "queued for pg";
-    hit_flag_points |= flag_queued_for_pg;
-    latest_flag_point = flag_queued_for_pg;
+    mark_flag_point(flag_queued_for_pg, "queued_for_pg", "queued for pg");
   }
   void mark_reached_pg() {
-    mark_event("reached_pg");
-    current = "reached pg";
-    hit_flag_points |= flag_reached_pg;
-    latest_flag_point = flag_reached_pg;
+    mark_flag_point(flag_reached_pg, "reached_pg", "reached pg");
   }
   void mark_delayed(string s) {
-    mark_event(s);
-    current = s;
-    hit_flag_points |= flag_delayed;
-    latest_flag_point = flag_delayed;
+    mark_flag_point(flag_delayed, s, s);
   }
   void mark_started() {
-    mark_event("started");
-    current = "started";
-    hit_flag_points |= flag_started;
-    latest_flag_point = flag_started;
+    mark_flag_point(flag_started, "started", "started");
   }
   void mark_sub_op_sent(string s) {
-    mark_event(s);
-    current = s;
-    hit_flag_points |= flag_sub_op_sent;
-    latest_flag_point = flag_sub_op_sent;
+    mark_flag_point(flag_sub_op_sent, s, s);
   }
   void mark_commit_sent() {
-    mark_event("commit_sent");
-    current = "commit sent";
-    hit_flag_points |= flag_commit_sent;
-    latest_flag_point = flag_commit_sent;
+    mark_flag_point(flag_commit_sent, "commit_sent", "commit sent");
   }
 
   void mark_event(const string &event);
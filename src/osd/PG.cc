@@ -18,6 +18,7 @@
 #include "OpRequest.h"
 
 #include "common/Timer.h"
+#include "common/histogram.h"
 
 #include "messages/MOSDOp.h"
 #include "messages/MOSDPGNotify.h"
@@ -67,7 +68,7 @@ PG::PG(OSDService *o, OSDMapRef curmap,
   info(p),
   info_struct_v(0),
   coll(p), log_oid(loid), biginfo_oid(ioid),
-  recovery_item(this), scrub_item(this), scrub_finalize_item(this), snap_trim_item(this), stat_queue_item(this),
+  recovery_item(this), scrub_item(this), scrub_finalize_item(this), snap_trim_item(this), agent_item(this), stat_queue_item(this),
   recovery_ops_active(0),
   waiting_on_backfill(0),
   role(0),
@@ -80,6 +81,7 @@ PG::PG(OSDService *o, OSDMapRef curmap,
   backfill_target(-1),
   backfill_reserved(0),
   backfill_reserving(0),
+  recovery_priority(0),
   pg_stats_lock("PG::pg_stats_lock"),
   pg_stats_valid(false),
   osr(osd->osr_registry.lookup_or_create(p, (stringify(p)))),
@@ -831,6 +833,64 @@ bool PG::needs_backfill() const
   return ret;
 }
 
+/*
+ * Reservations go first to PGs that have lost the most copies, and
+ * within that to those with the most degraded objects.  An acting OSD
+ * holds a complete copy unless it is missing objects or is being
+ * backfilled.
+ */
+unsigned PG::get_recovery_priority() const
+{
+  assert(is_primary());
+
+  unsigned size = get_osdmap()->get_pg_size(info.pgid);
+  unsigned complete = 0;
+  for (vector<int>::const_iterator a = acting.begin(); a != acting.end(); ++a) {
+    if (*a == osd->whoami) {
+      if (!missing.num_missing())
+	++complete;
+      continue;
+    }
+    if (*a == backfill_target)
+      continue;
+    map<int, pg_missing_t>::const_iterator pm = peer_missing.find(*a);
+    if (pm == peer_missing.end() || pm->second.num_missing())
+      continue;
+    ++complete;
+  }
+
+  unsigned lost = size > complete ? size - complete : 0;
+  unsigned prio;
+  if (lost == 0)
+    prio = RECOVERY_PRIORITY_MISPLACED;
+  else if (complete <= 1)
+    prio = RECOVERY_PRIORITY_CRITICAL;
+  else
+    prio = RECOVERY_PRIORITY_DEGRADED;
+  prio += MIN(lost, 3) * 16;
+  prio += MIN(pow2_hist_t::bucket_of(info.stats.stats.sum.num_objects_degraded),
+	      15u);
+  dout(20) << __func__ << " " << complete << "/" << size << " complete copies, "
+	   << info.stats.stats.sum.num_objects_degraded << " degraded objects: "
+	   << prio << dendl;
+  return prio;
+}
+
+/// tell the backfill target to drop the reservation it holds (or has queued) for us
+void PG::release_remote_backfill_reservation()
+{
+  ConnectionRef con = osd->get_con_osd_cluster(
+    backfill_target, get_osdmap()->get_epoch());
+  if (con && (con->features & CEPH_FEATURE_RESERVATION_PRIO)) {
+    osd->send_message_osd_cluster(
+      new MRecoveryReserve(
+	MRecoveryReserve::RELEASE,
+	info.pgid,
+	get_osdmap()->get_epoch()),
+      con.get());
+  }
+}
+
 bool PG::_calc_past_interval_range(epoch_t *start, epoch_t *end)
 {
   *end = info.history.same_interval_since;
@@ -1055,6 +1115,7 @@ void PG::clear_primary_state()
 
   osd->recovery_wq.dequeue(this);
   osd->snap_trim_wq.dequeue(this);
+  osd->agent_wq.dequeue(this);
 }
 
 /**
@@ -2965,19 +3026,85 @@ void PG::sub_op_scrub_map(OpRequestRef op)
   }
 }
 
+/*
+ * read and hash the data and omap of one object for deep scrub
+ *
+ * called without the pg lock, from the scrub hash threads, so this is
+ * static and logs without the pg prefix.
+ * returns the number of data bytes read.
+ */
+uint64_t PG::_scan_deep(ObjectStore *store, coll_t coll,
+			const hobject_t &poid, ScrubMap::object &o)
+{
+  bufferhash h, oh;
+  bufferlist bl, hdrbl;
+  int r;
+  __u64 pos = 0;
+  while ( (r = store->read(coll, poid, pos,
+			   g_conf->osd_deep_scrub_stride, bl)) > 0) {
+    h << bl;
+    pos += bl.length();
+    bl.clear();
+  }
+  o.digest = h.digest();
+  o.digest_present = true;
+
+  bl.clear();
+  r = store->omap_get_header(coll, poid, &hdrbl);
+  if (r == 0) {
+    generic_dout(25) << "CRC header " << string(hdrbl.c_str(), hdrbl.length())
+		     << dendl;
+    ::encode(hdrbl, bl);
+    oh << bl;
+    bl.clear();
+  }
+
+  ObjectMap::ObjectMapIterator iter = store->get_omap_iterator(coll, poid);
+  assert(iter);
+  for (iter->seek_to_first(); iter->valid() ; iter->next()) {
+    generic_dout(25) << "CRC key " << iter->key() << " value "
+		     << string(iter->value().c_str(), iter->value().length())
+		     << dendl;
+    ::encode(iter->key(), bl);
+    ::encode(iter->value(), bl);
+    oh << bl;
+    bl.clear();
+  }
+
+  //Store final calculated CRC32 of omap header & key/values
+  o.omap_digest = oh.digest();
+  o.omap_digest_present = true;
+  return pos;
+}
+
 /* 
  * pg lock may or may not be held
+ *
+ * on deep scrubs, objects are hashed on the scrub hash threads while
+ * we stat the next ones, and the store is asked to prefetch
+ * osd_deep_scrub_readahead_objects objects ahead.
  */
 void PG::_scan_list(ScrubMap &map, vector<hobject_t> &ls, bool deep)
 {
   dout(10) << "_scan_list scanning " << ls.size() << " objects"
            << (deep ? " deeply" : "") << dendl;
-  int i = 0;
+  bool parallel = deep && g_conf->osd_deep_scrub_threads > 0;
+  unsigned readahead = deep ? g_conf->osd_deep_scrub_readahead_objects : 0;
+  ScrubHashBatch batch;
+  uint64_t bytes = 0;
+
+  for (unsigned j = 0; j < readahead && j < ls.size(); j++)
+    osd->store->readahead(coll, ls[j], 0, 0);
+
+  unsigned i = 0;
   for (vector<hobject_t>::iterator p = ls.begin(); 
        p != ls.end(); 
        p++, i++) {
     hobject_t poid = *p;
 
+    if (readahead && i + readahead < ls.size())
+      osd->store->readahead(coll, ls[i + readahead], 0, 0);
+
     struct stat st;
     int r = osd->store->stat(coll, poid, &st);
     if (r == 0) {
@@ -2989,45 +3116,15 @@ void PG::_scan_list(ScrubMap &map, vector<hobject_t> &ls, bool deep)
 
       // calculate the CRC32 on deep scrubs
       if (deep) {
-        bufferhash h, oh;
-        bufferlist bl, hdrbl;
-        int r;
-        __u64 pos = 0;
-        while ( (r = osd->store->read(coll, poid, pos,
-                                      g_conf->osd_deep_scrub_stride, bl)) > 0) {
-          h << bl;
-          pos += bl.length();
-          bl.clear();
-        }
-        o.digest = h.digest();
-        o.digest_present = true;
-
-        bl.clear();
-        r = osd->store->omap_get_header(coll, poid, &hdrbl);
-        if (r == 0) {
-          dout(25) << "CRC header " << string(hdrbl.c_str(), hdrbl.length())
-             << dendl;
-          ::encode(hdrbl, bl);
-          oh << bl;
-          bl.clear();
-        }
-
-        ObjectMap::ObjectMapIterator iter = osd->store->get_omap_iterator(
-          coll, poid);
-        assert(iter);
-        for (iter->seek_to_first(); iter->valid() ; iter->next()) {
-          dout(25) << "CRC key " << iter->key() << " value "
-            << string(iter->value().c_str(), iter->value().length()) << dendl;
-
-          ::encode(iter->key(), bl);
-          ::encode(iter->value(), bl);
-          oh << bl;
-          bl.clear();
-        }
-
-        //Store final calculated CRC32 of omap header & key/values
-        o.omap_digest = oh.digest();
-        o.omap_digest_present = true;
+	if (parallel) {
+	  batch.lock.Lock();
+	  ++batch.pending;
+	  batch.lock.Unlock();
+	  osd->scrub_hash_wq.queue(new ScrubHashJob(&batch, osd->store, coll,
+						    poid, &o));
+	} else {
+	  bytes += _scan_deep(osd->store, coll, poid, o);
+	}
       }
 
       if (poid.snap != CEPH_SNAPDIR && poid.snap != CEPH_NOSNAP) {
@@ -3039,6 +3136,15 @@ void PG::_scan_list(ScrubMap &map, vector<hobject_t> &ls, bool deep)
       dout(25) << "_scan_list  " << poid << " got " << r << ", skipping" << dendl;
     }
   }
+
+  if (parallel) {
+    batch.wait();
+    bytes += batch.bytes;
+  }
+  if (deep) {
+    dout(20) << "_scan_list read " << bytes << " bytes" << dendl;
+    osd->deep_scrub_charge(bytes);
+  }
 }
 
 // send scrub v2-compatible messages (classic scrub)
@@ -3716,11 +3822,20 @@ void PG::chunky_scrub() {
 	}
 
         scrubber.start = hobject_t();
+        scrubber.stamp_started = ceph_clock_now(g_ceph_context);
         scrubber.state = PG::Scrubber::NEW_CHUNK;
 
         break;
 
       case PG::Scrubber::NEW_CHUNK:
+        // wait, without blocking writes, until the osd's deep scrub
+        // budget allows another chunk; OSD::tick will requeue us
+        if (scrubber.deep && osd->deep_scrub_delay(this)) {
+          dout(15) << "deep scrub throttled" << dendl;
+          done = true;
+          break;
+        }
+
         scrubber.primary_scrubmap = ScrubMap();
         scrubber.received_maps.clear();
 
@@ -3827,6 +3942,13 @@ void PG::chunky_scrub() {
         --scrubber.waiting_on;
         scrubber.waiting_on_whom.erase(osd->whoami);
 
+        scrubber.objects_scrubbed += scrubber.primary_scrubmap.objects.size();
+        for (map<hobject_t,ScrubMap::object>::iterator p =
+               scrubber.primary_scrubmap.objects.begin();
+             p != scrubber.primary_scrubmap.objects.end();
+             ++p)
+          scrubber.bytes_scrubbed += p->second.size;
+
         scrubber.state = PG::Scrubber::WAIT_REPLICAS;
         break;
 
@@ -3852,6 +3974,16 @@ void PG::chunky_scrub() {
         requeue_ops(waiting_for_active);
 
         if (scrubber.end < hobject_t::get_max()) {
+          double rate, eta;
+          get_scrub_progress(&rate, &eta);
+          dout(10) << "scrub progress " << scrubber.objects_scrubbed << "/"
+                   << info.stats.stats.sum.num_objects << " objects, "
+                   << scrubber.bytes_scrubbed << "/"
+                   << info.stats.stats.sum.num_bytes << " bytes, "
+                   << (uint64_t)rate << " bytes/sec, eta "
+                   << (eta < 0 ? string("unknown") : stringify((int)eta) + "s")
+                   << dendl;
+
           // schedule another leg of the scrub
           scrubber.start = scrubber.end;
 
@@ -3877,6 +4009,52 @@ void PG::chunky_scrub() {
   }
 }
 
+/*
+ * rate: bytes/sec scrubbed so far
+ * eta: seconds until the scrub reaches the end of the pg, -1 if unknown
+ */
+void PG::get_scrub_progress(double *rate, double *eta)
+{
+  *rate = 0;
+  *eta = -1;
+  if (scrubber.stamp_started == utime_t())
+    return;
+  double elapsed = ceph_clock_now(g_ceph_context) - scrubber.stamp_started;
+  if (elapsed <= 0)
+    return;
+  *rate = (double)scrubber.bytes_scrubbed / elapsed;
+
+  // extrapolate by bytes, or by objects for a pg of empty objects
+  uint64_t total = info.stats.stats.sum.num_bytes;
+  uint64_t done = scrubber.bytes_scrubbed;
+  if (total == 0) {
+    total = info.stats.stats.sum.num_objects;
+    done = scrubber.objects_scrubbed;
+  }
+  if (done == 0)
+    return;
+  *eta = done >= total ? 0 :
+    elapsed * (double)(total - done) / (double)done;
+}
+
+void PG::dump_scrub_progress(Formatter *f)
+{
+  f->dump_int("active", scrubber.active);
+  if (!scrubber.active)
+    return;
+  double rate, eta;
+  get_scrub_progress(&rate, &eta);
+  f->dump_int("deep", scrubber.deep);
+  f->dump_string("state", Scrubber::state_string(scrubber.state));
+  f->dump_stream("started") << scrubber.stamp_started;
+  f->dump_stream("position") << scrubber.start;
+  f->dump_unsigned("objects_scrubbed", scrubber.objects_scrubbed);
+  f->dump_unsigned("bytes_scrubbed", scrubber.bytes_scrubbed);
+  f->dump_float("bytes_per_sec", rate);
+  f->dump_float("eta_seconds", eta);
+  f->dump_float("osd_deep_scrub_rate_limit", osd->get_deep_scrub_rate());
+}
+
 void PG::scrub_clear_state()
 {
   assert(_lock.is_locked());
@@ -4797,6 +4975,15 @@ bool PG::can_discard_op(OpRequestRef op)
   if (OSD::op_is_discardable(m)) {
     dout(20) << " discard " << *m << dendl;
     return true;
+  } else if (op->may_write() && !is_primary() &&
+	     same_for_modify_since(m->get_map_epoch()) &&
+	     (m->get_flags() & (CEPH_OSD_FLAG_BALANCE_READS |
+				CEPH_OSD_FLAG_LOCALIZE_READS))) {
+    // a read sent to a replica that turns out to write (e.g. a class
+    // method); have the client resend it to the primary.
+    dout(20) << " replica read may write " << *m << dendl;
+    osd->reply_op_error(op, -EAGAIN);
+    return true;
   } else if (op->may_write() &&
 	     (!is_primary() ||
 	      !same_for_modify_since(m->get_map_epoch()))) {
@@ -5669,6 +5856,29 @@ PG::RecoveryState::Backfilling::Backfilling(my_context ctx)
   pg->state_set(PG_STATE_BACKFILL);
 }
 
+boost::statechart::result
+PG::RecoveryState::Backfilling::react(const DeferBackfill &evt)
+{
+  PG *pg = context< RecoveryMachine >().pg;
+  dout(10) << "backfill preempted by a higher priority pg" << dendl;
+  pg->osd->logger->inc(l_osd_backfill_preempt);
+  pg->osd->local_reserver.cancel_reservation(pg->info.pgid);
+  pg->release_remote_backfill_reservation();
+  pg->state_set(PG_STATE_BACKFILL_WAIT);
+  return transit<WaitLocalBackfillReserved>();
+}
+
+boost::statechart::result
+PG::RecoveryState::Backfilling::react(const RemoteReservationRevoked &evt)
+{
+  PG *pg = context< RecoveryMachine >().pg;
+  dout(10) << "backfill preempted on osd." << pg->backfill_target << dendl;
+  pg->osd->logger->inc(l_osd_backfill_preempt);
+  pg->osd->local_reserver.cancel_reservation(pg->info.pgid);
+  pg->state_set(PG_STATE_BACKFILL_WAIT);
+  return transit<WaitLocalBackfillReserved>();
+}
+
 void PG::RecoveryState::Backfilling::exit()
 {
   context< RecoveryMachine >().log_exit(state_name, enter_time);
@@ -5713,7 +5923,8 @@ PG::RecoveryState::WaitRemoteBackfillReserved::WaitRemoteBackfillReserved(my_con
         new MBackfillReserve(
 	  MBackfillReserve::REQUEST,
 	  pg->info.pgid,
-	  pg->get_osdmap()->get_epoch()),
+	  pg->get_osdmap()->get_epoch(),
+	  pg->recovery_priority),
 	con.get());
     } else {
       post_event(RemoteBackfillReserved());
@@ -5752,6 +5963,25 @@ PG::RecoveryState::WaitRemoteBackfillReserved::react(const RemoteReservationReje
   return transit<NotBackfilling>();
 }
 
+boost::statechart::result
+PG::RecoveryState::WaitRemoteBackfillReserved::react(const RemoteReservationRevoked &evt)
+{
+  // the target revokes only what it granted, and a grant reaches us
+  // before its revocation, so this is about a reservation we gave up
+  dout(10) << "ignoring revocation of a previous backfill reservation" << dendl;
+  return discard_event();
+}
+
+boost::statechart::result
+PG::RecoveryState::WaitRemoteBackfillReserved::react(const DeferBackfill &evt)
+{
+  PG *pg = context< RecoveryMachine >().pg;
+  dout(10) << "local backfill reservation preempted" << dendl;
+  pg->osd->logger->inc(l_osd_backfill_preempt);
+  pg->release_remote_backfill_reservation();
+  return transit<WaitLocalBackfillReserved>();
+}
+
 /*--WaitLocalBackfillReserved--*/
 PG::RecoveryState::WaitLocalBackfillReserved::WaitLocalBackfillReserved(my_context ctx)
   : my_base(ctx)
@@ -5760,11 +5990,24 @@ PG::RecoveryState::WaitLocalBackfillReserved::WaitLocalBackfillReserved(my_conte
   context< RecoveryMachine >().log_enter(state_name);
   PG *pg = context< RecoveryMachine >().pg;
   pg->state_set(PG_STATE_BACKFILL_WAIT);
+  pg->osd->osd->set_recovery_priority(pg, pg->get_recovery_priority());
+
+  // we can only give the slot back if the backfill target lets us
+  // release its reservation while it is still queued
+  Context *on_preempt = 0;
+  ConnectionRef con = pg->osd->get_con_osd_cluster(
+    pg->backfill_target, pg->get_osdmap()->get_epoch());
+  if (con && (con->features & CEPH_FEATURE_RESERVATION_PRIO))
+    on_preempt = new QueuePeeringEvt<DeferBackfill>(
+      pg, pg->get_osdmap()->get_epoch(),
+      DeferBackfill());
   pg->osd->local_reserver.request_reservation(
     pg->info.pgid,
     new QueuePeeringEvt<LocalBackfillReserved>(
       pg, pg->get_osdmap()->get_epoch(),
-      LocalBackfillReserved()));
+      LocalBackfillReserved()),
+    pg->recovery_priority,
+    on_preempt);
 }
 
 void PG::RecoveryState::WaitLocalBackfillReserved::exit()
@@ -5793,6 +6036,24 @@ PG::RecoveryState::RepNotRecovering::RepNotRecovering(my_context ctx)
   context< RecoveryMachine >().log_enter(state_name);
 }
 
+boost::statechart::result
+PG::RecoveryState::RepNotRecovering::react(const RequestBackfillPrio &evt)
+{
+  ReplicaActive &ra = context< ReplicaActive >();
+  ra.reserve_priority = evt.priority;
+  ra.reserve_preemptible = true;
+  return transit<RepWaitBackfillReserved>();
+}
+
+boost::statechart::result
+PG::RecoveryState::RepNotRecovering::react(const RequestRecoveryPrio &evt)
+{
+  ReplicaActive &ra = context< ReplicaActive >();
+  ra.reserve_priority = evt.priority;
+  ra.reserve_preemptible = false;
+  return transit<RepWaitRecoveryReserved>();
+}
+
 void PG::RecoveryState::RepNotRecovering::exit()
 {
   context< RecoveryMachine >().log_exit(state_name, enter_time);
@@ -5810,7 +6071,8 @@ PG::RecoveryState::RepWaitRecoveryReserved::RepWaitRecoveryReserved(my_context c
     pg->info.pgid,
     new QueuePeeringEvt<RemoteRecoveryReserved>(
       pg, pg->get_osdmap()->get_epoch(),
-      RemoteRecoveryReserved()));
+      RemoteRecoveryReserved()),
+    context< ReplicaActive >().reserve_priority);
 }
 
 boost::statechart::result
@@ -5848,11 +6110,17 @@ PG::RecoveryState::RepWaitBackfillReserved::RepWaitBackfillReserved(my_context c
              << kb_used << " >= " << max << dendl;
     post_event(RemoteReservationRejected());
   } else {
+    ReplicaActive &ra = context< ReplicaActive >();
     pg->osd->remote_reserver.request_reservation(
       pg->info.pgid,
       new QueuePeeringEvt<RemoteBackfillReserved>(
         pg, pg->get_osdmap()->get_epoch(),
-        RemoteBackfillReserved()));
+        RemoteBackfillReserved()),
+      ra.reserve_priority,
+      ra.reserve_preemptible ?
+        new QueuePeeringEvt<RemoteBackfillPreempted>(
+	  pg, pg->get_osdmap()->get_epoch(),
+	  RemoteBackfillPreempted()) : 0);
   }
 }
 
@@ -5889,6 +6157,15 @@ PG::RecoveryState::RepWaitBackfillReserved::react(const RemoteReservationRejecte
   return transit<RepNotRecovering>();
 }
 
+boost::statechart::result
+PG::RecoveryState::RepWaitBackfillReserved::react(const RecoveryDone &evt)
+{
+  // the primary gave up its request while we were still queued
+  PG *pg = context< RecoveryMachine >().pg;
+  pg->osd->remote_reserver.cancel_reservation(pg->info.pgid);
+  return transit<RepNotRecovering>();
+}
+
 /*---RepRecovering-------*/
 PG::RecoveryState::RepRecovering::RepRecovering(my_context ctx)
   : my_base(ctx)
@@ -5897,6 +6174,21 @@ PG::RecoveryState::RepRecovering::RepRecovering(my_context ctx)
   context< RecoveryMachine >().log_enter(state_name);
 }
 
+boost::statechart::result
+PG::RecoveryState::RepRecovering::react(const RemoteBackfillPreempted &evt)
+{
+  PG *pg = context< RecoveryMachine >().pg;
+  dout(10) << "remote backfill reservation preempted" << dendl;
+  pg->osd->send_message_osd_cluster(
+    pg->acting[0],
+    new MBackfillReserve(
+      MBackfillReserve::REVOKE,
+      pg->info.pgid,
+      pg->get_osdmap()->get_epoch()),
+    pg->get_osdmap()->get_epoch());
+  return transit<RepNotRecovering>();
+}
+
 void PG::RecoveryState::RepRecovering::exit()
 {
   context< RecoveryMachine >().log_exit(state_name, enter_time);
@@ -5924,11 +6216,13 @@ PG::RecoveryState::WaitLocalRecoveryReserved::WaitLocalRecoveryReserved(my_conte
   context< RecoveryMachine >().log_enter(state_name);
   PG *pg = context< RecoveryMachine >().pg;
   pg->state_set(PG_STATE_RECOVERY_WAIT);
+  pg->osd->osd->set_recovery_priority(pg, pg->get_recovery_priority());
   pg->osd->local_reserver.request_reservation(
     pg->info.pgid,
     new QueuePeeringEvt<LocalRecoveryReserved>(
       pg, pg->get_osdmap()->get_epoch(),
-      LocalRecoveryReserved()));
+      LocalRecoveryReserved()),
+    pg->recovery_priority);
 }
 
 void PG::RecoveryState::WaitLocalRecoveryReserved::exit()
@@ -5962,7 +6256,8 @@ PG::RecoveryState::WaitRemoteRecoveryReserved::react(const RemoteRecoveryReserve
 	pg->osd->send_message_osd_cluster(
           new MRecoveryReserve(MRecoveryReserve::REQUEST,
 			       pg->info.pgid,
-			       pg->get_osdmap()->get_epoch()),
+			       pg->get_osdmap()->get_epoch(),
+			       pg->recovery_priority),
 	  con.get());
       } else {
 	post_event(RemoteRecoveryReserved());
@@ -6341,7 +6636,9 @@ void PG::RecoveryState::Active::exit()
 
 /*------ReplicaActive-----*/
 PG::RecoveryState::ReplicaActive::ReplicaActive(my_context ctx) 
-  : my_base(ctx)
+  : my_base(ctx),
+    reserve_priority(0),
+    reserve_preemptible(false)
 {
   state_name = "Started/ReplicaActive";
 
@@ -134,6 +134,34 @@ struct PGPool {
   void update(OSDMapRef map);
 };
 
+/**
+ * objects of one deep scrub chunk being hashed on the osd's scrub hash
+ * threads.  the scrubbing thread waits until pending drops to 0.
+ */
+struct ScrubHashBatch {
+  Mutex lock;
+  Cond cond;
+  int pending;
+  uint64_t bytes;   ///< object data read so far
+  ScrubHashBatch() : lock("ScrubHashBatch::lock"), pending(0), bytes(0) {}
+  void wait() {
+    Mutex::Locker l(lock);
+    while (pending)
+      cond.Wait(lock);
+  }
+};
+
+struct ScrubHashJob {
+  ScrubHashBatch *batch;
+  ObjectStore *store;
+  coll_t coll;
+  hobject_t oid;
+  ScrubMap::object *o;   ///< entry in the scrub map to fill in
+  ScrubHashJob(ScrubHashBatch *b, ObjectStore *s, coll_t c,
+	       const hobject_t &oid, ScrubMap::object *o)
+    : batch(b), store(s), coll(c), oid(oid), o(o) {}
+};
+
 /** PG - Replica Placement Group
  *
  */
@@ -457,7 +485,7 @@ public:
 
   /* You should not use these items without taking their respective queue locks
    * (if they have one) */
-  xlist<PG*>::item recovery_item, scrub_item, scrub_finalize_item, snap_trim_item, stat_queue_item;
+  xlist<PG*>::item recovery_item, scrub_item, scrub_finalize_item, snap_trim_item, agent_item, stat_queue_item;
   int recovery_ops_active;
   bool waiting_on_backfill;
 #ifdef DEBUG_RECOVERY_OIDS
@@ -591,11 +619,13 @@ protected:
     map<hobject_t,eversion_t> objects;
     hobject_t begin;
     hobject_t end;
+    eversion_t version;  ///< pg last_update as of the scan (local only)
     
     /// clear content
     void clear() {
       objects.clear();
       begin = end = hobject_t();
+      version = eversion_t();
     }
 
     void reset(hobject_t start) {
@@ -635,6 +665,7 @@ protected:
     void dump(Formatter *f) const {
       f->dump_stream("begin") << begin;
       f->dump_stream("end") << end;
+      f->dump_stream("version") << version;
       f->open_array_section("objects");
       for (map<hobject_t, eversion_t>::const_iterator i = objects.begin();
 	   i != objects.end();
@@ -661,6 +692,19 @@ public:
     return backfill_target;
   }
 
+  /// bands of recovery reservation priorities, see get_recovery_priority()
+  enum {
+    RECOVERY_PRIORITY_MISPLACED = 0,   ///< all copies intact, data is moving
+    RECOVERY_PRIORITY_DEGRADED = 64,   ///< some copies are lost
+    RECOVERY_PRIORITY_CRITICAL = 128,  ///< at most one copy is left
+  };
+  unsigned get_recovery_priority() const;
+  void release_remote_backfill_reservation();
+
+  /// priority of our last reservation request; orders the RecoveryWQ.
+  /// changed only through OSD::set_recovery_priority() with the pg locked
+  unsigned recovery_priority;
+
 protected:
 
 
@@ -836,7 +880,8 @@ public:
       must_scrub(false), must_deep_scrub(false), must_repair(false),
       classic(false),
       finalizing(false), is_chunky(false), state(INACTIVE),
-      deep(false)
+      deep(false),
+      objects_scrubbed(0), bytes_scrubbed(0)
     {
     }
 
@@ -893,6 +938,10 @@ public:
     // deep scrub
     bool deep;
 
+    // progress
+    utime_t stamp_started;
+    uint64_t objects_scrubbed, bytes_scrubbed;
+
     list<Context*> callbacks;
     void add_callback(Context *context) {
       callbacks.push_back(context);
@@ -966,6 +1015,9 @@ public:
       errors = 0;
       fixed = 0;
       deep = false;
+      stamp_started = utime_t();
+      objects_scrubbed = 0;
+      bytes_scrubbed = 0;
       run_callbacks();
       inconsistent.clear();
       missing.clear();
@@ -1001,6 +1053,10 @@ public:
   void scrub_clear_state();
   bool scrub_gather_replica_maps();
   void _scan_list(ScrubMap &map, vector<hobject_t> &ls, bool deep);
+  static uint64_t _scan_deep(ObjectStore *store, coll_t coll,
+			     const hobject_t &poid, ScrubMap::object &o);
+  void get_scrub_progress(double *rate, double *eta);
+  void dump_scrub_progress(Formatter *f);
   void _request_scrub_map_classic(int replica, eversion_t version);
   void _request_scrub_map(int replica, eversion_t version,
                           hobject_t start, hobject_t end, bool deep);
@@ -1165,9 +1221,31 @@ public:
   TrivialEvent(LocalBackfillReserved)
   TrivialEvent(RemoteBackfillReserved)
   TrivialEvent(RemoteReservationRejected)
+  TrivialEvent(RemoteReservationRevoked)
   TrivialEvent(RequestBackfill)
   TrivialEvent(RequestRecovery)
   TrivialEvent(RecoveryDone)
+  TrivialEvent(DeferBackfill)
+  TrivialEvent(RemoteBackfillPreempted)
+
+  struct RequestBackfillPrio : boost::statechart::event< RequestBackfillPrio > {
+    unsigned priority;
+    RequestBackfillPrio(unsigned prio) :
+      boost::statechart::event< RequestBackfillPrio >(),
+      priority(prio) {}
+    void print(std::ostream *out) const {
+      *out << "RequestBackfillPrio: priority " << priority;
+    }
+  };
+  struct RequestRecoveryPrio : boost::statechart::event< RequestRecoveryPrio > {
+    unsigned priority;
+    RequestRecoveryPrio(unsigned prio) :
+      boost::statechart::event< RequestRecoveryPrio >(),
+      priority(prio) {}
+    void print(std::ostream *out) const {
+      *out << "RequestRecoveryPrio: priority " << priority;
+    }
+  };
 
   TrivialEvent(AllReplicasRecovered)
   TrivialEvent(DoRecovery)
@@ -1460,21 +1538,29 @@ public:
 
     struct Backfilling : boost::statechart::state< Backfilling, Active >, NamedState {
       typedef boost::mpl::list<
-	boost::statechart::transition< Backfilled, Recovered >
+	boost::statechart::transition< Backfilled, Recovered >,
+	boost::statechart::custom_reaction< DeferBackfill >,
+	boost::statechart::custom_reaction< RemoteReservationRevoked >
 	> reactions;
       Backfilling(my_context ctx);
       void exit();
+      boost::statechart::result react(const DeferBackfill& evt);
+      boost::statechart::result react(const RemoteReservationRevoked& evt);
     };
 
     struct WaitRemoteBackfillReserved : boost::statechart::state< WaitRemoteBackfillReserved, Active >, NamedState {
       typedef boost::mpl::list<
 	boost::statechart::custom_reaction< RemoteBackfillReserved >,
-	boost::statechart::custom_reaction< RemoteReservationRejected >
+	boost::statechart::custom_reaction< RemoteReservationRejected >,
+	boost::statechart::custom_reaction< RemoteReservationRevoked >,
+	boost::statechart::custom_reaction< DeferBackfill >
 	> reactions;
       WaitRemoteBackfillReserved(my_context ctx);
       void exit();
       boost::statechart::result react(const RemoteBackfillReserved& evt);
       boost::statechart::result react(const RemoteReservationRejected& evt);
+      boost::statechart::result react(const RemoteReservationRevoked& evt);
+      boost::statechart::result react(const DeferBackfill& evt);
     };
 
     struct WaitLocalBackfillReserved : boost::statechart::state< WaitLocalBackfillReserved, Active >, NamedState {
@@ -1495,6 +1581,9 @@ public:
 
     struct RepNotRecovering;
     struct ReplicaActive : boost::statechart::state< ReplicaActive, Started, RepNotRecovering >, NamedState {
+      unsigned reserve_priority;  ///< of the primary's pending request
+      bool reserve_preemptible;   ///< primary understands REVOKE
+
       ReplicaActive(my_context ctx);
       void exit();
 
@@ -1516,21 +1605,25 @@ public:
 
     struct RepRecovering : boost::statechart::state< RepRecovering, ReplicaActive >, NamedState {
       typedef boost::mpl::list<
-	boost::statechart::transition< RecoveryDone, RepNotRecovering >
+	boost::statechart::transition< RecoveryDone, RepNotRecovering >,
+	boost::statechart::custom_reaction< RemoteBackfillPreempted >
 	> reactions;
       RepRecovering(my_context ctx);
       void exit();
+      boost::statechart::result react(const RemoteBackfillPreempted &evt);
     };
 
     struct RepWaitBackfillReserved : boost::statechart::state< RepWaitBackfillReserved, ReplicaActive >, NamedState {
       typedef boost::mpl::list<
 	boost::statechart::custom_reaction< RemoteBackfillReserved >,
-	boost::statechart::custom_reaction< RemoteReservationRejected >
+	boost::statechart::custom_reaction< RemoteReservationRejected >,
+	boost::statechart::custom_reaction< RecoveryDone >
 	> reactions;
       RepWaitBackfillReserved(my_context ctx);
       void exit();
       boost::statechart::result react(const RemoteBackfillReserved &evt);
       boost::statechart::result react(const RemoteReservationRejected &evt);
+      boost::statechart::result react(const RecoveryDone &evt);
     };
 
     struct RepWaitRecoveryReserved : boost::statechart::state< RepWaitRecoveryReserved, ReplicaActive >, NamedState {
@@ -1546,10 +1639,14 @@ public:
       typedef boost::mpl::list<
 	boost::statechart::transition< RequestBackfill, RepWaitBackfillReserved >,
         boost::statechart::transition< RequestRecovery, RepWaitRecoveryReserved >,
+	boost::statechart::custom_reaction< RequestBackfillPrio >,
+	boost::statechart::custom_reaction< RequestRecoveryPrio >,
 	boost::statechart::transition< RecoveryDone, RepNotRecovering >  // for compat with pre-reservation peers
 	> reactions;
       RepNotRecovering(my_context ctx);
       void exit();
+      boost::statechart::result react(const RequestBackfillPrio &evt);
+      boost::statechart::result react(const RequestRecoveryPrio &evt);
     };
 
     struct Recovering : boost::statechart::state< Recovering, Active >, NamedState {
@@ -1912,6 +2009,7 @@ public:
   virtual void do_scan(OpRequestRef op) = 0;
   virtual void do_backfill(OpRequestRef op) = 0;
   virtual void snap_trimmer() = 0;
+  virtual void agent_work() = 0;
 
   virtual int do_command(vector<string>& cmd, ostream& ss,
 			 bufferlist& idata, bufferlist& odata) = 0;
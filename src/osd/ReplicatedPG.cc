@@ -97,6 +97,23 @@ bool ReplicatedPG::is_missing_object(const hobject_t& soid)
   return missing.missing.count(soid);
 }
 
+/*
+ * A replica may only serve a read if its copy of the object is
+ * complete (not missing, not past last_backfill) and it has no
+ * replicated update for it still in flight; otherwise a client could
+ * read data older than what the primary has already applied.
+ */
+bool ReplicatedPG::can_serve_replica_read(const hobject_t& soid)
+{
+  if (soid > info.last_backfill)
+    return false;
+  if (missing.missing.count(soid))
+    return false;
+  if (rep_writes_pending.count(soid))
+    return false;
+  return true;
+}
+
 void ReplicatedPG::wait_for_missing_object(const hobject_t& soid, OpRequestRef op)
 {
   assert(is_missing_object(soid));
@@ -283,6 +300,10 @@ int ReplicatedPG::do_command(vector<string>& cmd, ostream& ss,
     handle_query_state(&jsf);
     jsf.close_section();
 
+    jsf.open_object_section("scrub");
+    dump_scrub_progress(&jsf);
+    jsf.close_section();
+
     jsf.close_section();
     stringstream dss;
     jsf.flush(dss);
@@ -631,10 +652,31 @@ void ReplicatedPG::do_op(OpRequestRef op)
 
   dout(10) << "do_op " << *m << (op->may_write() ? " may_write" : "") << dendl;
 
+  // the snapdir can only be read
+  if (m->get_snapid() == CEPH_SNAPDIR && op->may_write()) {
+    osd->reply_op_error(op, -EINVAL);
+    return;
+  }
+
   hobject_t head(m->get_oid(), m->get_object_locator().key,
 		 CEPH_NOSNAP, m->get_pg().ps(),
 		 info.pgid.pool());
 
+  // balanced/localized read on a replica?
+  if (!is_primary()) {
+    hobject_t snapdir = head;
+    snapdir.snap = CEPH_SNAPDIR;
+    if (pool.info.cache_mode != pg_pool_t::CACHEMODE_NONE ||
+	!can_serve_replica_read(head) || !can_serve_replica_read(snapdir)) {
+      dout(10) << "do_op can't serve replica read of " << head
+	       << ", sending client back to the primary" << dendl;
+      osd->logger->inc(l_osd_op_r_replica_bounce);
+      osd->reply_op_error(op, -EAGAIN);
+      return;
+    }
+    osd->logger->inc(l_osd_op_r_replica);
+  }
+
   if (op->may_write() && scrubber.write_blocked_by_scrub(head)) {
     dout(20) << __func__ << ": waiting for scrub" << dendl;
     waiting_for_active.push_back(op);
@@ -672,6 +714,9 @@ void ReplicatedPG::do_op(OpRequestRef op)
     wait_for_degraded_object(snapdir, op);
     return;
   }
+
+  if (maybe_handle_cache(op, head))
+    return;
  
   entity_inst_t client = m->get_source_inst();
 
@@ -688,10 +733,10 @@ void ReplicatedPG::do_op(OpRequestRef op)
     &obc, can_create, &snapid);
   if (r) {
     if (r == -EAGAIN) {
-      // If we're not the primary of this OSD, and we have
-      // CEPH_OSD_FLAG_LOCALIZE_READS set, we just return -EAGAIN. Otherwise,
+      // If we're not the primary of this PG (the client asked for a
+      // balanced or localized read), we just return -EAGAIN. Otherwise,
       // we have to wait for the object.
-      if (is_primary() || (!(m->get_flags() & CEPH_OSD_FLAG_LOCALIZE_READS))) {
+      if (is_primary()) {
 	// missing the specific snap we need; requeue and wait.
 	assert(!can_create); // only happens on a read
 	hobject_t soid(m->get_oid(), m->get_object_locator().key,
@@ -831,6 +876,38 @@ void ReplicatedPG::do_op(OpRequestRef op)
     return;
   }
 
+  // reads of the snapdir (list_snaps) need the object info of every
+  // clone; take them as src_obcs so they are released with the op
+  if (m->get_snapid() == CEPH_SNAPDIR) {
+    for (vector<snapid_t>::iterator p = obc->ssc->snapset.clones.begin();
+	 p != obc->ssc->snapset.clones.end();
+	 ++p) {
+      hobject_t clone_oid = obc->obs.oi.soid;
+      clone_oid.snap = *p;
+      if (src_obc.count(clone_oid))
+	continue;
+      ObjectContext *sobc;
+      snapid_t ssnapid;
+      int r = find_object_context(clone_oid, m->get_object_locator(), &sobc,
+				  false, &ssnapid);
+      if (r == 0) {
+	dout(10) << " clone_oid " << clone_oid << " obc " << sobc << dendl;
+	src_obc[clone_oid] = sobc;
+	continue;
+      }
+      if (r == -EAGAIN) {
+	hobject_t wait_oid(clone_oid.oid, clone_oid.get_key(), ssnapid,
+			   m->get_pg().ps(), info.pgid.pool());
+	wait_for_missing_object(wait_oid, op);
+      } else {
+	osd->reply_op_error(op, r);
+      }
+      put_object_contexts(src_obc);
+      put_object_context(obc);
+      return;
+    }
+  }
+
   op->mark_started();
 
   const hobject_t& soid = obc->obs.oi.soid;
@@ -2252,6 +2329,80 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
         break;
       }
 
+    case CEPH_OSD_OP_LIST_SNAPS:
+      {
+	if (ctx->obc->obs.oi.soid.snap != CEPH_NOSNAP &&
+	    ctx->obc->obs.oi.soid.snap != CEPH_SNAPDIR) {
+	  // only the head or the snapdir know about every clone
+	  result = -EINVAL;
+	  break;
+	}
+	assert(ssc);
+
+	obj_list_snap_response_t resp;
+	resp.clones.reserve(ssc->snapset.clones.size() + 1);
+	for (vector<snapid_t>::const_iterator clone_iter = ssc->snapset.clones.begin();
+	     clone_iter != ssc->snapset.clones.end(); ++clone_iter) {
+	  clone_info ci;
+	  ci.cloneid = *clone_iter;
+
+	  hobject_t clone_oid = soid;
+	  clone_oid.snap = *clone_iter;
+	  map<hobject_t,ObjectContext*>::iterator q = ctx->src_obc.find(clone_oid);
+	  if (q == ctx->src_obc.end()) {
+	    // not a snapdir read, so the clones were not loaded
+	    result = -EINVAL;
+	    break;
+	  }
+	  ObjectContext *clone_obc = q->second;
+	  for (vector<snapid_t>::reverse_iterator p = clone_obc->obs.oi.snaps.rbegin();
+	       p != clone_obc->obs.oi.snaps.rend();
+	       ++p) {
+	    ci.snaps.push_back(*p);
+	  }
+
+	  map<snapid_t, interval_set<uint64_t> >::const_iterator coi =
+	    ssc->snapset.clone_overlap.find(ci.cloneid);
+	  map<snapid_t, uint64_t>::const_iterator si =
+	    ssc->snapset.clone_size.find(ci.cloneid);
+	  if (coi == ssc->snapset.clone_overlap.end() ||
+	      si == ssc->snapset.clone_size.end()) {
+	    osd->clog.error() << "osd." << osd->whoami
+			      << ": inconsistent snapset for " << soid
+			      << " clone " << *clone_iter << "\n";
+	    result = -EINVAL;
+	    break;
+	  }
+	  for (interval_set<uint64_t>::const_iterator r = coi->second.begin();
+	       r != coi->second.end(); ++r) {
+	    ci.overlap.push_back(pair<uint64_t,uint64_t>(r.get_start(),
+							 r.get_len()));
+	  }
+	  ci.size = si->second;
+
+	  dout(20) << " clone " << *clone_iter << " snaps " << ci.snaps
+		   << " overlap " << coi->second << " size " << ci.size
+		   << dendl;
+	  resp.clones.push_back(ci);
+	}
+	if (result < 0)
+	  break;
+
+	if (ssc->snapset.head_exists) {
+	  clone_info ci;
+	  ci.cloneid = CEPH_NOSNAP;
+	  ci.size = oi.size;
+	  resp.clones.push_back(ci);
+	}
+	resp.seq = ssc->snapset.seq;
+
+	resp.encode(osd_op.outdata);
+	result = 0;
+
+	ctx->delta_stats.num_rd++;
+	break;
+      }
+
     case CEPH_OSD_OP_ASSERT_SRC_VERSION:
       {
 	uint64_t ver = op.watch.ver;
@@ -3297,6 +3448,10 @@ void ReplicatedPG::add_interval_usage(interval_set<uint64_t>& s, object_stat_sum
 
 void ReplicatedPG::do_osd_op_effects(OpContext *ctx)
 {
+  if (ctx->watch_connects.empty() && ctx->watch_disconnects.empty() &&
+      ctx->notifies.empty() && ctx->notify_acks.empty())
+    return;  // nothing to do (and internal ops have no connection)
+
   ConnectionRef conn(ctx->op->request->get_connection());
   boost::intrusive_ptr<OSD::Session> session(
     (OSD::Session *)conn->get_priv());
@@ -3507,6 +3662,9 @@ int ReplicatedPG::prepare_transaction(OpContext *ctx)
     } else {
       dout(10) << " mtime unchanged at " << ctx->new_obs.oi.mtime << dendl;
     }
+    if (ctx->user_modify && !ctx->ignore_cache &&
+	pool.info.cache_mode != pg_pool_t::CACHEMODE_NONE)
+      ctx->new_obs.oi.set_flag(object_info_t::FLAG_DIRTY);
 
     bufferlist bv(sizeof(ctx->new_obs.oi));
     ::encode(ctx->new_obs.oi, bv);
@@ -3517,6 +3675,13 @@ int ReplicatedPG::prepare_transaction(OpContext *ctx)
     ctx->op_t.setattr(coll, soid, SS_ATTR, bss);   
   }
 
+  // keep the dirty count in line, so the mon can tell when a
+  // writeback cache is fully flushed
+  bool was_dirty = ctx->obs->exists && ctx->obs->oi.is_dirty();
+  bool is_dirty = ctx->new_obs.exists && ctx->new_obs.oi.is_dirty();
+  if (was_dirty != is_dirty)
+    ctx->delta_stats.num_objects_dirty += is_dirty ? 1 : -1;
+
   // append to log
   int logopcode = pg_log_entry_t::MODIFY;
   if (!ctx->new_obs.exists)
@@ -3768,7 +3933,6 @@ void ReplicatedPG::eval_repop(RepGather *repop)
 	  reply = new MOSDOpReply(m, 0, get_osdmap()->get_epoch(), 0);
 	reply->add_flags(CEPH_OSD_FLAG_ACK | CEPH_OSD_FLAG_ONDISK);
 	dout(10) << " sending commit on " << *repop << " " << reply << dendl;
-	assert(entity_name_t::TYPE_OSD != m->get_connection()->peer_type);
 	osd->send_message_osd_client(reply, m->get_connection());
 	repop->sent_disk = true;
 	repop->ctx->op->mark_commit_sent();
@@ -3801,7 +3965,6 @@ void ReplicatedPG::eval_repop(RepGather *repop)
 	  reply = new MOSDOpReply(m, 0, get_osdmap()->get_epoch(), 0);
 	reply->add_flags(CEPH_OSD_FLAG_ACK);
 	dout(10) << " sending ack on " << *repop << " " << reply << dendl;
-        assert(entity_name_t::TYPE_OSD != m->get_connection()->peer_type);
 	osd->send_message_osd_client(reply, m->get_connection());
 	repop->sent_ack = true;
       }
@@ -4107,6 +4270,498 @@ void ReplicatedPG::handle_watch_timeout(WatchRef watch)
   eval_repop(repop);
 }
 
+// ========================================================================
+// cache tiering
+
+static bool op_has_delete(MOSDOp *m)
+{
+  for (vector<OSDOp>::iterator p = m->ops.begin(); p != m->ops.end(); ++p)
+    if (p->op.op == CEPH_OSD_OP_DELETE)
+      return true;
+  return false;
+}
+
+bool ReplicatedPG::maybe_handle_cache(OpRequestRef op, const hobject_t& head)
+{
+  MOSDOp *m = static_cast<MOSDOp*>(op->request);
+  if (pool.info.cache_mode == pg_pool_t::CACHEMODE_NONE ||
+      !pool.info.is_tier() ||
+      (m->get_flags() & CEPH_OSD_FLAG_IGNORE_CACHE))
+    return false;
+
+  hit_set.insert(head);
+
+  if (waiting_for_cache.count(head)) {
+    dout(10) << __func__ << " " << head << " has a cache op in flight" << dendl;
+    wait_for_cache(head, op);
+    return true;
+  }
+
+  ObjectContext *obc = get_object_context(head, m->get_object_locator(), false);
+  if (!obc || !obc->obs.exists) {
+    if (obc)
+      put_object_context(obc);
+    if (cache_absent.count(head))
+      return false;
+    promote_object(op, head);
+    return true;
+  }
+
+  // delete the base copy first, or a later miss would promote it again
+  if (op_has_delete(m) && !cache_absent.count(head)) {
+    cache_delete_base(op, obc);  // consumes our ref
+    return true;
+  }
+  put_object_context(obc);
+  return false;
+}
+
+void ReplicatedPG::wait_for_cache(const hobject_t& soid, OpRequestRef op)
+{
+  waiting_for_cache[soid].push_back(op);
+  op->mark_delayed("waiting for cache tier");
+  osd->logger->inc(l_osd_tier_delay);
+}
+
+void ReplicatedPG::promote_object(OpRequestRef op, const hobject_t& soid)
+{
+  dout(10) << __func__ << " " << soid << " from pool " << pool.info.tier_of << dendl;
+  wait_for_cache(soid, op);
+
+  PromoteOp *pop = new PromoteOp(soid, get_osdmap()->get_epoch());
+  ObjectOperation rd;
+  rd.stat(&pop->size, &pop->mtime, NULL);
+  rd.read(0, 0, &pop->data, NULL);
+  rd.getxattrs(&pop->attrs, NULL);
+  rd.omap_get_header(&pop->omap_header, NULL);
+  rd.omap_get_vals("", "", (uint64_t)-1, &pop->omap, NULL);
+
+  Context *onfinish = new C_OnFinisher(new C_PromoteFinish(this, pop),
+				       &osd->objecter_finisher);
+  osd->objecter_lock.Lock();
+  osd->objecter->read(soid.oid, object_locator_t(pool.info.tier_of, soid.get_key()),
+		      rd, CEPH_NOSNAP, NULL,
+		      CEPH_OSD_FLAG_IGNORE_OVERLAY | CEPH_OSD_FLAG_IGNORE_CACHE,
+		      onfinish);
+  osd->objecter_lock.Unlock();
+}
+
+void ReplicatedPG::finish_promote(PromoteOp *pop, int r)
+{
+  const hobject_t& soid = pop->soid;
+  if (pg_has_reset_since(pop->epoch)) {
+    dout(10) << __func__ << " " << soid << " pg changed, dropping" << dendl;
+    delete pop;
+    return;
+  }
+  dout(10) << __func__ << " " << soid << " r = " << r << dendl;
+
+  list<OpRequestRef> ls;
+  map<hobject_t, list<OpRequestRef> >::iterator p = waiting_for_cache.find(soid);
+  if (p != waiting_for_cache.end()) {
+    ls.swap(p->second);
+    waiting_for_cache.erase(p);
+  }
+
+  if (r == -ENOENT) {
+    cache_absent.insert(soid);
+  } else if (r < 0) {
+    for (list<OpRequestRef>::iterator i = ls.begin(); i != ls.end(); ++i)
+      osd->reply_op_error(*i, r);
+    ls.clear();
+  } else {
+    ObjectOperation wr;
+    wr.create(false);
+    wr.write_full(pop->data);
+    for (map<string, bufferlist>::iterator i = pop->attrs.begin();
+	 i != pop->attrs.end();
+	 ++i)
+      wr.setxattr(i->first.c_str(), i->second);
+    if (pop->omap_header.length())
+      wr.omap_set_header(pop->omap_header);
+    if (!pop->omap.empty())
+      wr.omap_set(pop->omap);
+    if (cache_submit_internal(soid, wr.ops, pop->mtime) == 0)
+      osd->logger->inc(l_osd_tier_promote);
+  }
+  requeue_ops(ls);
+  delete pop;
+}
+
+/**
+ * write @obc back to the base pool
+ *
+ * The object is read back through the objecter, like a promote reads
+ * the base copy, so that the read is queued as an op of its own rather
+ * than done under our lock.  Writes to it wait until the flush is done.
+ */
+void ReplicatedPG::start_flush(ObjectContext *obc)
+{
+  const hobject_t& soid = obc->obs.oi.soid;
+  dout(10) << __func__ << " " << soid << " " << obc->obs.oi.version
+	   << " to pool " << pool.info.tier_of << dendl;
+
+  waiting_for_cache[soid];
+
+  FlushOp *fop = new FlushOp(soid, get_osdmap()->get_epoch(),
+			     obc->obs.oi.version, obc->obs.oi.mtime);
+  ObjectOperation rd;
+  rd.read(0, 0, &fop->data, NULL);
+  rd.getxattrs(&fop->attrs, NULL);
+  rd.omap_get_header(&fop->omap_header, NULL);
+  rd.omap_get_vals("", "", (uint64_t)-1, &fop->omap, NULL);
+
+  Context *onfinish = new C_OnFinisher(new C_FlushRead(this, fop),
+				       &osd->objecter_finisher);
+  osd->objecter_lock.Lock();
+  osd->objecter->read(soid.oid, object_locator_t(info.pgid.pool(), soid.get_key()),
+		      rd, CEPH_NOSNAP, NULL,
+		      CEPH_OSD_FLAG_IGNORE_OVERLAY | CEPH_OSD_FLAG_IGNORE_CACHE,
+		      onfinish);
+  osd->objecter_lock.Unlock();
+}
+
+void ReplicatedPG::finish_flush_read(FlushOp *fop, int r)
+{
+  const hobject_t& soid = fop->soid;
+  if (pg_has_reset_since(fop->epoch)) {
+    dout(10) << __func__ << " " << soid << " pg changed, dropping" << dendl;
+    delete fop;
+    return;
+  }
+  dout(10) << __func__ << " " << soid << " r = " << r << dendl;
+  if (r < 0) {
+    dout(0) << __func__ << " reading " << soid << ": " << cpp_strerror(r) << dendl;
+    finish_flush(soid, fop->epoch, fop->version, r);
+    delete fop;
+    return;
+  }
+
+  // replace the base copy wholesale so that removed xattrs and omap
+  // keys do not linger there
+  ObjectOperation wr;
+  wr.remove();
+  wr.set_last_op_flags(CEPH_OSD_OP_FLAG_FAILOK);
+  wr.create(false);
+  wr.write_full(fop->data);
+  for (map<string, bufferlist>::iterator p = fop->attrs.begin();
+       p != fop->attrs.end();
+       ++p)
+    wr.setxattr(p->first.c_str(), p->second);
+  if (fop->omap_header.length())
+    wr.omap_set_header(fop->omap_header);
+  if (!fop->omap.empty())
+    wr.omap_set(fop->omap);
+
+  // it exists in the base pool from now on
+  cache_absent.erase(soid);
+
+  Context *onfinish = new C_OnFinisher(
+    new C_FlushFinish(this, soid, fop->epoch, fop->version),
+    &osd->objecter_finisher);
+  osd->objecter_lock.Lock();
+  osd->objecter->mutate(soid.oid, object_locator_t(pool.info.tier_of, soid.get_key()),
+			wr, SnapContext(), fop->mtime,
+			CEPH_OSD_FLAG_IGNORE_OVERLAY | CEPH_OSD_FLAG_IGNORE_CACHE,
+			NULL, onfinish);
+  osd->objecter_lock.Unlock();
+  delete fop;
+}
+
+void ReplicatedPG::finish_flush(const hobject_t& soid, epoch_t epoch,
+				eversion_t version, int r)
+{
+  if (pg_has_reset_since(epoch)) {
+    dout(10) << __func__ << " " << soid << " pg changed, dropping" << dendl;
+    return;
+  }
+  dout(10) << __func__ << " " << soid << " " << version << " r = " << r << dendl;
+
+  list<OpRequestRef> ls;
+  map<hobject_t, list<OpRequestRef> >::iterator p = waiting_for_cache.find(soid);
+  if (p != waiting_for_cache.end()) {
+    ls.swap(p->second);
+    waiting_for_cache.erase(p);
+  }
+
+  if (r < 0) {
+    osd->logger->inc(l_osd_tier_flush_fail);
+  } else {
+    osd->logger->inc(l_osd_tier_flush);
+    ObjectContext *obc = get_object_context(
+      soid, object_locator_t(info.pgid.pool(), soid.get_key()), false);
+    if (obc && obc->obs.exists && obc->obs.oi.version == version &&
+	obc->obs.oi.is_dirty() &&
+	!is_degraded_object(soid) &&
+	!scrubber.write_blocked_by_scrub(soid))
+      cache_set_dirty(obc, false);  // consumes our ref
+    else if (obc)
+      put_object_context(obc);
+  }
+  requeue_ops(ls);
+}
+
+void ReplicatedPG::cache_delete_base(OpRequestRef op, ObjectContext *obc)
+{
+  const hobject_t soid = obc->obs.oi.soid;
+  dout(10) << __func__ << " " << soid << " in pool " << pool.info.tier_of << dendl;
+  wait_for_cache(soid, op);
+
+  // if the op then fails, ours is the only copy left; make sure the
+  // agent writes it back rather than evicting it.  The dirty flag is
+  // queued before the delete is sent, and a client whose op was lost
+  // with us resends it and repeats both.
+  if (obc->obs.oi.is_dirty())
+    put_object_context(obc);
+  else
+    cache_set_dirty(obc, true);  // consumes our ref
+
+  ObjectOperation wr;
+  wr.remove();
+  wr.set_last_op_flags(CEPH_OSD_OP_FLAG_FAILOK);
+
+  Context *onfinish = new C_OnFinisher(
+    new C_BaseDeleteFinish(this, soid, get_osdmap()->get_epoch()),
+    &osd->objecter_finisher);
+  osd->objecter_lock.Lock();
+  osd->objecter->mutate(soid.oid, object_locator_t(pool.info.tier_of, soid.get_key()),
+			wr, SnapContext(), ceph_clock_now(g_ceph_context),
+			CEPH_OSD_FLAG_IGNORE_OVERLAY | CEPH_OSD_FLAG_IGNORE_CACHE,
+			NULL, onfinish);
+  osd->objecter_lock.Unlock();
+}
+
+void ReplicatedPG::finish_base_delete(const hobject_t& soid, epoch_t epoch, int r)
+{
+  if (pg_has_reset_since(epoch)) {
+    dout(10) << __func__ << " " << soid << " pg changed, dropping" << dendl;
+    return;
+  }
+  dout(10) << __func__ << " " << soid << " r = " << r << dendl;
+
+  list<OpRequestRef> ls;
+  map<hobject_t, list<OpRequestRef> >::iterator p = waiting_for_cache.find(soid);
+  if (p != waiting_for_cache.end()) {
+    ls.swap(p->second);
+    waiting_for_cache.erase(p);
+  }
+
+  if (r < 0) {
+    for (list<OpRequestRef>::iterator i = ls.begin(); i != ls.end(); ++i)
+      osd->reply_op_error(*i, r);
+    ls.clear();
+  } else {
+    cache_absent.insert(soid);
+  }
+  requeue_ops(ls);
+}
+
+/**
+ * apply @ops to @soid as an OSD-generated write
+ *
+ * Used to install promoted objects and to evict them.  Unlike a client
+ * write, this does not mark the object dirty.
+ */
+int ReplicatedPG::cache_submit_internal(const hobject_t& soid,
+					vector<OSDOp>& ops, utime_t mtime)
+{
+  ObjectContext *obc = get_object_context(
+    soid, object_locator_t(info.pgid.pool(), soid.get_key()), true);
+  assert(obc);
+
+  tid_t rep_tid = osd->get_tid();
+  osd_reqid_t reqid(osd->get_cluster_msgr_name(), 0, rep_tid);
+  OpContext *ctx = new OpContext(OpRequestRef(), reqid, ops,
+				 &obc->obs, obc->ssc, this);
+  ctx->obc = obc;
+  ctx->mtime = mtime;
+  ctx->ignore_cache = true;
+  ctx->at_version.epoch = get_osdmap()->get_epoch();
+  ctx->at_version.version = log.head.version + 1;
+
+  entity_inst_t nobody;
+
+  /* Currently, mode.try_write always returns true.  If this changes, we will
+   * need to delay the repop accordingly */
+  assert(mode.try_write(nobody));
+
+  eversion_t old_last_update = log.head;
+  bool old_exists = obc->obs.exists;
+  uint64_t old_size = obc->obs.oi.size;
+  eversion_t old_version = obc->obs.oi.version;
+
+  int r = prepare_transaction(ctx);
+  if (r < 0 || ctx->op_t.empty()) {
+    dout(0) << __func__ << " " << soid << " " << ops << " failed: "
+	    << cpp_strerror(r) << dendl;
+    delete ctx;
+    put_object_context(obc);
+    return r < 0 ? r : -EINVAL;
+  }
+
+  calc_trim_to();
+  append_log(ctx->log, pg_trim_to, ctx->local_t);
+
+  // obc ref swallowed by repop!
+  RepGather *repop = new_repop(ctx, obc, rep_tid);
+  issue_repop(repop, ctx->mtime, old_last_update, old_exists,
+	      old_size, old_version);
+  eval_repop(repop);
+  repop->put();
+  return 0;
+}
+
+void ReplicatedPG::cache_evict(const hobject_t& soid)
+{
+  dout(10) << __func__ << " " << soid << dendl;
+  vector<OSDOp> ops(1);
+  ops[0].op.op = CEPH_OSD_OP_DELETE;
+  if (cache_submit_internal(soid, ops, ceph_clock_now(g_ceph_context)) == 0)
+    osd->logger->inc(l_osd_tier_evict);
+}
+
+/// set or clear FLAG_DIRTY on @obc, consuming the caller's ref
+void ReplicatedPG::cache_set_dirty(ObjectContext *obc, bool dirty)
+{
+  dout(10) << __func__ << " " << obc->obs.oi.soid << " " << dirty << dendl;
+
+  vector<OSDOp> ops;
+  tid_t rep_tid = osd->get_tid();
+  osd_reqid_t reqid(osd->get_cluster_msgr_name(), 0, rep_tid);
+  OpContext *ctx = new OpContext(OpRequestRef(), reqid, ops,
+				 &obc->obs, obc->ssc, this);
+  ctx->mtime = ceph_clock_now(g_ceph_context);
+
+  ctx->at_version.epoch = get_osdmap()->get_epoch();
+  ctx->at_version.version = log.head.version + 1;
+
+  entity_inst_t nobody;
+  assert(mode.try_write(nobody));
+  RepGather *repop = new_repop(ctx, obc, rep_tid);
+
+  ObjectStore::Transaction *t = &ctx->op_t;
+
+  ctx->log.push_back(pg_log_entry_t(pg_log_entry_t::MODIFY, obc->obs.oi.soid,
+				    ctx->at_version,
+				    obc->obs.oi.version,
+				    osd_reqid_t(), ctx->mtime));
+
+  eversion_t old_last_update = log.head;
+  bool old_exists = repop->obc->obs.exists;
+  uint64_t old_size = repop->obc->obs.oi.size;
+  eversion_t old_version = repop->obc->obs.oi.version;
+
+  obc->obs.oi.prior_version = old_version;
+  obc->obs.oi.version = ctx->at_version;
+  if (dirty)
+    obc->obs.oi.set_flag(object_info_t::FLAG_DIRTY);
+  else
+    obc->obs.oi.clear_flag(object_info_t::FLAG_DIRTY);
+  bufferlist bl;
+  ::encode(obc->obs.oi, bl);
+  t->setattr(coll, obc->obs.oi.soid, OI_ATTR, bl);
+
+  const hobject_t& soid = obc->obs.oi.soid;
+  ctx->delta_stats.num_objects_dirty += dirty ? 1 : -1;
+  info.stats.stats.add(ctx->delta_stats, obc->obs.oi.category);
+  if (backfill_target >= 0) {
+    pg_info_t& pinfo = peer_info[backfill_target];
+    if (soid < pinfo.last_backfill)
+      pinfo.stats.stats.add(ctx->delta_stats, obc->obs.oi.category);
+    else if (soid < backfill_pos)
+      pending_backfill_updates[soid].stats.add(ctx->delta_stats, obc->obs.oi.category);
+  }
+  if (scrubber.active && scrubber.is_chunky && soid < scrubber.start)
+    scrub_cstat.add(ctx->delta_stats, obc->obs.oi.category);
+
+  append_log(repop->ctx->log, eversion_t(), repop->ctx->local_t);
+
+  // obc ref swallowed by repop!
+  issue_repop(repop, repop->ctx->mtime, old_last_update, old_exists,
+	      old_size, old_version);
+  eval_repop(repop);
+  repop->put();
+}
+
+/**
+ * flush and evict cold objects once the pg holds more than its share
+ * of the pool's target_max_objects
+ */
+void ReplicatedPG::agent_work()
+{
+  lock();
+  if (deleting || !is_primary() || !is_clean() ||
+      pool.info.cache_mode == pg_pool_t::CACHEMODE_NONE ||
+      !pool.info.is_tier()) {
+    unlock();
+    return;
+  }
+
+  utime_t now = ceph_clock_now(g_ceph_context);
+  if (hit_set.maybe_rotate(now, pool.info.hit_set_period, pool.info.hit_set_count)) {
+    dout(20) << __func__ << " started a new hit set, keeping "
+	     << hit_set.num_sets() << dendl;
+    // bound its size; forgetting an entry only costs a promote attempt
+    cache_absent.clear();
+  }
+
+  uint64_t num = info.stats.stats.sum.num_objects;
+  uint64_t target = pool.info.target_max_objects / MAX(pool.info.get_pg_num(), 1u);
+  if (!pool.info.target_max_objects || num <= target) {
+    unlock();
+    return;
+  }
+  dout(10) << __func__ << " " << num << " objects > target " << target
+	   << ", scanning from " << agent_cursor << dendl;
+
+  vector<hobject_t> ls;
+  hobject_t next;
+  int r = osd->store->collection_list_partial(coll, agent_cursor,
+					      osd->store->get_ideal_list_min(),
+					      osd->store->get_ideal_list_max(),
+					      CEPH_NOSNAP, &ls, &next);
+  if (r < 0) {
+    dout(0) << __func__ << " collection_list_partial: " << cpp_strerror(r) << dendl;
+    unlock();
+    return;
+  }
+
+  int ops = 0;
+  vector<hobject_t>::iterator p;
+  for (p = ls.begin(); p != ls.end() && ops < g_conf->osd_tier_agent_max_ops; ++p) {
+    if (p->snap != CEPH_NOSNAP ||
+	hit_set.contains(*p) ||
+	waiting_for_cache.count(*p) ||
+	is_missing_object(*p) ||
+	is_degraded_object(*p) ||
+	scrubber.write_blocked_by_scrub(*p))
+      continue;
+    ObjectContext *obc = get_object_context(
+      *p, object_locator_t(info.pgid.pool(), p->get_key()), false);
+    if (!obc)
+      continue;
+    bool skip = !obc->obs.exists ||
+      !obc->watchers.empty() || !obc->obs.oi.watchers.empty();
+    bool dirty = obc->obs.oi.is_dirty();
+    if (!skip && dirty)
+      start_flush(obc);
+    put_object_context(obc);
+    if (skip)
+      continue;
+    if (!dirty)
+      cache_evict(*p);
+    ++ops;
+  }
+
+  if (p != ls.end())
+    agent_cursor = *p;
+  else if (next.is_max())
+    agent_cursor = hobject_t();
+  else
+    agent_cursor = next;
+  unlock();
+}
+
 ObjectContext *ReplicatedPG::_lookup_object_context(const hobject_t& oid)
 {
   map<hobject_t, ObjectContext*>::iterator p = object_contexts.find(oid);
@@ -4208,6 +4863,29 @@ int ReplicatedPG::find_object_context(const hobject_t& oid,
   // want the head?
   hobject_t head(oid.oid, oid.get_key(), CEPH_NOSNAP, oid.hash,
 		 info.pgid.pool());
+
+  // want the snapdir?  return the head or the snapdir, whichever exists
+  if (oid.snap == CEPH_SNAPDIR) {
+    ObjectContext *obc = get_object_context(head, oloc, false);
+    if (obc && !obc->obs.exists) {
+      put_object_context(obc);
+      obc = NULL;
+    }
+    if (!obc) {
+      hobject_t snapdir(oid.oid, oid.get_key(), CEPH_SNAPDIR, oid.hash,
+			info.pgid.pool());
+      obc = get_object_context(snapdir, oloc, false);
+    }
+    if (!obc)
+      return -ENOENT;
+    dout(10) << "find_object_context " << oid << " @" << oid.snap << dendl;
+    *pobc = obc;
+
+    if (!obc->ssc)
+      obc->ssc = get_snapset_context(oid.oid, oid.get_key(), oid.hash, true);
+    return 0;
+  }
+
   if (oid.snap == CEPH_NOSNAP) {
     ObjectContext *obc = get_object_context(head, oloc, can_create);
     if (!obc)
@@ -4343,6 +5021,8 @@ void ReplicatedPG::add_object_context_to_pg_stat(ObjectContext *obc, pg_stat_t *
 
   if (oi.soid.snap != CEPH_SNAPDIR)
     stat.num_objects++;
+  if (oi.is_dirty())
+    stat.num_objects_dirty++;
 
   if (oi.soid.snap && oi.soid.snap != CEPH_NOSNAP && oi.soid.snap != CEPH_SNAPDIR) {
     stat.num_object_clones++;
@@ -4475,6 +5155,9 @@ void ReplicatedPG::sub_op_modify(OpRequestRef op)
   rm->epoch_started = get_osdmap()->get_epoch();
 
   if (!m->noop) {
+    // hold off replica reads of soid until this is applied
+    rep_writes_pending[soid]++;
+
     if (m->logbl.length()) {
       // shipped transaction and log entries
       vector<pg_log_entry_t> log;
@@ -4577,6 +5260,13 @@ void ReplicatedPG::sub_op_modify_applied(RepModify *rm)
       osd->send_message_osd_cluster(rm->ackerosd, ack, get_osdmap()->get_epoch());
     }
     
+    if (!m->noop) {
+      map<hobject_t, int>::iterator p = rep_writes_pending.find(m->poid);
+      assert(p != rep_writes_pending.end());
+      if (--p->second == 0)
+	rep_writes_pending.erase(p);
+    }
+
     assert(info.last_update >= m->version);
     assert(last_update_applied < m->version);
     last_update_applied = m->version;
@@ -6147,6 +6837,12 @@ void ReplicatedPG::on_change()
   requeue_ops(waiting_for_all_missing);
   waiting_for_all_missing.clear();
 
+  // in-flight cache ops notice the reset and drop their results
+  requeue_object_waiters(waiting_for_cache);
+  cache_absent.clear();
+  hit_set.clear();
+  agent_cursor = hobject_t();
+
   // this will requeue ops we were working on but didn't finish, and
   // any dups
   apply_and_flush_repops(is_primary());
@@ -6155,6 +6851,7 @@ void ReplicatedPG::on_change()
   pushing.clear();
   pulling.clear();
   pull_from_peer.clear();
+  rep_writes_pending.clear();
 
   // clear snap_trimmer state
   snap_trimmer_machine.process_event(Reset());
@@ -6674,17 +7371,19 @@ int ReplicatedPG::recover_backfill(int max)
 	   << " interval " << pbi.begin << "-" << pbi.end
 	   << " " << pbi.objects.size() << " objects" << dendl;
 
-  int local_min = osd->store->get_ideal_list_min();
-  int local_max = osd->store->get_ideal_list_max();
+  int local_min = g_conf->osd_backfill_scan_min;
+  int local_max = g_conf->osd_backfill_scan_max;
 
-  // re-scan our local interval to cope with recent changes
-  // FIXME: we could track the eversion_t when we last scanned, and invalidate
-  // that way.  or explicitly modify/invalidate when we actually change specific
-  // objects.
-  dout(10) << " rescanning local backfill_info from " << backfill_pos << dendl;
-  backfill_info.clear();
-  osr->flush();
-  scan_range(backfill_pos, local_min, local_max, &backfill_info);
+  // bring our local interval up to date with the writes since we
+  // scanned it, or re-scan it if the log no longer covers them
+  backfill_info.begin = backfill_pos;
+  if (!update_range(&backfill_info)) {
+    dout(10) << " rescanning local backfill_info from " << backfill_pos << dendl;
+    backfill_info.clear();
+    osr->flush();
+    scan_range(backfill_pos, local_min, local_max, &backfill_info);
+  }
+  osd->logger->inc(l_osd_backfill_inflight, backfills_in_flight.size());
 
   int ops = 0;
   map<hobject_t, pair<eversion_t, eversion_t> > to_push;
@@ -6851,12 +7550,54 @@ void ReplicatedPG::push_backfill_object(hobject_t oid, eversion_t v, eversion_t
   put_object_context(obc);
 }
 
+/**
+ * update_range
+ *
+ * Apply the log entries since @bi was scanned to the objects in
+ * [bi->begin, bi->end), so that we need not list and stat the range
+ * again.
+ *
+ * @return false if the range must be re-scanned instead
+ */
+bool ReplicatedPG::update_range(BackfillInterval *bi)
+{
+  if (bi->begin == bi->end && bi->objects.empty())
+    return false;  // nothing scanned yet
+  if (bi->version >= info.last_update)
+    return true;
+  if (bi->version < log.tail)
+    return false;
+
+  list<pg_log_entry_t>::reverse_iterator p = log.log.rbegin();
+  while (p != log.log.rend() && p->version > bi->version)
+    ++p;
+  for (list<pg_log_entry_t>::iterator i = p.base(); i != log.log.end(); ++i) {
+    if (i->soid < bi->begin || i->soid >= bi->end)
+      continue;
+    if (i->is_lost_revert() || i->is_lost_mark())
+      return false;  // let the store tell us the resulting version
+    dout(20) << "update_range " << *i << dendl;
+    if (i->is_update())
+      bi->objects[i->soid] = i->version;
+    else if (i->is_delete())
+      bi->objects.erase(i->soid);
+  }
+  // drop anything below the new start
+  while (!bi->objects.empty() && bi->objects.begin()->first < bi->begin)
+    bi->objects.erase(bi->objects.begin());
+  bi->version = info.last_update;
+  osd->logger->inc(l_osd_backfill_update);
+  return true;
+}
+
 void ReplicatedPG::scan_range(hobject_t begin, int min, int max, BackfillInterval *bi)
 {
   assert(is_locked());
   dout(10) << "scan_range from " << begin << dendl;
+  utime_t start = ceph_clock_now(g_ceph_context);
   bi->begin = begin;
   bi->objects.clear();  // for good measure
+  bi->version = info.last_update;
 
   vector<hobject_t> ls;
   ls.reserve(max);
@@ -6882,6 +7623,9 @@ void ReplicatedPG::scan_range(hobject_t begin, int min, int max, BackfillInterva
       dout(20) << "  " << *p << " " << oi.version << dendl;
     }
   }
+  osd->logger->inc(l_osd_backfill_scan);
+  osd->logger->inc(l_osd_backfill_scan_objs, ls.size());
+  osd->logger->tinc(l_osd_backfill_scan_lat, ceph_clock_now(g_ceph_context) - start);
 }
 
 
@@ -7013,6 +7757,8 @@ void ReplicatedPG::_scrub(ScrubMap& scrubmap)
     dout(20) << mode << "  " << soid << " " << oi << dendl;
 
     stat.num_bytes += p->second.size;
+    if (oi.is_dirty())
+      stat.num_objects_dirty++;
 
     //bufferlist data;
     //osd->store->read(c, poid, 0, 0, data);
@@ -7105,6 +7851,16 @@ void ReplicatedPG::_scrub_finish()
       update_stats();
       share_pg_info();
     }
+  } else if (scrub_cstat.sum.num_objects_dirty !=
+	     info.stats.stats.sum.num_objects_dirty) {
+    // pgs from before the dirty count was kept start out at 0; quietly
+    // adopt what we found rather than calling it an error
+    dout(10) << mode << " fixing dirty count "
+	     << info.stats.stats.sum.num_objects_dirty << " -> "
+	     << scrub_cstat.sum.num_objects_dirty << dendl;
+    info.stats.stats.sum.num_objects_dirty = scrub_cstat.sum.num_objects_dirty;
+    update_stats();
+    share_pg_info();
   }
 }
 
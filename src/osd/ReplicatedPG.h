@@ -22,6 +22,7 @@
 #include "OSD.h"
 #include "Watch.h"
 #include "OpRequest.h"
+#include "HitSet.h"
 
 #include "messages/MOSDOp.h"
 #include "messages/MOSDOpReply.h"
@@ -258,6 +259,7 @@ public:
 
     bool modify;          // (force) modification (even if op_t is empty)
     bool user_modify;     // user-visible modification
+    bool ignore_cache;    // cache tier bookkeeping; leave the object clean
 
     // side effects
     list<watch_info_t> watch_connects;
@@ -303,7 +305,7 @@ public:
 	      ReplicatedPG *_pg) :
       op(_op), reqid(_reqid), ops(_ops), obs(_obs), snapset(0),
       new_obs(_obs->oi, _obs->exists),
-      modify(false), user_modify(false),
+      modify(false), user_modify(false), ignore_cache(false),
       bytes_written(0), bytes_read(0),
       obc(0), clone_obc(0), snapset_obc(0), data_off(0), reply(NULL), pg(_pg) { 
       if (_ssc) {
@@ -437,6 +439,102 @@ protected:
   map<hobject_t, map<client_t, tid_t> > debug_op_order;
 
   void populate_obc_watchers(ObjectContext *obc);
+
+  // -- cache tiering --
+  HitSetHistory hit_set;        ///< recently accessed objects (primary only)
+  /// objects known not to exist in the base pool; only a hint to skip
+  /// promotes, forgotten when the hit set rotates or the pg changes
+  set<hobject_t> cache_absent;
+  /// ops waiting for a promote, flush or base delete of the object
+  map<hobject_t, list<OpRequestRef> > waiting_for_cache;
+  hobject_t agent_cursor;       ///< where the agent resumes its scan
+
+  struct PromoteOp {
+    hobject_t soid;
+    epoch_t epoch;
+    uint64_t size;
+    utime_t mtime;
+    bufferlist data;
+    map<string, bufferlist> attrs;
+    bufferlist omap_header;
+    map<string, bufferlist> omap;
+    PromoteOp(const hobject_t& o, epoch_t e) : soid(o), epoch(e), size(0) {}
+  };
+  struct C_PromoteFinish : public Context {
+    boost::intrusive_ptr<ReplicatedPG> pg;
+    PromoteOp *pop;
+    C_PromoteFinish(ReplicatedPG *p, PromoteOp *o) : pg(p), pop(o) {}
+    void finish(int r) {
+      pg->lock();
+      pg->finish_promote(pop, r);
+      pg->unlock();
+    }
+  };
+  struct FlushOp {
+    hobject_t soid;
+    epoch_t epoch;
+    eversion_t version;  ///< of the cache copy when the flush started
+    utime_t mtime;
+    bufferlist data;
+    map<string, bufferlist> attrs;
+    bufferlist omap_header;
+    map<string, bufferlist> omap;
+    FlushOp(const hobject_t& o, epoch_t e, eversion_t v, utime_t m)
+      : soid(o), epoch(e), version(v), mtime(m) {}
+  };
+  struct C_FlushRead : public Context {
+    boost::intrusive_ptr<ReplicatedPG> pg;
+    FlushOp *fop;
+    C_FlushRead(ReplicatedPG *p, FlushOp *o) : pg(p), fop(o) {}
+    void finish(int r) {
+      pg->lock();
+      pg->finish_flush_read(fop, r);
+      pg->unlock();
+    }
+  };
+  struct C_FlushFinish : public Context {
+    boost::intrusive_ptr<ReplicatedPG> pg;
+    hobject_t soid;
+    epoch_t epoch;
+    eversion_t version;
+    C_FlushFinish(ReplicatedPG *p, const hobject_t& o, epoch_t e, eversion_t v)
+      : pg(p), soid(o), epoch(e), version(v) {}
+    void finish(int r) {
+      pg->lock();
+      pg->finish_flush(soid, epoch, version, r);
+      pg->unlock();
+    }
+  };
+  struct C_BaseDeleteFinish : public Context {
+    boost::intrusive_ptr<ReplicatedPG> pg;
+    hobject_t soid;
+    epoch_t epoch;
+    C_BaseDeleteFinish(ReplicatedPG *p, const hobject_t& o, epoch_t e)
+      : pg(p), soid(o), epoch(e) {}
+    void finish(int r) {
+      pg->lock();
+      pg->finish_base_delete(soid, epoch, r);
+      pg->unlock();
+    }
+  };
+  friend struct C_PromoteFinish;
+  friend struct C_FlushRead;
+  friend struct C_FlushFinish;
+  friend struct C_BaseDeleteFinish;
+
+  /// true if the op was queued behind a cache tier operation
+  bool maybe_handle_cache(OpRequestRef op, const hobject_t& head);
+  void wait_for_cache(const hobject_t& soid, OpRequestRef op);
+  void promote_object(OpRequestRef op, const hobject_t& soid);
+  void finish_promote(PromoteOp *pop, int r);
+  void start_flush(ObjectContext *obc);
+  void finish_flush_read(FlushOp *fop, int r);
+  void finish_flush(const hobject_t& soid, epoch_t epoch, eversion_t version, int r);
+  void cache_delete_base(OpRequestRef op, ObjectContext *obc);
+  void finish_base_delete(const hobject_t& soid, epoch_t epoch, int r);
+  int cache_submit_internal(const hobject_t& soid, vector<OSDOp>& ops, utime_t mtime);
+  void cache_evict(const hobject_t& soid);
+  void cache_set_dirty(ObjectContext *obc, bool dirty);
 public:
   void handle_watch_timeout(WatchRef watch);
 protected:
@@ -655,6 +753,9 @@ protected:
   /// leading edge of backfill
   hobject_t backfill_pos;
 
+  /// objects with replicated updates queued but not yet applied (replica)
+  map<hobject_t, int> rep_writes_pending;
+
   // Reverse mapping from osd peer to objects beging pulled from that peer
   map<int, set<hobject_t> > pull_from_peer;
 
@@ -728,6 +829,7 @@ protected:
    * @bi [out] resulting map of objects to eversion_t's
    */
   void scan_range(hobject_t begin, int min, int max, BackfillInterval *bi);
+  bool update_range(BackfillInterval *bi);
 
   void push_backfill_object(hobject_t oid, eversion_t v, eversion_t have, int peer);
   void send_remove_op(const hobject_t& oid, eversion_t v, int peer);
@@ -910,6 +1012,7 @@ public:
 		       vector<hobject_t> &obs_to_trim);
   RepGather *trim_object(const hobject_t &coid, const snapid_t &sn);
   void snap_trimmer();
+  void agent_work();
   int do_osd_ops(OpContext *ctx, vector<OSDOp>& ops);
 
   int do_tmapup(OpContext *ctx, bufferlist::iterator& bp, OSDOp& osd_op);
@@ -1000,6 +1103,7 @@ public:
   bool same_for_rep_modify_since(epoch_t e);
 
   bool is_missing_object(const hobject_t& oid);
+  bool can_serve_replica_read(const hobject_t& oid);
   void wait_for_missing_object(const hobject_t& oid, OpRequestRef op);
   void wait_for_all_missing(OpRequestRef op);
   void wait_for_backfill_pos(OpRequestRef op);
@@ -547,6 +547,20 @@ void pg_pool_t::dump(Formatter *f) const
   }
   f->close_section();
   f->dump_stream("removed_snaps") << removed_snaps;
+  f->dump_unsigned("qos_reservation", qos_reservation);
+  f->dump_unsigned("qos_weight", qos_weight);
+  f->dump_unsigned("qos_limit", qos_limit);
+  f->dump_int("tier_of", tier_of);
+  f->open_array_section("tiers");
+  for (set<uint64_t>::const_iterator p = tiers.begin(); p != tiers.end(); ++p)
+    f->dump_unsigned("pool_id", *p);
+  f->close_section();
+  f->dump_int("read_tier", read_tier);
+  f->dump_int("write_tier", write_tier);
+  f->dump_string("cache_mode", get_cache_mode_name());
+  f->dump_unsigned("hit_set_period", hit_set_period);
+  f->dump_unsigned("hit_set_count", hit_set_count);
+  f->dump_unsigned("target_max_objects", target_max_objects);
 }
 
 
@@ -751,7 +765,7 @@ void pg_pool_t::encode(bufferlist& bl, uint64_t features) const
     return;
   }
 
-  ENCODE_START(7, 5, bl);
+  ENCODE_START(9, 5, bl);
   ::encode(type, bl);
   ::encode(size, bl);
   ::encode(crush_ruleset, bl);
@@ -770,12 +784,24 @@ void pg_pool_t::encode(bufferlist& bl, uint64_t features) const
   ::encode(flags, bl);
   ::encode(crash_replay_interval, bl);
   ::encode(min_size, bl);
+  ::encode(qos_reservation, bl);
+  ::encode(qos_weight, bl);
+  ::encode(qos_limit, bl);
+  ::encode(tiers, bl);
+  ::encode(tier_of, bl);
+  ::encode(read_tier, bl);
+  ::encode(write_tier, bl);
+  __u8 c = cache_mode;
+  ::encode(c, bl);
+  ::encode(hit_set_period, bl);
+  ::encode(hit_set_count, bl);
+  ::encode(target_max_objects, bl);
   ENCODE_FINISH(bl);
 }
 
 void pg_pool_t::decode(bufferlist::iterator& bl)
 {
-  DECODE_START_LEGACY_COMPAT_LEN(7, 5, 5, bl);
+  DECODE_START_LEGACY_COMPAT_LEN(9, 5, 5, bl);
   ::decode(type, bl);
   ::decode(size, bl);
   ::decode(crush_ruleset, bl);
@@ -824,6 +850,31 @@ void pg_pool_t::decode(bufferlist::iterator& bl)
   } else {
     min_size = size - size/2;
   }
+  if (struct_v >= 8) {
+    ::decode(qos_reservation, bl);
+    ::decode(qos_weight, bl);
+    ::decode(qos_limit, bl);
+  } else {
+    qos_reservation = qos_weight = qos_limit = 0;
+  }
+  if (struct_v >= 9) {
+    ::decode(tiers, bl);
+    ::decode(tier_of, bl);
+    ::decode(read_tier, bl);
+    ::decode(write_tier, bl);
+    __u8 v;
+    ::decode(v, bl);
+    cache_mode = (cache_mode_t)v;
+    ::decode(hit_set_period, bl);
+    ::decode(hit_set_count, bl);
+    ::decode(target_max_objects, bl);
+  } else {
+    tiers.clear();
+    tier_of = read_tier = write_tier = -1;
+    cache_mode = CACHEMODE_NONE;
+    hit_set_period = hit_set_count = 0;
+    target_max_objects = 0;
+  }
   DECODE_FINISH(bl);
   calc_pg_masks();
 }
@@ -856,6 +907,22 @@ void pg_pool_t::generate_test_instances(list<pg_pool_t*>& o)
 
   a.removed_snaps.insert(2);   // not quite valid to combine with snaps!
   o.push_back(new pg_pool_t(a));
+
+  a.qos_reservation = 100;
+  a.qos_weight = 5;
+  a.qos_limit = 1000;
+  o.push_back(new pg_pool_t(a));
+
+  a.tiers.insert(20);
+  a.tiers.insert(21);
+  a.tier_of = 2;
+  a.read_tier = 20;
+  a.write_tier = 21;
+  a.cache_mode = CACHEMODE_WRITEBACK;
+  a.hit_set_period = 3600;
+  a.hit_set_count = 4;
+  a.target_max_objects = 12345;
+  o.push_back(new pg_pool_t(a));
 }
 
 ostream& operator<<(ostream& out, const pg_pool_t& p)
@@ -873,6 +940,23 @@ ostream& operator<<(ostream& out, const pg_pool_t& p)
     out << " flags " << p.flags;
   if (p.crash_replay_interval)
     out << " crash_replay_interval " << p.crash_replay_interval;
+  if (p.has_qos())
+    out << " qos " << p.qos_reservation << "/" << p.qos_weight
+	<< "/" << p.qos_limit;
+  if (p.is_tier())
+    out << " tier_of " << p.tier_of;
+  if (p.has_tiers())
+    out << " tiers " << p.tiers;
+  if (p.has_read_tier())
+    out << " read_tier " << p.read_tier;
+  if (p.has_write_tier())
+    out << " write_tier " << p.write_tier;
+  if (p.cache_mode)
+    out << " cache_mode " << p.get_cache_mode_name();
+  if (p.target_max_objects)
+    out << " target_objects " << p.target_max_objects;
+  if (p.hit_set_period)
+    out << " hit_set " << p.hit_set_count << "x" << p.hit_set_period << "s";
   return out;
 }
 
@@ -896,11 +980,12 @@ void object_stat_sum_t::dump(Formatter *f) const
   f->dump_int("num_objects_recovered", num_objects_recovered);
   f->dump_int("num_bytes_recovered", num_bytes_recovered);
   f->dump_int("num_keys_recovered", num_keys_recovered);
+  f->dump_int("num_objects_dirty", num_objects_dirty);
 }
 
 void object_stat_sum_t::encode(bufferlist& bl) const
 {
-  ENCODE_START(5, 3, bl);
+  ENCODE_START(6, 3, bl);
   ::encode(num_bytes, bl);
   ::encode(num_objects, bl);
   ::encode(num_object_clones, bl);
@@ -916,12 +1001,13 @@ void object_stat_sum_t::encode(bufferlist& bl) const
   ::encode(num_objects_recovered, bl);
   ::encode(num_bytes_recovered, bl);
   ::encode(num_keys_recovered, bl);
+  ::encode(num_objects_dirty, bl);
   ENCODE_FINISH(bl);
 }
 
 void object_stat_sum_t::decode(bufferlist::iterator& bl)
 {
-  DECODE_START_LEGACY_COMPAT_LEN(5, 3, 3, bl);
+  DECODE_START_LEGACY_COMPAT_LEN(6, 3, 3, bl);
   ::decode(num_bytes, bl);
   if (struct_v < 3) {
     uint64_t num_kb;
@@ -951,6 +1037,10 @@ void object_stat_sum_t::decode(bufferlist::iterator& bl)
     num_bytes_recovered = 0;
     num_keys_recovered = 0;
   }
+  if (struct_v >= 6)
+    ::decode(num_objects_dirty, bl);
+  else
+    num_objects_dirty = 0;
   DECODE_FINISH(bl);
 }
 
@@ -972,6 +1062,7 @@ void object_stat_sum_t::generate_test_instances(list<object_stat_sum_t*>& o)
   a.num_objects_recovered = 14;
   a.num_bytes_recovered = 15;
   a.num_keys_recovered = 16;
+  a.num_objects_dirty = 17;
   o.push_back(new object_stat_sum_t(a));
 }
 
@@ -992,6 +1083,7 @@ void object_stat_sum_t::add(const object_stat_sum_t& o)
   num_objects_recovered += o.num_objects_recovered;
   num_bytes_recovered += o.num_bytes_recovered;
   num_keys_recovered += o.num_keys_recovered;
+  num_objects_dirty += o.num_objects_dirty;
 }
 
 void object_stat_sum_t::sub(const object_stat_sum_t& o)
@@ -1011,6 +1103,7 @@ void object_stat_sum_t::sub(const object_stat_sum_t& o)
   num_objects_recovered -= o.num_objects_recovered;
   num_bytes_recovered -= o.num_bytes_recovered;
   num_keys_recovered -= o.num_keys_recovered;
+  num_objects_dirty -= o.num_objects_dirty;
 }
 
 
@@ -2499,7 +2592,7 @@ void object_info_t::encode(bufferlist& bl) const
        ++i) {
     old_watchers.insert(make_pair(i->first.second, i->second));
   }
-  ENCODE_START(11, 8, bl);
+  ENCODE_START(12, 8, bl);
   ::encode(soid, bl);
   ::encode(oloc, bl);
   ::encode(category, bl);
@@ -2519,12 +2612,13 @@ void object_info_t::encode(bufferlist& bl) const
   ::encode(user_version, bl);
   ::encode(uses_tmap, bl);
   ::encode(watchers, bl);
+  ::encode(flags, bl);
   ENCODE_FINISH(bl);
 }
 
 void object_info_t::decode(bufferlist::iterator& bl)
 {
-  DECODE_START_LEGACY_COMPAT_LEN(11, 8, 8, bl);
+  DECODE_START_LEGACY_COMPAT_LEN(12, 8, 8, bl);
   map<entity_name_t, watch_info_t> old_watchers;
   if (struct_v >= 2 && struct_v <= 5) {
     sobject_t obj;
@@ -2579,6 +2673,10 @@ void object_info_t::decode(bufferlist::iterator& bl)
 	  make_pair(i->second.cookie, i->first), i->second));
     }
   }
+  if (struct_v >= 12)
+    ::decode(flags, bl);
+  else
+    flags = 0;
   DECODE_FINISH(bl);
 }
 
@@ -2597,6 +2695,7 @@ void object_info_t::dump(Formatter *f) const
   f->dump_unsigned("size", size);
   f->dump_stream("mtime") << mtime;
   f->dump_unsigned("lost", lost);
+  f->dump_unsigned("flags", flags);
   f->dump_stream("wrlock_by") << wrlock_by;
   f->open_array_section("snaps");
   for (vector<snapid_t>::const_iterator p = snaps.begin(); p != snaps.end(); ++p)
@@ -2634,6 +2733,8 @@ ostream& operator<<(ostream& out, const object_info_t& oi)
     out << " " << oi.snaps;
   if (oi.lost)
     out << " LOST";
+  if (oi.is_dirty())
+    out << " DIRTY";
   out << ")";
   return out;
 }
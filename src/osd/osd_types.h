@@ -623,6 +623,31 @@ struct pg_pool_t {
   enum {
     FLAG_HASHPSPOOL = 1, // hash pg seed and pool together (instead of adding)
   };
+  typedef enum {
+    CACHEMODE_NONE = 0,      ///< no caching
+    CACHEMODE_WRITEBACK = 1, ///< write to cache, flush later
+    CACHEMODE_READONLY = 2,  ///< handle reads, forward writes [not strongly consistent]
+  } cache_mode_t;
+  static const char *get_cache_mode_name(cache_mode_t m) {
+    switch (m) {
+    case CACHEMODE_NONE: return "none";
+    case CACHEMODE_WRITEBACK: return "writeback";
+    case CACHEMODE_READONLY: return "readonly";
+    default: return "unknown";
+    }
+  }
+  static cache_mode_t get_cache_mode_from_str(const string& s) {
+    if (s == "none")
+      return CACHEMODE_NONE;
+    if (s == "writeback")
+      return CACHEMODE_WRITEBACK;
+    if (s == "readonly")
+      return CACHEMODE_READONLY;
+    return (cache_mode_t)-1;
+  }
+  const char *get_cache_mode_name() const {
+    return get_cache_mode_name(cache_mode);
+  }
 
   static const char *get_type_name(int t) {
     switch (t) {
@@ -663,6 +688,31 @@ public:
    */
   interval_set<snapid_t> removed_snaps;
 
+  /*
+   * Per client QoS for the mclock op queue (osd_op_queue = mclock).
+   * Each client of the pool gets this reservation and limit (ops/sec,
+   * 0 for none) and weight (0 for the osd default).
+   */
+  uint32_t qos_reservation, qos_weight, qos_limit;
+
+  /*
+   * Cache tiering.  A cache pool is a tier of exactly one base pool
+   * (tier_of); the base pool lists its tiers.  Clients are redirected
+   * to read_tier/write_tier (the overlay) by the Objecter.  The cache
+   * pool's OSDs promote objects from the base pool on a miss, and
+   * flush and evict objects that were not touched in the last
+   * hit_set_count hit sets of hit_set_period seconds each once the
+   * pool holds more than target_max_objects.
+   */
+  set<uint64_t> tiers;      ///< pools that are tiers of us
+  int64_t tier_of;          ///< pool for which we are a tier, or -1
+  int64_t read_tier;        ///< pool/tier for objecter to direct reads to
+  int64_t write_tier;       ///< pool/tier for objecter to direct writes to
+  cache_mode_t cache_mode;  ///< cache pool mode
+  uint32_t hit_set_period;  ///< seconds per hit set
+  uint32_t hit_set_count;   ///< number of hit sets to consult
+  uint64_t target_max_objects; ///< flush/evict above this many objects (0 = never)
+
   int pg_num_mask, pgp_num_mask;
 
   pg_pool_t()
@@ -673,6 +723,11 @@ public:
       snap_seq(0), snap_epoch(0),
       auid(0),
       crash_replay_interval(0),
+      qos_reservation(0), qos_weight(0), qos_limit(0),
+      tier_of(-1), read_tier(-1), write_tier(-1),
+      cache_mode(CACHEMODE_NONE),
+      hit_set_period(0), hit_set_count(0),
+      target_max_objects(0),
       pg_num_mask(0), pgp_num_mask(0) { }
 
   void dump(Formatter *f) const;
@@ -698,6 +753,16 @@ public:
   bool is_rep()   const { return get_type() == TYPE_REP; }
   bool is_raid4() const { return get_type() == TYPE_RAID4; }
 
+  bool has_qos() const { return qos_reservation || qos_weight || qos_limit; }
+
+  bool is_tier() const { return tier_of >= 0; }
+  bool has_tiers() const { return !tiers.empty(); }
+  void clear_tier() { tier_of = -1; }
+  bool has_read_tier() const { return read_tier >= 0; }
+  void clear_read_tier() { read_tier = -1; }
+  bool has_write_tier() const { return write_tier >= 0; }
+  void clear_write_tier() { write_tier = -1; }
+
   unsigned get_pg_num() const { return pg_num; }
   unsigned get_pgp_num() const { return pgp_num; }
 
@@ -784,6 +849,7 @@ struct object_stat_sum_t {
   int64_t num_objects_recovered;
   int64_t num_bytes_recovered;
   int64_t num_keys_recovered;
+  int64_t num_objects_dirty;  // cache tier objects not yet flushed to the base pool
 
   object_stat_sum_t()
     : num_bytes(0),
@@ -793,7 +859,8 @@ struct object_stat_sum_t {
       num_scrub_errors(0),
       num_objects_recovered(0),
       num_bytes_recovered(0),
-      num_keys_recovered(0)
+      num_keys_recovered(0),
+      num_objects_dirty(0)
   {}
 
   void clear() {
@@ -1729,6 +1796,10 @@ static inline ostream& operator<<(ostream& out, const notify_info_t& n) {
 
 
 struct object_info_t {
+  typedef enum {
+    FLAG_DIRTY = 1<<0, ///< object has been modified since last flushed to the base tier
+  } flag_t;
+
   hobject_t soid;
   object_locator_t oloc;
   string category;
@@ -1749,6 +1820,12 @@ struct object_info_t {
 
   map<pair<uint64_t, entity_name_t>, watch_info_t> watchers;
   bool uses_tmap;
+  uint32_t flags;          ///< FLAG_*
+
+  bool test_flag(flag_t f) const { return (flags & f) == (uint32_t)f; }
+  void set_flag(flag_t f) { flags |= f; }
+  void clear_flag(flag_t f) { flags &= ~f; }
+  bool is_dirty() const { return test_flag(FLAG_DIRTY); }
 
   void copy_user_bits(const object_info_t& other);
 
@@ -1766,12 +1843,13 @@ struct object_info_t {
 
   explicit object_info_t()
     : size(0), lost(false),
-      truncate_seq(0), truncate_size(0), uses_tmap(false)
+      truncate_seq(0), truncate_size(0), uses_tmap(false), flags(0)
   {}
 
   object_info_t(const hobject_t& s, const object_locator_t& o)
     : soid(s), oloc(o), size(0),
-      lost(false), truncate_seq(0), truncate_size(0), uses_tmap(false) {}
+      lost(false), truncate_seq(0), truncate_size(0), uses_tmap(false),
+      flags(0) {}
 
   object_info_t(bufferlist& bl) {
     decode(bl);
@@ -2093,4 +2171,116 @@ struct obj_list_watch_response_t {
 
 WRITE_CLASS_ENCODER(obj_list_watch_response_t)
 
+/**
+ * one clone (or the head) of an object, as reported by list_snaps
+ */
+struct clone_info {
+  snapid_t cloneid;                         ///< CEPH_NOSNAP for the head
+  vector<snapid_t> snaps;                   ///< snaps the clone covers, ascending
+  vector<pair<uint64_t,uint64_t> > overlap; ///< extents unchanged in the next clone
+  uint64_t size;
+
+  clone_info() : cloneid(CEPH_NOSNAP), size(0) {}
+
+  void encode(bufferlist& bl) const {
+    ENCODE_START(1, 1, bl);
+    ::encode(cloneid, bl);
+    ::encode(snaps, bl);
+    ::encode(overlap, bl);
+    ::encode(size, bl);
+    ENCODE_FINISH(bl);
+  }
+  void decode(bufferlist::iterator& bl) {
+    DECODE_START(1, bl);
+    ::decode(cloneid, bl);
+    ::decode(snaps, bl);
+    ::decode(overlap, bl);
+    ::decode(size, bl);
+    DECODE_FINISH(bl);
+  }
+  void dump(Formatter *f) const {
+    if (cloneid == CEPH_NOSNAP)
+      f->dump_string("cloneid", "HEAD");
+    else
+      f->dump_unsigned("cloneid", cloneid.val);
+    f->open_array_section("snapshots");
+    for (vector<snapid_t>::const_iterator p = snaps.begin(); p != snaps.end(); ++p)
+      f->dump_unsigned("snap", *p);
+    f->close_section();
+    f->open_array_section("overlaps");
+    for (vector<pair<uint64_t,uint64_t> >::const_iterator q = overlap.begin();
+	 q != overlap.end(); ++q) {
+      f->open_object_section("overlap");
+      f->dump_unsigned("offset", q->first);
+      f->dump_unsigned("length", q->second);
+      f->close_section();
+    }
+    f->close_section();
+    f->dump_unsigned("size", size);
+  }
+  static void generate_test_instances(list<clone_info*>& o) {
+    o.push_back(new clone_info);
+    o.push_back(new clone_info);
+    o.back()->cloneid = 1;
+    o.back()->snaps.push_back(1);
+    o.back()->overlap.push_back(pair<uint64_t,uint64_t>(0,4096));
+    o.back()->overlap.push_back(pair<uint64_t,uint64_t>(8192,4096));
+    o.back()->size = 16384;
+    o.push_back(new clone_info);
+    o.back()->cloneid = CEPH_NOSNAP;
+    o.back()->size = 32768;
+  }
+};
+WRITE_CLASS_ENCODER(clone_info)
+
+/**
+ * obj list snaps response format
+ *
+ */
+struct obj_list_snap_response_t {
+  vector<clone_info> clones;   ///< ascending, head last
+  snapid_t seq;
+
+  void encode(bufferlist& bl) const {
+    ENCODE_START(1, 1, bl);
+    ::encode(clones, bl);
+    ::encode(seq, bl);
+    ENCODE_FINISH(bl);
+  }
+  void decode(bufferlist::iterator& bl) {
+    DECODE_START(1, bl);
+    ::decode(clones, bl);
+    ::decode(seq, bl);
+    DECODE_FINISH(bl);
+  }
+  void dump(Formatter *f) const {
+    f->open_array_section("clones");
+    for (vector<clone_info>::const_iterator p = clones.begin(); p != clones.end(); ++p) {
+      f->open_object_section("clone");
+      p->dump(f);
+      f->close_section();
+    }
+    f->close_section();
+    f->dump_unsigned("seq", seq);
+  }
+  static void generate_test_instances(list<obj_list_snap_response_t*>& o) {
+    o.push_back(new obj_list_snap_response_t);
+    o.push_back(new obj_list_snap_response_t);
+    clone_info cl;
+    cl.cloneid = 1;
+    cl.snaps.push_back(1);
+    cl.overlap.push_back(pair<uint64_t,uint64_t>(0,4096));
+    cl.size = 16384;
+    o.back()->clones.push_back(cl);
+    cl.cloneid = CEPH_NOSNAP;
+    cl.snaps.clear();
+    cl.overlap.clear();
+    cl.size = 32768;
+    o.back()->clones.push_back(cl);
+    o.back()->seq = 123;
+  }
+};
+
+WRITE_CLASS_ENCODER(obj_list_snap_response_t)
+
 #endif
@@ -32,6 +32,7 @@ ObjectCacher::BufferHead *ObjectCacher::Object::split(BufferHead *left, loff_t o
   right->last_write_tid = left->last_write_tid;
   right->set_state(left->get_state());
   right->snapc = left->snapc;
+  right->write_around = left->write_around;
 
   loff_t newleftlen = off - left->start();
   right->set_start(off);
@@ -94,6 +95,7 @@ void ObjectCacher::Object::merge_left(BufferHead *left, BufferHead *right)
   // note: this is sorta busted, but should only be used for dirty buffers
   left->last_write_tid =  MAX( left->last_write_tid, right->last_write_tid );
   left->last_write = MAX( left->last_write, right->last_write );
+  left->write_around = left->write_around && right->write_around;
 
   // waiters
   for (map<loff_t, list<Context*> >::iterator p = right->waitfor_read.begin();
@@ -483,6 +485,116 @@ void ObjectCacher::Object::discard(loff_t off, loff_t len)
 
 
 
+/*** ObjectCacher::Budget ***/
+
+ObjectCacher::Budget::Budget(CephContext *cct_)
+  : cct(cct_),
+    caches_lock("ObjectCacher::Budget::caches_lock"),
+    lock("ObjectCacher::Budget::lock")
+{
+}
+
+ObjectCacher::Budget::~Budget()
+{
+  assert(caches.empty());
+}
+
+void ObjectCacher::Budget::add_cache(ObjectCacher *oc)
+{
+  Mutex::Locker l(caches_lock);
+  caches.push_back(oc);
+  num_caches.inc();
+}
+
+void ObjectCacher::Budget::remove_cache(ObjectCacher *oc)
+{
+  Mutex::Locker l(caches_lock);
+  caches.remove(oc);
+  num_caches.dec();
+}
+
+void ObjectCacher::Budget::stat_add(int state, loff_t len)
+{
+  switch (state) {
+  case BufferHead::STATE_CLEAN:
+    clean.add(len);
+    break;
+  case BufferHead::STATE_DIRTY:
+    dirty.add(len);
+    break;
+  case BufferHead::STATE_TX:
+    tx.add(len);
+    break;
+  }
+}
+
+void ObjectCacher::Budget::stat_sub(int state, loff_t len)
+{
+  switch (state) {
+  case BufferHead::STATE_CLEAN:
+    clean.sub(len);
+    break;
+  case BufferHead::STATE_DIRTY:
+    dirty.sub(len);
+    break;
+  case BufferHead::STATE_TX:
+    tx.sub(len);
+    break;
+  }
+}
+
+void ObjectCacher::Budget::adjust_writeback_bandwidth(int64_t delta)
+{
+  if (delta > 0)
+    writeback_bandwidth.add(delta);
+  else
+    writeback_bandwidth.sub(-delta);
+}
+
+/*
+ * The stats are updated before this is called, and a writer checks them
+ * under our lock, so taking it here means a writer either sees the
+ * update or is already waiting when we signal.
+ */
+void ObjectCacher::Budget::signal_writers()
+{
+  Mutex::Locker l(lock);
+  cond.Signal();
+}
+
+void ObjectCacher::Budget::kick_flushers()
+{
+  Mutex::Locker l(caches_lock);
+  for (list<ObjectCacher*>::iterator p = caches.begin();
+       p != caches.end();
+       ++p) {
+    Mutex::Locker cl((*p)->lock);
+    (*p)->flusher_cond.Signal();
+  }
+}
+
+/**
+ * wait for the dirty data over all caches to go down
+ *
+ * Called with @cache_lock held, which is dropped while waiting so that
+ * this cache can make progress too.  Like the single cache case, this
+ * does not wait for bytes other writers are waiting on.
+ */
+void ObjectCacher::Budget::wait_for_dirty(loff_t len, loff_t max_dirty,
+					  Mutex& cache_lock)
+{
+  dirty_waiting.add(len);
+  cache_lock.Unlock();
+  kick_flushers();
+  lock.Lock();
+  if (get_dirty() + get_tx() >= max_dirty + get_dirty_waiting() - len)
+    cond.Wait(lock);
+  lock.Unlock();
+  dirty_waiting.sub(len);
+  cache_lock.Lock();
+}
+
+
 /*** ObjectCacher ***/
 
 #undef dout_prefix
@@ -493,11 +605,14 @@ ObjectCacher::ObjectCacher(CephContext *cct_, string name, WritebackHandler& wb,
 			   flush_set_callback_t flush_callback,
 			   void *flush_callback_arg,
 			   uint64_t max_bytes, uint64_t max_objects,
-			   uint64_t max_dirty, uint64_t target_dirty, double max_dirty_age)
+			   uint64_t max_dirty, uint64_t target_dirty, double max_dirty_age,
+			   Budget *b)
   : perfcounter(NULL),
-    cct(cct_), writeback_handler(wb), name(name), lock(l),
+    cct(cct_), writeback_handler(wb), name(name), lock(l), budget(b),
     max_dirty(max_dirty), target_dirty(target_dirty),
     max_size(max_bytes), max_objects(max_objects),
+    write_around_bytes(0),
+    writeback_sample_bytes(0), writeback_bandwidth(0),
     flush_set_callback(flush_callback), flush_set_callback_arg(flush_callback_arg),
     flusher_stop(false), flusher_thread(this),
     stat_clean(0), stat_zero(0), stat_dirty(0), stat_rx(0), stat_tx(0), stat_missing(0),
@@ -505,10 +620,16 @@ ObjectCacher::ObjectCacher(CephContext *cct_, string name, WritebackHandler& wb,
 {
   this->max_dirty_age.set_from_double(max_dirty_age);
   perf_start();
+  if (budget)
+    budget->add_cache(this);
 }
 
 ObjectCacher::~ObjectCacher()
 {
+  if (budget) {
+    budget->adjust_writeback_bandwidth(-(int64_t)writeback_bandwidth);
+    budget->remove_cache(this);
+  }
   perf_stop();
   // we should be empty.
   for (vector<hash_map<sobject_t, Object *> >::iterator i = objects.begin();
@@ -538,6 +659,11 @@ void ObjectCacher::perf_start()
   plb.add_u64_counter(l_objectcacher_write_ops_blocked, "write_ops_blocked");
   plb.add_u64_counter(l_objectcacher_write_bytes_blocked, "write_bytes_blocked");
   plb.add_time(l_objectcacher_write_time_blocked, "write_time_blocked");
+  plb.add_u64_counter(l_objectcacher_write_ops_throttled, "write_ops_throttled");
+  plb.add_time(l_objectcacher_write_time_throttled, "write_time_throttled");
+  plb.add_u64_counter(l_objectcacher_write_around_ops, "write_around_ops");
+  plb.add_u64_counter(l_objectcacher_write_around_bytes, "write_around_bytes");
+  plb.add_u64(l_objectcacher_writeback_bandwidth, "writeback_bandwidth");
 
   perfcounter = plb.create_perf_counters();
   cct->get_perfcounters_collection()->add(perfcounter);
@@ -760,6 +886,8 @@ void ObjectCacher::bh_write(BufferHead *bh)
     perfcounter->inc(l_objectcacher_data_flushed, bh->length());
   }
 
+  if (writeback_sample_start == utime_t())
+    writeback_sample_start = ceph_clock_now(cct);
   mark_tx(bh);
 }
 
@@ -821,6 +949,8 @@ void ObjectCacher::bh_write_commit(int64_t poolid, sobject_t oid, loff_t start,
       if (r >= 0) {
 	// ok!  mark bh clean and error-free
 	mark_clean(bh);
+	if (bh->write_around)
+	  bh_lru_rest.lru_bottouch(bh);
 	ldout(cct, 10) << "bh_write_commit clean " << *bh << dendl;
       } else {
 	mark_dirty(bh);
@@ -852,6 +982,90 @@ void ObjectCacher::bh_write_commit(int64_t poolid, sobject_t oid, loff_t start,
       flush_set_callback(flush_set_callback_arg, oset);      
     }
   }
+
+  if (r >= 0)
+    sample_writeback(length);
+}
+
+/**
+ * account for committed writeback and update the measured rate
+ *
+ * A sample runs from the first write sent while none was in flight
+ * until at least 100ms later, or until writeback goes idle, so time
+ * with nothing to write back doesn't count.  The rate is smoothed
+ * over samples.
+ */
+void ObjectCacher::sample_writeback(uint64_t bytes)
+{
+  assert(lock.is_locked());
+  if (writeback_sample_start == utime_t())
+    return;
+  writeback_sample_bytes += bytes;
+  utime_t now = ceph_clock_now(cct);
+  double elapsed = now - writeback_sample_start;
+  bool idle = get_stat_tx() == 0;
+  if (elapsed < .1 && !idle)
+    return;
+
+  if (elapsed > 0) {
+    double rate = writeback_sample_bytes / elapsed;
+    double old = writeback_bandwidth;
+    if (old)
+      writeback_bandwidth = old * .75 + rate * .25;
+    else
+      writeback_bandwidth = rate;
+    if (budget)
+      budget->adjust_writeback_bandwidth((int64_t)writeback_bandwidth -
+					 (int64_t)old);
+    if (perfcounter)
+      perfcounter->set(l_objectcacher_writeback_bandwidth,
+		       (uint64_t)writeback_bandwidth);
+    ldout(cct, 20) << "sample_writeback " << writeback_sample_bytes
+		   << " bytes in " << elapsed << "s, bandwidth now "
+		   << writeback_bandwidth << dendl;
+  }
+  writeback_sample_bytes = 0;
+  writeback_sample_start = idle ? utime_t() : now;
+}
+
+/**
+ * dirty limits for the measured writeback rate
+ *
+ * Hold no more dirty data than writeback gets through in max_dirty_age,
+ * so a flush never has much more to do than that, but keep at least an
+ * eighth of max_dirty to absorb bursts.  target_dirty scales along.
+ */
+void ObjectCacher::get_dirty_limits(loff_t *max, loff_t *target)
+{
+  *max = max_dirty;
+  *target = target_dirty;
+  double bandwidth = get_total_writeback_bandwidth();
+  if (bandwidth <= 0 || max_dirty <= 0 || (double)max_dirty_age <= 0)
+    return;
+  loff_t limit = bandwidth * (double)max_dirty_age;
+  limit = MAX(limit, max_dirty / 8);
+  if (limit < max_dirty) {
+    *target = target_dirty * limit / max_dirty;
+    *max = limit;
+  }
+}
+
+/**
+ * decide whether a write to @ob goes straight to writeback
+ *
+ * True once the sequential writes to the object, this one included,
+ * add up to write_around_bytes.
+ */
+bool ObjectCacher::should_write_around(Object *ob, loff_t off, loff_t len)
+{
+  if (!write_around_bytes || max_dirty == 0)
+    return false;
+  if (off == ob->seq_write_end)
+    ob->seq_write_bytes += len;
+  else
+    ob->seq_write_bytes = len;
+  ob->seq_write_end = off + len;
+  return ob->seq_write_bytes >= (loff_t)write_around_bytes;
 }
 
 void ObjectCacher::flush(loff_t amount)
@@ -887,10 +1101,16 @@ void ObjectCacher::trim(loff_t max_bytes, loff_t max_ob)
     max_ob = max_objects;
   
   ldout(cct, 10) << "trim  start: bytes: max " << max_bytes << "  clean " << get_stat_clean()
+		 << " total " << get_total_clean()
 		 << ", objects: max " << max_ob << " current " << ob_lru.lru_get_size()
 		 << dendl;
 
-  while (get_stat_clean() > max_bytes) {
+  // with a shared budget, only trim what we hold over our share
+  loff_t min_bytes = 0;
+  if (budget)
+    min_bytes = max_bytes / budget->get_num_caches();
+
+  while (get_total_clean() > max_bytes && get_stat_clean() > min_bytes) {
     BufferHead *bh = (BufferHead*) bh_lru_rest.lru_expire();
     if (!bh)
       break;
@@ -1203,6 +1423,7 @@ int ObjectCacher::writex(OSDWrite *wr, ObjectSet *oset, Mutex& wait_on_lock)
   utime_t now = ceph_clock_now(cct);
   uint64_t bytes_written = 0;
   uint64_t bytes_written_in_flush = 0;
+  uint64_t bytes_written_around = 0;
   
   for (vector<ObjectExtent>::iterator ex_it = wr->extents.begin();
        ex_it != wr->extents.end();
@@ -1253,7 +1474,17 @@ int ObjectCacher::writex(OSDWrite *wr, ObjectSet *oset, Mutex& wait_on_lock)
     touch_bh(bh);
     bh->last_write = now;
 
-    o->try_merge_bh(bh);
+    // part of a large sequential write?  send it now, and don't let it
+    // push more useful data out of the cache later.  it stays on its
+    // own so its commit isn't tied to any other write.
+    bh->write_around = should_write_around(o, ex_it->offset, ex_it->length);
+    if (bh->write_around) {
+      ldout(cct, 10) << "writex writing around " << *bh << dendl;
+      bytes_written_around += bh->length();
+      bh_write(bh);
+    } else {
+      o->try_merge_bh(bh);
+    }
   }
 
   if (perfcounter) {
@@ -1262,6 +1493,11 @@ int ObjectCacher::writex(OSDWrite *wr, ObjectSet *oset, Mutex& wait_on_lock)
       perfcounter->inc(l_objectcacher_overwritten_in_flush,
                        bytes_written_in_flush);
     }
+    if (bytes_written_around) {
+      perfcounter->inc(l_objectcacher_write_around_ops);
+      perfcounter->inc(l_objectcacher_write_around_bytes,
+		       bytes_written_around);
+    }
   }
 
   int r = _wait_for_write(wr, bytes_written, oset, wait_on_lock);
@@ -1281,24 +1517,57 @@ int ObjectCacher::_wait_for_write(OSDWrite *wr, uint64_t len, ObjectSet *oset, M
   int blocked = 0;
   utime_t start = ceph_clock_now(cct);
   int ret = 0;
+  loff_t max = max_dirty, target = target_dirty;
 
   if (max_dirty > 0) {
+    get_dirty_limits(&max, &target);
+
     // wait for writeback?
     //  - wait for dirty and tx bytes (relative to the max_dirty threshold)
     //  - do not wait for bytes other waiters are waiting on.  this means that
     //    threads do not wait for each other.  this effectively allows the cache size
     //    to balloon proportional to the data that is in flight.
-    while (get_stat_dirty() + get_stat_tx() >= max_dirty + get_stat_dirty_waiting()) {
+    while (get_total_dirty() + get_total_tx() >= max + get_total_dirty_waiting()) {
       ldout(cct, 10) << "wait_for_write waiting on " << len << ", dirty|tx " 
-		     << (get_stat_dirty() + get_stat_tx()) 
-		     << " >= max " << max_dirty << " + dirty_waiting " << get_stat_dirty_waiting()
+		     << (get_total_dirty() + get_total_tx()) 
+		     << " >= max " << max << " + dirty_waiting " << get_total_dirty_waiting()
 		     << dendl;
-      flusher_cond.Signal();
-      stat_dirty_waiting += len;
-      stat_cond.Wait(lock);
-      stat_dirty_waiting -= len;
+      if (budget) {
+	stat_dirty_waiting += len;
+	budget->wait_for_dirty(len, max, lock);
+	stat_dirty_waiting -= len;
+      } else {
+	flusher_cond.Signal();
+	stat_dirty_waiting += len;
+	stat_cond.Wait(lock);
+	stat_dirty_waiting -= len;
+      }
       blocked++;
       ldout(cct, 10) << "wait_for_write woke up" << dendl;
+      get_dirty_limits(&max, &target);
+    }
+
+    // between target and max, delay writers in proportion: not at all at
+    // the target, up to the time writeback needs for this write at max.
+    // writers then settle at the writeback rate instead of running into
+    // max and stalling.
+    loff_t dirty = get_total_dirty() + get_total_tx();
+    double bandwidth = get_total_writeback_bandwidth();
+    if (!blocked && bandwidth > 0 && dirty > target && max > target) {
+      double frac = MIN(1.0, (double)(dirty - target) / (max - target));
+      utime_t delay;
+      delay.set_from_double(MIN(frac * len / bandwidth, 1.0));
+      ldout(cct, 10) << "wait_for_write throttling " << len << " for " << delay
+		     << ", dirty|tx " << dirty << " target " << target
+		     << " max " << max << " bandwidth " << bandwidth << dendl;
+      flusher_cond.Signal();
+      Cond cond;
+      cond.WaitInterval(cct, lock, delay);
+      if (perfcounter) {
+	perfcounter->inc(l_objectcacher_write_ops_throttled);
+	perfcounter->tinc(l_objectcacher_write_time_throttled,
+			  ceph_clock_now(cct) - start);
+      }
     }
   } else {
     // write-thru!  flush what we just wrote.
@@ -1314,9 +1583,9 @@ int ObjectCacher::_wait_for_write(OSDWrite *wr, uint64_t len, ObjectSet *oset, M
   }
 
   // start writeback anyway?
-  if (get_stat_dirty() > target_dirty) {
-    ldout(cct, 10) << "wait_for_write " << get_stat_dirty() << " > target "
-		   << target_dirty << ", nudging flusher" << dendl;
+  if (get_total_dirty() > target) {
+    ldout(cct, 10) << "wait_for_write " << get_total_dirty() << " > target "
+		   << target << ", nudging flusher" << dendl;
     flusher_cond.Signal();
   }
   if (blocked && perfcounter) {
@@ -1333,6 +1602,8 @@ void ObjectCacher::flusher_entry()
   ldout(cct, 10) << "flusher start" << dendl;
   lock.Lock();
   while (!flusher_stop) {
+    loff_t max, target;
+    get_dirty_limits(&max, &target);
     loff_t all = get_stat_tx() + get_stat_rx() + get_stat_clean() + get_stat_dirty();
     ldout(cct, 11) << "flusher "
 		   << all << " / " << max_size << ":  "
@@ -1340,18 +1611,26 @@ void ObjectCacher::flusher_entry()
 		   << get_stat_rx() << " rx, "
 		   << get_stat_clean() << " clean, "
 		   << get_stat_dirty() << " dirty ("
-		   << target_dirty << " target, "
-		   << max_dirty << " max)"
+		   << target << " target, "
+		   << max << " max)"
 		   << dendl;
-    loff_t actual = get_stat_dirty() + get_stat_dirty_waiting();
-    if (actual > target_dirty) {
+    loff_t actual = get_total_dirty() + get_total_dirty_waiting();
+    if (actual > target && get_stat_dirty() > 0) {
       // flush some dirty pages
       ldout(cct, 10) << "flusher " 
-		     << get_stat_dirty() << " dirty + " << get_stat_dirty_waiting()
+		     << get_total_dirty() << " dirty + " << get_total_dirty_waiting()
 		     << " dirty_waiting > target "
-		     << target_dirty
+		     << target
 		     << ", flushing some dirty bhs" << dendl;
-      flush(actual - target_dirty);
+      loff_t amount = actual - target;
+      if (budget) {
+	// our share of it, by how much of the dirty data we hold
+	loff_t total = MAX(get_total_dirty(), get_stat_dirty());
+	amount = amount * get_stat_dirty() / total;
+	if (amount == 0)
+	  amount = 1;
+      }
+      flush(amount);
     } else {
       // check tail of lru for old dirty items
       utime_t cutoff = ceph_clock_now(cct);
@@ -1811,8 +2090,12 @@ void ObjectCacher::bh_stat_add(BufferHead *bh)
   default:
     assert(0 == "bh_stat_add: invalid bufferhead state");
   }
-  if (get_stat_dirty_waiting() > 0)
+  if (budget) {
+    budget->stat_add(bh->get_state(), bh->length());
+    budget->signal_writers();
+  } else if (get_stat_dirty_waiting() > 0) {
     stat_cond.Signal();
+  }
 }
 
 void ObjectCacher::bh_stat_sub(BufferHead *bh)
@@ -1847,6 +2130,8 @@ void ObjectCacher::bh_stat_sub(BufferHead *bh)
   default:
     assert(0 == "bh_stat_sub: invalid bufferhead state");
   }
+  if (budget)
+    budget->stat_sub(bh->get_state(), bh->length());
 }
 
 void ObjectCacher::bh_set_state(BufferHead *bh, int s)
@@ -6,6 +6,7 @@
 #include "include/types.h"
 #include "include/lru.h"
 #include "include/Context.h"
+#include "include/atomic.h"
 #include "include/xlist.h"
 
 #include "common/Cond.h"
@@ -36,6 +37,12 @@ enum {
   l_objectcacher_write_bytes_blocked, // total number of write bytes we delayed due to dirty limits
   l_objectcacher_write_time_blocked, // total time in seconds spent blocking a write due to dirty limits
 
+  l_objectcacher_write_ops_throttled, // write ops delayed to slow writers down to the writeback rate
+  l_objectcacher_write_time_throttled, // total time in seconds writes were delayed for that
+  l_objectcacher_write_around_ops, // write ops sent straight to the WritebackHandler
+  l_objectcacher_write_around_bytes, // bytes written that way
+  l_objectcacher_writeback_bandwidth, // measured writeback rate, bytes per second
+
   l_objectcacher_last,
 };
 
@@ -77,6 +84,59 @@ class ObjectCacher {
   }
 
 
+  /**
+   * memory accounting shared by several caches
+   *
+   * Caches created with the same budget add their clean, dirty and tx
+   * bytes to it, and apply their size and dirty limits to the totals
+   * over all of them.  Each cache still has its own lock, objects,
+   * LRUs and flusher, so the objects of a set can be spread over
+   * several caches (shards) that are used concurrently.  A cache trims
+   * clean data only while it holds more than its share of max_size, and
+   * flushes its share of the dirty data above target_dirty.
+   *
+   * Lock order: a cache's lock, then the budget's lock.  The budget
+   * takes cache locks only while holding no other lock.
+   */
+  class Budget {
+  public:
+    Budget(CephContext *cct_);
+    ~Budget();
+
+    loff_t get_clean() const { return (loff_t)clean.read(); }
+    loff_t get_dirty() const { return (loff_t)dirty.read(); }
+    loff_t get_tx() const { return (loff_t)tx.read(); }
+    loff_t get_dirty_waiting() const { return (loff_t)dirty_waiting.read(); }
+    int get_num_caches() const { return num_caches.read(); }
+    /// sum of the writeback rates measured by the caches, bytes/sec
+    double get_writeback_bandwidth() const {
+      return (double)writeback_bandwidth.read();
+    }
+
+  private:
+    friend class ObjectCacher;
+
+    void add_cache(ObjectCacher *oc);
+    void remove_cache(ObjectCacher *oc);
+    void stat_add(int state, loff_t len);
+    void stat_sub(int state, loff_t len);
+    void adjust_writeback_bandwidth(int64_t delta);
+    void signal_writers();
+    void kick_flushers();
+    void wait_for_dirty(loff_t len, loff_t max_dirty, Mutex& cache_lock);
+
+    CephContext *cct;
+    atomic_t clean, dirty, tx, dirty_waiting, num_caches;
+    atomic_t writeback_bandwidth;
+
+    Mutex caches_lock;            ///< protects caches
+    list<ObjectCacher*> caches;
+
+    Mutex lock;                   ///< for writers waiting on dirty data
+    Cond cond;
+  };
+
+
 
   // ******* BufferHead *********
   class BufferHead : public LRUObject {
@@ -105,6 +165,7 @@ class ObjectCacher {
     utime_t last_write;
     SnapContext snapc;
     int error; // holds return value for failed reads
+    bool write_around; // written back right away; evict first once clean
     
     map< loff_t, list<Context*> > waitfor_read;
     
@@ -114,7 +175,8 @@ class ObjectCacher {
       ref(0),
       ob(o),
       last_write_tid(0),
-      error(0) {
+      error(0),
+      write_around(false) {
       ex.start = ex.length = 0;
     }
   
@@ -181,6 +243,10 @@ class ObjectCacher {
 
     int dirty_or_tx;
 
+    // sequential writes, for write-around
+    loff_t seq_write_end;
+    loff_t seq_write_bytes;
+
     map< tid_t, list<Context*> > waitfor_commit;
 
   public:
@@ -193,7 +259,8 @@ class ObjectCacher {
       oid(o), oset(os), set_item(this), oloc(l),
       complete(false), exists(true),
       last_write_tid(0), last_commit_tid(0),
-      dirty_or_tx(0) {
+      dirty_or_tx(0),
+      seq_write_end(0), seq_write_bytes(0) {
       // add to set
       os->objects.push_back(&set_item);
     }
@@ -321,9 +388,18 @@ class ObjectCacher {
 
   string name;
   Mutex& lock;
+  Budget *budget;
+  friend class Budget;
   
   int64_t max_dirty, target_dirty, max_size, max_objects;
   utime_t max_dirty_age;
+  uint64_t write_around_bytes;
+
+  // writeback rate, measured over at least writeback_sample_interval
+  // while there is writeback in flight
+  utime_t writeback_sample_start;
+  uint64_t writeback_sample_bytes;
+  double writeback_bandwidth;  ///< bytes/sec, 0 until measured
 
   flush_set_callback_t flush_set_callback;
   void *flush_set_callback_arg;
@@ -384,6 +460,21 @@ class ObjectCacher {
   loff_t get_stat_clean() { return stat_clean; }
   loff_t get_stat_zero() { return stat_zero; }
 
+  // totals the limits apply to: over the budget if there is one
+  loff_t get_total_tx() { return budget ? budget->get_tx() : stat_tx; }
+  loff_t get_total_dirty() { return budget ? budget->get_dirty() : stat_dirty; }
+  loff_t get_total_dirty_waiting() {
+    return budget ? budget->get_dirty_waiting() : stat_dirty_waiting;
+  }
+  loff_t get_total_clean() { return budget ? budget->get_clean() : stat_clean; }
+  double get_total_writeback_bandwidth() {
+    return budget ? budget->get_writeback_bandwidth() : writeback_bandwidth;
+  }
+
+  void get_dirty_limits(loff_t *max, loff_t *target);
+  void sample_writeback(uint64_t bytes);
+  bool should_write_around(Object *ob, loff_t off, loff_t len);
+
   void touch_bh(BufferHead *bh) {
     if (bh->is_dirty())
       bh_lru_dirty.lru_touch(bh);
@@ -486,7 +577,8 @@ class ObjectCacher {
 	       flush_set_callback_t flush_callback,
 	       void *flush_callback_arg,
 	       uint64_t max_bytes, uint64_t max_objects,
-	       uint64_t max_dirty, uint64_t target_dirty, double max_age);
+	       uint64_t max_dirty, uint64_t target_dirty, double max_age,
+	       Budget *budget=NULL);
   ~ObjectCacher();
 
   void start() {
@@ -569,6 +661,14 @@ public:
   void set_max_objects(int64_t v) {
     max_objects = v;
   }
+  /**
+   * write back sequential writes to an object right away once they add
+   * up to @v bytes, and evict that data before anything else once it
+   * is clean; 0 disables this
+   */
+  void set_write_around_bytes(uint64_t v) {
+    write_around_bytes = v;
+  }
 
 
   // file functions
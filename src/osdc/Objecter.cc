@@ -40,6 +40,7 @@
 
 #include "common/config.h"
 #include "common/perf_counters.h"
+#include "include/str_list.h"
 
 
 #define dout_subsys ceph_subsys_objecter
@@ -62,6 +63,8 @@ enum {
   l_osdc_op_w,
   l_osdc_op_rmw,
   l_osdc_op_pg,
+  l_osdc_op_r_replica,
+  l_osdc_op_r_replica_bounce,
 
   l_osdc_osdop_stat,
   l_osdc_osdop_create,
@@ -125,6 +128,10 @@ void Objecter::init_unlocked()
 {
   assert(!initialized);
 
+  // we only change osdmap with decode() and apply_incremental()
+  if (cct->_conf->osd_map_cache_pg_mapping)
+    osdmap->enable_pg_mapping_cache();
+
   if (!logger) {
     PerfCountersBuilder pcb(cct, "objecter", l_osdc_first, l_osdc_last);
 
@@ -141,6 +148,8 @@ void Objecter::init_unlocked()
     pcb.add_u64_counter(l_osdc_op_w, "op_w");
     pcb.add_u64_counter(l_osdc_op_rmw, "op_rmw");
     pcb.add_u64_counter(l_osdc_op_pg, "op_pg");
+    pcb.add_u64_counter(l_osdc_op_r_replica, "op_r_replica");
+    pcb.add_u64_counter(l_osdc_op_r_replica_bounce, "op_r_replica_bounce");
 
     pcb.add_u64_counter(l_osdc_osdop_stat, "osdop_stat");
     pcb.add_u64_counter(l_osdc_osdop_create, "osdop_create");
@@ -199,6 +208,17 @@ void Objecter::init_unlocked()
     cct->get_perfcounters_collection()->add(logger);
   }
 
+  // crush_location is a list of type=name pairs, e.g. "host=foo rack=bar"
+  list<string> loc;
+  get_str_list(cct->_conf->crush_location, loc);
+  crush_location.clear();
+  while (loc.size() >= 2) {
+    string type = loc.front();
+    loc.pop_front();
+    crush_location[type] = loc.front();
+    loc.pop_front();
+  }
+
   m_request_state_hook = new RequestStateHook(this);
   AdminSocket* admin_socket = cct->get_admin_socket();
   int ret = admin_socket->register_command("objecter_requests",
@@ -218,13 +238,17 @@ void Objecter::init_locked()
   schedule_tick();
   maybe_request_map();
 
+  rwlock.get_write();
   initialized = true;
+  rwlock.put_write();
 }
 
 void Objecter::shutdown_locked() 
 {
   assert(client_lock.is_locked());
   assert(initialized);
+
+  rwlock.get_write();
   initialized = false;
 
   map<int,OSDSession*>::iterator p;
@@ -232,6 +256,7 @@ void Objecter::shutdown_locked()
     p = osd_sessions.begin();
     close_session(p->second);
   }
+  rwlock.put_write();
 
   if (tick_event) {
     timer.cancel_event(tick_event);
@@ -255,9 +280,9 @@ void Objecter::shutdown_unlocked()
   }
 }
 
-void Objecter::send_linger(LingerOp *info)
+void Objecter::_send_linger(LingerOp *info)
 {
-  ldout(cct, 15) << "send_linger " << info->linger_id << dendl;
+  ldout(cct, 15) << "_send_linger " << info->linger_id << dendl;
   vector<OSDOp> opv = info->ops; // need to pass a copy to ops
   Context *onack = (!info->registered && info->on_reg_ack) ? new C_Linger_Ack(this, info) : NULL;
   Context *oncommit = new C_Linger_Commit(this, info);
@@ -272,26 +297,32 @@ void Objecter::send_linger(LingerOp *info)
   o->should_resend = false;
 
   if (info->session) {
-    int r = recalc_op_target(o);
+    // recalc_op_target() counts an op without a session as homeless;
+    // o isn't tracked yet, so leave it uncounted for _op_submit()
+    num_homeless_ops.inc();
+    int r = recalc_op_target(o, true);
+    if (!o->session)
+      num_homeless_ops.dec();
     if (r == RECALC_OP_TARGET_POOL_DNE) {
       _send_linger_map_check(info);
     }
   }
 
+  // registrations are not budgeted: we hold rwlock for write, and
+  // can't block here waiting for replies to free up some budget.
   if (info->register_tid) {
     // repeat send.  cancel old registeration op, if any.
-    if (ops.count(info->register_tid)) {
-      Op *o = ops[info->register_tid];
-      cancel_op(o);
-    }
-    info->register_tid = _op_submit(o);
+    OpShard& shard = get_op_shard(info->register_tid);
+    map<tid_t,Op*>::iterator p = shard.ops.find(info->register_tid);
+    if (p != shard.ops.end())
+      cancel_op(p->second);
   } else {
     // first send
     // populate info->pgid and info->acting so we
     // don't resend the linger op on the next osdmap update
     recalc_linger_op_target(info);
-    info->register_tid = op_submit(o);
   }
+  info->register_tid = _op_submit(o, true);
 
   OSDSession *s = o->session;
   if (info->session != s) {
@@ -306,6 +337,7 @@ void Objecter::send_linger(LingerOp *info)
 
 void Objecter::_linger_ack(LingerOp *info, int r) 
 {
+  ClientLocker l(client_lock);
   ldout(cct, 10) << "_linger_ack " << info->linger_id << dendl;
   if (info->on_reg_ack) {
     info->on_reg_ack->finish(r);
@@ -316,6 +348,7 @@ void Objecter::_linger_ack(LingerOp *info, int r)
 
 void Objecter::_linger_commit(LingerOp *info, int r) 
 {
+  ClientLocker l(client_lock);
   ldout(cct, 10) << "_linger_commit " << info->linger_id << dendl;
   if (info->on_reg_commit) {
     info->on_reg_commit->finish(r);
@@ -329,6 +362,12 @@ void Objecter::_linger_commit(LingerOp *info, int r)
 }
 
 void Objecter::unregister_linger(uint64_t linger_id)
+{
+  RWLock::WLocker wl(rwlock);
+  _unregister_linger(linger_id);
+}
+
+void Objecter::_unregister_linger(uint64_t linger_id)
 {
   map<uint64_t, LingerOp*>::iterator iter = linger_ops.find(linger_id);
   if (iter != linger_ops.end()) {
@@ -367,7 +406,9 @@ tid_t Objecter::linger_mutate(const object_t& oid, const object_locator_t& oloc,
 
   logger->set(l_osdc_linger_active, linger_ops.size());
 
-  send_linger(info);
+  rwlock.get_write();
+  _send_linger(info);
+  rwlock.put_write();
 
   return info->linger_id;
 }
@@ -396,7 +437,9 @@ tid_t Objecter::linger_read(const object_t& oid, const object_locator_t& oloc,
 
   logger->set(l_osdc_linger_active, linger_ops.size());
 
-  send_linger(info);
+  rwlock.get_write();
+  _send_linger(info);
+  rwlock.put_write();
 
   return info->linger_id;
 }
@@ -430,9 +473,16 @@ void Objecter::dispatch(Message *m)
   }
 }
 
+/*
+ * Retarget every op and linger op for the current map.  Called with
+ * rwlock held for write; contexts for ops that turn out to be on a pool
+ * that does not exist are added to need_finish, for the caller to
+ * complete once it drops rwlock.
+ */
 void Objecter::scan_requests(bool skipped_map,
 			     map<tid_t, Op*>& need_resend,
-			     list<LingerOp*>& need_resend_linger)
+			     list<LingerOp*>& need_resend_linger,
+			     context_list_t& need_finish)
 {
   // check for changed linger mappings (_before_ regular ops)
   map<tid_t,LingerOp*>::iterator lp = linger_ops.begin();
@@ -452,31 +502,36 @@ void Objecter::scan_requests(bool skipped_map,
       linger_cancel_map_check(op);
       break;
     case RECALC_OP_TARGET_POOL_DNE:
-      check_linger_pool_dne(op);
+      need_resend_linger.remove(op);
+      check_linger_pool_dne(op, need_finish);
       break;
     }
   }
 
   // check for changed request mappings
-  map<tid_t,Op*>::iterator p = ops.begin();
-  while (p != ops.end()) {
-    Op *op = p->second;
-    ++p;   // check_op_pool_dne() may touch ops; prevent iterator invalidation
-    ldout(cct, 10) << " checking op " << op->tid << dendl;
-    int r = recalc_op_target(op);
-    switch (r) {
-    case RECALC_OP_TARGET_NO_ACTION:
-      // resend if skipped map; otherwise do nothing.
-      if (!skipped_map)
+  for (unsigned i = 0; i < NUM_OP_SHARDS; ++i) {
+    map<tid_t,Op*>& ops = op_shards[i].ops;
+    map<tid_t,Op*>::iterator p = ops.begin();
+    while (p != ops.end()) {
+      Op *op = p->second;
+      ++p;   // check_op_pool_dne() may touch ops; prevent iterator invalidation
+      ldout(cct, 10) << " checking op " << op->tid << dendl;
+      int r = recalc_op_target(op, true);
+      switch (r) {
+      case RECALC_OP_TARGET_NO_ACTION:
+	// resend if skipped map; otherwise do nothing.
+	if (!skipped_map)
+	  break;
+	// -- fall-thru --
+      case RECALC_OP_TARGET_NEED_RESEND:
+	need_resend[op->tid] = op;
+	op_cancel_map_check(op);
 	break;
-      // -- fall-thru --
-    case RECALC_OP_TARGET_NEED_RESEND:
-      need_resend[op->tid] = op;
-      op_cancel_map_check(op);
-      break;
-    case RECALC_OP_TARGET_POOL_DNE:
-      check_op_pool_dne(op);
-      break;
+      case RECALC_OP_TARGET_POOL_DNE:
+	need_resend.erase(op->tid);
+	check_op_pool_dne(op, need_finish);
+	break;
+      }
     }
   }
 }
@@ -493,11 +548,14 @@ void Objecter::handle_osd_map(MOSDMap *m)
     return;
   }
 
+  rwlock.get_write();
+
   bool was_pauserd = osdmap->test_flag(CEPH_OSDMAP_PAUSERD);
   bool was_pausewr = osdmap->test_flag(CEPH_OSDMAP_PAUSEWR) || osdmap->test_flag(CEPH_OSDMAP_FULL);
   
   list<LingerOp*> need_resend_linger;
   map<tid_t, Op*> need_resend;
+  context_list_t need_finish;
 
   bool skipped_map = false;
 
@@ -543,10 +601,9 @@ void Objecter::handle_osd_map(MOSDMap *m)
 	  continue;
 	}
 	logger->set(l_osdc_map_epoch, osdmap->get_epoch());
-	
-	scan_requests(skipped_map, need_resend, need_resend_linger);
 
-	// osd addr changes?
+	// osd addr changes?  close those sessions first, so that their
+	// ops are retargeted below.
 	for (map<int,OSDSession*>::iterator p = osd_sessions.begin();
 	     p != osd_sessions.end(); ) {
 	  OSDSession *s = p->second;
@@ -559,6 +616,8 @@ void Objecter::handle_osd_map(MOSDMap *m)
 	  }
 	}
 
+	scan_requests(skipped_map, need_resend, need_resend_linger, need_finish);
+
 	assert(e == osdmap->get_epoch());
       }
       
@@ -568,7 +627,7 @@ void Objecter::handle_osd_map(MOSDMap *m)
 	ldout(cct, 3) << "handle_osd_map decoding full epoch " << m->get_last() << dendl;
 	osdmap->decode(m->maps[m->get_last()]);
 
-	scan_requests(false, need_resend, need_resend_linger);
+	scan_requests(false, need_resend, need_resend_linger, need_finish);
       } else {
 	ldout(cct, 3) << "handle_osd_map hmm, i want a full map, requesting" << dendl;
 	monc->sub_want("osdmap", 0, CEPH_SUBSCRIBE_ONETIME);
@@ -587,14 +646,16 @@ void Objecter::handle_osd_map(MOSDMap *m)
   // unpause requests?
   if ((was_pauserd && !pauserd) ||
       (was_pausewr && !pausewr))
-    for (map<tid_t,Op*>::iterator p = ops.begin();
-	 p != ops.end();
-	 p++) {
-      Op *op = p->second;
-      if (op->paused &&
-	  !((op->flags & CEPH_OSD_FLAG_READ) && pauserd) &&   // not still paused as a read
-	  !((op->flags & CEPH_OSD_FLAG_WRITE) && pausewr))    // not still paused as a write
-	need_resend[op->tid] = op;
+    for (unsigned i = 0; i < NUM_OP_SHARDS; ++i) {
+      for (map<tid_t,Op*>::iterator p = op_shards[i].ops.begin();
+	   p != op_shards[i].ops.end();
+	   p++) {
+	Op *op = p->second;
+	if (op->paused &&
+	    !((op->flags & CEPH_OSD_FLAG_READ) && pauserd) &&   // not still paused as a read
+	    !((op->flags & CEPH_OSD_FLAG_WRITE) && pausewr))    // not still paused as a write
+	  need_resend[op->tid] = op;
+      }
     }
 
   // resend requests
@@ -613,12 +674,16 @@ void Objecter::handle_osd_map(MOSDMap *m)
     LingerOp *op = *p;
     if (op->session) {
       logger->inc(l_osdc_linger_resend);
-      send_linger(op);
+      _send_linger(op);
     }
   }
 
   dump_active();
-  
+
+  rwlock.put_write();
+
+  finish_contexts(need_finish);
+
   // finish any Contexts that were waiting on a map update
   map<epoch_t,list< pair< Context*, int > > >::iterator p =
     waiting_for_map.begin();
@@ -652,25 +717,32 @@ void Objecter::C_Op_Map_Latest::finish(int r)
 
   Mutex::Locker l(objecter->client_lock);
 
-  map<tid_t, Op*>::iterator iter =
-    objecter->check_latest_map_ops.find(tid);
-  if (iter == objecter->check_latest_map_ops.end()) {
-    lgeneric_subdout(objecter->cct, objecter, 10) << "op_map_latest op " << tid << " not found" << dendl;
-    return;
-  }
+  context_list_t need_finish;
+  {
+    RWLock::WLocker wl(objecter->rwlock);
 
-  Op *op = iter->second;
-  objecter->check_latest_map_ops.erase(iter);
+    map<tid_t, Op*>::iterator iter =
+      objecter->check_latest_map_ops.find(tid);
+    if (iter == objecter->check_latest_map_ops.end()) {
+      lgeneric_subdout(objecter->cct, objecter, 10) << "op_map_latest op " << tid << " not found" << dendl;
+      return;
+    }
+
+    Op *op = iter->second;
+    objecter->check_latest_map_ops.erase(iter);
 
-  lgeneric_subdout(objecter->cct, objecter, 20) << "op_map_latest op " << op << dendl;
+    lgeneric_subdout(objecter->cct, objecter, 20) << "op_map_latest op " << op << dendl;
 
-  if (op->map_dne_bound == 0)
-    op->map_dne_bound = latest;
+    if (op->map_dne_bound == 0)
+      op->map_dne_bound = latest;
 
-  objecter->check_op_pool_dne(op);
+    objecter->check_op_pool_dne(op, need_finish);
+  }
+  objecter->finish_contexts(need_finish);
 }
 
-void Objecter::check_op_pool_dne(Op *op)
+/// rwlock must be held for write; completions are added to @finish
+void Objecter::check_op_pool_dne(Op *op, context_list_t& finish)
 {
   ldout(cct, 10) << "check_op_pool_dne tid " << op->tid
 		 << " current " << osdmap->get_epoch()
@@ -683,14 +755,16 @@ void Objecter::check_op_pool_dne(Op *op)
 		     << " concluding pool " << op->pgid.pool() << " dne"
 		     << dendl;
       if (op->onack) {
-	op->onack->complete(-ENOENT);
+	finish.push_back(make_pair(op->onack, -ENOENT));
+	op->onack = NULL;
+	num_unacked.dec();
       }
       if (op->oncommit) {
-	op->oncommit->complete(-ENOENT);
+	finish.push_back(make_pair(op->oncommit, -ENOENT));
+	op->oncommit = NULL;
+	num_uncommitted.dec();
       }
-      op->session_item.remove_myself();
-      ops.erase(op->tid);
-      delete op;
+      finish_op(op);
     }
   } else {
     _send_op_map_check(op);
@@ -716,23 +790,30 @@ void Objecter::C_Linger_Map_Latest::finish(int r)
 
   Mutex::Locker l(objecter->client_lock);
 
-  map<uint64_t, LingerOp*>::iterator iter =
-    objecter->check_latest_map_lingers.find(linger_id);
-  if (iter == objecter->check_latest_map_lingers.end()) {
-    return;
-  }
+  context_list_t need_finish;
+  {
+    RWLock::WLocker wl(objecter->rwlock);
 
-  LingerOp *op = iter->second;
-  objecter->check_latest_map_lingers.erase(iter);
-  op->put();
+    map<uint64_t, LingerOp*>::iterator iter =
+      objecter->check_latest_map_lingers.find(linger_id);
+    if (iter == objecter->check_latest_map_lingers.end()) {
+      return;
+    }
 
-  if (op->map_dne_bound == 0)
-    op->map_dne_bound = latest;
+    LingerOp *op = iter->second;
+    objecter->check_latest_map_lingers.erase(iter);
+    op->put();
 
-  objecter->check_linger_pool_dne(op);
+    if (op->map_dne_bound == 0)
+      op->map_dne_bound = latest;
+
+    objecter->check_linger_pool_dne(op, need_finish);
+  }
+  objecter->finish_contexts(need_finish);
 }
 
-void Objecter::check_linger_pool_dne(LingerOp *op)
+/// rwlock must be held for write; completions are added to @finish
+void Objecter::check_linger_pool_dne(LingerOp *op, context_list_t& finish)
 {
   ldout(cct, 10) << "check_linger_pool_dne linger_id " << op->linger_id
 		 << " current " << osdmap->get_epoch()
@@ -741,12 +822,14 @@ void Objecter::check_linger_pool_dne(LingerOp *op)
   if (op->map_dne_bound > 0) {
     if (osdmap->get_epoch() >= op->map_dne_bound) {
       if (op->on_reg_ack) {
-	op->on_reg_ack->complete(-ENOENT);
+	finish.push_back(make_pair(op->on_reg_ack, -ENOENT));
+	op->on_reg_ack = NULL;
       }
       if (op->on_reg_commit) {
-	op->on_reg_commit->complete(-ENOENT);
+	finish.push_back(make_pair(op->on_reg_commit, -ENOENT));
+	op->on_reg_commit = NULL;
       }
-      unregister_linger(op->linger_id);
+      _unregister_linger(op->linger_id);
     }
   } else {
     _send_linger_map_check(op);
@@ -773,6 +856,13 @@ void Objecter::op_cancel_map_check(Op *op)
   }
 }
 
+void Objecter::finish_contexts(context_list_t& ls)
+{
+  for (context_list_t::iterator p = ls.begin(); p != ls.end(); ++p)
+    p->first->complete(p->second);
+  ls.clear();
+}
+
 void Objecter::linger_cancel_map_check(LingerOp *op)
 {
   map<uint64_t, LingerOp*>::iterator iter =
@@ -784,17 +874,26 @@ void Objecter::linger_cancel_map_check(LingerOp *op)
   }
 }
 
-Objecter::OSDSession *Objecter::get_session(int osd)
+/*
+ * Find the session for @osd, opening it if we need to.  Only a writer
+ * may open one; with rwlock held for read, return -EAGAIN instead.
+ */
+int Objecter::get_session(int osd, OSDSession **session, bool wlocked)
 {
   map<int,OSDSession*>::iterator p = osd_sessions.find(osd);
-  if (p != osd_sessions.end())
-    return p->second;
+  if (p != osd_sessions.end()) {
+    *session = p->second;
+    return 0;
+  }
+  if (!wlocked)
+    return -EAGAIN;
   OSDSession *s = new OSDSession(osd);
   osd_sessions[osd] = s;
   s->con = messenger->get_connection(osdmap->get_inst(osd));
   logger->inc(l_osdc_osd_session_open);
   logger->inc(l_osdc_osd_sessions, osd_sessions.size());
-  return s;
+  *session = s;
+  return 0;
 }
 
 void Objecter::reopen_session(OSDSession *s)
@@ -819,8 +918,23 @@ void Objecter::close_session(OSDSession *s)
     s->con->put();
     logger->inc(l_osdc_osd_session_close);
   }
-  s->ops.clear();
-  s->linger_ops.clear();
+  // the ops are homeless until they are retargeted; clear their acting
+  // sets so that happens on the next scan even if the mapping is the same
+  for (xlist<Op*>::iterator p = s->ops.begin(); !p.end(); ) {
+    Op *op = *p;
+    ++p;
+    op->session_item.remove_myself();
+    op->session = NULL;
+    op->acting.clear();
+    num_homeless_ops.inc();
+  }
+  for (xlist<LingerOp*>::iterator p = s->linger_ops.begin(); !p.end(); ) {
+    LingerOp *op = *p;
+    ++p;
+    op->session_item.remove_myself();
+    op->session = NULL;
+    op->acting.clear();
+  }
   osd_sessions.erase(s->osd);
   delete s;
 
@@ -890,7 +1004,7 @@ void Objecter::kick_requests(OSDSession *session)
     lresend[(*j)->linger_id] = *j;
   }
   while (!lresend.empty()) {
-    send_linger(lresend.begin()->second);
+    _send_linger(lresend.begin()->second);
     lresend.erase(lresend.begin());
   }
 }
@@ -918,15 +1032,20 @@ void Objecter::tick()
   utime_t cutoff = ceph_clock_now(cct);
   cutoff -= cct->_conf->objecter_timeout;  // timeout
 
+  RWLock::RLocker rl(rwlock);
+
   unsigned laggy_ops = 0;
-  for (map<tid_t,Op*>::iterator p = ops.begin();
-       p != ops.end();
-       p++) {
-    Op *op = p->second;
-    if (op->session && op->stamp < cutoff) {
-      ldout(cct, 2) << " tid " << p->first << " on osd." << op->session->osd << " is laggy" << dendl;
-      toping.insert(op->session);
-      ++laggy_ops;
+  for (unsigned i = 0; i < NUM_OP_SHARDS; ++i) {
+    Mutex::Locker l(op_shards[i].lock);
+    for (map<tid_t,Op*>::iterator p = op_shards[i].ops.begin();
+	 p != op_shards[i].ops.end();
+	 p++) {
+      Op *op = p->second;
+      if (op->session && op->stamp < cutoff) {
+	ldout(cct, 2) << " tid " << p->first << " on osd." << op->session->osd << " is laggy" << dendl;
+	toping.insert(op->session);
+	++laggy_ops;
+      }
     }
   }
   for (map<uint64_t,LingerOp*>::iterator p = linger_ops.begin();
@@ -943,7 +1062,7 @@ void Objecter::tick()
   logger->set(l_osdc_op_laggy, laggy_ops);
   logger->set(l_osdc_osd_laggy, toping.size());
 
-  if (num_homeless_ops || !toping.empty())
+  if (num_homeless_ops.read() || !toping.empty())
     maybe_request_map();
 
   if (!toping.empty()) {
@@ -979,6 +1098,7 @@ void Objecter::resend_mon_ops()
     logger->inc(l_osdc_poolop_resend);
   }
 
+  RWLock::RLocker rl(rwlock);
   for (map<tid_t, Op*>::iterator p = check_latest_map_ops.begin();
        p != check_latest_map_ops.end();
        ++p) {
@@ -1000,46 +1120,76 @@ void Objecter::resend_mon_ops()
 
 tid_t Objecter::op_submit(Op *op)
 {
-  assert(client_lock.is_locked());
   assert(initialized);
 
   assert(op->ops.size() == op->out_bl.size());
   assert(op->ops.size() == op->out_rval.size());
   assert(op->ops.size() == op->out_handler.size());
 
-  // throttle.  before we look at any state, because
-  // take_op_budget() may drop our lock while it blocks.
+  // throttle.  before we take any of our locks, because
+  // take_op_budget() may block (dropping client_lock, if we hold it).
   take_op_budget(op);
 
-  return _op_submit(op);
+  return _op_submit_with_rwlock(op);
+}
+
+/*
+ * Submit with rwlock held for read, which is all most ops need.  If
+ * this one needs more (a session we haven't opened yet, or a pool we
+ * don't know about), do it again with rwlock held for write.
+ */
+tid_t Objecter::_op_submit_with_rwlock(Op *op)
+{
+  rwlock.get_read();
+  tid_t tid = _op_submit(op, false);
+  rwlock.put_read();
+  if (!tid) {
+    RWLock::WLocker wl(rwlock);
+    tid = _op_submit(op, true);
+    assert(tid);
+  }
+  return tid;
 }
 
-tid_t Objecter::_op_submit(Op *op)
+/*
+ * rwlock must be held, for write if @wlocked.  Returns the op's tid,
+ * or 0 if it needs rwlock held for write and we only hold it for read;
+ * nothing has been done with the op in that case.  The op may already
+ * be completed (and gone) by the time this returns.
+ */
+tid_t Objecter::_op_submit(Op *op, bool wlocked)
 {
   // pick tid
+  tid_lock.Lock();
   tid_t mytid = ++last_tid;
+  tid_lock.Unlock();
   op->tid = mytid;
   assert(client_inc >= 0);
 
   // pick target
-  num_homeless_ops++;  // initially; recalc_op_target() will decrement if it finds a target
-  int r = recalc_op_target(op);
+  if (!op->session)
+    num_homeless_ops.inc();  // initially; recalc_op_target() will decrement if it finds a target
+  int r = recalc_op_target(op, wlocked);
+  if (r == RECALC_OP_TARGET_NEED_WRITE_LOCK ||
+      (r == RECALC_OP_TARGET_POOL_DNE && !wlocked)) {
+    if (!op->session)
+      num_homeless_ops.dec();
+    ldout(cct, 15) << "op_submit tid " << mytid << " needs rwlock for write" << dendl;
+    return 0;
+  }
   bool check_for_latest_map = (r == RECALC_OP_TARGET_POOL_DNE);
 
   // add to gather set(s)
   if (op->onack) {
-    ++num_unacked;
+    num_unacked.inc();
   } else {
     ldout(cct, 20) << " note: not requesting ack" << dendl;
   }
   if (op->oncommit) {
-    ++num_uncommitted;
+    num_uncommitted.inc();
   } else {
     ldout(cct, 20) << " note: not requesting commit" << dendl;
   }
-  ops[op->tid] = op;
-
-  logger->set(l_osdc_op_active, ops.size());
 
   logger->inc(l_osdc_op);
   if ((op->flags & (CEPH_OSD_FLAG_READ|CEPH_OSD_FLAG_WRITE)) == (CEPH_OSD_FLAG_READ|CEPH_OSD_FLAG_WRITE))
@@ -1084,6 +1234,13 @@ tid_t Objecter::_op_submit(Op *op)
       logger->inc(code);
   }
 
+  // the op is visible once it is in its shard; hold the shard lock
+  // until we're done with it, so a reply can't complete it under us
+  OpShard& shard = get_op_shard(mytid);
+  shard.lock.Lock();
+  shard.ops[mytid] = op;
+  logger->set(l_osdc_op_active, num_ops.inc());
+
   // send?
   ldout(cct, 10) << "op_submit oid " << op->oid
            << " " << op->oloc 
@@ -1095,17 +1252,17 @@ tid_t Objecter::_op_submit(Op *op)
 
   if ((op->flags & CEPH_OSD_FLAG_WRITE) &&
       osdmap->test_flag(CEPH_OSDMAP_PAUSEWR)) {
-    ldout(cct, 10) << " paused modify " << op << " tid " << last_tid << dendl;
+    ldout(cct, 10) << " paused modify " << op << " tid " << mytid << dendl;
     op->paused = true;
     maybe_request_map();
   } else if ((op->flags & CEPH_OSD_FLAG_READ) &&
 	     osdmap->test_flag(CEPH_OSDMAP_PAUSERD)) {
-    ldout(cct, 10) << " paused read " << op << " tid " << last_tid << dendl;
+    ldout(cct, 10) << " paused read " << op << " tid " << mytid << dendl;
     op->paused = true;
     maybe_request_map();
   } else if ((op->flags & CEPH_OSD_FLAG_WRITE) &&
 	     osdmap->test_flag(CEPH_OSDMAP_FULL)) {
-    ldout(cct, 0) << " FULL, paused modify " << op << " tid " << last_tid << dendl;
+    ldout(cct, 0) << " FULL, paused modify " << op << " tid " << mytid << dendl;
     op->paused = true;
     maybe_request_map();
   } else if (op->session) {
@@ -1117,10 +1274,11 @@ tid_t Objecter::_op_submit(Op *op)
   if (check_for_latest_map) {
     _send_op_map_check(op);
   }
+  shard.lock.Unlock();
 
-  ldout(cct, 5) << num_unacked << " unacked, " << num_uncommitted << " uncommitted" << dendl;
+  ldout(cct, 5) << num_unacked.read() << " unacked, " << num_uncommitted.read() << " uncommitted" << dendl;
   
-  return op->tid;
+  return mytid;
 }
 
 bool Objecter::is_pg_changed(vector<int>& o, vector<int>& n, bool any_change)
@@ -1136,7 +1294,12 @@ bool Objecter::is_pg_changed(vector<int>& o, vector<int>& n, bool any_change)
   return false;      // same primary (tho replicas may have changed)
 }
 
-int Objecter::recalc_op_target(Op *op)
+/*
+ * rwlock must be held, for write if @wlocked.  If the op needs a
+ * session that isn't open yet and we only hold it for read, return
+ * RECALC_OP_TARGET_NEED_WRITE_LOCK without changing the op.
+ */
+int Objecter::recalc_op_target(Op *op, bool wlocked)
 {
   vector<int> acting;
   pg_t pgid = op->pgid;
@@ -1145,64 +1308,120 @@ int Objecter::recalc_op_target(Op *op)
     if (!osdmap->have_pg_pool(pgid.pool()))
       return RECALC_OP_TARGET_POOL_DNE;
   } else {
-    int ret = osdmap->object_locator_to_pg(op->oid, op->oloc, pgid);
+    // send ops on a pool with an overlay (cache tier) to the tier
+    op->target_oloc = op->oloc;
+    if ((op->flags & CEPH_OSD_FLAG_IGNORE_OVERLAY) == 0) {
+      const pg_pool_t *pi = osdmap->get_pg_pool(op->oloc.pool);
+      if (pi) {
+	if ((op->flags & CEPH_OSD_FLAG_READ) && pi->has_read_tier())
+	  op->target_oloc.pool = pi->read_tier;
+	if ((op->flags & CEPH_OSD_FLAG_WRITE) && pi->has_write_tier())
+	  op->target_oloc.pool = pi->write_tier;
+      }
+    }
+    int ret = osdmap->object_locator_to_pg(op->oid, op->target_oloc, pgid);
     if (ret == -ENOENT)
       return RECALC_OP_TARGET_POOL_DNE;
   }
   osdmap->pg_to_acting_osds(pgid, acting);
 
   if (op->pgid != pgid || is_pg_changed(op->acting, acting, op->used_replica)) {
-    op->pgid = pgid;
-    op->acting = acting;
     ldout(cct, 10) << "recalc_op_target tid " << op->tid
 	     << " pgid " << pgid << " acting " << acting << dendl;
 
     OSDSession *s = NULL;
-    op->used_replica = false;
+    bool used_replica = false;
     if (!acting.empty()) {
       int osd;
       bool read = (op->flags & CEPH_OSD_FLAG_READ) && (op->flags & CEPH_OSD_FLAG_WRITE) == 0;
       if (read && (op->flags & CEPH_OSD_FLAG_BALANCE_READS)) {
 	int p = rand() % acting.size();
 	if (p)
-	  op->used_replica = true;
+	  used_replica = true;
 	osd = acting[p];
 	ldout(cct, 10) << " chose random osd." << osd << " of " << acting << dendl;
       } else if (read && (op->flags & CEPH_OSD_FLAG_LOCALIZE_READS)) {
-	// look for a local replica
-	int i;
-	/* loop through the OSD replicas and see if any are local to read from.
-	 * We don't need to check the primary since we default to it. (Be
-         * careful to preserve that default, which is why we iterate in reverse
-         * order.) */
-	for (i = acting.size()-1; i > 0; --i) {
-	  if (osdmap->get_addr(acting[i]).is_same_host(messenger->get_myaddr())) {
-	    op->used_replica = true;
-	    ldout(cct, 10) << " chose local osd." << acting[i] << " of " << acting << dendl;
-	    break;
+	// pick the closest replica; the primary wins ties, and is the
+	// default if none of them are near us.
+	unsigned best = 0;
+	int best_distance = get_osd_distance(acting[0]);
+	for (unsigned i = 1; i < acting.size(); ++i) {
+	  int d = get_osd_distance(acting[i]);
+	  if (d >= 0 && (best_distance < 0 || d < best_distance)) {
+	    best = i;
+	    best_distance = d;
 	  }
 	}
-	osd = acting[i];
+	if (best)
+	  used_replica = true;
+	osd = acting[best];
+	ldout(cct, 10) << " chose local osd." << osd << " (distance " << best_distance
+		       << ") of " << acting << dendl;
       } else
 	osd = acting[0];
-      s = get_session(osd);
+      if (get_session(osd, &s, wlocked) < 0)
+	return RECALC_OP_TARGET_NEED_WRITE_LOCK;
     }
 
+    op->pgid = pgid;
+    op->acting = acting;
+    op->used_replica = used_replica;
     if (op->session != s) {
-      if (!op->session)
-	num_homeless_ops--;
-      op->session_item.remove_myself();
-      op->session = s;
+      if (op->session)
+	_session_op_remove(op);
+      else
+	num_homeless_ops.dec();
       if (s)
-	s->ops.push_back(&op->session_item);
+	_session_op_assign(s, op);
       else
-	num_homeless_ops++;
+	num_homeless_ops.inc();
     }
     return RECALC_OP_TARGET_NEED_RESEND;
   }
   return RECALC_OP_TARGET_NO_ACTION;
 }
 
+/*
+ * How close @osd is to us: 0 if it shares our address, otherwise the
+ * crush type id of the lowest bucket above it that matches our
+ * crush_location (so lower is closer), or -1 if we don't know.
+ */
+int Objecter::get_osd_distance(int osd)
+{
+  Mutex::Locker l(osd_distance_lock);
+  if (osd_distance_epoch != osdmap->get_epoch()) {
+    osd_distance.clear();
+    osd_distance_epoch = osdmap->get_epoch();
+  }
+  map<int, int>::iterator p = osd_distance.find(osd);
+  if (p != osd_distance.end())
+    return p->second;
+
+  int distance = -1;
+  if (osdmap->get_addr(osd).is_same_host(messenger->get_myaddr())) {
+    distance = 0;
+  } else if (!crush_location.empty()) {
+    CrushWrapper *crush = osdmap->crush.get();
+    int id = osd, parent;
+    while (crush->get_immediate_parent_id(id, &parent) == 0) {
+      int type = crush->get_bucket_type(parent);
+      const char *type_name = crush->get_type_name(type);
+      const char *name = crush->get_item_name(parent);
+      if (type_name && name) {
+	map<string, string>::iterator q = crush_location.find(type_name);
+	if (q != crush_location.end() && q->second == name) {
+	  distance = type;
+	  break;
+	}
+      }
+      id = parent;
+    }
+  }
+  ldout(cct, 20) << "get_osd_distance osd." << osd << " = " << distance << dendl;
+  osd_distance[osd] = distance;
+  return distance;
+}
+
 bool Objecter::recalc_linger_op_target(LingerOp *linger_op)
 {
   vector<int> acting;
@@ -1219,7 +1438,9 @@ bool Objecter::recalc_linger_op_target(LingerOp *linger_op)
     ldout(cct, 10) << "recalc_linger_op_target tid " << linger_op->linger_id
 	     << " pgid " << pgid << " acting " << acting << dendl;
     
-    OSDSession *s = acting.size() ? get_session(acting[0]) : NULL;
+    OSDSession *s = NULL;
+    if (acting.size())
+      get_session(acting[0], &s, true);
     if (linger_op->session != s) {
       linger_op->session_item.remove_myself();
       linger_op->session = s;
@@ -1238,28 +1459,66 @@ void Objecter::cancel_op(Op *op)
   // currently this only works for linger registrations, since we just
   // throw out the callbacks.
   assert(!op->should_resend);
-  delete op->onack;
-  delete op->oncommit;
+  if (op->onack) {
+    delete op->onack;
+    num_unacked.dec();
+  }
+  if (op->oncommit) {
+    delete op->oncommit;
+    num_uncommitted.dec();
+  }
+  op_cancel_map_check(op);
 
   finish_op(op);
 }
 
+/*
+ * Callers hold rwlock for write, or for read along with the op's
+ * shard lock.
+ */
 void Objecter::finish_op(Op *op)
 {
   ldout(cct, 15) << "finish_op " << op->tid << dendl;
 
-  op->session_item.remove_myself();
+  if (op->session)
+    _session_op_remove(op);
+  else
+    num_homeless_ops.dec();
   if (op->budgeted)
     put_op_budget(op);
   if (op->con)
     op->con->put();
 
-  ops.erase(op->tid);
-  logger->set(l_osdc_op_active, ops.size());
+  get_op_shard(op->tid).ops.erase(op->tid);
+  logger->set(l_osdc_op_active, num_ops.dec());
 
   delete op;
 }
 
+/*
+ * Link an op into, or unlink it from, its session's list.  Callers
+ * hold rwlock, and either hold it for write, or the op's shard lock,
+ * or the op isn't in a shard yet.
+ */
+void Objecter::_session_op_assign(OSDSession *s, Op *op)
+{
+  assert(op->session == NULL);
+  s->lock.Lock();
+  s->ops.push_back(&op->session_item);
+  s->lock.Unlock();
+  op->session = s;
+}
+
+void Objecter::_session_op_remove(Op *op)
+{
+  OSDSession *s = op->session;
+  assert(s);
+  s->lock.Lock();
+  op->session_item.remove_myself();
+  s->lock.Unlock();
+  op->session = NULL;
+}
+
 void Objecter::send_op(Op *op)
 {
   ldout(cct, 15) << "send_op " << op->tid << " to osd." << op->session->osd << dendl;
@@ -1289,7 +1548,7 @@ void Objecter::send_op(Op *op)
   op->stamp = ceph_clock_now(cct);
 
   MOSDOp *m = new MOSDOp(client_inc, op->tid, 
-			 op->oid, op->oloc, op->pgid, osdmap->get_epoch(),
+			 op->oid, op->target_oloc, op->pgid, osdmap->get_epoch(),
 			 flags);
 
   m->set_snapid(op->snapid);
@@ -1310,6 +1569,8 @@ void Objecter::send_op(Op *op)
 
   logger->inc(l_osdc_op_send);
   logger->inc(l_osdc_op_send_bytes, m->get_data().length());
+  if (op->used_replica)
+    logger->inc(l_osdc_op_r_replica);
 
   messenger->send_message(m, op->session->con);
 }
@@ -1338,32 +1599,53 @@ void Objecter::throttle_op(Op *op, int op_budget)
 {
   if (!op_budget)
     op_budget = calc_op_budget(op);
+  bool locked = client_lock.is_locked_by_me();
   if (!op_throttle_bytes.get_or_fail(op_budget)) { //couldn't take right now
-    client_lock.Unlock();
+    if (locked)
+      client_lock.Unlock();
     op_throttle_bytes.get(op_budget);
-    client_lock.Lock();
+    if (locked)
+      client_lock.Lock();
   }
   if (!op_throttle_ops.get_or_fail(1)) { //couldn't take right now
-    client_lock.Unlock();
+    if (locked)
+      client_lock.Unlock();
     op_throttle_ops.get(1);
-    client_lock.Lock();
+    if (locked)
+      client_lock.Lock();
   }
 }
 
-/* This function DOES put the passed message before returning */
+/*
+ * This function DOES put the passed message before returning.
+ *
+ * The caller need not hold client_lock; the op is looked up and
+ * updated under rwlock (for read) and its shard lock, and the
+ * completions are called after both are dropped.
+ */
 void Objecter::handle_osd_op_reply(MOSDOpReply *m)
 {
-  assert(client_lock.is_locked());
-  assert(initialized);
   ldout(cct, 10) << "in handle_osd_op_reply" << dendl;
 
   // get pio
   tid_t tid = m->get_tid();
 
-  if (ops.count(tid) == 0) {
+  rwlock.get_read();
+  if (!initialized) {
+    rwlock.put_read();
+    m->put();
+    return;
+  }
+
+  OpShard& shard = get_op_shard(tid);
+  shard.lock.Lock();
+  map<tid_t,Op*>::iterator iter = shard.ops.find(tid);
+  if (iter == shard.ops.end()) {
     ldout(cct, 7) << "handle_osd_op_reply " << tid
 	    << (m->is_ondisk() ? " ondisk":(m->is_onnvram() ? " onnvram":" ack"))
 	    << " ... stray" << dendl;
+    shard.lock.Unlock();
+    rwlock.put_read();
     m->put();
     return;
   }
@@ -1373,14 +1655,16 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
 		<< " v " << m->get_version() << " in " << m->get_pg()
 		<< " attempt " << m->get_retry_attempt()
 		<< dendl;
-  Op *op = ops[tid];
+  Op *op = iter->second;
 
   if (m->get_retry_attempt() >= 0) {
     if (m->get_retry_attempt() != (op->attempts - 1)) {
       ldout(cct, 7) << " ignoring reply from attempt " << m->get_retry_attempt()
 		    << " from " << m->get_source_inst()
-		    << "; last attempt " << (op->attempts - 1) << " sent to "
-		    << op->session->con->get_peer_addr() << dendl;
+		    << "; last attempt " << (op->attempts - 1) << " sent to osd."
+		    << (op->session ? op->session->osd : -1) << dendl;
+      shard.lock.Unlock();
+      rwlock.put_read();
       m->put();
       return;
     }
@@ -1395,13 +1679,38 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
 
   int rc = m->get_result();
 
+  if (rc == -EAGAIN && op->used_replica) {
+    // the replica can't serve this read right now; go to the primary
+    ldout(cct, 7) << " got -EAGAIN from replica, resubmitting to primary" << dendl;
+    logger->inc(l_osdc_op_r_replica_bounce);
+    op->flags &= ~(CEPH_OSD_FLAG_BALANCE_READS | CEPH_OSD_FLAG_LOCALIZE_READS);
+    op->acting.clear();  // force recalc_op_target to pick a new target
+  }
   if (rc == -EAGAIN) {
     ldout(cct, 7) << " got -EAGAIN, resubmitting" << dendl;
     if (op->onack)
-      num_unacked--;
+      num_unacked.dec();
     if (op->oncommit)
-      num_uncommitted--;
-    op_submit(op);
+      num_uncommitted.dec();
+
+    // take it out entirely and submit it again, under a new tid, with
+    // the budget it already has
+    shard.ops.erase(iter);
+    logger->set(l_osdc_op_active, num_ops.dec());
+    if (op->session)
+      _session_op_remove(op);
+    else
+      num_homeless_ops.dec();
+    op->acting.clear();  // make recalc_op_target() pick a target
+    if (op->con) {
+      op->con->revoke_rx_buffer(op->tid);
+      op->con->put();
+      op->con = NULL;
+    }
+    shard.lock.Unlock();
+    rwlock.put_read();
+
+    _op_submit_with_rwlock(op);
     m->put();
     return;
   }
@@ -1448,14 +1757,14 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
     op->version = m->get_version();
     onack = op->onack;
     op->onack = 0;  // only do callback once
-    num_unacked--;
+    num_unacked.dec();
     logger->inc(l_osdc_op_ack);
   }
   if (op->oncommit && (m->is_ondisk() || rc)) {
     ldout(cct, 15) << "handle_osd_op_reply safe" << dendl;
     oncommit = op->oncommit;
     op->oncommit = 0;
-    num_uncommitted--;
+    num_uncommitted.dec();
     logger->inc(l_osdc_op_commit);
   }
 
@@ -1472,8 +1781,10 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
     ldout(cct, 15) << "handle_osd_op_reply completed tid " << tid << dendl;
     finish_op(op);
   }
+  shard.lock.Unlock();
+  rwlock.put_read();
   
-  ldout(cct, 5) << num_unacked << " unacked, " << num_uncommitted << " uncommitted" << dendl;
+  ldout(cct, 5) << num_unacked.read() << " unacked, " << num_uncommitted.read() << " uncommitted" << dendl;
 
   // do callbacks
   if (onack) {
@@ -1999,7 +2310,7 @@ void Objecter::ms_handle_connect(Connection *con)
 void Objecter::ms_handle_reset(Connection *con)
 {
   if (con->get_peer_type() == CEPH_ENTITY_TYPE_OSD) {
-    //
+    RWLock::WLocker wl(rwlock);
     int osd = osdmap->identify_osd(con->get_peer_addr());
     if (osd >= 0) {
       ldout(cct, 1) << "ms_handle_reset on osd." << osd << dendl;
@@ -2027,11 +2338,15 @@ void Objecter::ms_handle_remote_reset(Connection *con)
 
 void Objecter::dump_active()
 {
-  ldout(cct, 20) << "dump_active .. " << num_homeless_ops << " homeless" << dendl;
-  for (map<tid_t,Op*>::iterator p = ops.begin(); p != ops.end(); p++) {
-    Op *op = p->second;
-    ldout(cct, 20) << op->tid << "\t" << op->pgid << "\tosd." << (op->session ? op->session->osd : -1)
-	    << "\t" << op->oid << "\t" << op->ops << dendl;
+  ldout(cct, 20) << "dump_active .. " << num_homeless_ops.read() << " homeless" << dendl;
+  for (unsigned i = 0; i < NUM_OP_SHARDS; ++i) {
+    for (map<tid_t,Op*>::iterator p = op_shards[i].ops.begin();
+	 p != op_shards[i].ops.end();
+	 p++) {
+      Op *op = p->second;
+      ldout(cct, 20) << op->tid << "\t" << op->pgid << "\tosd." << (op->session ? op->session->osd : -1)
+	      << "\t" << op->oid << "\t" << op->ops << dendl;
+    }
   }
 }
 
@@ -2051,31 +2366,33 @@ void Objecter::dump_requests(Formatter& fmt) const
 void Objecter::dump_ops(Formatter& fmt) const
 {
   fmt.open_array_section("ops");
-  for (map<tid_t,Op*>::const_iterator p = ops.begin();
-       p != ops.end();
-       ++p) {
-    Op *op = p->second;
-    fmt.open_object_section("op");
-    fmt.dump_unsigned("tid", op->tid);
-    fmt.dump_stream("pg") << op->pgid;
-    fmt.dump_int("osd", op->session ? op->session->osd : -1);
-    fmt.dump_stream("last_sent") << op->stamp;
-    fmt.dump_int("attempts", op->attempts);
-    fmt.dump_stream("object_id") << op->oid;
-    fmt.dump_stream("object_locator") << op->oloc;
-    fmt.dump_stream("snapid") << op->snapid;
-    fmt.dump_stream("snap_context") << op->snapc;
-    fmt.dump_stream("mtime") << op->mtime;
+  for (unsigned i = 0; i < NUM_OP_SHARDS; ++i) {
+    for (map<tid_t,Op*>::const_iterator p = op_shards[i].ops.begin();
+	 p != op_shards[i].ops.end();
+	 ++p) {
+      Op *op = p->second;
+      fmt.open_object_section("op");
+      fmt.dump_unsigned("tid", op->tid);
+      fmt.dump_stream("pg") << op->pgid;
+      fmt.dump_int("osd", op->session ? op->session->osd : -1);
+      fmt.dump_stream("last_sent") << op->stamp;
+      fmt.dump_int("attempts", op->attempts);
+      fmt.dump_stream("object_id") << op->oid;
+      fmt.dump_stream("object_locator") << op->oloc;
+      fmt.dump_stream("snapid") << op->snapid;
+      fmt.dump_stream("snap_context") << op->snapc;
+      fmt.dump_stream("mtime") << op->mtime;
+
+      fmt.open_array_section("osd_ops");
+      for (vector<OSDOp>::const_iterator it = op->ops.begin();
+	   it != op->ops.end();
+	   ++it) {
+	fmt.dump_stream("osd_op") << *it;
+      }
+      fmt.close_section(); // osd_ops array
 
-    fmt.open_array_section("osd_ops");
-    for (vector<OSDOp>::const_iterator it = op->ops.begin();
-	 it != op->ops.end();
-	 ++it) {
-      fmt.dump_stream("osd_op") << *it;
+      fmt.close_section(); // op object
     }
-    fmt.close_section(); // osd_ops array
-
-    fmt.close_section(); // op object
   }
   fmt.close_section(); // ops array
 }
@@ -2171,7 +2488,9 @@ bool Objecter::RequestStateHook::call(std::string command, std::string args, buf
   stringstream ss;
   JSONFormatter formatter(true);
   m_objecter->client_lock.Lock();
+  m_objecter->rwlock.get_write();
   m_objecter->dump_requests(formatter);
+  m_objecter->rwlock.put_write();
   m_objecter->client_lock.Unlock();
   formatter.flush(ss);
   out.append(ss);
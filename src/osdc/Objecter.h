@@ -16,6 +16,7 @@
 #define CEPH_OBJECTER_H
 
 #include "include/types.h"
+#include "include/atomic.h"
 #include "include/buffer.h"
 #include "include/xlist.h"
 
@@ -23,8 +24,10 @@
 #include "messages/MOSDOp.h"
 
 #include "common/admin_socket.h"
+#include "common/RWLock.h"
 #include "common/Timer.h"
 #include "include/rados/rados_types.h"
+#include "include/rados/rados_types.hpp"
 
 #include <list>
 #include <map>
@@ -344,6 +347,44 @@ struct ObjectOperation {
       }	
     }
   };
+  struct C_ObjectOperation_decodesnaps : public Context {
+    bufferlist bl;
+    librados::snap_set_t *psnaps;
+    int *prval;
+    C_ObjectOperation_decodesnaps(librados::snap_set_t *ps, int *pr)
+      : psnaps(ps), prval(pr) {}
+    void finish(int r) {
+      if (r >= 0) {
+	bufferlist::iterator p = bl.begin();
+	try {
+	  obj_list_snap_response_t resp;
+	  ::decode(resp, p);
+	  if (psnaps) {
+	    psnaps->clones.clear();
+	    for (vector<clone_info>::iterator ci = resp.clones.begin();
+		 ci != resp.clones.end();
+		 ++ci) {
+	      librados::clone_info_t clone;
+	      clone.cloneid = ci->cloneid;
+	      clone.snaps.reserve(ci->snaps.size());
+	      clone.snaps.insert(clone.snaps.end(), ci->snaps.begin(),
+				 ci->snaps.end());
+	      clone.overlap = ci->overlap;
+	      clone.size = ci->size;
+	      psnaps->clones.push_back(clone);
+	    }
+	    psnaps->seq = resp.seq;
+	  }
+	  if (prval)
+	    *prval = 0;
+	}
+	catch (buffer::error& e) {
+	  if (prval)
+	    *prval = -EIO;
+	}
+      }
+    }
+  };
   void getxattrs(std::map<std::string,bufferlist> *pattrs, int *prval) {
     add_op(CEPH_OSD_OP_GETXATTRS);
     if (pattrs || prval) {
@@ -539,6 +580,18 @@ struct ObjectOperation {
     }
   }
 
+  void list_snaps(librados::snap_set_t *out, int *prval) {
+    (void)add_op(CEPH_OSD_OP_LIST_SNAPS);
+    if (prval || out) {
+      unsigned p = ops.size() - 1;
+      C_ObjectOperation_decodesnaps *h =
+	new C_ObjectOperation_decodesnaps(out, prval);
+      out_handler[p] = h;
+      out_bl[p] = &h->bl;
+      out_rval[p] = prval;
+    }
+  }
+
   void assert_version(uint64_t ver) {
     bufferlist bl;
     add_watch(CEPH_OSD_OP_ASSERT_VER, 0, ver, 0, bl);
@@ -582,11 +635,12 @@ class Objecter {
   bool initialized;
  
  private:
-  tid_t last_tid;
+  Mutex tid_lock;
+  tid_t last_tid;  ///< protected by tid_lock
   int client_inc;
   uint64_t max_linger_id;
-  int num_unacked;
-  int num_uncommitted;
+  atomic_t num_unacked;
+  atomic_t num_uncommitted;
   int global_op_flags; // flags which are applied to each IO op
   bool keep_balanced_budget;
   bool honor_osdmap_full;
@@ -599,6 +653,50 @@ class Objecter {
   Mutex &client_lock;
   SafeTimer &timer;
 
+  /**
+   * Locking
+   *
+   * rwlock protects the osdmap, the session map and the map-check
+   * lists.  Ops are submitted, and their replies handled, without
+   * client_lock: those paths take rwlock for read, plus the tid shard
+   * lock of the op they work on and, briefly, the lock of its OSD
+   * session.  A submission that has to open a session, or to check on a
+   * pool we don't know about, is retried with rwlock held for write,
+   * still without client_lock.  So client_lock alone does not keep the
+   * session map from changing; take rwlock to look at it.
+   *
+   * Map handling, session resets and closes, linger registration and
+   * the map-check callbacks hold client_lock and rwlock for write, which
+   * lets them retarget ops in bulk and change ops and sessions without
+   * their own locks.  The osdmap is only replaced there, so either lock
+   * is enough to read it.  The linger op map is protected by client_lock.
+   * The tick only reads: it holds client_lock, rwlock for read, and each
+   * shard lock in turn.
+   *
+   * Lock order: client_lock, rwlock, tid shard lock, session lock.
+   * Completions are never called with rwlock held.
+   */
+  RWLock rwlock;
+
+  /**
+   * hold client_lock unless the caller already does; for the
+   * completions of our own ops that need it, now that replies may be
+   * handled without it
+   */
+  class ClientLocker {
+    Mutex &lock;
+    bool taken;
+  public:
+    ClientLocker(Mutex &l) : lock(l), taken(!l.is_locked_by_me()) {
+      if (taken)
+	lock.Lock();
+    }
+    ~ClientLocker() {
+      if (taken)
+	lock.Unlock();
+    }
+  };
+
   PerfCounters *logger;
   
   class C_Tick : public Context {
@@ -634,6 +732,7 @@ public:
     
     object_t oid;
     object_locator_t oloc;
+    object_locator_t target_oloc;  ///< oloc, redirected to the pool's overlay tier
 
     pg_t pgid;
     vector<int> acting;
@@ -677,7 +776,7 @@ public:
     Op(const object_t& o, const object_locator_t& ol, vector<OSDOp>& op,
        int f, Context *ac, Context *co, eversion_t *ov) :
       session(NULL), session_item(this), incarnation(0),
-      oid(o), oloc(ol),
+      oid(o), oloc(ol), target_oloc(ol),
       used_replica(false), con(NULL),
       snapid(CEPH_NOSNAP),
       outbl(NULL),
@@ -793,6 +892,7 @@ public:
     C_List(ListContext *lc, Context * finish, bufferlist *b, Objecter *ob) :
       list_context(lc), final_finish(finish), bl(b), objecter(ob), epoch(0) {}
     void finish(int r) {
+      ClientLocker l(objecter->client_lock);
       if (r >= 0) {
         objecter->_list_reply(list_context, r, bl, final_finish, epoch);
       } else {
@@ -920,21 +1020,34 @@ public:
 
   // -- osd sessions --
   struct OSDSession {
+    Mutex lock;  ///< protects the lists below under rwlock read
     xlist<Op*> ops;
     xlist<LingerOp*> linger_ops;
     int osd;
     int incarnation;
     Connection *con;
 
-    OSDSession(int o) : osd(o), incarnation(0), con(NULL) {}
+    OSDSession(int o)
+      : lock("Objecter::OSDSession::lock"),
+	osd(o), incarnation(0), con(NULL) {}
   };
   map<int,OSDSession*> osd_sessions;
 
 
  private:
-  // pending ops
-  map<tid_t,Op*>            ops;
-  int                       num_homeless_ops;
+  // pending ops, hashed by tid
+  struct OpShard {
+    Mutex lock;  ///< protects ops, and the Ops in it, under rwlock read
+    map<tid_t,Op*> ops;
+    OpShard() : lock("Objecter::OpShard::lock") {}
+  };
+  static const unsigned NUM_OP_SHARDS = 32;
+  OpShard                   op_shards[NUM_OP_SHARDS];
+  OpShard& get_op_shard(tid_t tid) {
+    return op_shards[tid % NUM_OP_SHARDS];
+  }
+  atomic_t                  num_ops;
+  atomic_t                  num_homeless_ops;
   map<uint64_t, LingerOp*>  linger_ops;
   map<tid_t,PoolStatOp*>    poolstat_ops;
   map<tid_t,StatfsOp*>      statfs_ops;
@@ -947,32 +1060,45 @@ public:
 
   map<epoch_t,list< pair<Context*, int> > > waiting_for_map;
 
+  // for CEPH_OSD_FLAG_LOCALIZE_READS
+  map<string, string> crush_location;  ///< our position, from conf crush_location
+  Mutex osd_distance_lock;             ///< protects osd_distance*
+  map<int, int> osd_distance;          ///< cache of get_osd_distance()
+  epoch_t osd_distance_epoch;          ///< osdmap epoch osd_distance is valid for
+  int get_osd_distance(int osd);
+
   void send_op(Op *op);
   void cancel_op(Op *op);
   void finish_op(Op *op);
+  void _session_op_assign(OSDSession *s, Op *op);
+  void _session_op_remove(Op *op);
   bool is_pg_changed(vector<int>& a, vector<int>& b, bool any_change=false);
   enum recalc_op_target_result {
     RECALC_OP_TARGET_NO_ACTION = 0,
     RECALC_OP_TARGET_NEED_RESEND,
     RECALC_OP_TARGET_POOL_DNE,
+    RECALC_OP_TARGET_NEED_WRITE_LOCK,
   };
-  int recalc_op_target(Op *op);
+  int recalc_op_target(Op *op, bool wlocked);
   bool recalc_linger_op_target(LingerOp *op);
 
-  void send_linger(LingerOp *info);
+  void _send_linger(LingerOp *info);
   void _linger_ack(LingerOp *info, int r);
   void _linger_commit(LingerOp *info, int r);
+  void _unregister_linger(uint64_t linger_id);
 
-  void check_op_pool_dne(Op *op);
+  typedef list<pair<Context*, int> > context_list_t;
+  void check_op_pool_dne(Op *op, context_list_t& finish);
   void _send_op_map_check(Op *op);
   void op_cancel_map_check(Op *op);
-  void check_linger_pool_dne(LingerOp *op);
+  void check_linger_pool_dne(LingerOp *op, context_list_t& finish);
   void _send_linger_map_check(LingerOp *op);
   void linger_cancel_map_check(LingerOp *op);
+  void finish_contexts(context_list_t& ls);
 
   void kick_requests(OSDSession *session);
 
-  OSDSession *get_session(int osd);
+  int get_session(int osd, OSDSession **session, bool wlocked);
   void reopen_session(OSDSession *session);
   void close_session(OSDSession *session);
   
@@ -985,7 +1111,8 @@ public:
    * handle a budget for in-flight ops
    * budget is taken whenever an op goes into the ops map
    * and returned whenever an op is removed from the map
-   * If throttle_op needs to throttle it will unlock client_lock.
+   * If throttle_op needs to throttle it will unlock client_lock, if
+   * the caller holds it.  It must not be called with rwlock held.
    */
   int calc_op_budget(Op *op);
   void throttle_op(Op *op, int op_size=0);
@@ -1012,6 +1139,7 @@ public:
 	   OSDMap *om, Mutex& l, SafeTimer& t) : 
     messenger(m), monc(mc), osdmap(om), cct(cct_),
     initialized(false),
+    tid_lock("Objecter::tid_lock"),
     last_tid(0), client_inc(-1), max_linger_id(0),
     num_unacked(0), num_uncommitted(0),
     global_op_flags(0),
@@ -1019,9 +1147,13 @@ public:
     last_seen_osdmap_version(0),
     last_seen_pgmap_version(0),
     client_lock(l), timer(t),
+    rwlock("Objecter::rwlock"),
     logger(NULL), tick_event(NULL),
     m_request_state_hook(NULL),
+    num_ops(0),
     num_homeless_ops(0),
+    osd_distance_lock("Objecter::osd_distance_lock"),
+    osd_distance_epoch(0),
     op_throttle_bytes(cct, "objecter_bytes", cct->_conf->objecter_inflight_op_bytes),
     op_throttle_ops(cct, "objecter_ops", cct->_conf->objecter_inflight_ops)
   { }
@@ -1051,7 +1183,8 @@ public:
 
   void scan_requests(bool skipped_map,
 		     map<tid_t, Op*>& need_resend,
-		     list<LingerOp*>& need_resend_linger);
+		     list<LingerOp*>& need_resend_linger,
+		     context_list_t& need_finish);
 
   // messages
  public:
@@ -1063,12 +1196,13 @@ public:
 private:
   // low-level
   tid_t op_submit(Op *op);
-  tid_t _op_submit(Op *op);
+  tid_t _op_submit_with_rwlock(Op *op);
+  tid_t _op_submit(Op *op, bool wlocked);
 
   // public interface
  public:
   bool is_active() {
-    return !(ops.empty() && linger_ops.empty() && poolstat_ops.empty() && statfs_ops.empty());
+    return !(num_ops.read() == 0 && linger_ops.empty() && poolstat_ops.empty() && statfs_ops.empty());
   }
 
   /**
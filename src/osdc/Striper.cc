@@ -299,3 +299,29 @@ void Striper::StripedReadResult::assemble_result(CephContext *cct, bufferlist& b
   partial.clear();
 }
 
+
+void Striper::StripedReadResult::assemble_result(CephContext *cct,
+						 map<uint64_t, bufferlist> *extents)
+{
+  ldout(cct, 10) << "assemble_result(" << this << ") sparse" << dendl;
+
+  uint64_t last_end = 0;
+  map<uint64_t, bufferlist>::iterator last = extents->end();
+  for (map<uint64_t,pair<bufferlist,uint64_t> >::iterator p = partial.begin();
+       p != partial.end();
+       ++p) {
+    size_t len = p->second.first.length();
+    ldout(cct, 20) << "assemble_result(" << this << ") " << p->first << "~" << p->second.second
+		   << " " << len << " bytes" << dendl;
+    if (len == 0)
+      continue;
+    if (last != extents->end() && last_end == p->first) {
+      last->second.claim_append(p->second.first);
+    } else {
+      last = extents->insert(make_pair(p->first, bufferlist())).first;
+      last->second.claim(p->second.first);
+    }
+    last_end = p->first + len;
+  }
+  partial.clear();
+}
@@ -85,6 +85,15 @@ class CephContext;
 				     const vector<pair<uint64_t,uint64_t> >& buffer_extents);
 
       void assemble_result(CephContext *cct, bufferlist& bl, bool zero_tail);
+
+      /**
+       * assemble only the data of a sparse result
+       *
+       * Adjacent pieces are merged; holes are left out of @extents.
+       *
+       * @param extents buffer offset -> data
+       */
+      void assemble_result(CephContext *cct, map<uint64_t, bufferlist> *extents);
     };
 
   };
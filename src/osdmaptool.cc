@@ -16,6 +16,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <math.h>
 
 #include <iostream>
 #include <string>
@@ -37,6 +38,8 @@ void usage()
   cout << "   --test-map-pg <pgid>    map a pgid to osds" << std::endl;
   cout << "   --test-map-object <objectname> [--pool <poolid>] map an object to osds"
        << std::endl;
+  cout << "   --test-map-pgs [--pool <poolid>] [--threads <n>] map all pgs, time" << std::endl;
+  cout << "                           CRUSH against the cached mapping table" << std::endl;
   exit(1);
 }
 
@@ -66,9 +69,11 @@ int main(int argc, const char **argv)
   std::string export_crush, import_crush, test_map_pg, test_map_object;
   list<entity_addr_t> add, rm;
   bool test_crush = false;
+  bool test_map_pgs = false;
   int range_first = -1;
   int range_last = -1;
-  int pool = 0;
+  int pool = -1;
+  int threads = 4;
 
   std::string val;
   std::ostringstream err;
@@ -113,6 +118,9 @@ int main(int argc, const char **argv)
       test_map_object = val;
     } else if (ceph_argparse_flag(args, i, "--test_crush", (char*)NULL)) {
       test_crush = true;
+    } else if (ceph_argparse_flag(args, i, "--test-map-pgs", (char*)NULL)) {
+      test_map_pgs = true;
+    } else if (ceph_argparse_withint(args, i, &threads, &err, "--threads", (char*)NULL)) {
     } else if (ceph_argparse_withint(args, i, &range_first, &err, "--range_first", (char*)NULL)) {
     } else if (ceph_argparse_withint(args, i, &range_last, &err, "--range_last", (char*)NULL)) {
     } else if (ceph_argparse_withint(args, i, &pool, &err, "--pool", (char*)NULL)) {
@@ -246,6 +254,8 @@ int main(int argc, const char **argv)
 
   if (!test_map_object.empty()) {
     object_t oid(test_map_object);
+    if (pool < 0)
+      pool = 0;
     if (!osdmap.have_pg_pool(pool)) {
       cerr << "There is no pool " << pool << std::endl;
       exit(1);
@@ -306,9 +316,97 @@ int main(int argc, const char **argv)
     }
   }
 
+  if (test_map_pgs) {
+    if (pool >= 0 && !osdmap.have_pg_pool(pool)) {
+      cerr << "There is no pool " << pool << std::endl;
+      exit(1);
+    }
+    // map everything through CRUSH first, then through the cache
+    map<pg_t, pair<vector<int>, vector<int> > > expected;
+    vector<int> count, first, primary;
+    count.resize(osdmap.get_max_osd());
+    first.resize(osdmap.get_max_osd());
+    primary.resize(osdmap.get_max_osd());
+    utime_t start = ceph_clock_now(g_ceph_context);
+    for (map<int64_t,pg_pool_t>::const_iterator p = osdmap.get_pools().begin();
+	 p != osdmap.get_pools().end();
+	 ++p) {
+      if (pool >= 0 && p->first != pool)
+	continue;
+      cout << "pool " << p->first << " pg_num " << p->second.get_pg_num() << std::endl;
+      for (ps_t ps = 0; ps < p->second.get_pg_num(); ps++) {
+	pg_t pgid(ps, p->first, -1);
+	vector<int>& up = expected[pgid].first;
+	vector<int>& acting = expected[pgid].second;
+	osdmap.pg_to_up_acting_osds(pgid, up, acting);
+	for (unsigned i = 0; i < acting.size(); i++)
+	  count[acting[i]]++;
+	if (up.size())
+	  first[up[0]]++;
+	if (acting.size())
+	  primary[acting[0]]++;
+      }
+    }
+    utime_t crush_time = ceph_clock_now(g_ceph_context) - start;
+
+    osdmap.enable_pg_mapping_cache();
+    start = ceph_clock_now(g_ceph_context);
+    osdmap.prime_pg_mapping(threads, pool);
+    utime_t prime_time = ceph_clock_now(g_ceph_context) - start;
+
+    start = ceph_clock_now(g_ceph_context);
+    int mismatch = 0;
+    for (map<pg_t, pair<vector<int>, vector<int> > >::iterator p = expected.begin();
+	 p != expected.end();
+	 ++p) {
+      vector<int> up, acting;
+      osdmap.pg_to_up_acting_osds(p->first, up, acting);
+      if (up != p->second.first || acting != p->second.second) {
+	cerr << p->first << " crush " << p->second.first << "/" << p->second.second
+	     << " cached " << up << "/" << acting << std::endl;
+	mismatch++;
+      }
+    }
+    utime_t lookup_time = ceph_clock_now(g_ceph_context) - start;
+
+    cout << "#osd\tcount\tfirst\tprimary" << std::endl;
+    int in = 0, min_osd = -1, max_osd = -1;
+    double total = 0, sq = 0;
+    for (int i = 0; i < osdmap.get_max_osd(); i++) {
+      if (!osdmap.exists(i) || osdmap.is_out(i))
+	continue;
+      cout << "osd." << i << "\t" << count[i] << "\t" << first[i]
+	   << "\t" << primary[i] << std::endl;
+      in++;
+      total += count[i];
+      sq += (double)count[i] * count[i];
+      if (min_osd < 0 || count[i] < count[min_osd])
+	min_osd = i;
+      if (max_osd < 0 || count[i] > count[max_osd])
+	max_osd = i;
+    }
+    if (in) {
+      double avg = total / in;
+      cout << " in " << in << std::endl;
+      cout << " avg " << avg << " stddev " << sqrt(sq / in - avg * avg) << std::endl;
+      cout << " min osd." << min_osd << " " << count[min_osd] << std::endl;
+      cout << " max osd." << max_osd << " " << count[max_osd] << std::endl;
+    }
+    cout << " " << expected.size() << " pgs" << std::endl;
+    cout << " crush mapping " << crush_time << " sec" << std::endl;
+    cout << " cached mapping (" << threads << " threads) " << prime_time << " sec, "
+	 << osdmap.get_pg_mapping_bytes() << " bytes" << std::endl;
+    cout << " cached lookup " << lookup_time << " sec" << std::endl;
+    if (mismatch) {
+      cerr << me << ": " << mismatch << " pgs mapped differently from the cache"
+	   << std::endl;
+      exit(1);
+    }
+  }
+
   if (!print && !print_json && !tree && !modified && 
       export_crush.empty() && import_crush.empty() && 
-      test_map_pg.empty() && test_map_object.empty()) {
+      test_map_pg.empty() && test_map_object.empty() && !test_map_pgs) {
     cerr << me << ": no action specified?" << std::endl;
     usage();
   }
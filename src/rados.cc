@@ -153,6 +153,9 @@ void usage(ostream& out)
 "        Set number of concurrent I/O operations\n"
 "   --show-time\n"
 "        prefix output with date/time\n"
+"   --read-from-replica=balance|localize\n"
+"        let replicas serve seq/rand reads: any replica, or the\n"
+"        closest one according to crush_location\n"
 "\n"
 "LOAD GEN OPTIONS:\n"
 "   --num-objects                    total number of objects\n"
@@ -1043,6 +1046,7 @@ static int rados_tool_common(const std::map < std::string, std::string > &opts,
   int run_length = 0;
 
   bool show_time = false;
+  int read_flags = 0;
 
   Formatter *formatter = NULL;
   bool pretty_format = false;
@@ -1135,6 +1139,17 @@ static int rados_tool_common(const std::map < std::string, std::string > &opts,
   if (i != opts.end()) {
     cleanup = false;
   }
+  i = opts.find("read-from-replica");
+  if (i != opts.end()) {
+    if (i->second == "balance") {
+      read_flags = librados::OPERATION_BALANCE_READS;
+    } else if (i->second == "localize") {
+      read_flags = librados::OPERATION_LOCALIZE_READS;
+    } else {
+      cerr << "unknown read-from-replica policy '" << i->second << "'" << std::endl;
+      return -EINVAL;
+    }
+  }
   i = opts.find("pretty-format");
   if (i != opts.end()) {
     pretty_format = true;
@@ -1901,6 +1916,7 @@ static int rados_tool_common(const std::map < std::string, std::string > &opts,
       operation = OP_RAND_READ;
     else
       usage_exit();
+    io_ctx.set_read_flags(read_flags);
     RadosBencher bencher(rados, io_ctx);
     bencher.set_show_time(show_time);
     ret = bencher.aio_bench(operation, seconds, concurrent_ios, op_size, cleanup);
@@ -2063,6 +2079,8 @@ int main(int argc, const char **argv)
       opts["show-time"] = "true";
     } else if (ceph_argparse_flag(args, i, "--no-cleanup", (char*)NULL)) {
       opts["no-cleanup"] = "true";
+    } else if (ceph_argparse_witharg(args, i, &val, "--read-from-replica", (char*)NULL)) {
+      opts["read-from-replica"] = val;
     } else if (ceph_argparse_witharg(args, i, &val, "-p", "--pool", (char*)NULL)) {
       opts["pool"] = val;
     } else if (ceph_argparse_witharg(args, i, &val, "--target-pool", (char*)NULL)) {
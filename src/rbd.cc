@@ -27,6 +27,7 @@
 #include "include/rados/librados.hpp"
 #include "include/rbd/librbd.hpp"
 #include "include/byteorder.h"
+#include "include/encoding.h"
 
 #include "include/intarith.h"
 
@@ -94,6 +95,11 @@ void usage()
 "                                              (dest defaults\n"
 "                                               as the filename part of file)\n"
 "                                              \"-\" for stdin\n"
+"  export-diff <image-name> [--from-snap <snap-name>] <path>\n"
+"                                              export an incremental diff to\n"
+"                                              path, or \"-\" for stdout\n"
+"  import-diff <path> <image-name>             import an incremental diff from\n"
+"                                              path or \"-\" for stdin\n"
 "  (cp | copy) <src> <dest>                    copy src image to dest\n"
 "  (mv | rename) <src> <dest>                  rename src image to dest\n"
 "  snap ls <image-name>                        dump list of image snapshots\n"
@@ -114,6 +120,10 @@ void usage()
 "  lock add <image-name> <id> [--shared <tag>] take a lock called id on an image\n"
 "  lock remove <image-name> <id> <locker>      release a lock on an image\n"
 "  bench-write <image-name> --io-size <bytes> --io-threads <num> --io-total <bytes>\n"
+"  object-map rebuild <image-name>             recreate the object map of an\n"
+"                                              image or snapshot\n"
+"  object-map check <image-name>               compare the object map with the\n"
+"                                              objects that exist\n"
 "\n"
 "<image-name>, <snap-name> are [pool/]name[@snap], or you may specify\n"
 "individual pieces of names with -p/--pool, --image, and/or --snap.\n"
@@ -123,6 +133,7 @@ void usage()
 "  --image <image-name>               image name\n"
 "  --dest <image-name>                destination [pool and] image name\n"
 "  --snap <snap-name>                 snapshot name\n"
+"  --from-snap <snap-name>            snapshot starting point for export-diff\n"
 "  --dest-pool <name>                 destination pool name\n"
 "  --path <path-name>                 path name for import/export\n"
 "  --size <size in MB>                size of image for create and resize\n"
@@ -131,6 +142,7 @@ void usage()
 "  --image-format <format-number>     format to use when creating an image\n"
 "                                     format 1 is the original format (default)\n"
 "                                     format 2 supports cloning\n"
+"  --object-map                       track which objects exist (format 2 only)\n"
 "  --id <username>                    rados user (without 'client.'prefix) to\n"
 "                                     authenticate as\n"
 "  --keyfile <path>                   file containing secret key for use with cephx\n"
@@ -147,6 +159,8 @@ static string feature_str(uint64_t feature)
     return "layering";
   case RBD_FEATURE_STRIPINGV2:
     return "striping";
+  case RBD_FEATURE_OBJECT_MAP:
+    return "object-map";
   default:
     return "";
   }
@@ -156,8 +170,10 @@ static string features_str(uint64_t features)
 {
   string s = "";
 
-  for (uint64_t feature = 1; feature <= RBD_FEATURE_STRIPINGV2;
+  for (uint64_t feature = 1; feature <= RBD_FEATURE_OBJECT_MAP;
        feature <<= 1) {
+    if (!(features & feature))
+      continue;
     if (s.size())
       s += ", ";
     s += feature_str(feature);
@@ -168,9 +184,10 @@ static string features_str(uint64_t features)
 static void format_features(Formatter *f, uint64_t features)
 {
   f->open_array_section("features");
-  for (uint64_t feature = 1; feature <= RBD_FEATURE_STRIPINGV2;
+  for (uint64_t feature = 1; feature <= RBD_FEATURE_OBJECT_MAP;
        feature <<= 1) {
-    f->dump_string("feature", feature_str(feature));
+    if (features & feature)
+      f->dump_string("feature", feature_str(feature));
   }
   f->close_section();
 }
@@ -178,27 +195,52 @@ static void format_features(Formatter *f, uint64_t features)
 struct MyProgressContext : public librbd::ProgressContext {
   const char *operation;
   int last_pc;
+  bool show_rate;   ///< also show the average bytes/sec so far
+  utime_t start;
+  size_t last_len;  ///< length of the last line printed
 
-  MyProgressContext(const char *o) : operation(o), last_pc(0) {
+  MyProgressContext(const char *o, bool rate = false)
+    : operation(o), last_pc(0), show_rate(rate),
+      start(ceph_clock_now(NULL)), last_len(0) {
   }
 
   int update_progress(uint64_t offset, uint64_t total) {
     int pc = total ? (offset * 100ull / total) : 0;
     if (pc != last_pc) {
-      cout << "\r" << operation << ": "
+      ostringstream line;
+      line << operation << ": "
 	//	   << offset << " / " << total << " "
 	   << pc << "% complete...";
+      if (show_rate) {
+	double secs = ceph_clock_now(NULL) - start;
+	if (secs > 0)
+	  line << " " << prettybyte_t(offset / secs) << "/s";
+      }
+      print(line.str());
       cout.flush();
       last_pc = pc;
     }
     return 0;
   }
   void finish() {
-    cout << "\r" << operation << ": 100% complete...done." << std::endl;
+    ostringstream line;
+    line << operation << ": 100% complete...done.";
+    print(line.str());
+    cout << std::endl;
   }
   void fail() {
-    cout << "\r" << operation << ": " << last_pc << "% complete...failed."
-	 << std::endl;
+    ostringstream line;
+    line << operation << ": " << last_pc << "% complete...failed.";
+    print(line.str());
+    cout << std::endl;
+  }
+
+  // overwrite the previous line, blanking whatever it had beyond this one
+  void print(const string& line) {
+    cout << "\r" << line;
+    if (line.length() < last_len)
+      cout << string(last_len - line.length(), ' ');
+    last_len = line.length();
   }
 };
 
@@ -438,6 +480,40 @@ static int do_flatten(librbd::Image& image)
   return 0;
 }
 
+static int do_rebuild_object_map(librbd::Image& image)
+{
+  MyProgressContext pc("Object map rebuild");
+  int r = image.rebuild_object_map(pc);
+  if (r < 0) {
+    pc.fail();
+    return r;
+  }
+  pc.finish();
+  return 0;
+}
+
+/// returns 1 if the object map lacks objects that exist
+static int do_check_object_map(librbd::Image& image)
+{
+  MyProgressContext pc("Object map check");
+  uint64_t missing, stale;
+  int r = image.check_object_map(pc, &missing, &stale);
+  if (r < 0) {
+    pc.fail();
+    return r;
+  }
+  pc.finish();
+  cout << missing << " objects missing from the object map, "
+       << stale << " objects in the object map that do not exist"
+       << std::endl;
+  if (missing) {
+    cerr << "rbd: object map is invalid, run 'rbd object-map rebuild'"
+	 << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
 static int do_rename(librbd::RBD &rbd, librados::IoCtx& io_ctx,
 		     const char *imgname, const char *destname)
 {
@@ -910,7 +986,7 @@ struct ExportContext {
   uint64_t totalsize;
   MyProgressContext pc;
 
-  ExportContext(int f, uint64_t t) : fd(f), totalsize(t), pc("Exporting image")
+  ExportContext(int f, uint64_t t) : fd(f), totalsize(t), pc("Exporting image", true)
   {}
 };
 
@@ -951,6 +1027,7 @@ static int export_read_cb(uint64_t ofs, size_t len, const char *buf, void *arg)
   } else {		// not stdout
     if (!buf || buf_is_zero(buf, len)) {
       /* a hole */
+      ec->pc.update_progress(ofs + len, ec->totalsize);
       return 0;
     }
 
@@ -1003,6 +1080,126 @@ static int do_export(librbd::Image& image, const char *path)
   return r;
 }
 
+/*
+ * export-diff/import-diff stream: a banner, then records that each
+ * start with a tag byte:
+ *
+ *  'f' <string>             snapshot the diff starts from
+ *  't' <string>             snapshot the diff ends at
+ *  's' <u64 size>           image size at the end snapshot
+ *  'w' <u64 off> <u64 len>  followed by len bytes of data
+ *  'z' <u64 off> <u64 len>  zeroed (discarded) extent
+ *  'e'                      end of the stream
+ *
+ * Integers and strings use the usual little-endian encoding.
+ */
+#define RBD_DIFF_BANNER "rbd diff v1\n"
+
+struct ExportDiffContext {
+  librbd::Image *image;
+  int fd;
+  uint64_t totalsize;
+  MyProgressContext pc;
+
+  ExportDiffContext(librbd::Image *i, int f, uint64_t t)
+    : image(i), fd(f), totalsize(t), pc("Exporting image", true)
+  {}
+};
+
+static int export_diff_cb(uint64_t ofs, size_t _len, int exists, void *arg)
+{
+  ExportDiffContext *ec = (ExportDiffContext *)arg;
+  uint64_t len = _len;
+  int r;
+
+  bufferlist bl;
+  __u8 tag = exists ? 'w' : 'z';
+  ::encode(tag, bl);
+  ::encode(ofs, bl);
+  ::encode(len, bl);
+  if (exists) {
+    bufferlist data;
+    r = ec->image->read(ofs, len, data);
+    if (r < 0)
+      return r;
+    bl.claim_append(data);
+  }
+  r = bl.write_fd(ec->fd);
+  if (r < 0)
+    return r;
+
+  ec->pc.update_progress(ofs, ec->totalsize);
+  return 0;
+}
+
+static int do_export_diff(librbd::Image& image, const char *fromsnapname,
+			  const char *endsnapname, const char *path)
+{
+  int r;
+  librbd::image_info_t info;
+  int fd;
+
+  r = image.stat(info, sizeof(info));
+  if (r < 0)
+    return r;
+
+  if (strcmp(path, "-") == 0)
+    fd = 1;
+  else
+    fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if (fd < 0)
+    return -errno;
+
+  ExportDiffContext ec(&image, fd, info.size);
+  {
+    bufferlist bl;
+    bl.append(RBD_DIFF_BANNER);
+
+    __u8 tag;
+    if (fromsnapname) {
+      tag = 'f';
+      ::encode(tag, bl);
+      string from(fromsnapname);
+      ::encode(from, bl);
+    }
+    if (endsnapname) {
+      tag = 't';
+      ::encode(tag, bl);
+      string to(endsnapname);
+      ::encode(to, bl);
+    }
+    tag = 's';
+    ::encode(tag, bl);
+    uint64_t endsize = info.size;
+    ::encode(endsize, bl);
+
+    r = bl.write_fd(fd);
+    if (r < 0)
+      goto out;
+  }
+
+  r = image.diff_iterate(fromsnapname, 0, info.size, export_diff_cb,
+			 (void *)&ec);
+  if (r < 0)
+    goto out;
+
+  {
+    bufferlist bl;
+    __u8 tag = 'e';
+    ::encode(tag, bl);
+    r = bl.write_fd(fd);
+  }
+
+ out:
+  if (fd != 1)
+    close(fd);
+  if (r < 0)
+    ec.pc.fail();
+  else
+    ec.pc.finish();
+  return r;
+}
+
 static const char *imgname_from_path(const char *path)
 {
   const char *imgname;
@@ -1310,10 +1507,196 @@ static int do_import(librbd::RBD &rbd, librados::IoCtx& io_ctx,
   return r;
 }
 
+static int snap_exists(librbd::Image& image, const string& snapname,
+		       bool *exists)
+{
+  vector<librbd::snap_info_t> snaps;
+  int r = image.snap_list(snaps);
+  if (r < 0)
+    return r;
+  *exists = false;
+  for (vector<librbd::snap_info_t>::iterator p = snaps.begin();
+       p != snaps.end();
+       ++p) {
+    if (p->name == snapname) {
+      *exists = true;
+      break;
+    }
+  }
+  return 0;
+}
+
+/// read a tagged string of at most 4k, so garbage can't make us allocate
+static int read_diff_string(int fd, string *out)
+{
+  char buf[4];
+  int r = safe_read_exact(fd, buf, 4);
+  if (r < 0)
+    return r;
+  bufferlist bl;
+  bl.append(buf, 4);
+  bufferlist::iterator p = bl.begin();
+  __u32 len;
+  ::decode(len, p);
+  if (len > 4096)
+    return -EINVAL;
+  char str[len];
+  r = safe_read_exact(fd, str, len);
+  if (r < 0)
+    return r;
+  out->assign(str, len);
+  return 0;
+}
+
+static int do_import_diff(librbd::Image& image, const char *path)
+{
+  int fd, r;
+  uint64_t size = 0;
+  string from, to;
+  MyProgressContext pc("Importing image diff");
+
+  if (strcmp(path, "-") == 0) {
+    fd = 0;
+  } else {
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+      r = -errno;
+      cerr << "rbd: error opening " << path << std::endl;
+      return r;
+    }
+    struct stat stat_buf;
+    r = fstat(fd, &stat_buf);
+    if (r < 0) {
+      r = -errno;
+      cerr << "rbd: stat error " << path << std::endl;
+      close(fd);
+      return r;
+    }
+    size = (uint64_t)stat_buf.st_size;
+  }
+
+  size_t banner_len = strlen(RBD_DIFF_BANNER);
+  char banner[banner_len + 1];
+  uint64_t pos = banner_len;
+  r = safe_read_exact(fd, banner, banner_len);
+  if (r < 0)
+    goto done;
+  banner[banner_len] = '\0';
+  if (strcmp(banner, RBD_DIFF_BANNER)) {
+    cerr << "rbd: invalid banner '" << banner << "', expected '"
+	 << RBD_DIFF_BANNER << "'" << std::endl;
+    r = -EINVAL;
+    goto done;
+  }
+
+  while (true) {
+    __u8 tag;
+    r = safe_read_exact(fd, &tag, 1);
+    if (r < 0)
+      goto done;
+    pos++;
+
+    if (tag == 'e') {
+      break;
+    } else if (tag == 'f' || tag == 't') {
+      string *name = (tag == 'f') ? &from : &to;
+      r = read_diff_string(fd, name);
+      if (r < 0)
+	goto done;
+      pos += 4 + name->length();
+
+      bool exists;
+      r = snap_exists(image, *name, &exists);
+      if (r < 0)
+	goto done;
+      if (tag == 'f' && !exists) {
+	cerr << "rbd: start snapshot '" << from
+	     << "' does not exist in the image, aborting" << std::endl;
+	r = -EINVAL;
+	goto done;
+      }
+      if (tag == 't' && exists) {
+	cerr << "rbd: end snapshot '" << to
+	     << "' already exists, aborting" << std::endl;
+	r = -EEXIST;
+	goto done;
+      }
+    } else if (tag == 's') {
+      char buf[8];
+      r = safe_read_exact(fd, buf, 8);
+      if (r < 0)
+	goto done;
+      pos += 8;
+      bufferlist bl;
+      bl.append(buf, 8);
+      bufferlist::iterator p = bl.begin();
+      uint64_t end_size;
+      ::decode(end_size, p);
+
+      uint64_t cur_size;
+      r = image.size(&cur_size);
+      if (r < 0)
+	goto done;
+      if (cur_size != end_size) {
+	r = image.resize(end_size);
+	if (r < 0)
+	  goto done;
+      }
+    } else if (tag == 'w' || tag == 'z') {
+      char buf[16];
+      r = safe_read_exact(fd, buf, 16);
+      if (r < 0)
+	goto done;
+      pos += 16;
+      bufferlist bl;
+      bl.append(buf, 16);
+      bufferlist::iterator p = bl.begin();
+      uint64_t off, len;
+      ::decode(off, p);
+      ::decode(len, p);
+
+      if (tag == 'w') {
+	bufferptr bp = buffer::create(len);
+	r = safe_read_exact(fd, bp.c_str(), len);
+	if (r < 0)
+	  goto done;
+	pos += len;
+	bufferlist data;
+	data.append(bp);
+	r = image.write(off, len, data);
+      } else {
+	r = image.discard(off, len);
+      }
+      if (r < 0)
+	goto done;
+    } else {
+      cerr << "rbd: unrecognized tag byte " << (int)tag
+	   << " in stream; aborting" << std::endl;
+      r = -EINVAL;
+      goto done;
+    }
+    if (size)
+      pc.update_progress(pos, size);
+  }
+
+  // the image now matches the end of the diff
+  if (to.length())
+    r = image.snap_create(to.c_str());
+
+ done:
+  if (fd != 0)
+    close(fd);
+  if (r < 0)
+    pc.fail();
+  else
+    pc.finish();
+  return r;
+}
+
 static int do_copy(librbd::Image &src, librados::IoCtx& dest_pp,
 		   const char *destname)
 {
-  MyProgressContext pc("Image copy");
+  MyProgressContext pc("Image copy", true);
   int r = src.copy_with_progress(dest_pp, destname, pc);
   if (r < 0){
     pc.fail();
@@ -1720,6 +2103,8 @@ enum {
   OPT_RM,
   OPT_EXPORT,
   OPT_IMPORT,
+  OPT_EXPORT_DIFF,
+  OPT_IMPORT_DIFF,
   OPT_COPY,
   OPT_RENAME,
   OPT_SNAP_CREATE,
@@ -1737,11 +2122,19 @@ enum {
   OPT_LOCK_ADD,
   OPT_LOCK_REMOVE,
   OPT_BENCH_WRITE,
+  OPT_OBJECT_MAP_REBUILD,
+  OPT_OBJECT_MAP_CHECK,
 };
 
-static int get_cmd(const char *cmd, bool snapcmd, bool lockcmd)
+static int get_cmd(const char *cmd, bool snapcmd, bool lockcmd,
+		   bool objectmapcmd)
 {
-  if (!snapcmd && !lockcmd) {
+  if (objectmapcmd) {
+    if (strcmp(cmd, "rebuild") == 0)
+      return OPT_OBJECT_MAP_REBUILD;
+    if (strcmp(cmd, "check") == 0)
+      return OPT_OBJECT_MAP_CHECK;
+  } else if (!snapcmd && !lockcmd) {
     if (strcmp(cmd, "ls") == 0 ||
         strcmp(cmd, "list") == 0)
       return OPT_LIST;
@@ -1763,6 +2156,10 @@ static int get_cmd(const char *cmd, bool snapcmd, bool lockcmd)
       return OPT_EXPORT;
     if (strcmp(cmd, "import") == 0)
       return OPT_IMPORT;
+    if (strcmp(cmd, "export-diff") == 0)
+      return OPT_EXPORT_DIFF;
+    if (strcmp(cmd, "import-diff") == 0)
+      return OPT_IMPORT_DIFF;
     if (strcmp(cmd, "copy") == 0 ||
         strcmp(cmd, "cp") == 0)
       return OPT_COPY;
@@ -1857,9 +2254,11 @@ int main(int argc, const char **argv)
   uint64_t features = RBD_FEATURE_LAYERING;
   const char *imgname = NULL, *snapname = NULL, *destname = NULL,
     *dest_poolname = NULL, *dest_snapname = NULL, *path = NULL,
+    *fromsnapname = NULL,
     *devpath = NULL, *lock_cookie = NULL, *lock_client = NULL,
     *lock_tag = NULL, *output_format = "plain";
   bool lflag = false;
+  bool object_map = false;
   int pretty_format = 0;
   long long stripe_unit = 0, stripe_count = 0;
   long long bench_io_size = 4096, bench_io_threads = 16, bench_bytes = 1 << 30;
@@ -1893,6 +2292,8 @@ int main(int argc, const char **argv)
       dest_poolname = strdup(val.c_str());
     } else if (ceph_argparse_witharg(args, i, &val, "--snap", (char*)NULL)) {
       snapname = strdup(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--from-snap", (char*)NULL)) {
+      fromsnapname = strdup(val.c_str());
     } else if (ceph_argparse_witharg(args, i, &val, "-i", "--image", (char*)NULL)) {
       imgname = strdup(val.c_str());
     } else if (ceph_argparse_withlonglong(args, i, &sizell, &err, "-s", "--size", (char*)NULL)) {
@@ -1929,6 +2330,8 @@ int main(int argc, const char **argv)
       lock_tag = strdup(val.c_str());
     } else if (ceph_argparse_flag(args, i, "--no-settle", (char *)NULL)) {
       udevadm_settle = false;
+    } else if (ceph_argparse_flag(args, i, "--object-map", (char *)NULL)) {
+      object_map = true;
     } else if (ceph_argparse_witharg(args, i, &val, "--format", (char *) NULL)) {
       std::string err;
       long long ret = strict_strtoll(val.c_str(), 10, &err);
@@ -1960,16 +2363,23 @@ int main(int argc, const char **argv)
       cerr << "rbd: which snap command do you want?" << std::endl;
       return EXIT_FAILURE;
     }
-    opt_cmd = get_cmd(*i, true, false);
+    opt_cmd = get_cmd(*i, true, false, false);
   } else if (strcmp(*i, "lock") == 0) {
     i = args.erase(i);
     if (i == args.end()) {
       cerr << "rbd: which lock command do you want?" << std::endl;
       return EXIT_FAILURE;
     }
-    opt_cmd = get_cmd(*i, false, true);
+    opt_cmd = get_cmd(*i, false, true, false);
+  } else if (strcmp(*i, "object-map") == 0) {
+    i = args.erase(i);
+    if (i == args.end()) {
+      cerr << "rbd: which object-map command do you want?" << std::endl;
+      return EXIT_FAILURE;
+    }
+    opt_cmd = get_cmd(*i, false, false, true);
   } else {
-    opt_cmd = get_cmd(*i, false, false);
+    opt_cmd = get_cmd(*i, false, false, false);
   }
   if (opt_cmd == OPT_NO_CMD) {
     cerr << "rbd: error parsing command '" << *i << "'" << std::endl;
@@ -2009,17 +2419,23 @@ if (!set_conf_param(v, p1, p2, p3)) { \
       case OPT_MAP:
       case OPT_BENCH_WRITE:
       case OPT_LOCK_LIST:
+      case OPT_OBJECT_MAP_REBUILD:
+      case OPT_OBJECT_MAP_CHECK:
 	SET_CONF_PARAM(v, &imgname, NULL, NULL);
 	break;
       case OPT_UNMAP:
 	SET_CONF_PARAM(v, &devpath, NULL, NULL);
 	break;
       case OPT_EXPORT:
+      case OPT_EXPORT_DIFF:
 	SET_CONF_PARAM(v, &imgname, &path, NULL);
 	break;
       case OPT_IMPORT:
 	SET_CONF_PARAM(v, &path, &destname, NULL);
 	break;
+      case OPT_IMPORT_DIFF:
+	SET_CONF_PARAM(v, &path, &imgname, NULL);
+	break;
       case OPT_COPY:
       case OPT_RENAME:
       case OPT_CLONE:
@@ -2049,6 +2465,20 @@ if (!set_conf_param(v, p1, p2, p3)) { \
     return EXIT_FAILURE;
   }
 
+  if (object_map) {
+    if (opt_cmd != OPT_IMPORT && opt_cmd != OPT_CREATE &&
+	opt_cmd != OPT_CLONE) {
+      cerr << "rbd: --object-map can only be used when creating, cloning "
+	   << "or importing an image" << std::endl;
+      return EXIT_FAILURE;
+    }
+    if (opt_cmd != OPT_CLONE && format != 2) {
+      cerr << "rbd: --object-map requires --image-format 2" << std::endl;
+      return EXIT_FAILURE;
+    }
+    features |= RBD_FEATURE_OBJECT_MAP;
+  }
+
   if (pretty_format && !strcmp(output_format, "plain")) {
     cerr << "rbd: --pretty-format only works when --format is json or xml"
 	 << std::endl;
@@ -2078,11 +2508,17 @@ if (!set_conf_param(v, p1, p2, p3)) { \
     return EXIT_FAILURE;
   }
 
-  if (opt_cmd == OPT_IMPORT && !path) {
+  if ((opt_cmd == OPT_IMPORT || opt_cmd == OPT_IMPORT_DIFF) && !path) {
     cerr << "rbd: path was not specified" << std::endl;
     return EXIT_FAILURE;
   }
 
+  if (fromsnapname && opt_cmd != OPT_EXPORT_DIFF) {
+    cerr << "rbd: only the export-diff command uses the --from-snap option"
+	 << std::endl;
+    return EXIT_FAILURE;
+  }
+
   if (opt_cmd == OPT_IMPORT && !destname) {
     destname = imgname;
     if (!destname)
@@ -2119,8 +2555,8 @@ if (!set_conf_param(v, p1, p2, p3)) { \
 		      (char **)&imgname, (char **)&snapname);
   if (snapname && opt_cmd != OPT_SNAP_CREATE && opt_cmd != OPT_SNAP_ROLLBACK &&
       opt_cmd != OPT_SNAP_REMOVE && opt_cmd != OPT_INFO &&
-      opt_cmd != OPT_EXPORT && opt_cmd != OPT_COPY &&
-      opt_cmd != OPT_MAP && opt_cmd != OPT_CLONE &&
+      opt_cmd != OPT_EXPORT && opt_cmd != OPT_EXPORT_DIFF &&
+      opt_cmd != OPT_COPY && opt_cmd != OPT_MAP && opt_cmd != OPT_CLONE &&
       opt_cmd != OPT_SNAP_PROTECT && opt_cmd != OPT_SNAP_UNPROTECT &&
       opt_cmd != OPT_CHILDREN) {
     cerr << "rbd: snapname specified for a command that doesn't use it"
@@ -2157,7 +2593,7 @@ if (!set_conf_param(v, p1, p2, p3)) { \
   if (!dest_poolname)
     dest_poolname = "rbd";
 
-  if (opt_cmd == OPT_EXPORT && !path)
+  if ((opt_cmd == OPT_EXPORT || opt_cmd == OPT_EXPORT_DIFF) && !path)
     path = imgname;
 
   if ((opt_cmd == OPT_COPY || opt_cmd == OPT_CLONE || opt_cmd == OPT_RENAME) &&
@@ -2215,11 +2651,15 @@ if (!set_conf_param(v, p1, p2, p3)) { \
        opt_cmd == OPT_LOCK_REMOVE || opt_cmd == OPT_BENCH_WRITE ||
        opt_cmd == OPT_INFO || opt_cmd == OPT_SNAP_LIST ||
        opt_cmd == OPT_EXPORT || opt_cmd == OPT_COPY ||
-       opt_cmd == OPT_CHILDREN || opt_cmd == OPT_LOCK_LIST)) {
+       opt_cmd == OPT_CHILDREN || opt_cmd == OPT_LOCK_LIST ||
+       opt_cmd == OPT_OBJECT_MAP_REBUILD || opt_cmd == OPT_OBJECT_MAP_CHECK ||
+       opt_cmd == OPT_EXPORT_DIFF || opt_cmd == OPT_IMPORT_DIFF)) {
 
     if (opt_cmd == OPT_INFO || opt_cmd == OPT_SNAP_LIST ||
-	opt_cmd == OPT_EXPORT || opt_cmd == OPT_COPY ||
-	opt_cmd == OPT_CHILDREN || opt_cmd == OPT_LOCK_LIST) {
+	opt_cmd == OPT_EXPORT || opt_cmd == OPT_EXPORT_DIFF ||
+	opt_cmd == OPT_COPY ||
+	opt_cmd == OPT_CHILDREN || opt_cmd == OPT_LOCK_LIST ||
+	opt_cmd == OPT_OBJECT_MAP_CHECK) {
       r = rbd.open_read_only(io_ctx, image, imgname, NULL);
     } else {
       r = rbd.open(io_ctx, image, imgname);
@@ -2233,7 +2673,8 @@ if (!set_conf_param(v, p1, p2, p3)) { \
 
   if (snapname && talk_to_cluster &&
       (opt_cmd == OPT_INFO || opt_cmd == OPT_EXPORT || opt_cmd == OPT_COPY ||
-       opt_cmd == OPT_CHILDREN)) {
+       opt_cmd == OPT_CHILDREN || opt_cmd == OPT_OBJECT_MAP_REBUILD ||
+       opt_cmd == OPT_OBJECT_MAP_CHECK || opt_cmd == OPT_EXPORT_DIFF)) {
     r = image.snap_set(snapname);
     if (r < 0) {
       cerr << "rbd: error setting snapshot context: " << cpp_strerror(-r)
@@ -2317,6 +2758,26 @@ if (!set_conf_param(v, p1, p2, p3)) { \
     }
     break;
 
+  case OPT_OBJECT_MAP_REBUILD:
+    r = do_rebuild_object_map(image);
+    if (r < 0) {
+      cerr << "rbd: rebuilding object map failed: " << cpp_strerror(-r)
+	   << std::endl;
+      return EXIT_FAILURE;
+    }
+    break;
+
+  case OPT_OBJECT_MAP_CHECK:
+    r = do_check_object_map(image);
+    if (r < 0) {
+      cerr << "rbd: checking object map failed: " << cpp_strerror(-r)
+	   << std::endl;
+      return EXIT_FAILURE;
+    }
+    if (r > 0)
+      return EXIT_FAILURE;
+    break;
+
   case OPT_RENAME:
     r = do_rename(rbd, io_ctx, imgname, destname);
     if (r < 0) {
@@ -2488,6 +2949,26 @@ if (!set_conf_param(v, p1, p2, p3)) { \
     }
     break;
 
+  case OPT_EXPORT_DIFF:
+    if (!path) {
+      cerr << "rbd: export-diff requires pathname" << std::endl;
+      return EXIT_FAILURE;
+    }
+    r = do_export_diff(image, fromsnapname, snapname, path);
+    if (r < 0) {
+      cerr << "rbd: export-diff error: " << cpp_strerror(-r) << std::endl;
+      return EXIT_FAILURE;
+    }
+    break;
+
+  case OPT_IMPORT_DIFF:
+    r = do_import_diff(image, path);
+    if (r < 0) {
+      cerr << "rbd: import-diff failed: " << cpp_strerror(-r) << std::endl;
+      return EXIT_FAILURE;
+    }
+    break;
+
   case OPT_COPY:
     r = do_copy(image, dest_io_ctx, destname);
     if (r < 0) {
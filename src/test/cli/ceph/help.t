@@ -61,6 +61,11 @@
     ceph osd pool delete <pool> [<pool> --yes-i-really-really-mean-it]
     ceph osd pool rename <pool> <new pool name>
     ceph osd pool set <pool> <field> <value>
+    ceph osd tier add <pool> <tierpool>
+    ceph osd tier remove <pool> <tierpool>
+    ceph osd tier cache-mode <tierpool> none|writeback|readonly
+    ceph osd tier set-overlay <pool> <tierpool>
+    ceph osd tier remove-overlay <pool>
     ceph osd scrub <osd-id>
     ceph osd deep-scrub <osd-id>
     ceph osd repair <osd-id>
@@ -6,7 +6,7 @@
                            specify output for for (de)compilation
      --build --num_osds N layer1 ...
                            build a new map, where each 'layer' is
-                             'name (uniform|straw|list|tree) size'
+                             'name (uniform|straw|straw2|list|tree) size'
      -i mapfn --test       test a range of inputs on the map
         [--min-x x] [--max-x x] [--x x]
         [--min-rule r] [--max-rule r] [--rule r]
@@ -29,6 +29,14 @@
                            reweight a given item (and adjust ancestor
                            weights as needed)
      -i mapfn --reweight   recalculate all bucket weights
+     -i mapfn --compare othermapfn [--threads n]
+                           map the test range with both maps and report
+                           time per mapping, device utilization and the
+                           fraction of data that moves between them
+     -i mapfn --compare-straw2 [--compare-item devno]
+                           compare mapping time and data movement on
+                           reweight of the map's straw buckets with
+                           straw2 buckets
      --show-utilization    show OSD usage
      --show utilization-all
                            include zero weight items
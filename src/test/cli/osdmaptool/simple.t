@@ -5,4 +5,6 @@
      --import-crush <file>   replace osdmap's crush map with <file>
      --test-map-pg <pgid>    map a pgid to osds
      --test-map-object <objectname> [--pool <poolid>] map an object to osds
+     --test-map-pgs [--pool <poolid>] [--threads <n>] map all pgs, time
+                             CRUSH against the cached mapping table
   [1]
@@ -20,6 +20,11 @@
                                                 (dest defaults
                                                  as the filename part of file)
                                                 "-" for stdin
+    export-diff <image-name> [--from-snap <snap-name>] <path>
+                                                export an incremental diff to
+                                                path, or "-" for stdout
+    import-diff <path> <image-name>             import an incremental diff from
+                                                path or "-" for stdin
     (cp | copy) <src> <dest>                    copy src image to dest
     (mv | rename) <src> <dest>                  rename src image to dest
     snap ls <image-name>                        dump list of image snapshots
@@ -40,6 +45,10 @@
     lock add <image-name> <id> [--shared <tag>] take a lock called id on an image
     lock remove <image-name> <id> <locker>      release a lock on an image
     bench-write <image-name> --io-size <bytes> --io-threads <num> --io-total <bytes>
+    object-map rebuild <image-name>             recreate the object map of an
+                                                image or snapshot
+    object-map check <image-name>               compare the object map with the
+                                                objects that exist
   
   <image-name>, <snap-name> are [pool/]name[@snap], or you may specify
   individual pieces of names with -p/--pool, --image, and/or --snap.
@@ -49,6 +58,7 @@
     --image <image-name>               image name
     --dest <image-name>                destination [pool and] image name
     --snap <snap-name>                 snapshot name
+    --from-snap <snap-name>            snapshot starting point for export-diff
     --dest-pool <name>                 destination pool name
     --path <path-name>                 path name for import/export
     --size <size in MB>                size of image for create and resize
@@ -57,6 +67,7 @@
     --image-format <format-number>     format to use when creating an image
                                        format 1 is the original format (default)
                                        format 2 supports cloning
+    --object-map                       track which objects exist (format 2 only)
     --id <username>                    rados user (without 'client.'prefix) to
                                        authenticate as
     --keyfile <path>                   file containing secret key for use with cephx
@@ -48,6 +48,10 @@ using ::librbd::cls_client::set_protection_status;
 using ::librbd::cls_client::get_stripe_unit_count;
 using ::librbd::cls_client::set_stripe_unit_count;
 using ::librbd::cls_client::old_snapshot_add;
+using ::librbd::cls_client::object_map_load;
+using ::librbd::cls_client::object_map_save;
+using ::librbd::cls_client::object_map_resize;
+using ::librbd::cls_client::object_map_update;
 
 static char *random_buf(size_t len)
 {
@@ -909,3 +913,55 @@ TEST(cls_rbd, stripingv2)
   ioctx.close();
   ASSERT_EQ(0, destroy_one_pool_pp(pool_name, rados));
 }
+
+TEST(cls_rbd, object_map)
+{
+  librados::Rados rados;
+  librados::IoCtx ioctx;
+  string pool_name = get_temp_pool_name();
+
+  ASSERT_EQ("", create_one_pool_pp(pool_name, rados));
+  ASSERT_EQ(0, rados.ioctx_create(pool_name.c_str(), ioctx));
+
+  vector<bool> map;
+  ASSERT_EQ(-ENOENT, object_map_load(&ioctx, "foo", &map));
+  ASSERT_EQ(-ENOENT, object_map_update(&ioctx, "foo", 0, 1, true));
+
+  ASSERT_EQ(0, object_map_resize(&ioctx, "foo", 10, false));
+  ASSERT_EQ(0, object_map_load(&ioctx, "foo", &map));
+  ASSERT_EQ(vector<bool>(10, false), map);
+
+  ASSERT_EQ(0, object_map_update(&ioctx, "foo", 3, 5, true));
+  ASSERT_EQ(0, object_map_update(&ioctx, "foo", 9, 20, true));
+  ASSERT_EQ(0, object_map_load(&ioctx, "foo", &map));
+  vector<bool> expected(10, false);
+  expected[3] = expected[4] = expected[9] = true;
+  ASSERT_EQ(expected, map);
+
+  // growing keeps the existing bits and sets the new ones
+  ASSERT_EQ(0, object_map_resize(&ioctx, "foo", 20, true));
+  ASSERT_EQ(0, object_map_load(&ioctx, "foo", &map));
+  expected.resize(20, true);
+  ASSERT_EQ(expected, map);
+
+  // shrinking drops bits that must not come back when growing again
+  ASSERT_EQ(0, object_map_resize(&ioctx, "foo", 4, false));
+  ASSERT_EQ(0, object_map_resize(&ioctx, "foo", 12, false));
+  ASSERT_EQ(0, object_map_load(&ioctx, "foo", &map));
+  expected.assign(12, false);
+  expected[3] = true;
+  ASSERT_EQ(expected, map);
+
+  ASSERT_EQ(0, object_map_update(&ioctx, "foo", 0, 12, false));
+  ASSERT_EQ(0, object_map_load(&ioctx, "foo", &map));
+  ASSERT_EQ(vector<bool>(12, false), map);
+
+  expected.assign(17, false);
+  expected[0] = expected[8] = expected[16] = true;
+  ASSERT_EQ(0, object_map_save(&ioctx, "bar", expected));
+  ASSERT_EQ(0, object_map_load(&ioctx, "bar", &map));
+  ASSERT_EQ(expected, map);
+
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, rados));
+}
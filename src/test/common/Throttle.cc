@@ -21,6 +21,7 @@
 
 #include <stdio.h>
 #include <signal.h>
+#include <errno.h>
 #include "common/Mutex.h"
 #include "common/Thread.h"
 #include "common/Throttle.h"
@@ -240,6 +241,33 @@ TEST_F(ThrottleTest, destructor) {
   }
 }
 
+TEST_F(ThrottleTest, simple_throttle) {
+  SimpleThrottle throttle(2, false);
+  C_SimpleThrottle *a = new C_SimpleThrottle(&throttle);
+  C_SimpleThrottle *b = new C_SimpleThrottle(&throttle);
+  ASSERT_FALSE(throttle.pending_error());
+  a->complete(0);
+  C_SimpleThrottle *c = new C_SimpleThrottle(&throttle);
+  c->complete(-EIO);
+  ASSERT_TRUE(throttle.pending_error());
+  b->complete(-EINVAL);
+  // the first error wins
+  ASSERT_EQ(-EIO, throttle.wait_for_ret());
+}
+
+TEST_F(ThrottleTest, simple_throttle_ignore_enoent) {
+  {
+    SimpleThrottle throttle(1, true);
+    (new C_SimpleThrottle(&throttle))->complete(-ENOENT);
+    ASSERT_EQ(0, throttle.wait_for_ret());
+  }
+  {
+    SimpleThrottle throttle(1, false);
+    (new C_SimpleThrottle(&throttle))->complete(-ENOENT);
+    ASSERT_EQ(-ENOENT, throttle.wait_for_ret());
+  }
+}
+
 int main(int argc, char **argv) {
   vector<const char*> args;
   argv_to_vec(argc, (const char **)argv, args);
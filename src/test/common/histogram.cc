@@ -0,0 +1,70 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2013 Inktank
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <sstream>
+
+#include "include/types.h"
+#include "common/histogram.h"
+
+#include "gtest/gtest.h"
+
+TEST(Histogram, buckets)
+{
+  ASSERT_EQ(0u, pow2_hist_t::bucket_of(-5));
+  ASSERT_EQ(0u, pow2_hist_t::bucket_of(0));
+  ASSERT_EQ(1u, pow2_hist_t::bucket_of(1));
+  ASSERT_EQ(2u, pow2_hist_t::bucket_of(2));
+  ASSERT_EQ(2u, pow2_hist_t::bucket_of(3));
+  ASSERT_EQ(3u, pow2_hist_t::bucket_of(4));
+  ASSERT_EQ(11u, pow2_hist_t::bucket_of(1024));
+
+  pow2_hist_t h;
+  ASSERT_TRUE(h.empty());
+  h.add(0);
+  h.add(3);
+  h.add(3);
+  h.add(1000);
+  ASSERT_EQ(4u, h.count());
+  ASSERT_EQ(11u, h.h.size());
+  ASSERT_EQ(1u, h.h[0]);
+  ASSERT_EQ(2u, h.h[2]);
+  ASSERT_EQ(1u, h.h[10]);
+  h.clear();
+  ASSERT_TRUE(h.empty());
+}
+
+TEST(Histogram, percentile)
+{
+  pow2_hist_t h;
+  ASSERT_EQ(0, h.percentile(.99));
+  for (int i = 0; i < 99; i++)
+    h.add(10);     // bucket 4, [8, 16)
+  h.add(5000);     // bucket 13, [4096, 8192)
+  ASSERT_EQ(16, h.percentile(.5));
+  ASSERT_EQ(16, h.percentile(.99));
+  ASSERT_EQ(8192, h.percentile(1.0));
+}
+
+TEST(Histogram, dump)
+{
+  pow2_hist_t h;
+  h.add(1);
+  h.add(2);
+  h.add(2);
+  JSONFormatter f;
+  h.dump(&f);
+  std::stringstream ss;
+  f.flush(ss);
+  ASSERT_EQ("[0,1,2]", ss.str());
+}
@@ -0,0 +1,172 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2013 Inktank
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "include/types.h"
+#include "common/AsyncReserver.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+#include "global/global_context.h"
+
+#include "gtest/gtest.h"
+
+// every callback appends its tag to a shared log
+struct C_Log : public Context {
+  Mutex *lock;
+  vector<int> *log;
+  int tag;
+  C_Log(Mutex *l, vector<int> *lg, int t) : lock(l), log(lg), tag(t) {}
+  void finish(int r) {
+    Mutex::Locker l(*lock);
+    log->push_back(tag);
+  }
+};
+
+class AsyncReserverTest : public ::testing::Test {
+public:
+  Finisher finisher;
+  Mutex lock;
+  vector<int> log;
+
+  AsyncReserverTest()
+    : finisher(g_ceph_context), lock("AsyncReserverTest::lock") {}
+  virtual void SetUp() {
+    finisher.start();
+  }
+  virtual void TearDown() {
+    finisher.stop();
+  }
+
+  Context *logger(int tag) {
+    return new C_Log(&lock, &log, tag);
+  }
+  vector<int> flush() {
+    finisher.wait_for_empty();
+    Mutex::Locker l(lock);
+    vector<int> ret;
+    ret.swap(log);
+    return ret;
+  }
+};
+
+TEST_F(AsyncReserverTest, fifo)
+{
+  AsyncReserver<int> r(&finisher, 1);
+  r.request_reservation(1, logger(1));
+  r.request_reservation(2, logger(2));
+  r.request_reservation(3, logger(3));
+  ASSERT_EQ(vector<int>(1, 1), flush());
+  r.cancel_reservation(1);
+  ASSERT_EQ(vector<int>(1, 2), flush());
+  r.cancel_reservation(2);
+  ASSERT_EQ(vector<int>(1, 3), flush());
+  r.cancel_reservation(3);
+}
+
+TEST_F(AsyncReserverTest, priority)
+{
+  AsyncReserver<int> r(&finisher, 1);
+  r.request_reservation(1, logger(1), 10);
+  r.request_reservation(2, logger(2), 10);
+  r.request_reservation(3, logger(3), 20);
+  r.request_reservation(4, logger(4), 5);
+  ASSERT_EQ(vector<int>(1, 1), flush());
+
+  map<unsigned, unsigned> depths;
+  r.get_queue_depths(&depths);
+  ASSERT_EQ(3u, depths.size());
+  ASSERT_EQ(1u, depths[20]);
+  ASSERT_EQ(1u, depths[10]);
+  ASSERT_EQ(1u, depths[5]);
+
+  int expect[] = { 3, 2, 4 };
+  int last = 1;
+  for (int i = 0; i < 3; ++i) {
+    r.cancel_reservation(last);
+    ASSERT_EQ(vector<int>(1, expect[i]), flush());
+    last = expect[i];
+  }
+  r.cancel_reservation(last);
+  r.get_queue_depths(&depths);
+  ASSERT_TRUE(depths.empty());
+}
+
+TEST_F(AsyncReserverTest, cancel_queued)
+{
+  AsyncReserver<int> r(&finisher, 1);
+  r.request_reservation(1, logger(1));
+  r.request_reservation(2, logger(2), 0, logger(-2));
+  r.request_reservation(3, logger(3));
+  r.cancel_reservation(2);
+  ASSERT_EQ(vector<int>(1, 1), flush());
+  r.cancel_reservation(1);
+  ASSERT_EQ(vector<int>(1, 3), flush());
+  r.cancel_reservation(3);
+}
+
+TEST_F(AsyncReserverTest, preempt)
+{
+  AsyncReserver<int> r(&finisher, 2);
+  r.request_reservation(1, logger(1), 10, logger(-1));
+  r.request_reservation(2, logger(2), 5, logger(-2));
+  ASSERT_EQ(2u, flush().size());
+
+  // equal priority waits
+  r.request_reservation(3, logger(3), 5);
+  ASSERT_TRUE(flush().empty());
+
+  // higher priority takes the lowest preemptible slot
+  r.request_reservation(4, logger(4), 20);
+  vector<int> got = flush();
+  ASSERT_EQ(2u, got.size());
+  ASSERT_EQ(-2, got[0]);
+  ASSERT_EQ(4, got[1]);
+
+  // cancelling a preempted reservation is harmless
+  r.cancel_reservation(2);
+  ASSERT_TRUE(flush().empty());
+
+  // 1 can still be preempted, 3 cannot
+  r.cancel_reservation(4);
+  ASSERT_EQ(vector<int>(1, 3), flush());
+  r.request_reservation(5, logger(5), 30);
+  got = flush();
+  ASSERT_EQ(2u, got.size());
+  ASSERT_EQ(-1, got[0]);
+  ASSERT_EQ(5, got[1]);
+  r.cancel_reservation(3);
+  r.cancel_reservation(5);
+}
+
+TEST_F(AsyncReserverTest, not_preemptible)
+{
+  AsyncReserver<int> r(&finisher, 1);
+  r.request_reservation(1, logger(1), 0);
+  ASSERT_EQ(vector<int>(1, 1), flush());
+  r.request_reservation(2, logger(2), 100);
+  ASSERT_TRUE(flush().empty());
+  r.cancel_reservation(1);
+  ASSERT_EQ(vector<int>(1, 2), flush());
+  r.cancel_reservation(2);
+}
+
+int main(int argc, char **argv) {
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
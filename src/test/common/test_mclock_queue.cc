@@ -0,0 +1,169 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2013 Inktank
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "include/types.h"
+#include "common/mClockQueue.h"
+
+#include "gtest/gtest.h"
+
+typedef mClockQueue<int, int> Queue;
+
+// every item is tagged with the id of its client
+static void fill(Queue &q, int cl, const Queue::ClientInfo &info,
+		 int n, double now)
+{
+  for (int i = 0; i < n; i++)
+    q.enqueue(cl, info, 1, cl, now);
+}
+
+TEST(mClockQueue, fifo_within_class)
+{
+  Queue q(100, 1);
+  for (int i = 0; i < 10; i++)
+    q.enqueue(1, Queue::ClientInfo(), 1, i, 0.0);
+  ASSERT_EQ(10u, q.length());
+  for (int i = 0; i < 10; i++)
+    ASSERT_EQ(i, q.dequeue(0.0));
+  ASSERT_TRUE(q.empty());
+}
+
+TEST(mClockQueue, strict_first)
+{
+  Queue q(100, 1);
+  q.enqueue(1, Queue::ClientInfo(), 1, 1, 0.0);
+  q.enqueue_strict(2, 200, 2);
+  q.enqueue_strict(3, 250, 3);
+  ASSERT_EQ(3u, q.length());
+  ASSERT_EQ(3, q.dequeue(0.0));
+  ASSERT_EQ(2, q.dequeue(0.0));
+  ASSERT_EQ(1, q.dequeue(0.0));
+  ASSERT_TRUE(q.empty());
+}
+
+TEST(mClockQueue, weight)
+{
+  // two backlogged clients with weights 1:3 share service 1:3
+  Queue q(100, 1);
+  fill(q, 1, Queue::ClientInfo(0, 1, 0), 100, 0.0);
+  fill(q, 2, Queue::ClientInfo(0, 3, 0), 100, 0.0);
+  int served[3] = { 0, 0, 0 };
+  for (int i = 0; i < 80; i++)
+    served[q.dequeue(0.0)]++;
+  ASSERT_EQ(20, served[1]);
+  ASSERT_EQ(60, served[2]);
+}
+
+TEST(mClockQueue, reservation)
+{
+  // client 1 has a tiny weight but reserves 10 ops/sec; over a bit
+  // more than one second it must get its reservation even though
+  // client 2 would otherwise take almost everything.
+  Queue q(100, 1);
+  fill(q, 1, Queue::ClientInfo(10, 0.01, 0), 100, 0.0);
+  fill(q, 2, Queue::ClientInfo(0, 100, 0), 1000, 0.0);
+  int served[3] = { 0, 0, 0 };
+  for (int i = 0; i < 220; i++)
+    served[q.dequeue(i / 200.0)]++;
+  ASSERT_GE(served[1], 10);
+  ASSERT_LE(served[1], 12);
+}
+
+TEST(mClockQueue, limit)
+{
+  // client 1 is limited to 10 ops/sec; while client 2 has work, client
+  // 1 must not exceed its limit.
+  Queue q(100, 1);
+  fill(q, 1, Queue::ClientInfo(0, 100, 10), 100, 0.0);
+  fill(q, 2, Queue::ClientInfo(0, 1, 0), 1000, 0.0);
+  int served[3] = { 0, 0, 0 };
+  for (int i = 0; i < 200; i++)
+    served[q.dequeue(i / 200.0)]++;
+  ASSERT_LE(served[1], 11);
+
+  // limits are soft: with nobody else waiting the queue still drains
+  Queue q2(100, 1);
+  fill(q2, 1, Queue::ClientInfo(0, 1, 1), 5, 0.0);
+  for (int i = 0; i < 5; i++)
+    ASSERT_EQ(1, q2.dequeue(0.0));
+  ASSERT_TRUE(q2.empty());
+}
+
+TEST(mClockQueue, enqueue_front)
+{
+  Queue q(100, 1);
+  q.enqueue(1, Queue::ClientInfo(), 1, 1, 0.0);
+  q.enqueue(1, Queue::ClientInfo(), 1, 2, 0.0);
+  q.enqueue_front(1, Queue::ClientInfo(), 1, 0, 0.0);
+  ASSERT_EQ(0, q.dequeue(0.0));
+  ASSERT_EQ(1, q.dequeue(0.0));
+  ASSERT_EQ(2, q.dequeue(0.0));
+}
+
+struct IsOdd {
+  bool operator()(int i) const {
+    return i % 2;
+  }
+};
+
+TEST(mClockQueue, remove_by_filter)
+{
+  Queue q(100, 1);
+  for (int i = 0; i < 10; i++)
+    q.enqueue(i % 3, Queue::ClientInfo(), 1, i, 0.0);
+  q.enqueue_strict(5, 200, 11);
+  list<int> removed;
+  q.remove_by_filter(IsOdd(), &removed);
+  ASSERT_EQ(6u, removed.size());
+  ASSERT_EQ(5u, q.length());
+  while (!q.empty())
+    ASSERT_EQ(0, q.dequeue(0.0) % 2);
+}
+
+TEST(mClockQueue, idle_classes_are_forgotten)
+{
+  // every client issues two ops and goes away, leaving its tags a
+  // little in the future; once they are due its class is dropped
+  Queue q(100, 1);
+  for (int i = 0; i < 100; i++) {
+    fill(q, i, Queue::ClientInfo(1, 1, 1), 2, i);
+    q.dequeue(i);
+    q.dequeue(i);
+  }
+  ASSERT_TRUE(q.empty());
+  ASSERT_GE(5u, q.get_num_classes());
+  q.enqueue(1000, Queue::ClientInfo(), 1, 0, 200.0);
+  q.dequeue(200.0);
+  ASSERT_EQ(0u, q.get_num_classes());
+
+  // remove_by_filter drops the classes it empties too
+  fill(q, 1, Queue::ClientInfo(), 3, 300.0);
+  fill(q, 2, Queue::ClientInfo(), 3, 300.0);
+  list<int> removed;
+  q.remove_by_filter(IsOdd(), &removed, 400.0);
+  ASSERT_EQ(3u, removed.size());
+  ASSERT_EQ(1u, q.get_num_classes());
+}
+
+TEST(mClockQueue, remove_by_class)
+{
+  Queue q(100, 1);
+  fill(q, 1, Queue::ClientInfo(), 5, 0.0);
+  fill(q, 2, Queue::ClientInfo(), 3, 0.0);
+  list<int> removed;
+  q.remove_by_class(1, &removed);
+  ASSERT_EQ(5u, removed.size());
+  ASSERT_EQ(3u, q.length());
+  while (!q.empty())
+    ASSERT_EQ(2, q.dequeue(0.0));
+}
@@ -0,0 +1,141 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2013 Inktank
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "include/types.h"
+#include "common/Readahead.h"
+
+#include "gtest/gtest.h"
+
+typedef Readahead::extent_t extent_t;
+
+// start away from 0: a read at offset 0 counts as sequential
+static const uint64_t base = 1 << 20;
+
+// read @n times @len bytes sequentially from @off; return the last
+// readahead
+static extent_t read_seq(Readahead &ra, uint64_t *off, uint64_t len, int n,
+			 uint64_t limit = 1 << 30)
+{
+  extent_t e(0, 0);
+  for (int i = 0; i < n; i++) {
+    e = ra.update(*off, len, limit);
+    *off += len;
+  }
+  return e;
+}
+
+TEST(Readahead, trigger)
+{
+  Readahead ra;
+  ra.set_trigger_requests(4);
+  uint64_t off = base;
+  // the first read doesn't count, it has nothing to follow
+  ASSERT_EQ(0u, read_seq(ra, &off, 4096, 4).second);
+  extent_t e = read_seq(ra, &off, 4096, 1);
+  ASSERT_EQ(off, e.first);
+  ASSERT_EQ(4u * 4096, e.second);
+
+  // a random read starts over
+  off = 8 * base;
+  ASSERT_EQ(0u, read_seq(ra, &off, 4096, 4).second);
+  ASSERT_NE(0u, read_seq(ra, &off, 4096, 1).second);
+}
+
+TEST(Readahead, window_grows)
+{
+  Readahead ra;
+  ra.set_trigger_requests(1);
+  ra.set_max_readahead_size(64 * 4096);
+  uint64_t off = base;
+  read_seq(ra, &off, 4096, 1);
+  extent_t e = read_seq(ra, &off, 4096, 1);
+  ASSERT_EQ(base + 8192, e.first);
+  ASSERT_EQ(4096u, e.second);
+
+  uint64_t last_len = e.second;
+  uint64_t ra_end = e.first + e.second;
+  for (int i = 0; i < 200; i++) {
+    e = read_seq(ra, &off, 4096, 1);
+    if (!e.second)
+      continue;
+    // contiguous with the previous window, and never smaller
+    ASSERT_EQ(ra_end, e.first);
+    ASSERT_GE(e.second, last_len);
+    ASSERT_LE(e.second, 64u * 4096);
+    last_len = e.second;
+    ra_end = e.first + e.second;
+  }
+  ASSERT_EQ(64u * 4096, last_len);
+  // the reader never catches up with the readahead
+  ASSERT_GT(ra_end, off);
+}
+
+TEST(Readahead, limit)
+{
+  Readahead ra;
+  ra.set_trigger_requests(1);
+  uint64_t off = 4096;
+  read_seq(ra, &off, 4096, 1);
+  extent_t e = read_seq(ra, &off, 4096, 1, 14000);
+  ASSERT_EQ(12288u, e.first);
+  ASSERT_EQ(14000u - 12288, e.second);
+  ASSERT_EQ(0u, read_seq(ra, &off, 4096, 1, 14000).second);
+}
+
+TEST(Readahead, alignment)
+{
+  Readahead ra;
+  ra.set_trigger_requests(1);
+  ra.set_alignment(1 << 16);
+  uint64_t off = base;
+  read_seq(ra, &off, 40000, 1);
+  // would end at 120000; the next boundary is close enough to extend to
+  extent_t e = read_seq(ra, &off, 40000, 1);
+  ASSERT_EQ(base + 80000, e.first);
+  ASSERT_EQ((1u << 17) - 80000, e.second);
+}
+
+TEST(Readahead, disabled)
+{
+  Readahead ra;
+  ra.set_trigger_requests(1);
+  ra.set_max_readahead_size(0);
+  uint64_t off = base;
+  ASSERT_EQ(0u, read_seq(ra, &off, 4096, 100).second);
+}
+
+TEST(Readahead, hits)
+{
+  Readahead ra;
+  ra.set_trigger_requests(1);
+  uint64_t off = base;
+  read_seq(ra, &off, 4096, 1);
+  extent_t e = read_seq(ra, &off, 4096, 1);
+  ASSERT_EQ(off, e.first);
+
+  uint64_t hit;
+  ra.update(off, 4096, 1 << 30, &hit);
+  ASSERT_EQ(4096u, hit);
+  ra.update(8 * base, 4096, 1 << 30, &hit);
+  ASSERT_EQ(0u, hit);
+}
+
+TEST(Readahead, pending)
+{
+  Readahead ra;
+  ra.inc_pending(2);
+  ra.dec_pending();
+  ra.dec_pending();
+  ra.wait_for_pending();
+}
@@ -0,0 +1,171 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#include "gtest/gtest.h"
+#include "include/types.h"
+
+#include <errno.h>
+#include <vector>
+
+extern "C" {
+#include "crush/crush.h"
+#include "crush/hash.h"
+#include "crush/mapper.h"
+#include "crush/builder.h"
+}
+
+/*
+ * A single straw2 bucket of devices with a rule that picks one of
+ * them, so that every mapping is one bucket_straw2_choose() call.
+ */
+class Straw2Test : public testing::Test {
+public:
+  static const int num_items = 5;
+  static const int num_inputs = 100000;
+
+  struct crush_map *map;
+  struct crush_bucket *bucket;
+  std::vector<__u32> dev_weights;
+
+  Straw2Test() : map(NULL), bucket(NULL) {}
+
+  void build(const int *weights) {
+    int items[num_items];
+    int w[num_items];
+    for (int i = 0; i < num_items; ++i) {
+      items[i] = i;
+      w[i] = weights[i] * 0x10000;
+    }
+    map = crush_create();
+    bucket = crush_make_bucket(CRUSH_BUCKET_STRAW2, CRUSH_HASH_DEFAULT,
+			       1, num_items, items, w);
+    ASSERT_TRUE(bucket != NULL);
+    int id = crush_add_bucket(map, 0, bucket);
+    ASSERT_LT(id, 0);
+
+    struct crush_rule *rule = crush_make_rule(3, 0, 1, 1, 1);
+    crush_rule_set_step(rule, 0, CRUSH_RULE_TAKE, id, 0);
+    crush_rule_set_step(rule, 1, CRUSH_RULE_CHOOSE_FIRSTN, 1, 0);
+    crush_rule_set_step(rule, 2, CRUSH_RULE_EMIT, 0, 0);
+    ASSERT_EQ(0, crush_add_rule(map, rule, 0));
+    crush_finalize(map);
+
+    // no device is out; only the bucket weights matter
+    dev_weights.assign(num_items, 0x10000);
+  }
+
+  void TearDown() {
+    if (map)
+      crush_destroy(map);
+  }
+
+  /// map every input, leaving the chosen item per input in @out
+  void map_all(std::vector<int> *out) {
+    out->resize(num_inputs);
+    for (int x = 0; x < num_inputs; ++x) {
+      int result = -1;
+      int n = crush_do_rule(map, 0, x, &result, 1,
+			    &dev_weights[0], dev_weights.size());
+      ASSERT_EQ(1, n);
+      (*out)[x] = result;
+    }
+  }
+
+  /// check that the counts in @mapping follow @weights to within 5%
+  void check_proportional(const std::vector<int>& mapping,
+			  const int *weights) {
+    int total_weight = 0;
+    for (int i = 0; i < num_items; ++i)
+      total_weight += weights[i];
+    std::vector<int> count(num_items, 0);
+    for (int x = 0; x < num_inputs; ++x)
+      count[mapping[x]]++;
+    for (int i = 0; i < num_items; ++i) {
+      double expected = (double)num_inputs * weights[i] / total_weight;
+      EXPECT_NEAR(expected, count[i], expected * .05)
+	<< "item " << i << " weight " << weights[i];
+    }
+  }
+};
+
+TEST_F(Straw2Test, Proportional) {
+  int weights[num_items] = { 1, 2, 3, 4, 5 };
+  build(weights);
+  std::vector<int> mapping;
+  map_all(&mapping);
+  check_proportional(mapping, weights);
+}
+
+TEST_F(Straw2Test, ZeroWeight) {
+  int weights[num_items] = { 1, 0, 1, 0, 1 };
+  build(weights);
+  std::vector<int> mapping;
+  map_all(&mapping);
+  for (int x = 0; x < num_inputs; ++x)
+    ASSERT_TRUE(mapping[x] != 1 && mapping[x] != 3);
+  check_proportional(mapping, weights);
+}
+
+TEST_F(Straw2Test, ReweightMovesOnlyThatItem) {
+  int weights[num_items] = { 3, 3, 3, 3, 3 };
+  build(weights);
+  std::vector<int> before;
+  map_all(&before);
+
+  // halving item 2 may only move inputs off of item 2
+  const int item = 2;
+  weights[item] = 1;
+  crush_bucket_adjust_item_weight(bucket, item, weights[item] * 0x10000);
+  std::vector<int> after;
+  map_all(&after);
+  int moved = 0;
+  for (int x = 0; x < num_inputs; ++x) {
+    if (before[x] != after[x]) {
+      ASSERT_EQ(item, before[x]) << "input " << x << " moved "
+				 << before[x] << " -> " << after[x];
+      ++moved;
+    }
+  }
+  ASSERT_GT(moved, 0);
+  check_proportional(after, weights);
+
+  // and raising it again may only move inputs onto item 2
+  weights[item] = 6;
+  crush_bucket_adjust_item_weight(bucket, item, weights[item] * 0x10000);
+  std::vector<int> raised;
+  map_all(&raised);
+  moved = 0;
+  for (int x = 0; x < num_inputs; ++x) {
+    if (after[x] != raised[x]) {
+      ASSERT_EQ(item, raised[x]) << "input " << x << " moved "
+				 << after[x] << " -> " << raised[x];
+      ++moved;
+    }
+  }
+  ASSERT_GT(moved, 0);
+  check_proportional(raised, weights);
+}
+
+TEST_F(Straw2Test, RemoveItem) {
+  int weights[num_items] = { 1, 2, 3, 4, 5 };
+  build(weights);
+
+  // the last item used to be reported missing after it was removed
+  ASSERT_EQ(0, crush_bucket_remove_item(bucket, num_items - 1));
+  ASSERT_EQ(num_items - 1, (int)bucket->size);
+  ASSERT_EQ((1 + 2 + 3 + 4) * 0x10000, (int)bucket->weight);
+
+  ASSERT_EQ(0, crush_bucket_remove_item(bucket, 0));
+  ASSERT_EQ(num_items - 2, (int)bucket->size);
+  ASSERT_EQ((2 + 3 + 4) * 0x10000, (int)bucket->weight);
+  ASSERT_EQ(1, bucket->items[0]);
+
+  ASSERT_EQ(-ENOENT, crush_bucket_remove_item(bucket, 0));
+  ASSERT_EQ(num_items - 2, (int)bucket->size);
+  ASSERT_EQ((2 + 3 + 4) * 0x10000, (int)bucket->weight);
+
+  // nothing maps to a removed item
+  std::vector<int> mapping;
+  map_all(&mapping);
+  for (int x = 0; x < num_inputs; ++x)
+    ASSERT_TRUE(mapping[x] >= 1 && mapping[x] <= 3);
+}
@@ -72,6 +72,43 @@ TEST(LibRadosIo, RoundTripPP) {
   ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
 }
 
+TEST(LibRadosIo, ReplicaReadRoundTripPP) {
+  char buf[128];
+  Rados cluster;
+  std::string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool_pp(pool_name, cluster));
+  IoCtx ioctx;
+  cluster.ioctx_create(pool_name.c_str(), ioctx);
+  memset(buf, 0xcc, sizeof(buf));
+  bufferlist bl;
+  bl.append(buf, sizeof(buf));
+  ASSERT_EQ((int)sizeof(buf), ioctx.write("foo", bl, sizeof(buf), 0));
+
+  // whichever osd serves them, reads must see the write
+  ioctx.set_read_flags(librados::OPERATION_BALANCE_READS);
+  for (int i = 0; i < 20; i++) {
+    bufferlist cl;
+    ASSERT_EQ((int)sizeof(buf), ioctx.read("foo", cl, sizeof(buf), 0));
+    ASSERT_EQ(0, memcmp(buf, cl.c_str(), sizeof(buf)));
+  }
+  ioctx.set_read_flags(librados::OPERATION_NOFLAG);
+
+  ObjectReadOperation op;
+  bufferlist cl;
+  op.read(0, sizeof(buf), NULL, NULL);
+  AioCompletion *completion = cluster.aio_create_completion();
+  ASSERT_EQ(0, ioctx.aio_operate("foo", completion, &op,
+				 librados::OPERATION_LOCALIZE_READS, &cl));
+  completion->wait_for_complete();
+  ASSERT_EQ(0, completion->get_return_value());
+  completion->release();
+  ASSERT_EQ((unsigned)sizeof(buf), cl.length());
+  ASSERT_EQ(0, memcmp(buf, cl.c_str(), sizeof(buf)));
+
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
+}
+
 TEST(LibRadosIo, OverlappingWriteRoundTrip) {
   char buf[128];
   char buf2[64];
@@ -19,7 +19,9 @@
 
 #include "gtest/gtest.h"
 
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -33,6 +35,7 @@
 
 #include "test/librados/test.h"
 #include "common/errno.h"
+#include "include/encoding.h"
 #include "include/stringify.h"
 
 using namespace std;
@@ -746,6 +749,305 @@ TEST(LibRBD, TestIO)
   ASSERT_EQ(0, destroy_one_pool(pool_name, &cluster));
 }
 
+TEST(LibRBD, TestPersistentCache)
+{
+  rados_t cluster;
+  rados_ioctx_t ioctx;
+  string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool(pool_name, &cluster));
+  rados_ioctx_create(cluster, pool_name.c_str(), &ioctx);
+
+  char cache_dir[] = "/tmp/test_librbd_pcache.XXXXXX";
+  ASSERT_TRUE(mkdtemp(cache_dir) != NULL);
+  ASSERT_EQ(0, rados_conf_set(cluster, "rbd_persistent_cache", "true"));
+  ASSERT_EQ(0, rados_conf_set(cluster, "rbd_persistent_cache_path", cache_dir));
+  // keep everything in the log until the image is closed
+  ASSERT_EQ(0, rados_conf_set(cluster, "rbd_persistent_cache_max_dirty_age",
+			      "1000"));
+
+  rbd_image_t image;
+  int order = 0;
+  const char *name = "testimg";
+  uint64_t size = 2 << 20;
+
+  ASSERT_EQ(0, create_image(ioctx, name, size, &order));
+  ASSERT_EQ(0, rbd_open(ioctx, name, &image, NULL));
+
+  char test_data[TEST_IO_SIZE + 1];
+  char zero_data[TEST_IO_SIZE + 1];
+  for (int i = 0; i < TEST_IO_SIZE; ++i)
+    test_data[i] = (char) (rand() % (126 - 33) + 33);
+  test_data[TEST_IO_SIZE] = '\0';
+  memset(zero_data, 0, sizeof(zero_data));
+
+  // reads see what is still in the log, alone or mixed with the cluster
+  for (int i = 0; i < 5; ++i)
+    write_test_data(image, test_data, TEST_IO_SIZE * i, TEST_IO_SIZE);
+  aio_write_test_data(image, test_data, size - TEST_IO_SIZE, TEST_IO_SIZE);
+  for (int i = 0; i < 5; ++i)
+    read_test_data(image, test_data, TEST_IO_SIZE * i, TEST_IO_SIZE);
+  read_test_data(image, zero_data, TEST_IO_SIZE * 5, TEST_IO_SIZE);
+  read_test_data(image, test_data, size - TEST_IO_SIZE, TEST_IO_SIZE);
+
+  discard_test_data(image, TEST_IO_SIZE, TEST_IO_SIZE);
+  read_test_data(image, zero_data, TEST_IO_SIZE, TEST_IO_SIZE);
+  ASSERT_EQ(0, rbd_flush(image));
+
+  // closing writes everything back and removes the log
+  ASSERT_EQ(0, rbd_close(image));
+  ASSERT_EQ(0, rmdir(cache_dir));
+
+  ASSERT_EQ(0, rados_conf_set(cluster, "rbd_persistent_cache", "false"));
+  ASSERT_EQ(0, rbd_open(ioctx, name, &image, NULL));
+  read_test_data(image, test_data, 0, TEST_IO_SIZE);
+  read_test_data(image, zero_data, TEST_IO_SIZE, TEST_IO_SIZE);
+  for (int i = 2; i < 5; ++i)
+    read_test_data(image, test_data, TEST_IO_SIZE * i, TEST_IO_SIZE);
+  read_test_data(image, test_data, size - TEST_IO_SIZE, TEST_IO_SIZE);
+  ASSERT_EQ(0, rbd_close(image));
+
+  rados_ioctx_destroy(ioctx);
+  ASSERT_EQ(0, destroy_one_pool(pool_name, &cluster));
+}
+
+TEST(LibRBD, TestPersistentCacheWrap)
+{
+  rados_t cluster;
+  rados_ioctx_t ioctx;
+  string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool(pool_name, &cluster));
+  rados_ioctx_create(cluster, pool_name.c_str(), &ioctx);
+
+  char cache_dir[] = "/tmp/test_librbd_pcache.XXXXXX";
+  ASSERT_TRUE(mkdtemp(cache_dir) != NULL);
+  ASSERT_EQ(0, rados_conf_set(cluster, "rbd_persistent_cache", "true"));
+  ASSERT_EQ(0, rados_conf_set(cluster, "rbd_persistent_cache_path", cache_dir));
+  ASSERT_EQ(0, rados_conf_set(cluster, "rbd_persistent_cache_size", "1048576"));
+  // only write back when the log fills up
+  ASSERT_EQ(0, rados_conf_set(cluster, "rbd_persistent_cache_max_dirty_age",
+			      "1000"));
+
+  rbd_image_t image;
+  int order = 0;
+  const char *name = "testimg";
+  uint64_t size = 2 << 20;
+  const size_t len = 64 << 10;
+
+  ASSERT_EQ(0, create_image(ioctx, name, size, &order));
+  ASSERT_EQ(0, rbd_open(ioctx, name, &image, NULL));
+
+  // push several times the log size through it, overwriting the same
+  // extents, so the log wraps and older entries overlap newer ones
+  char *data = (char *)malloc(len);
+  for (int round = 0; round < 4; ++round) {
+    memset(data, 'a' + round, len);
+    for (uint64_t off = 0; off < size; off += len)
+      write_test_data(image, data, off, len);
+  }
+  for (uint64_t off = 0; off < size; off += len)
+    read_test_data(image, data, off, len);
+
+  ASSERT_EQ(0, rbd_close(image));
+  ASSERT_EQ(0, rmdir(cache_dir));
+
+  ASSERT_EQ(0, rados_conf_set(cluster, "rbd_persistent_cache", "false"));
+  ASSERT_EQ(0, rbd_open(ioctx, name, &image, NULL));
+  for (uint64_t off = 0; off < size; off += len)
+    read_test_data(image, data, off, len);
+  ASSERT_EQ(0, rbd_close(image));
+  free(data);
+
+  rados_ioctx_destroy(ioctx);
+  ASSERT_EQ(0, destroy_one_pool(pool_name, &cluster));
+}
+
+/// the persistent cache log in @dir, or "" if there is none
+static string pcache_log(const char *dir)
+{
+  string log;
+  DIR *d = opendir(dir);
+  struct dirent *de;
+  while ((de = readdir(d)) != NULL) {
+    string name = de->d_name;
+    if (name[0] != '.' && name.find(".stale") == string::npos)
+      log = string(dir) + "/" + name;
+  }
+  closedir(d);
+  return log;
+}
+
+TEST(LibRBD, TestPersistentCacheReplay)
+{
+  rados_t cluster;
+  rados_ioctx_t ioctx;
+  string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool(pool_name, &cluster));
+  rados_ioctx_create(cluster, pool_name.c_str(), &ioctx);
+
+  char cache_dir[] = "/tmp/test_librbd_pcache.XXXXXX";
+  ASSERT_TRUE(mkdtemp(cache_dir) != NULL);
+  ASSERT_EQ(0, rados_conf_set(cluster, "rbd_persistent_cache", "true"));
+  ASSERT_EQ(0, rados_conf_set(cluster, "rbd_persistent_cache_path", cache_dir));
+  ASSERT_EQ(0, rados_conf_set(cluster, "rbd_persistent_cache_size", "1048576"));
+  ASSERT_EQ(0, rados_conf_set(cluster, "rbd_persistent_cache_max_dirty_age",
+			      "1000"));
+
+  rbd_image_t image;
+  int order = 0;
+  const char *name = "testimg";
+  uint64_t size = 2 << 20;
+  const size_t len = 64 << 10;
+  char *data = (char *)malloc(len);
+  char *zero_data = (char *)calloc(1, len);
+
+  ASSERT_EQ(0, create_image(ioctx, name, size, &order));
+
+  // a torn entry at the tail ends the replay
+  ASSERT_EQ(0, rbd_open(ioctx, name, &image, NULL));
+  memset(data, 'a', len);
+  write_test_data(image, data, 0, len);
+  memset(data, 'b', len);
+  write_test_data(image, data, len, len);
+  ASSERT_EQ(0, rbd_flush(image));
+  ASSERT_EQ(0, rados_conf_set(cluster, "rbd_persistent_cache_inject_crash", "true"));
+  ASSERT_EQ(0, rbd_close(image));
+  ASSERT_EQ(0, rados_conf_set(cluster, "rbd_persistent_cache_inject_crash", "false"));
+  string log = pcache_log(cache_dir);
+  ASSERT_NE("", log);
+  // a 4096 byte header, then entries of a 45 byte header and the data;
+  // cut the second one short
+  ASSERT_EQ(0, truncate(log.c_str(), 4096 + 2 * (45 + len) - len / 2));
+
+  ASSERT_EQ(0, rbd_open(ioctx, name, &image, NULL));
+  memset(data, 'a', len);
+  read_test_data(image, data, 0, len);
+  read_test_data(image, zero_data, len, len);
+  ASSERT_EQ(0, rbd_close(image));
+  ASSERT_EQ("", pcache_log(cache_dir));
+
+  // a log that wrapped around the end of the file is replayed in
+  // order, so older entries never overwrite newer ones
+  ASSERT_EQ(0, rbd_open(ioctx, name, &image, NULL));
+  for (int round = 0; round < 4; ++round) {
+    memset(data, 'a' + round, len);
+    for (uint64_t off = 0; off < size; off += len)
+      write_test_data(image, data, off, len);
+  }
+  ASSERT_EQ(0, rbd_flush(image));
+  ASSERT_EQ(0, rados_conf_set(cluster, "rbd_persistent_cache_inject_crash", "true"));
+  ASSERT_EQ(0, rbd_close(image));
+  ASSERT_EQ(0, rados_conf_set(cluster, "rbd_persistent_cache_inject_crash", "false"));
+  ASSERT_NE("", pcache_log(cache_dir));
+
+  ASSERT_EQ(0, rbd_open(ioctx, name, &image, NULL));
+  for (uint64_t off = 0; off < size; off += len)
+    read_test_data(image, data, off, len);
+  ASSERT_EQ(0, rbd_close(image));
+  ASSERT_EQ("", pcache_log(cache_dir));
+
+  // a version 1 header records no owner, so the log is not replayed
+  ASSERT_EQ(0, rbd_open(ioctx, name, &image, NULL));
+  memset(data, 'x', len);
+  write_test_data(image, data, 0, len);
+  ASSERT_EQ(0, rbd_flush(image));
+  ASSERT_EQ(0, rados_conf_set(cluster, "rbd_persistent_cache_inject_crash", "true"));
+  ASSERT_EQ(0, rbd_close(image));
+  ASSERT_EQ(0, rados_conf_set(cluster, "rbd_persistent_cache_inject_crash", "false"));
+  log = pcache_log(cache_dir);
+  ASSERT_NE("", log);
+
+  int fd = open(log.c_str(), O_RDWR);
+  ASSERT_LE(0, fd);
+  bufferptr hp(4096);
+  ASSERT_EQ(4096, pread(fd, hp.c_str(), hp.length(), 0));
+  bufferlist hbl;
+  hbl.append(hp);
+  bufferlist::iterator p = hbl.begin();
+  __u32 magic;
+  __u8 version;
+  string key;
+  uint64_t generation, log_size;
+  ::decode(magic, p);
+  ::decode(version, p);
+  ::decode(key, p);
+  ::decode(generation, p);
+  ::decode(log_size, p);
+  ASSERT_EQ(3, version);
+  bufferlist v1;
+  ::encode(magic, v1);
+  ::encode((__u8)1, v1);
+  ::encode(key, v1);
+  ::encode(generation, v1);
+  ::encode(log_size, v1);
+  __u32 crc = v1.crc32c(0);
+  ::encode(crc, v1);
+  v1.append_zero(4096 - v1.length());
+  ASSERT_EQ(4096, pwrite(fd, v1.c_str(), v1.length(), 0));
+  close(fd);
+
+  // the lock of the crashed log is still held, so this open has to do
+  // without a persistent cache
+  ASSERT_EQ(0, rbd_open(ioctx, name, &image, NULL));
+  ASSERT_EQ("", pcache_log(cache_dir));
+  memset(data, 'd', len);
+  read_test_data(image, data, 0, len);
+  ASSERT_EQ(0, rbd_close(image));
+  string stale = log + ".stale";
+  ASSERT_EQ(0, unlink(stale.c_str()));
+  ASSERT_EQ(0, rmdir(cache_dir));
+
+  free(data);
+  free(zero_data);
+  ASSERT_EQ(0, rados_conf_set(cluster, "rbd_persistent_cache", "false"));
+  rados_ioctx_destroy(ioctx);
+  ASSERT_EQ(0, destroy_one_pool(pool_name, &cluster));
+}
+
+TEST(LibRBD, TestCacheShards)
+{
+  rados_t cluster;
+  rados_ioctx_t ioctx;
+  string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool(pool_name, &cluster));
+  rados_ioctx_create(cluster, pool_name.c_str(), &ioctx);
+
+  ASSERT_EQ(0, rados_conf_set(cluster, "rbd_cache", "true"));
+  ASSERT_EQ(0, rados_conf_set(cluster, "rbd_cache_shards", "4"));
+
+  rbd_image_t image;
+  int order = 16;
+  const char *name = "testimg";
+  uint64_t size = 2 << 20;
+
+  ASSERT_EQ(0, create_image(ioctx, name, size, &order));
+  ASSERT_EQ(0, rbd_open(ioctx, name, &image, NULL));
+
+  // spans all the shards, and some requests span two objects
+  uint64_t object_size = 1 << order;
+  char test_data[TEST_IO_SIZE + 1];
+  for (int i = 0; i < TEST_IO_SIZE; ++i)
+    test_data[i] = (char) (rand() % (126 - 33) + 33);
+  test_data[TEST_IO_SIZE] = '\0';
+  for (int i = 0; i < 8; ++i)
+    write_test_data(image, test_data, object_size * (i + 1) - 1,
+		    TEST_IO_SIZE);
+  for (int i = 0; i < 8; ++i)
+    read_test_data(image, test_data, object_size * (i + 1) - 1,
+		   TEST_IO_SIZE);
+  ASSERT_EQ(0, rbd_flush(image));
+  ASSERT_EQ(0, rbd_close(image));
+
+  ASSERT_EQ(0, rados_conf_set(cluster, "rbd_cache", "false"));
+  ASSERT_EQ(0, rbd_open(ioctx, name, &image, NULL));
+  for (int i = 0; i < 8; ++i)
+    read_test_data(image, test_data, object_size * (i + 1) - 1,
+		   TEST_IO_SIZE);
+  ASSERT_EQ(0, rbd_close(image));
+
+  rados_ioctx_destroy(ioctx);
+  ASSERT_EQ(0, destroy_one_pool(pool_name, &cluster));
+}
+
 TEST(LibRBD, TestEmptyDiscard)
 {
   rados_t cluster;
@@ -913,6 +1215,160 @@ TEST(LibRBD, TestIOPP)
 }
 
 
+struct iterate_state {
+  char *buf;
+  uint64_t next;   // offset the next callback must start at
+  int holes;
+};
+
+static int iterate_cb(uint64_t ofs, size_t len, const char *buf, void *arg)
+{
+  iterate_state *s = (iterate_state *)arg;
+  if (ofs != s->next)
+    return -EDOM;
+  if (buf)
+    memcpy(s->buf + ofs, buf, len);
+  else
+    s->holes++;
+  s->next = ofs + len;
+  return 0;
+}
+
+TEST(LibRBD, TestReadIterate)
+{
+  rados_t cluster;
+  rados_ioctx_t ioctx;
+  string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool(pool_name, &cluster));
+  rados_ioctx_create(cluster, pool_name.c_str(), &ioctx);
+
+  rbd_image_t image;
+  int order = 16;
+  const char *name = "testimg";
+  uint64_t size = 2 << 20;
+
+  ASSERT_EQ(0, create_image(ioctx, name, size, &order));
+  ASSERT_EQ(0, rbd_open(ioctx, name, &image, NULL));
+
+  char test_data[TEST_IO_SIZE];
+  for (int i = 0; i < TEST_IO_SIZE; ++i)
+    test_data[i] = (char) (rand() % (126 - 33) + 33);
+
+  // data in every third object, so that many periods are in flight
+  // and most of them are holes
+  char *expected = (char *)calloc(size, 1);
+  for (uint64_t off = 0; off < size; off += 3 << order) {
+    write_test_data(image, test_data, off + 100, TEST_IO_SIZE);
+    memcpy(expected + off + 100, test_data, TEST_IO_SIZE);
+  }
+
+  iterate_state s;
+  s.buf = (char *)calloc(size, 1);
+  s.next = 0;
+  s.holes = 0;
+  ASSERT_EQ((int64_t)size, rbd_read_iterate(image, 0, size, iterate_cb, &s));
+  ASSERT_EQ(size, s.next);
+  ASSERT_LT(0, s.holes);
+  ASSERT_EQ(0, memcmp(expected, s.buf, size));
+
+  free(s.buf);
+  free(expected);
+  ASSERT_EQ(0, rbd_close(image));
+
+  rados_ioctx_destroy(ioctx);
+  ASSERT_EQ(0, destroy_one_pool(pool_name, &cluster));
+}
+
+struct diff_extent {
+  uint64_t off;
+  uint64_t len;
+  bool exists;
+};
+
+static int diff_cb(uint64_t ofs, size_t len, int exists, void *arg)
+{
+  vector<diff_extent> *extents = (vector<diff_extent> *)arg;
+  // adjacent extents may be passed separately; merge them
+  if (!extents->empty() &&
+      extents->back().off + extents->back().len == ofs &&
+      extents->back().exists == (bool)exists) {
+    extents->back().len += len;
+  } else {
+    diff_extent e = { ofs, len, (bool)exists };
+    extents->push_back(e);
+  }
+  return 0;
+}
+
+TEST(LibRBD, TestDiffIteratePP)
+{
+  librados::Rados rados;
+  librados::IoCtx ioctx;
+  string pool_name = get_temp_pool_name();
+
+  ASSERT_EQ("", create_one_pool_pp(pool_name, rados));
+  ASSERT_EQ(0, rados.ioctx_create(pool_name.c_str(), ioctx));
+
+  {
+    librbd::RBD rbd;
+    librbd::Image image;
+    int order = 16;
+    const char *name = "testimg";
+    uint64_t size = 2 << 20;
+    uint64_t object_size = 1 << order;
+
+    ASSERT_EQ(0, create_image_pp(rbd, ioctx, name, size, &order));
+    ASSERT_EQ(0, rbd.open(ioctx, image, name, NULL));
+
+    ceph::bufferlist bl;
+    bl.append(string(512, '1'));
+    ASSERT_EQ(512, image.write(object_size, 512, bl));
+
+    vector<diff_extent> extents;
+    ASSERT_EQ(0, image.diff_iterate(NULL, 0, size, diff_cb, &extents));
+    ASSERT_EQ(1u, extents.size());
+    ASSERT_EQ(object_size, extents[0].off);
+    ASSERT_EQ(512u, extents[0].len);
+    ASSERT_TRUE(extents[0].exists);
+
+    ASSERT_EQ(0, image.snap_create("one"));
+    ASSERT_EQ(512, image.write(3 * object_size, 512, bl));
+
+    // only the write after the snapshot
+    extents.clear();
+    ASSERT_EQ(0, image.diff_iterate("one", 0, size, diff_cb, &extents));
+    ASSERT_EQ(1u, extents.size());
+    ASSERT_EQ(3 * object_size, extents[0].off);
+    ASSERT_EQ(512u, extents[0].len);
+    ASSERT_TRUE(extents[0].exists);
+
+    // both writes
+    extents.clear();
+    ASSERT_EQ(0, image.diff_iterate(NULL, 0, size, diff_cb, &extents));
+    ASSERT_EQ(2u, extents.size());
+    ASSERT_EQ(object_size, extents[0].off);
+    ASSERT_EQ(3 * object_size, extents[1].off);
+
+    // a removed object is reported as gone
+    ASSERT_EQ(0, image.discard(object_size, object_size));
+    extents.clear();
+    ASSERT_EQ(0, image.diff_iterate("one", 0, size, diff_cb, &extents));
+    ASSERT_EQ(2u, extents.size());
+    ASSERT_EQ(object_size, extents[0].off);
+    ASSERT_FALSE(extents[0].exists);
+    ASSERT_EQ(3 * object_size, extents[1].off);
+    ASSERT_TRUE(extents[1].exists);
+
+    ASSERT_EQ(-ENOENT, image.diff_iterate("two", 0, size, diff_cb, &extents));
+    ASSERT_EQ(0, image.snap_set("one"));
+    ASSERT_EQ(-EINVAL, image.diff_iterate("one", 0, size, diff_cb,
+					  &extents));
+  }
+
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, rados));
+}
+
 TEST(LibRBD, TestIOToSnapshot)
 {
   rados_t cluster;
@@ -1119,6 +1575,69 @@ TEST(LibRBD, TestClone)
   ASSERT_EQ(0, destroy_one_pool(pool_name, &cluster));
 }
 
+TEST(LibRBD, TestCloneCopyOnRead)
+{
+  rados_t cluster;
+  rados_ioctx_t ioctx;
+  string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool(pool_name, &cluster));
+  rados_ioctx_create(cluster, pool_name.c_str(), &ioctx);
+  ASSERT_EQ(0, rados_conf_set(cluster, "rbd_clone_copy_on_read", "true"));
+
+  int features = RBD_FEATURE_LAYERING;
+  rbd_image_t parent, child;
+  int order = 20;
+
+  ASSERT_EQ(0, create_image_full(ioctx, "parent", 4<<20, &order, false,
+				 features));
+  ASSERT_EQ(0, rbd_open(ioctx, "parent", &parent, NULL));
+  char *data = (char *)"testdata";
+  ASSERT_EQ((ssize_t)strlen(data), rbd_write(parent, 0, strlen(data), data));
+  ASSERT_EQ((ssize_t)strlen(data),
+	    rbd_write(parent, 2 << 20, strlen(data), data));
+  ASSERT_EQ(0, rbd_snap_create(parent, "parent_snap"));
+  ASSERT_EQ(0, rbd_snap_protect(parent, "parent_snap"));
+  ASSERT_EQ(0, rbd_close(parent));
+
+  ASSERT_EQ(0, rbd_clone(ioctx, "parent", "parent_snap", ioctx, "child",
+			 features, &order));
+  ASSERT_EQ(0, rbd_open(ioctx, "child", &child, NULL));
+  rbd_image_info_t cinfo;
+  ASSERT_EQ(0, rbd_stat(child, &cinfo, sizeof(cinfo)));
+
+  // reading part of the first object copies all of it into the child
+  read_test_data(child, data + 4, 4, strlen(data) - 4);
+  // closing waits for the copyup
+  ASSERT_EQ(0, rbd_close(child));
+
+  char oid[RBD_MAX_BLOCK_NAME_SIZE + 32];
+  uint64_t size;
+  time_t mtime;
+  snprintf(oid, sizeof(oid), "%s.%016llx", cinfo.block_name_prefix, 0ull);
+  ASSERT_EQ(0, rados_stat(ioctx, oid, &size, &mtime));
+  ASSERT_EQ((uint64_t)1 << order, size);
+  snprintf(oid, sizeof(oid), "%s.%016llx", cinfo.block_name_prefix, 2ull);
+  ASSERT_EQ(-ENOENT, rados_stat(ioctx, oid, &size, &mtime));
+
+  // an object that is all zeros in the parent is not copied
+  ASSERT_EQ(0, rbd_open(ioctx, "child", &child, NULL));
+  char zeros[16];
+  memset(zeros, 0, sizeof(zeros));
+  read_test_data(child, zeros, 1 << order, sizeof(zeros));
+  ASSERT_EQ(0, rbd_close(child));
+  snprintf(oid, sizeof(oid), "%s.%016llx", cinfo.block_name_prefix, 1ull);
+  ASSERT_EQ(-ENOENT, rados_stat(ioctx, oid, &size, &mtime));
+
+  // the copied data reads back the same
+  ASSERT_EQ(0, rbd_open(ioctx, "child", &child, NULL));
+  read_test_data(child, data, 0, strlen(data));
+  read_test_data(child, data, 2 << 20, strlen(data));
+  ASSERT_EQ(0, rbd_close(child));
+
+  rados_ioctx_destroy(ioctx);
+  ASSERT_EQ(0, destroy_one_pool(pool_name, &cluster));
+}
+
 TEST(LibRBD, TestClone2)
 {
   rados_t cluster;
@@ -0,0 +1,200 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2013 Inktank
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <errno.h>
+
+#include "include/types.h"
+#include "osd/ECUtil.h"
+#include "osd/ErasureCodePlugin.h"
+#include "osd/ErasureCodeReedSolomon.h"
+
+#include "gtest/gtest.h"
+
+static bufferlist random_bl(unsigned len)
+{
+  bufferptr bp(len);
+  for (unsigned i = 0; i < len; i++)
+    bp[i] = rand();
+  bufferlist bl;
+  bl.append(bp);
+  return bl;
+}
+
+TEST(ErasureCodeReedSolomon, gf)
+{
+  for (unsigned a = 1; a < 256; a++) {
+    uint8_t inv = ErasureCodeReedSolomon::gf_inv(a);
+    ASSERT_EQ(1, ErasureCodeReedSolomon::gf_mul(a, inv));
+  }
+  ASSERT_EQ(0, ErasureCodeReedSolomon::gf_mul(0, 17));
+  ASSERT_EQ(17, ErasureCodeReedSolomon::gf_mul(1, 17));
+}
+
+TEST(ErasureCodeReedSolomon, region_multiply)
+{
+  // odd length to exercise the tail handling
+  unsigned len = 1000 + 13;
+  bufferlist src = random_bl(len);
+  bufferlist dst = random_bl(len);
+  bufferlist orig;
+  orig.append(dst.c_str(), len);
+  for (unsigned c = 0; c < 256; c += 7) {
+    ErasureCodeReedSolomon::region_multiply(c, src.c_str(), dst.c_str(), len, true);
+    for (unsigned i = 0; i < len; i++)
+      ASSERT_EQ((uint8_t)(orig[i] ^ ErasureCodeReedSolomon::gf_mul(c, src[i])),
+		(uint8_t)dst[i]);
+    ErasureCodeReedSolomon::region_multiply(c, src.c_str(), dst.c_str(), len, false);
+    for (unsigned i = 0; i < len; i++)
+      ASSERT_EQ(ErasureCodeReedSolomon::gf_mul(c, src[i]), (uint8_t)dst[i]);
+    memcpy(dst.c_str(), orig.c_str(), len);
+  }
+}
+
+TEST(ErasureCodeReedSolomon, encode_decode)
+{
+  unsigned k = 4, m = 2;
+  ErasureCodeReedSolomon rs(k, m);
+  EXPECT_EQ(6u, rs.get_chunk_count());
+  EXPECT_EQ(4u, rs.get_data_chunk_count());
+  EXPECT_EQ(0u, rs.get_chunk_size(4096) % ErasureCodeReedSolomon::ALIGNMENT);
+
+  unsigned len = 4096 + 100;
+  bufferlist in = random_bl(len);
+  set<int> want;
+  for (unsigned i = 0; i < k + m; i++)
+    want.insert(i);
+  map<int, bufferlist> encoded;
+  ASSERT_EQ(0, rs.encode(want, in, &encoded));
+  ASSERT_EQ(k + m, encoded.size());
+  unsigned chunk_size = rs.get_chunk_size(len);
+  for (unsigned i = 0; i < k + m; i++)
+    ASSERT_EQ(chunk_size, encoded[i].length());
+
+  // data chunks are the object itself
+  bufferlist data;
+  for (unsigned i = 0; i < k; i++)
+    data.append(encoded[i]);
+  ASSERT_TRUE(memcmp(in.c_str(), data.c_str(), len) == 0);
+
+  // every combination of up to m erasures
+  for (unsigned a = 0; a < k + m; a++) {
+    for (unsigned b = a; b < k + m; b++) {
+      map<int, bufferlist> chunks = encoded;
+      chunks.erase(a);
+      chunks.erase(b);
+      map<int, bufferlist> decoded;
+      ASSERT_EQ(0, rs.decode(want, chunks, &decoded));
+      ASSERT_EQ(k + m, decoded.size());
+      for (unsigned i = 0; i < k + m; i++) {
+	ASSERT_EQ(chunk_size, decoded[i].length());
+	ASSERT_TRUE(memcmp(encoded[i].c_str(), decoded[i].c_str(), chunk_size) == 0)
+	  << "chunk " << i << " erasures " << a << "," << b;
+      }
+    }
+  }
+
+  // too many erasures
+  map<int, bufferlist> chunks = encoded;
+  chunks.erase(0);
+  chunks.erase(1);
+  chunks.erase(2);
+  map<int, bufferlist> decoded;
+  ASSERT_EQ(-EIO, rs.decode(want, chunks, &decoded));
+}
+
+TEST(ErasureCodeReedSolomon, minimum_to_decode)
+{
+  ErasureCodeReedSolomon rs(2, 1);
+  set<int> want, available, minimum;
+  want.insert(0);
+  want.insert(1);
+
+  available.insert(0);
+  available.insert(1);
+  available.insert(2);
+  ASSERT_EQ(0, rs.minimum_to_decode(want, available, &minimum));
+  ASSERT_EQ(want, minimum);
+
+  available.erase(1);
+  ASSERT_EQ(0, rs.minimum_to_decode(want, available, &minimum));
+  ASSERT_EQ(2u, minimum.size());
+  ASSERT_TRUE(minimum.count(0));
+  ASSERT_TRUE(minimum.count(2));
+
+  available.erase(2);
+  ASSERT_EQ(-EIO, rs.minimum_to_decode(want, available, &minimum));
+}
+
+TEST(ErasureCodePluginRegistry, factory)
+{
+  ErasureCodeInterfaceRef ec;
+  map<string,string> parameters;
+  ASSERT_EQ(-ENOENT, ErasureCodePluginRegistry::instance().factory("nonexistent", parameters, &ec));
+  parameters["k"] = "3";
+  parameters["m"] = "2";
+  ASSERT_EQ(0, ErasureCodePluginRegistry::instance().factory("reed_solomon", parameters, &ec));
+  ASSERT_EQ(5u, ec->get_chunk_count());
+  ASSERT_EQ(3u, ec->get_data_chunk_count());
+  parameters["k"] = "garbage";
+  ASSERT_EQ(-EINVAL, ErasureCodePluginRegistry::instance().factory("reed_solomon", parameters, &ec));
+}
+
+TEST(ECUtil, stripe_info_t)
+{
+  ECUtil::stripe_info_t s(4, 4096);
+  ASSERT_EQ(1024u, s.get_chunk_size());
+  ASSERT_EQ(4096u, s.logical_to_prev_stripe_offset(5000));
+  ASSERT_EQ(8192u, s.logical_to_next_stripe_offset(5000));
+  ASSERT_EQ(8192u, s.logical_to_next_stripe_offset(8192));
+  ASSERT_EQ(1024u, s.logical_to_prev_chunk_offset(5000));
+  ASSERT_EQ(2048u, s.logical_to_next_chunk_offset(5000));
+  ASSERT_EQ(2048u, s.aligned_logical_offset_to_chunk_offset(8192));
+  ASSERT_EQ(8192u, s.aligned_chunk_offset_to_logical_offset(2048));
+  ASSERT_EQ(make_pair((uint64_t)4096, (uint64_t)8192),
+	    s.offset_len_to_stripe_bounds(5000, 4000));
+}
+
+TEST(ECUtil, encode_decode)
+{
+  map<string,string> parameters;
+  parameters["k"] = "4";
+  parameters["m"] = "2";
+  ErasureCodeInterfaceRef ec;
+  ASSERT_EQ(0, ErasureCodePluginRegistry::instance().factory("reed_solomon", parameters, &ec));
+  ECUtil::stripe_info_t sinfo(4, 4 * ec->get_chunk_size(4096));
+
+  // a full object write followed by an append
+  unsigned len = 3 * sinfo.get_stripe_width() + 123;
+  bufferlist object = random_bl(len);
+  set<int> want;
+  for (unsigned i = 0; i < ec->get_chunk_count(); i++)
+    want.insert(i);
+
+  bufferlist first, second;
+  first.substr_of(object, 0, 2 * sinfo.get_stripe_width());
+  second.substr_of(object, 2 * sinfo.get_stripe_width(), len - first.length());
+  map<int, bufferlist> shards;
+  ASSERT_EQ(0, ECUtil::encode(sinfo, ec, first, want, &shards));
+  ASSERT_EQ(0, ECUtil::encode(sinfo, ec, second, want, &shards));
+  for (unsigned i = 0; i < ec->get_chunk_count(); i++)
+    ASSERT_EQ(4 * sinfo.get_chunk_size(), shards[i].length());
+
+  // degraded read: lose one data and one coding shard
+  shards.erase(1);
+  shards.erase(5);
+  bufferlist out;
+  ASSERT_EQ(0, ECUtil::decode(sinfo, ec, shards, &out));
+  ASSERT_EQ(4 * sinfo.get_stripe_width(), out.length());
+  ASSERT_TRUE(memcmp(object.c_str(), out.c_str(), len) == 0);
+}
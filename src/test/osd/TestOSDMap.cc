@@ -0,0 +1,160 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#include "gtest/gtest.h"
+#include "osd/OSDMap.h"
+#include "global/global_context.h"
+#include "global/global_init.h"
+#include "common/common_init.h"
+#include "common/ceph_argparse.h"
+#include "include/ceph_features.h"
+
+class OSDMapTest : public testing::Test {
+public:
+  OSDMap osdmap;
+  static const int num_osds = 6;
+
+  void SetUp() {
+    uuid_d fsid;
+    osdmap.build_simple(g_ceph_context, 0, fsid, num_osds, 6, 6);
+  }
+
+  /// boot @osd, advertising @features
+  void boot_osd(int osd, uint64_t features) {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    inc.fsid = osdmap.get_fsid();
+    entity_addr_t addr;
+    addr.set_nonce(osd);
+    inc.new_up_client[osd] = addr;
+    osd_xinfo_t xi = osdmap.get_xinfo(osd);
+    xi.features = features;
+    inc.new_xinfo[osd] = xi;
+    osdmap.apply_incremental(inc);
+  }
+
+  /// make @tier a cache tier of @base, optionally as its overlay
+  void add_tier(int64_t base, int64_t tier, bool overlay) {
+    OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+    inc.fsid = osdmap.get_fsid();
+    inc.new_pools[base] = *osdmap.get_pg_pool(base);
+    inc.new_pools[tier] = *osdmap.get_pg_pool(tier);
+    inc.new_pools[base].tiers.insert(tier);
+    inc.new_pools[tier].tier_of = base;
+    if (overlay) {
+      inc.new_pools[base].read_tier = tier;
+      inc.new_pools[base].write_tier = tier;
+    }
+    osdmap.apply_incremental(inc);
+  }
+};
+
+TEST_F(OSDMapTest, FeaturesNoTiers) {
+  uint64_t mask = 0;
+  uint64_t features = osdmap.get_features(&mask);
+  ASSERT_TRUE(mask & CEPH_FEATURE_OSD_CACHEPOOL);
+  ASSERT_FALSE(features & CEPH_FEATURE_OSD_CACHEPOOL);
+}
+
+TEST_F(OSDMapTest, FeaturesWithTiers) {
+  int64_t base = osdmap.lookup_pg_pool_name("data");
+  int64_t tier = osdmap.lookup_pg_pool_name("rbd");
+  ASSERT_GE(base, 0);
+  ASSERT_GE(tier, 0);
+
+  add_tier(base, tier, false);
+  ASSERT_TRUE(osdmap.get_features(NULL) & CEPH_FEATURE_OSD_CACHEPOOL);
+
+  add_tier(base, tier, true);
+  ASSERT_TRUE(osdmap.get_features(NULL) & CEPH_FEATURE_OSD_CACHEPOOL);
+
+  // taking the tiering apart drops the requirement again
+  OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+  inc.fsid = osdmap.get_fsid();
+  inc.new_pools[base] = *osdmap.get_pg_pool(base);
+  inc.new_pools[tier] = *osdmap.get_pg_pool(tier);
+  inc.new_pools[base].tiers.clear();
+  inc.new_pools[base].clear_read_tier();
+  inc.new_pools[base].clear_write_tier();
+  inc.new_pools[tier].clear_tier();
+  osdmap.apply_incremental(inc);
+  ASSERT_FALSE(osdmap.get_features(NULL) & CEPH_FEATURE_OSD_CACHEPOOL);
+}
+
+TEST_F(OSDMapTest, UpOSDFeatures) {
+  // nobody up, nothing in common
+  ASSERT_EQ(0u, osdmap.get_up_osd_features());
+
+  for (int i = 0; i < num_osds; ++i)
+    boot_osd(i, CEPH_FEATURES_ALL);
+  ASSERT_TRUE(osdmap.get_up_osd_features() & CEPH_FEATURE_OSD_CACHEPOOL);
+
+  // one old osd is enough to lose the feature
+  boot_osd(2, CEPH_FEATURES_ALL & ~CEPH_FEATURE_OSD_CACHEPOOL);
+  ASSERT_FALSE(osdmap.get_up_osd_features() & CEPH_FEATURE_OSD_CACHEPOOL);
+
+  // ... until it goes down
+  OSDMap::Incremental inc(osdmap.get_epoch() + 1);
+  inc.fsid = osdmap.get_fsid();
+  inc.new_state[2] = CEPH_OSD_UP;
+  osdmap.apply_incremental(inc);
+  ASSERT_FALSE(osdmap.is_up(2));
+  ASSERT_TRUE(osdmap.get_up_osd_features() & CEPH_FEATURE_OSD_CACHEPOOL);
+}
+
+TEST_F(OSDMapTest, PGMappingCache) {
+  int64_t pool = osdmap.lookup_pg_pool_name("data");
+  ASSERT_GE(pool, 0);
+  unsigned pg_num = osdmap.get_pg_num(pool);
+  vector<vector<int> > uncached(pg_num);
+  for (unsigned ps = 0; ps < pg_num; ++ps)
+    osdmap.pg_to_osds(pg_t(ps, pool, -1), uncached[ps]);
+  ASSERT_EQ(0u, osdmap.get_pg_mapping_bytes());
+
+  osdmap.enable_pg_mapping_cache();
+  for (unsigned ps = 0; ps < pg_num; ++ps) {
+    vector<int> osds;
+    osdmap.pg_to_osds(pg_t(ps, pool, -1), osds);
+    ASSERT_TRUE(uncached[ps] == osds);
+  }
+  ASSERT_GT(osdmap.get_pg_mapping_bytes(), 0u);
+  for (unsigned ps = 0; ps < pg_num; ++ps) {
+    vector<int> osds;
+    osdmap.pg_to_osds(pg_t(ps, pool, -1), osds);
+    ASSERT_TRUE(uncached[ps] == osds);
+  }
+
+  // disabling frees the tables, and mapping does not refill them
+  osdmap.disable_pg_mapping_cache();
+  ASSERT_EQ(0u, osdmap.get_pg_mapping_bytes());
+  for (unsigned ps = 0; ps < pg_num; ++ps) {
+    vector<int> osds;
+    osdmap.pg_to_osds(pg_t(ps, pool, -1), osds);
+    ASSERT_TRUE(uncached[ps] == osds);
+  }
+  ASSERT_EQ(0u, osdmap.get_pg_mapping_bytes());
+}
+
+TEST(osd_xinfo_t, features_encoding) {
+  osd_xinfo_t xi;
+  xi.laggy_interval = 10;
+  xi.features = CEPH_FEATURE_OSD_CACHEPOOL | CEPH_FEATURE_CRUSH_V2;
+  bufferlist bl;
+  ::encode(xi, bl);
+
+  osd_xinfo_t out;
+  bufferlist::iterator p = bl.begin();
+  ::decode(out, p);
+  ASSERT_TRUE(xi == out);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+  env_to_vec(args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,156 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2013 Inktank
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * Measure erasure code encode/decode throughput outside of the OSD.
+ *
+ *   ceph_erasure_code_benchmark --workload encode --size 1048576 \
+ *       --iterations 1000 -P k=4 -P m=2
+ *
+ * prints "<seconds>\t<megabytes processed>".
+ */
+
+#include <stdlib.h>
+#include <iostream>
+#include <sstream>
+
+#include "include/types.h"
+#include "common/Clock.h"
+#include "common/ceph_argparse.h"
+#include "common/config.h"
+#include "common/errno.h"
+#include "global/global_init.h"
+#include "global/global_context.h"
+#include "osd/ErasureCodePlugin.h"
+
+static void usage()
+{
+  cout << "usage: ceph_erasure_code_benchmark [options]\n"
+       << "  --plugin <name>       erasure code plugin (default reed_solomon)\n"
+       << "  -P, --parameter k=v   plugin parameter, may be repeated\n"
+       << "  --workload <w>        encode or decode (default encode)\n"
+       << "  --size <bytes>        object size (default 1048576)\n"
+       << "  --iterations <n>      number of objects (default 100)\n"
+       << "  --erasures <n>        chunks lost before each decode (default 1)\n"
+       << std::endl;
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+
+  vector<const char*> empty_args;
+  global_init(NULL, empty_args, CEPH_ENTITY_TYPE_CLIENT,
+	      CODE_ENVIRONMENT_UTILITY, CINIT_FLAG_NO_DEFAULT_CONFIG_FILE);
+  common_init_finish(g_ceph_context);
+
+  string plugin = "reed_solomon";
+  string workload = "encode";
+  map<string,string> parameters;
+  int size = 1048576;
+  int iterations = 100;
+  int erasures = 1;
+
+  string val;
+  ostringstream err;
+  for (vector<const char*>::iterator i = args.begin(); i != args.end(); ) {
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_flag(args, i, "-h", "--help", (char*)NULL)) {
+      usage();
+      exit(0);
+    } else if (ceph_argparse_witharg(args, i, &val, "--plugin", (char*)NULL)) {
+      plugin = val;
+    } else if (ceph_argparse_witharg(args, i, &val, "--workload", (char*)NULL)) {
+      workload = val;
+    } else if (ceph_argparse_witharg(args, i, &val, "-P", "--parameter", (char*)NULL)) {
+      size_t eq = val.find('=');
+      if (eq == string::npos) {
+	cerr << "parameter " << val << " must be of the form key=value" << std::endl;
+	exit(1);
+      }
+      parameters[val.substr(0, eq)] = val.substr(eq + 1);
+    } else if (ceph_argparse_withint(args, i, &size, &err, "--size", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &iterations, &err, "--iterations", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &erasures, &err, "--erasures", (char*)NULL)) {
+    } else {
+      cerr << "unrecognized argument " << *i << std::endl;
+      usage();
+      exit(1);
+    }
+    if (!err.str().empty()) {
+      cerr << err.str() << std::endl;
+      exit(1);
+    }
+  }
+
+  ErasureCodeInterfaceRef ec;
+  int r = ErasureCodePluginRegistry::instance().factory(plugin, parameters, &ec);
+  if (r < 0) {
+    cerr << "erasure code plugin " << plugin << " " << parameters
+	 << ": " << cpp_strerror(r) << std::endl;
+    exit(1);
+  }
+  if (workload != "encode" && workload != "decode") {
+    cerr << "unknown workload " << workload << std::endl;
+    exit(1);
+  }
+  if (erasures < 0 || erasures > (int)(ec->get_chunk_count() - ec->get_data_chunk_count())) {
+    cerr << "cannot recover from " << erasures << " erasures" << std::endl;
+    exit(1);
+  }
+
+  bufferlist in;
+  bufferptr bp(size);
+  for (int i = 0; i < size; i++)
+    bp[i] = rand();
+  in.append(bp);
+
+  set<int> want;
+  for (unsigned i = 0; i < ec->get_chunk_count(); i++)
+    want.insert(i);
+
+  map<int, bufferlist> encoded;
+  if (workload == "decode") {
+    r = ec->encode(want, in, &encoded);
+    if (r < 0) {
+      cerr << "encode: " << cpp_strerror(r) << std::endl;
+      exit(1);
+    }
+  }
+
+  utime_t start = ceph_clock_now(g_ceph_context);
+  for (int n = 0; n < iterations; n++) {
+    if (workload == "encode") {
+      map<int, bufferlist> out;
+      r = ec->encode(want, in, &out);
+    } else {
+      // drop @erasures chunks, rotating which ones
+      map<int, bufferlist> chunks = encoded;
+      for (int e = 0; e < erasures; e++)
+	chunks.erase((n + e) % ec->get_chunk_count());
+      map<int, bufferlist> out;
+      r = ec->decode(want, chunks, &out);
+    }
+    if (r < 0) {
+      cerr << workload << ": " << cpp_strerror(r) << std::endl;
+      exit(1);
+    }
+  }
+  utime_t elapsed = ceph_clock_now(g_ceph_context) - start;
+
+  cout << elapsed << "\t" << ((uint64_t)size * iterations / 1048576) << std::endl;
+  return 0;
+}
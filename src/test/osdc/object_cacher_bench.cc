@@ -0,0 +1,303 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <cerrno>
+#include <cstdlib>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "common/ceph_argparse.h"
+#include "common/common_init.h"
+#include "common/config.h"
+#include "common/Cond.h"
+#include "common/errno.h"
+#include "common/Mutex.h"
+#include "common/Thread.h"
+#include "common/snap_types.h"
+#include "global/global_init.h"
+#include "include/buffer.h"
+#include "include/Context.h"
+#include "include/stringify.h"
+#include "osdc/ObjectCacher.h"
+
+#include "FakeWriteback.h"
+
+/*
+ * Measure how ObjectCacher throughput scales when the objects are
+ * spread over several independently locked caches sharing one budget,
+ * the way librbd does with rbd_cache_shards.  Several threads issue
+ * small reads and writes to random objects, and the run is repeated
+ * with 1, 2, 4, ... shards.
+ */
+
+struct Shard {
+  Mutex lock;
+  FakeWriteback writeback;
+  ObjectCacher cache;
+  ObjectCacher::ObjectSet object_set;
+
+  Shard(int i, uint64_t delay_ns, ObjectCacher::Budget *budget)
+    : lock("object_cacher_bench::Shard::lock"),
+      writeback(g_ceph_context, &lock, delay_ns),
+      cache(g_ceph_context, "bench" + stringify(i), writeback, lock,
+	    NULL, NULL,
+	    g_conf->client_oc_size,
+	    g_conf->client_oc_max_objects,
+	    g_conf->client_oc_max_dirty,
+	    g_conf->client_oc_target_dirty,
+	    g_conf->client_oc_max_dirty_age,
+	    budget),
+      object_set(NULL, 0, 0) {
+    cache.start();
+  }
+
+  int shutdown() {
+    lock.Lock();
+    cache.release_set(&object_set);
+    lock.Unlock();
+
+    int r = 0;
+    Mutex mylock("object_cacher_bench::Shard::shutdown");
+    Cond cond;
+    bool done;
+    Context *onfinish = new C_SafeCond(&mylock, &cond, &done, &r);
+    lock.Lock();
+    bool already_flushed = cache.flush_set(&object_set, onfinish);
+    lock.Unlock();
+    if (!already_flushed) {
+      mylock.Lock();
+      while (!done)
+	cond.Wait(mylock);
+      mylock.Unlock();
+    }
+
+    lock.Lock();
+    bool unclean = cache.release_set(&object_set);
+    lock.Unlock();
+    cache.stop();
+    if (unclean) {
+      std::cerr << "unclean buffers left over!" << std::endl;
+      return -EBUSY;
+    }
+    return r;
+  }
+};
+
+struct bench_config {
+  uint64_t ops_per_thread;
+  uint64_t num_objs;
+  uint64_t obj_size;
+  uint64_t op_size;
+  float percent_reads;
+};
+
+class BenchThread : public Thread {
+  const bench_config &m_conf;
+  std::vector<Shard*> &m_shards;
+  unsigned m_seed;
+public:
+  BenchThread(const bench_config &conf, std::vector<Shard*> &shards,
+	      unsigned seed)
+    : m_conf(conf), m_shards(shards), m_seed(seed) {}
+
+  void *entry() {
+    SnapContext snapc;
+    ceph::buffer::ptr bp(m_conf.op_size);
+    bp.zero();
+    ceph::bufferlist data;
+    data.append(bp);
+
+    for (uint64_t i = 0; i < m_conf.ops_per_thread; ++i) {
+      uint64_t objectno = rand_r(&m_seed) % m_conf.num_objs;
+      uint64_t offset = (rand_r(&m_seed) %
+			 (m_conf.obj_size / m_conf.op_size)) * m_conf.op_size;
+      bool is_read = rand_r(&m_seed) < m_conf.percent_reads * RAND_MAX;
+      Shard *shard = m_shards[objectno % m_shards.size()];
+
+      ObjectExtent extent(object_t("bench" + stringify(objectno)), objectno,
+			  offset, m_conf.op_size);
+      extent.oloc.pool = 0;
+      extent.buffer_extents.push_back(make_pair(0, m_conf.op_size));
+
+      if (is_read) {
+	ceph::bufferlist result;
+	ObjectCacher::OSDRead *rd = shard->cache.prepare_read(CEPH_NOSNAP,
+							      &result, 0);
+	rd->extents.push_back(extent);
+	Mutex mylock("object_cacher_bench::BenchThread::read");
+	Cond cond;
+	bool done;
+	int r;
+	Context *onfinish = new C_SafeCond(&mylock, &cond, &done, &r);
+	shard->lock.Lock();
+	int ret = shard->cache.readx(rd, &shard->object_set, onfinish);
+	shard->lock.Unlock();
+	if (ret != 0) {
+	  onfinish->complete(ret);
+	} else {
+	  mylock.Lock();
+	  while (!done)
+	    cond.Wait(mylock);
+	  mylock.Unlock();
+	}
+      } else {
+	ObjectCacher::OSDWrite *wr = shard->cache.prepare_write(snapc, data,
+								utime_t(), 0);
+	wr->extents.push_back(extent);
+	shard->lock.Lock();
+	shard->cache.writex(wr, &shard->object_set, shard->lock);
+	shard->lock.Unlock();
+      }
+    }
+    return 0;
+  }
+};
+
+int run_bench(const bench_config &conf, int num_threads, int num_shards,
+	      uint64_t delay_ns, unsigned seed, double *iops)
+{
+  ObjectCacher::Budget *budget = NULL;
+  if (num_shards > 1)
+    budget = new ObjectCacher::Budget(g_ceph_context);
+  std::vector<Shard*> shards;
+  for (int i = 0; i < num_shards; ++i)
+    shards.push_back(new Shard(i, delay_ns, budget));
+
+  std::vector<BenchThread*> threads;
+  utime_t start = ceph_clock_now(g_ceph_context);
+  for (int i = 0; i < num_threads; ++i) {
+    threads.push_back(new BenchThread(conf, shards, seed + i));
+    threads.back()->create();
+  }
+  for (int i = 0; i < num_threads; ++i) {
+    threads[i]->join();
+    delete threads[i];
+  }
+  utime_t elapsed = ceph_clock_now(g_ceph_context) - start;
+
+  int ret = 0;
+  for (int i = 0; i < num_shards; ++i) {
+    int r = shards[i]->shutdown();
+    if (r < 0)
+      ret = r;
+    delete shards[i];
+  }
+  delete budget;
+
+  *iops = (double)conf.ops_per_thread * num_threads / (double)elapsed;
+  return ret;
+}
+
+int main(int argc, const char **argv)
+{
+  std::vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+
+  long long delay_ns = 0;
+  long long num_ops = 100000;
+  long long obj_bytes = 4 << 20;
+  long long op_bytes = 4096;
+  long long num_objs = 16;
+  int num_threads = 8;
+  int max_shards = 8;
+  float percent_reads = 0.90;
+  int seed = time(0) % 100000;
+  std::ostringstream err;
+  std::vector<const char*>::iterator i;
+  for (i = args.begin(); i != args.end();) {
+    if (ceph_argparse_withlonglong(args, i, &delay_ns, &err, "--delay-ns", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << argv[0] << ": " << err.str() << std::endl;
+	return EXIT_FAILURE;
+      }
+    } else if (ceph_argparse_withlonglong(args, i, &num_ops, &err, "--ops", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << argv[0] << ": " << err.str() << std::endl;
+	return EXIT_FAILURE;
+      }
+    } else if (ceph_argparse_withlonglong(args, i, &num_objs, &err, "--objects", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << argv[0] << ": " << err.str() << std::endl;
+	return EXIT_FAILURE;
+      }
+    } else if (ceph_argparse_withlonglong(args, i, &obj_bytes, &err, "--obj-size", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << argv[0] << ": " << err.str() << std::endl;
+	return EXIT_FAILURE;
+      }
+    } else if (ceph_argparse_withlonglong(args, i, &op_bytes, &err, "--op-size", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << argv[0] << ": " << err.str() << std::endl;
+	return EXIT_FAILURE;
+      }
+    } else if (ceph_argparse_withint(args, i, &num_threads, &err, "--threads", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << argv[0] << ": " << err.str() << std::endl;
+	return EXIT_FAILURE;
+      }
+    } else if (ceph_argparse_withint(args, i, &max_shards, &err, "--max-shards", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << argv[0] << ": " << err.str() << std::endl;
+	return EXIT_FAILURE;
+      }
+    } else if (ceph_argparse_withfloat(args, i, &percent_reads, &err, "--percent-read", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << argv[0] << ": " << err.str() << std::endl;
+	return EXIT_FAILURE;
+      }
+    } else if (ceph_argparse_withint(args, i, &seed, &err, "--seed", (char*)NULL)) {
+      if (!err.str().empty()) {
+	cerr << argv[0] << ": " << err.str() << std::endl;
+	return EXIT_FAILURE;
+      }
+    } else {
+      cerr << "unknown option " << *i << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (num_threads < 1 || max_shards < 1 || num_objs < 1 ||
+      op_bytes < 1 || obj_bytes < op_bytes) {
+    cerr << argv[0] << ": invalid configuration" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  bench_config conf;
+  conf.ops_per_thread = num_ops / num_threads;
+  conf.num_objs = num_objs;
+  conf.obj_size = obj_bytes;
+  conf.op_size = op_bytes;
+  conf.percent_reads = percent_reads;
+
+  std::cout << "Bench configuration:\n\n"
+	    << setw(10) << "ops: " << num_ops << "\n"
+	    << setw(10) << "threads: " << num_threads << "\n"
+	    << setw(10) << "objects: " << num_objs << "\n"
+	    << setw(10) << "obj size: " << obj_bytes << "\n"
+	    << setw(10) << "op size: " << op_bytes << "\n"
+	    << setw(10) << "delay: " << delay_ns << "\n"
+	    << setw(10) << "percent reads: " << percent_reads << "\n\n";
+
+  double base = 0;
+  for (int shards = 1; shards <= max_shards; shards *= 2) {
+    double iops;
+    int r = run_bench(conf, num_threads, shards, delay_ns, seed, &iops);
+    if (r < 0) {
+      cerr << "shards " << shards << " failed: " << cpp_strerror(r)
+	   << std::endl;
+      return EXIT_FAILURE;
+    }
+    if (shards == 1)
+      base = iops;
+    std::cout << setw(4) << shards << " shards: "
+	      << std::fixed << std::setprecision(0) << iops << " ops/s ("
+	      << std::setprecision(2) << iops / base << "x)" << std::endl;
+  }
+  return EXIT_SUCCESS;
+}
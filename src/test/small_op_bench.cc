@@ -0,0 +1,299 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <cerrno>
+#include <cstdlib>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "common/ceph_argparse.h"
+#include "common/Clock.h"
+#include "common/errno.h"
+#include "common/Thread.h"
+#include "include/rados/librados.hpp"
+#include "include/stringify.h"
+#include "include/utime.h"
+
+/*
+ * Measure how small-op throughput through a single librados client
+ * scales with the number of threads submitting ops.  Each thread keeps
+ * a fixed number of small aio reads and writes in flight against its
+ * own set of objects, and the run is repeated with 1, 2, 4, ... threads.
+ */
+
+struct bench_config {
+  std::string prefix;
+  uint64_t ops_per_thread;
+  int in_flight;
+  uint64_t num_objs;
+  uint64_t obj_size;
+  uint64_t op_size;
+  float percent_reads;
+};
+
+static std::string obj_name(const bench_config &conf, int thread,
+			    uint64_t objectno)
+{
+  return conf.prefix + "." + stringify(thread) + "." + stringify(objectno);
+}
+
+class BenchThread : public Thread {
+  const bench_config &m_conf;
+  librados::IoCtx &m_ioctx;
+  int m_id;
+  unsigned m_seed;
+public:
+  int ret;
+
+  BenchThread(const bench_config &conf, librados::IoCtx &ioctx, int id,
+	      unsigned seed)
+    : m_conf(conf), m_ioctx(ioctx), m_id(id), m_seed(seed), ret(0) {}
+
+  int start_op(librados::AioCompletion **c, ceph::bufferlist *bl,
+	       const ceph::bufferlist &data) {
+    uint64_t objectno = rand_r(&m_seed) % m_conf.num_objs;
+    uint64_t offset = (rand_r(&m_seed) %
+		       (m_conf.obj_size / m_conf.op_size)) * m_conf.op_size;
+    bool is_read = rand_r(&m_seed) < m_conf.percent_reads * RAND_MAX;
+    std::string oid = obj_name(m_conf, m_id, objectno);
+
+    *c = librados::Rados::aio_create_completion();
+    bl->clear();
+    if (is_read)
+      return m_ioctx.aio_read(oid, *c, bl, m_conf.op_size, offset);
+    return m_ioctx.aio_write(oid, *c, data, m_conf.op_size, offset);
+  }
+
+  int finish_op(librados::AioCompletion *c) {
+    c->wait_for_complete();
+    int r = c->get_return_value();
+    c->release();
+    return r < 0 ? r : 0;
+  }
+
+  void *entry() {
+    ceph::buffer::ptr bp(m_conf.op_size);
+    bp.zero();
+    ceph::bufferlist data;
+    data.append(bp);
+
+    std::vector<librados::AioCompletion*> comps(m_conf.in_flight);
+    std::vector<ceph::bufferlist> bls(m_conf.in_flight);
+    uint64_t started = 0;
+    for (int i = 0; i < m_conf.in_flight && started < m_conf.ops_per_thread;
+	 ++i, ++started) {
+      ret = start_op(&comps[i], &bls[i], data);
+      if (ret < 0)
+	return 0;
+    }
+
+    // reap the slots in order, refilling each as it completes
+    for (uint64_t done = 0; done < started; ++done) {
+      int slot = done % m_conf.in_flight;
+      int r = finish_op(comps[slot]);
+      if (r < 0 && ret == 0)
+	ret = r;
+      if (started < m_conf.ops_per_thread && ret == 0) {
+	r = start_op(&comps[slot], &bls[slot], data);
+	if (r < 0)
+	  ret = r;
+	else
+	  ++started;
+      }
+    }
+    return 0;
+  }
+};
+
+/// write out the objects thread @id works on, so that reads find data
+int prepare_objects(const bench_config &conf, librados::IoCtx &ioctx, int id)
+{
+  ceph::buffer::ptr bp(conf.obj_size);
+  bp.zero();
+  ceph::bufferlist bl;
+  bl.append(bp);
+  for (uint64_t i = 0; i < conf.num_objs; ++i) {
+    int r = ioctx.write_full(obj_name(conf, id, i), bl);
+    if (r < 0)
+      return r;
+  }
+  return 0;
+}
+
+int run_bench(const bench_config &conf, librados::IoCtx &ioctx,
+	      int num_threads, unsigned seed, double *iops)
+{
+  std::vector<BenchThread*> threads;
+  utime_t start = ceph_clock_now(NULL);
+  for (int i = 0; i < num_threads; ++i) {
+    threads.push_back(new BenchThread(conf, ioctx, i, seed + i));
+    threads.back()->create();
+  }
+  int ret = 0;
+  for (int i = 0; i < num_threads; ++i) {
+    threads[i]->join();
+    if (threads[i]->ret < 0)
+      ret = threads[i]->ret;
+    delete threads[i];
+  }
+  utime_t elapsed = ceph_clock_now(NULL) - start;
+
+  *iops = (double)conf.ops_per_thread * num_threads / (double)elapsed;
+  return ret;
+}
+
+void usage(const char *name)
+{
+  std::cout << "usage: " << name << " [options]\n"
+	    << "  --pool <name>          pool to use (default data)\n"
+	    << "  --ops <n>              ops per thread, per run (default 100000)\n"
+	    << "  --max-threads <n>      double the threads up to this (default 16)\n"
+	    << "  --in-flight <n>        ops in flight per thread (default 16)\n"
+	    << "  --objects <n>          objects per thread (default 16)\n"
+	    << "  --obj-size <bytes>     object size (default 65536)\n"
+	    << "  --op-size <bytes>      op size (default 4096)\n"
+	    << "  --percent-read <f>     fraction of ops that are reads (default 0.5)\n"
+	    << "  --seed <n>             random seed\n"
+	    << "plus the usual librados options (-c, --id, ...)"
+	    << std::endl;
+}
+
+int main(int argc, const char **argv)
+{
+  std::vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+
+  std::string pool_name = "data";
+  long long num_ops = 100000;
+  long long obj_bytes = 64 << 10;
+  long long op_bytes = 4096;
+  long long num_objs = 16;
+  int in_flight = 16;
+  int max_threads = 16;
+  float percent_reads = 0.5;
+  int seed = time(0) % 100000;
+  std::ostringstream err;
+  std::vector<const char*> rados_args;
+  std::vector<const char*>::iterator i;
+  for (i = args.begin(); i != args.end();) {
+    if (ceph_argparse_flag(args, i, "-h", "--help", (char*)NULL)) {
+      usage(argv[0]);
+      return EXIT_SUCCESS;
+    } else if (ceph_argparse_witharg(args, i, &pool_name, "--pool", (char*)NULL)) {
+    } else if (ceph_argparse_withlonglong(args, i, &num_ops, &err, "--ops", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &max_threads, &err, "--max-threads", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &in_flight, &err, "--in-flight", (char*)NULL)) {
+    } else if (ceph_argparse_withlonglong(args, i, &num_objs, &err, "--objects", (char*)NULL)) {
+    } else if (ceph_argparse_withlonglong(args, i, &obj_bytes, &err, "--obj-size", (char*)NULL)) {
+    } else if (ceph_argparse_withlonglong(args, i, &op_bytes, &err, "--op-size", (char*)NULL)) {
+    } else if (ceph_argparse_withfloat(args, i, &percent_reads, &err, "--percent-read", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &seed, &err, "--seed", (char*)NULL)) {
+    } else {
+      // leave it to librados
+      rados_args.push_back(*i);
+      ++i;
+    }
+    if (!err.str().empty()) {
+      std::cerr << argv[0] << ": " << err.str() << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (max_threads < 1 || in_flight < 1 || num_objs < 1 || num_ops < 1 ||
+      op_bytes < 1 || obj_bytes < op_bytes) {
+    std::cerr << argv[0] << ": invalid configuration" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  librados::Rados rados;
+  int r = rados.init(NULL);
+  if (r < 0) {
+    std::cerr << "error during init: " << cpp_strerror(r) << std::endl;
+    return EXIT_FAILURE;
+  }
+  int rados_argc;
+  const char **rados_argv;
+  vec_to_argv(argv[0], rados_args, &rados_argc, &rados_argv);
+  r = rados.conf_parse_argv(rados_argc, rados_argv);
+  if (r < 0) {
+    std::cerr << "error parsing args: " << cpp_strerror(r) << std::endl;
+    return EXIT_FAILURE;
+  }
+  rados.conf_parse_env(NULL);
+  r = rados.conf_read_file(NULL);
+  if (r < 0) {
+    std::cerr << "error reading config file: " << cpp_strerror(r) << std::endl;
+    return EXIT_FAILURE;
+  }
+  r = rados.connect();
+  if (r < 0) {
+    std::cerr << "error connecting: " << cpp_strerror(r) << std::endl;
+    return EXIT_FAILURE;
+  }
+  librados::IoCtx ioctx;
+  r = rados.ioctx_create(pool_name.c_str(), ioctx);
+  if (r < 0) {
+    std::cerr << "error opening pool " << pool_name << ": " << cpp_strerror(r)
+	 << std::endl;
+    rados.shutdown();
+    return EXIT_FAILURE;
+  }
+
+  bench_config conf;
+  conf.prefix = "small_op_bench." + stringify(getpid());
+  conf.ops_per_thread = num_ops;
+  conf.in_flight = in_flight;
+  conf.num_objs = num_objs;
+  conf.obj_size = obj_bytes;
+  conf.op_size = op_bytes;
+  conf.percent_reads = percent_reads;
+
+  std::cout << "Bench configuration:\n\n"
+	    << std::setw(10) << "pool: " << pool_name << "\n"
+	    << std::setw(10) << "ops per thread: " << num_ops << "\n"
+	    << std::setw(10) << "in flight per thread: " << in_flight << "\n"
+	    << std::setw(10) << "objects per thread: " << num_objs << "\n"
+	    << std::setw(10) << "obj size: " << obj_bytes << "\n"
+	    << std::setw(10) << "op size: " << op_bytes << "\n"
+	    << std::setw(10) << "percent reads: " << percent_reads << "\n\n";
+
+  int ret = EXIT_SUCCESS;
+  for (int t = 0; t < max_threads; ++t) {
+    r = prepare_objects(conf, ioctx, t);
+    if (r < 0) {
+      std::cerr << "error writing objects: " << cpp_strerror(r) << std::endl;
+      ret = EXIT_FAILURE;
+      break;
+    }
+  }
+
+  double base = 0;
+  for (int threads = 1; ret == EXIT_SUCCESS && threads <= max_threads;
+       threads *= 2) {
+    double iops;
+    r = run_bench(conf, ioctx, threads, seed, &iops);
+    if (r < 0) {
+      std::cerr << "threads " << threads << " failed: " << cpp_strerror(r)
+	   << std::endl;
+      ret = EXIT_FAILURE;
+      break;
+    }
+    if (threads == 1)
+      base = iops;
+    std::cout << std::setw(4) << threads << " threads: "
+	      << std::fixed << std::setprecision(0) << iops << " ops/s ("
+	      << std::setprecision(2) << iops / base << "x)" << std::endl;
+  }
+
+  for (int t = 0; t < max_threads; ++t)
+    for (uint64_t o = 0; o < conf.num_objs; ++o)
+      ioctx.remove(obj_name(conf, t, o));
+  ioctx.close();
+  rados.shutdown();
+  return ret;
+}
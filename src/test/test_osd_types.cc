@@ -122,3 +122,21 @@ TEST(pg_t, split)
   ASSERT_TRUE(s.count(pg_t(7, 0, -1)));
 
 }
+
+TEST(object_stat_sum_t, dirty)
+{
+  object_stat_sum_t a, d;
+  d.num_objects_dirty = 3;
+  a.add(d);
+  ASSERT_EQ(3, a.num_objects_dirty);
+  d.num_objects_dirty = 1;
+  a.sub(d);
+  ASSERT_EQ(2, a.num_objects_dirty);
+
+  bufferlist bl;
+  ::encode(a, bl);
+  object_stat_sum_t b;
+  bufferlist::iterator p = bl.begin();
+  ::decode(b, p);
+  ASSERT_EQ(2, b.num_objects_dirty);
+}
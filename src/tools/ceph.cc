@@ -104,6 +104,11 @@ static void usage()
   cout << "  ceph osd pool delete <pool> [<pool> --yes-i-really-really-mean-it]\n";
   cout << "  ceph osd pool rename <pool> <new pool name>\n";
   cout << "  ceph osd pool set <pool> <field> <value>\n";
+  cout << "  ceph osd tier add <pool> <tierpool>\n";
+  cout << "  ceph osd tier remove <pool> <tierpool>\n";
+  cout << "  ceph osd tier cache-mode <tierpool> none|writeback|readonly\n";
+  cout << "  ceph osd tier set-overlay <pool> <tierpool>\n";
+  cout << "  ceph osd tier remove-overlay <pool>\n";
   cout << "  ceph osd scrub <osd-id>\n";
   cout << "  ceph osd deep-scrub <osd-id>\n";
   cout << "  ceph osd repair <osd-id>\n";